@@ -0,0 +1,920 @@
+/* zbar bench - timing and differential checks for the scan, binarize,
+ * Reed-Solomon and whole-image paths.
+ *
+ * built against the library sources by build.sh, once with the SIMD
+ * kernels and once with NO_SIMD.  results go to stdout and timings to
+ * stderr, so the stdout of the two builds must match exactly:
+ *
+ *   bench scan [file.pgm]       zbar_scan_y() per sample vs zbar_scan_row()
+ *   bench binarize [file.pgm]   packed mean/Sauvola binarizer checksums
+ *   bench rs [iters]            rs_correct() on clean and damaged codewords
+ *   bench image file.pgm...     zbar_scan_image() symbols and corners
+ *   bench rotate [n]            rotated codes at each coarse density
+ *   bench widths [width...]     row and column passes across image widths
+ *   bench rois                  overlapping regions of interest
+ *   bench stream [n]            streamed decodes against a single one
+ *   bench lazybin [threads]     lazy binarization against eager
+ *   bench sampling [n]          sampling grid projection kernels
+ *   bench finders               finder centers and triples on clutter
+ *   bench align [n]             alignment pattern search, n codes per version
+ *
+ * without a file, scan uses a synthetic bar image and binarize synthetic
+ * scenes at VGA, 1080p and 4K.
+ * BENCH_REPS sets the number of timed repetitions (default 10),
+ * BENCH_THREADS the image scanner's ZBAR_CFG_THREADS (default 1) and
+ * BENCH_CFG any other image scanner settings, as name=value[,...] with
+ * the names in cfg_names below.
+ * modes that check a property exit non-zero when it does not hold.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <zbar.h>
+#include "binarize.h"
+#include "rs.h"
+#include "bench.h"
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+/* not declared by the trimmed zbar.h, but exported (see libzbar-0.def) */
+extern zbar_image_t* zbar_image_create(void);
+extern void zbar_image_destroy(zbar_image_t* image);
+extern void zbar_image_set_format(zbar_image_t* image, unsigned long format);
+extern void zbar_image_set_size(zbar_image_t* image,
+    unsigned width, unsigned height);
+extern int zbar_scan_image(zbar_image_scanner_t* scanner, zbar_image_t* image);
+extern const zbar_symbol_t* zbar_image_first_symbol(const zbar_image_t* image);
+extern const zbar_symbol_t* zbar_symbol_next(const zbar_symbol_t* symbol);
+extern const char* zbar_symbol_get_data(const zbar_symbol_t* symbol);
+extern unsigned zbar_symbol_get_loc_size(const zbar_symbol_t* symbol);
+extern int zbar_symbol_get_loc_x(const zbar_symbol_t* symbol, unsigned idx);
+extern int zbar_symbol_get_loc_y(const zbar_symbol_t* symbol, unsigned idx);
+
+static const struct {
+    const char* name;
+    zbar_config_t cfg;
+} cfg_names[] = {
+    { "x-density", ZBAR_CFG_X_DENSITY },
+    { "y-density", ZBAR_CFG_Y_DENSITY },
+    { "threads", ZBAR_CFG_THREADS },
+    { "coarse-density", ZBAR_CFG_COARSE_DENSITY },
+    { "diag-density", ZBAR_CFG_DIAG_DENSITY },
+    { "expected-count", ZBAR_CFG_EXPECTED_COUNT },
+    { "stream-rows", ZBAR_CFG_STREAM_ROWS },
+    { "binarizer", ZBAR_CFG_BINARIZER },
+};
+#define NCFG_NAMES (sizeof(cfg_names) / sizeof(*cfg_names))
+
+/* apply name=value[,...] settings; non-zero on a bad one */
+static int configure(zbar_image_scanner_t* scanner, const char* spec)
+{
+    while (spec && *spec) {
+        const char* end = spec + strcspn(spec, ",");
+        const char* eq = memchr(spec, '=', end - spec);
+        unsigned i = NCFG_NAMES;
+        if (eq)
+            for (i = 0; i < NCFG_NAMES; i++)
+                if (strlen(cfg_names[i].name) == (size_t)(eq - spec) &&
+                    !strncmp(spec, cfg_names[i].name, eq - spec))
+                    break;
+        if (i == NCFG_NAMES ||
+            zbar_image_scanner_set_config(scanner, 0, cfg_names[i].cfg,
+                atoi(eq + 1))) {
+            fprintf(stderr, "bad setting: %.*s\n", (int)(end - spec), spec);
+            return(1);
+        }
+        spec = *end ? end + 1 : end;
+    }
+    return(0);
+}
+
+/* an image scanner set up from the environment, then from cfg */
+static zbar_image_scanner_t* create_scanner(const char* cfg)
+{
+    zbar_image_scanner_t* scanner = zbar_image_scanner_create();
+    const char* env = getenv("BENCH_THREADS");
+    if (env &&
+        zbar_image_scanner_set_config(scanner, 0, ZBAR_CFG_THREADS, atoi(env))) {
+        fprintf(stderr, "BENCH_THREADS=%s rejected\n", env);
+        exit(1);
+    }
+    if (configure(scanner, getenv("BENCH_CFG")) || configure(scanner, cfg))
+        exit(1);
+    return(scanner);
+}
+
+/* what one zbar_scan_image() call found, one line per symbol */
+typedef struct scan_text_s {
+    int nsyms;
+    char text[4096];
+} scan_text_t;
+
+static int cmp_lines(const void* a, const void* b)
+{
+    return(strcmp(*(char* const*)a, *(char* const*)b));
+}
+
+/* scan_bench_image() flags */
+#define SCAN_SORTED     1   /* found in another order still compares equal */
+#define SCAN_NO_CORNERS 2   /* list only the data */
+
+/* scan img once and list its symbols, with their corners and in decode
+ * order unless flags say otherwise.  returns the scan time
+ */
+static double scan_bench_image(zbar_image_scanner_t* scanner,
+    const bench_image_t* img, int flags, scan_text_t* res)
+{
+    zbar_image_t* zimg = zbar_image_create();
+    const zbar_symbol_t* sym;
+    char buf[sizeof(res->text)];
+    char* lines[64];
+    size_t len = 0;
+    int i, n = 0;
+    double t0;
+
+    zbar_image_set_format(zimg, zbar_fourcc('Y', '8', '0', '0'));
+    zbar_image_set_size(zimg, img->w, img->h);
+    zbar_image_set_data(zimg, img->data, (unsigned long)img->w * img->h,
+        NULL);
+    t0 = bench_now_ms();
+    res->nsyms = zbar_scan_image(scanner, zimg);
+    t0 = bench_now_ms() - t0;
+
+    for (sym = zbar_image_first_symbol(zimg); sym && n < 64;
+        sym = zbar_symbol_next(sym)) {
+        unsigned k;
+        lines[n++] = buf + len;
+        len += snprintf(buf + len, sizeof(buf) - len, "  [%s]",
+            zbar_symbol_get_data(sym));
+        for (k = 0; !(flags & SCAN_NO_CORNERS) &&
+            k < zbar_symbol_get_loc_size(sym) && len < sizeof(buf); k++)
+            len += snprintf(buf + len, sizeof(buf) - len, " (%d,%d)",
+                zbar_symbol_get_loc_x(sym, k), zbar_symbol_get_loc_y(sym, k));
+        if (++len >= sizeof(buf))
+            break;
+    }
+    if (flags & SCAN_SORTED)
+        qsort(lines, n, sizeof(*lines), cmp_lines);
+    for (i = 0, len = 0; i < n; i++)
+        len += snprintf(res->text + len, sizeof(res->text) - len, "%s\n",
+            lines[i]);
+    res->text[len] = '\0';
+    zbar_image_destroy(zimg);
+    return(t0);
+}
+
+/* rows of random bars 1-4 modules wide, smeared and with some noise */
+static void synth_bars(bench_image_t* img, int w, int h)
+{
+    int x, y;
+    bench_image_init(img, w, h, 0, 1);
+    for (y = 0; y < h; y++) {
+        unsigned char* row = img->data + (size_t)y * w;
+        int dark = 0, run = 0, prev = 128;
+        for (x = 0; x < w; x++) {
+            int v;
+            if (!run--) {
+                dark = !dark;
+                run = (1 + bench_rand(&img->seed) % 4) * (2 + y % 3) - 1;
+            }
+            v = (dark ? 40 : 210) + bench_rand(&img->seed) % 41 - 20;
+            prev = (prev + v) / 2;
+            row[x] = prev;
+        }
+    }
+}
+
+static void load(int argc, char** argv, bench_image_t* img)
+{
+    if (argc > 2)
+        bench_image_read(img, argv[2]);
+    else
+        synth_bars(img, 1280, 720);
+}
+
+/* state observable after one scan, to compare the two scan paths */
+typedef struct scan_result_s {
+    zbar_symbol_type_t edge;
+    unsigned width;
+    zbar_symbol_type_t type;
+    unsigned hash;
+} scan_result_t;
+
+static void scan_finish(zbar_scanner_t* scn, zbar_decoder_t* dcode,
+    zbar_symbol_type_t edge, scan_result_t* res)
+{
+    const char* data;
+    res->edge = edge;
+    res->width = zbar_scanner_get_width(scn);
+    res->type = zbar_decoder_get_type(dcode);
+    /* a ZBAR_QRCODE result is a finder line, with no decoded data */
+    data = (edge > ZBAR_PARTIAL && edge != ZBAR_QRCODE)
+        ? zbar_decoder_get_data(dcode) : NULL;
+    res->hash = data ? bench_hash(BENCH_HASH_INIT, data, strlen(data)) : 0;
+}
+
+/* one scan of n samples stride bytes apart, through either path */
+static void scan_line(zbar_scanner_t* scn, zbar_decoder_t* dcode,
+    const unsigned char* data, int n, int stride,
+    int use_row, scan_result_t* res)
+{
+    zbar_symbol_type_t edge = ZBAR_NONE;
+    zbar_scanner_new_scan(scn);
+    if (use_row)
+        edge = zbar_scan_row(scn, data, n, stride);
+    else {
+        int i;
+        for (i = 0; i < n; i++, data += stride) {
+            zbar_symbol_type_t tmp = zbar_scan_y(scn, *data);
+            if (tmp < 0 || tmp > edge)
+                edge = tmp;
+        }
+    }
+    scan_finish(scn, dcode, edge, res);
+}
+
+static int bench_scan(int argc, char** argv)
+{
+    /* one scanner per path, so decoder history can't leak between them */
+    zbar_decoder_t* dcode[2];
+    zbar_scanner_t* scn[2];
+    bench_image_t img;
+    int w, h, pass, r, i, nbad = 0;
+
+    load(argc, argv, &img);
+    w = img.w;
+    h = img.h;
+    for (i = 0; i < 2; i++) {
+        dcode[i] = zbar_decoder_create();
+        scn[i] = zbar_scanner_create(dcode[i]);
+    }
+    /* pass 0 scans rows, pass 1 scans columns bottom-up */
+    for (pass = 0; pass < 2; pass++) {
+        int nlines = pass ? w : h;
+        int n = pass ? h : w;
+        int stride = pass ? -w : 1;
+        unsigned h0 = BENCH_HASH_INIT;
+        double ms[2];
+        int use_row;
+
+        for (i = 0; i < nlines; i++) {
+            const unsigned char* p = pass
+                ? img.data + (size_t)(h - 1) * w + i
+                : img.data + (size_t)i * w;
+            scan_result_t a, b;
+            scan_line(scn[0], dcode[0], p, n, stride, 0, &a);
+            scan_line(scn[1], dcode[1], p, n, stride, 1, &b);
+            if (memcmp(&a, &b, sizeof(a)))
+                nbad++;
+            h0 = bench_hash(h0, &b, sizeof(b));
+        }
+        for (use_row = 0; use_row < 2; use_row++) {
+            double t0 = bench_now_ms();
+            for (r = 0; r < bench_reps; r++)
+                for (i = 0; i < nlines; i++) {
+                    const unsigned char* p = pass
+                        ? img.data + (size_t)(h - 1) * w + i
+                        : img.data + (size_t)i * w;
+                    scan_result_t res;
+                    scan_line(scn[use_row], dcode[use_row], p, n, stride,
+                        use_row, &res);
+                }
+            ms[use_row] = (bench_now_ms() - t0) / bench_reps;
+        }
+        printf("scan %s: %d lines hash %08x\n",
+            pass ? "columns" : "rows", nlines, h0);
+        fprintf(stderr, "scan %s: zbar_scan_y %.3fms zbar_scan_row %.3fms\n",
+            pass ? "columns" : "rows", ms[0], ms[1]);
+    }
+    printf("scan: %d mismatched lines\n", nbad);
+
+    for (i = 0; i < 2; i++) {
+        zbar_scanner_destroy(scn[i]);
+        zbar_decoder_destroy(dcode[i]);
+    }
+    bench_image_free(&img);
+    return(nbad != 0);
+}
+
+/* a w x h image with a row of codes over a light texture */
+static void synth_scene(bench_image_t* img, int w, int h)
+{
+    int n = 2 + w / 640, i;
+    bench_image_init(img, w, h, 200, w);
+    bench_image_texture(img, 40);
+    for (i = 0; i < n; i++) {
+        char data[32];
+        bench_qr_t qr;
+        memset(&qr, 0, sizeof(qr));
+        qr.mod = 2 + w / 640;
+        qr.x = (i + 0.5) * w / n;
+        qr.y = h / 2 + bench_uniform(&img->seed, -h / 6., h / 6.);
+        qr.angle = bench_uniform(&img->seed, -10, 10);
+        qr.ecl = 1;
+        sprintf(data, "%dpx wide %d", w, i);
+        qr.data = data;
+        bench_draw_qr(img, &qr);
+    }
+    bench_image_noise(img, 8);
+}
+
+/* time both packed binarizers over a whole image */
+static void binarize_image(const bench_image_t* img)
+{
+    int w = img->w, h = img->h;
+    int stride = ((w + 31) >> 5) << 2;
+    unsigned char* bits = calloc((size_t)stride * h, 1);
+    double t0;
+    double ms[2];
+    int r;
+
+    t0 = bench_now_ms();
+    for (r = 0; r < bench_reps; r++)
+        qr_binarize_rect_packed(bits, stride, img->data, w, h, 0, 0, w, h,
+            NULL);
+    ms[0] = (bench_now_ms() - t0) / bench_reps;
+    printf("binarize %dx%d mean: hash %08x\n", w, h,
+        bench_hash(BENCH_HASH_INIT, bits, (size_t)stride * h));
+    t0 = bench_now_ms();
+    for (r = 0; r < bench_reps; r++)
+        qr_sauvola_rect_packed(bits, stride, img->data, w, h, 0, 0, w, h,
+            NULL);
+    ms[1] = (bench_now_ms() - t0) / bench_reps;
+    printf("binarize %dx%d sauvola: hash %08x\n", w, h,
+        bench_hash(BENCH_HASH_INIT, bits, (size_t)stride * h));
+    fprintf(stderr, "binarize %dx%d: mean %.3fms sauvola %.3fms\n",
+        w, h, ms[0], ms[1]);
+    free(bits);
+}
+
+/* the given image, or synthetic scenes at VGA, 1080p and 4K */
+static int bench_binarize(int argc, char** argv)
+{
+    static const int sizes[][2] = {
+        { 640, 480 }, { 1920, 1080 }, { 3840, 2160 }
+    };
+    bench_image_t img;
+    unsigned i;
+
+    if (argc > 2) {
+        bench_image_read(&img, argv[2]);
+        binarize_image(&img);
+        bench_image_free(&img);
+        return(0);
+    }
+    for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+        synth_scene(&img, sizes[i][0], sizes[i][1]);
+        binarize_image(&img);
+        bench_image_free(&img);
+    }
+    return(0);
+}
+
+/* codewords are made and damaged a batch at a time, outside the timing */
+#define RS_BATCH 256
+
+/* one random codeword of a QR block's shape, and its parity size */
+static int rs_codeword(const rs_gf256* gf, unsigned* seed,
+    unsigned char* data, int* npar)
+{
+    unsigned char genpoly[256];
+    int ndata, i;
+    /* QR blocks carry at most 30 parity bytes */
+    *npar = 2 + bench_rand(seed) % 29;
+    ndata = *npar + 1 + bench_rand(seed) % (255 - *npar);
+    for (i = 0; i < ndata - *npar; i++)
+        data[i] = bench_rand(seed);
+    rs_compute_genpoly(gf, QR_M0, genpoly, *npar);
+    rs_encode(gf, data, ndata, genpoly, *npar);
+    return(ndata);
+}
+
+/* rs_correct() on clean codewords, where only the syndromes are
+ * computed, and on damaged ones, which also locate and evaluate the
+ * errors.  the NO_SIMD build times the scalar evaluation the vector
+ * kernels replaced
+ */
+static int bench_rs(int argc, char** argv)
+{
+    static unsigned char orig[RS_BATCH][256];
+    static unsigned char data[RS_BATCH][256];
+    int ndata[RS_BATCH], npar[RS_BATCH], nerr[RS_BATCH], ret[RS_BATCH];
+    rs_gf256 gf;
+    unsigned h0[2] = { BENCH_HASH_INIT, BENCH_HASH_INIT };
+    unsigned seed = 1;
+    int iters = (argc > 2) ? atoi(argv[2]) : 100000;
+    int it, n, i, nclean = 0, nfixed = 0, nbad = 0;
+    double ms[2] = { 0, 0 };
+
+    rs_gf256_init(&gf, QR_PPOLY);
+    for (it = 0; it < iters; it += n) {
+        int dmg;
+        n = (iters - it < RS_BATCH) ? iters - it : RS_BATCH;
+        for (i = 0; i < n; i++)
+            ndata[i] = rs_codeword(&gf, &seed, orig[i], &npar[i]);
+        for (dmg = 0; dmg < 2; dmg++) {
+            double t0;
+            for (i = 0; i < n; i++) {
+                int k;
+                memcpy(data[i], orig[i], ndata[i]);
+                /* 1 to npar/2+2 errors, so some are past correcting */
+                nerr[i] = dmg ? 1 + bench_rand(&seed) % (npar[i] / 2 + 2) : 0;
+                for (k = 0; k < nerr[i]; k++)
+                    data[i][bench_rand(&seed) % ndata[i]] ^=
+                        1 + bench_rand(&seed) % 255;
+            }
+            t0 = bench_now_ms();
+            for (i = 0; i < n; i++)
+                ret[i] = rs_correct(&gf, QR_M0, data[i], ndata[i], npar[i],
+                    NULL, 0);
+            ms[dmg] += bench_now_ms() - t0;
+            for (i = 0; i < n; i++) {
+                int fixed = ret[i] >= 0 &&
+                    !memcmp(data[i], orig[i], ndata[i]);
+                if (!dmg)
+                    nclean += fixed && !ret[i];
+                else
+                    nfixed += fixed;
+                /* past npar/2 errors, rejecting or miscorrecting is
+                 * expected
+                 */
+                if (dmg ? !fixed && nerr[i] <= npar[i] / 2 : !fixed || ret[i])
+                    nbad++;
+                h0[dmg] = bench_hash(h0[dmg], &ret[i], sizeof(*ret));
+                h0[dmg] = bench_hash(h0[dmg], data[i], ndata[i]);
+            }
+        }
+    }
+    printf("rs clean: %d codewords, %d passed, hash %08x\n", iters, nclean,
+        h0[0]);
+    printf("rs damaged: %d codewords, %d corrected, hash %08x\n", iters,
+        nfixed, h0[1]);
+    printf("rs: %d correctable codewords not corrected\n", nbad);
+    fprintf(stderr, "rs: clean %.3fus damaged %.3fus per codeword\n",
+        ms[0] * 1000. / (iters ? iters : 1),
+        ms[1] * 1000. / (iters ? iters : 1));
+    return(nbad != 0);
+}
+
+static int bench_image(int argc, char** argv)
+{
+    zbar_image_scanner_t* scanner = create_scanner(NULL);
+    int i;
+
+    for (i = 2; i < argc; i++) {
+        bench_image_t img;
+        scan_text_t res;
+        double ms = 0;
+        int r;
+
+        bench_image_read(&img, argv[i]);
+        for (r = 0; r < bench_reps; r++)
+            ms += scan_bench_image(scanner, &img, 0, &res);
+        fprintf(stderr, "%s: %.3fms\n", argv[i], ms / bench_reps);
+        printf("%s: %d symbols\n%s", argv[i], res.nsyms, res.text);
+        bench_image_free(&img);
+    }
+    zbar_image_scanner_destroy(scanner);
+    return(0);
+}
+
+/* the ZBAR_CFG_COARSE_DENSITY limit for rotated codes (see zbar.h) */
+#define ROTATED_COARSE_MAX 6
+
+/* ZBAR_CFG_COARSE_DENSITY against codes at random angles: each coarse
+ * density within the limits documented in zbar.h must decode everything
+ * a full density scan decodes (the corners may move a little, as they
+ * come from fewer finder lines).  larger densities are only counted
+ */
+static int bench_rotate(int argc, char** argv)
+{
+    static const int coarse[] = { 0, 4, 6, 8, 10 };
+    enum { NCOARSE = sizeof(coarse) / sizeof(*coarse), MAXMOD = 6 };
+    zbar_image_scanner_t* scanner[NCOARSE];
+    int found[NCOARSE][MAXMOD + 1] = { { 0 } };
+    int ncodes[MAXMOD + 1] = { 0 };
+    double ms[NCOARSE] = { 0 };
+    int n = (argc > 2) ? atoi(argv[2]) : 64;
+    int i, c, m, nlost = 0;
+
+    for (c = 0; c < NCOARSE; c++) {
+        char cfg[32];
+        sprintf(cfg, "coarse-density=%d", coarse[c]);
+        scanner[c] = create_scanner(cfg);
+    }
+    for (i = 0; i < n; i++) {
+        unsigned seed = (i + 1) * 0x9E3779B9U;
+        bench_image_t img;
+        bench_qr_t qr;
+        scan_text_t ref;
+        char data[32];
+
+        bench_image_init(&img, 640, 480, 200, seed);
+        memset(&qr, 0, sizeof(qr));
+        qr.mod = 3 + i % (MAXMOD - 2);
+        qr.angle = bench_uniform(&seed, 0, 90);
+        qr.x = bench_uniform(&seed, 240, 400);
+        qr.y = bench_uniform(&seed, 200, 280);
+        qr.ecl = 1;
+        sprintf(data, "rotate %d", i);
+        qr.data = data;
+        bench_draw_qr(&img, &qr);
+        bench_image_noise(&img, 12);
+
+        m = (int)qr.mod;
+        ncodes[m]++;
+        for (c = 0; c < NCOARSE; c++) {
+            scan_text_t res;
+            ms[c] += scan_bench_image(scanner[c], &img,
+                SCAN_SORTED | SCAN_NO_CORNERS, c ? &res : &ref);
+            if (!c) {
+                found[c][m] += ref.nsyms > 0;
+                continue;
+            }
+            found[c][m] += res.nsyms > 0;
+            if (coarse[c] <= ROTATED_COARSE_MAX && coarse[c] <= 3 * m &&
+                strcmp(ref.text, res.text)) {
+                printf("rotate: code %d (%d px modules, %.0f degrees) "
+                    "lost at coarse density %d\n", i, m, qr.angle,
+                    coarse[c]);
+                nlost++;
+            }
+        }
+        bench_image_free(&img);
+    }
+    for (c = 0; c < NCOARSE; c++) {
+        printf("rotate: coarse density %2d:", coarse[c]);
+        for (m = 3; m <= MAXMOD; m++)
+            printf(" %dpx %d/%d", m, found[c][m], ncodes[m]);
+        printf("\n");
+        fprintf(stderr, "rotate: coarse density %d: %.3fms per image\n",
+            coarse[c], ms[c] / (n ? n : 1));
+        zbar_image_scanner_destroy(scanner[c]);
+    }
+    return(nlost != 0);
+}
+
+/* the X density (column) pass reads the image through transposed tiles
+ * of TILE_LINES columns; time it against the row pass and a plain
+ * strided column scan, at widths where an image row no longer fits in
+ * (or a column's worth of them in) the caches
+ */
+static int bench_widths(int argc, char** argv)
+{
+    static const int def_widths[] = { 640, 1280, 1920, 2560, 3840 };
+    zbar_image_scanner_t* scanner[3];
+    zbar_decoder_t* dcode = zbar_decoder_create();
+    zbar_scanner_t* scn = zbar_scanner_create(dcode);
+    int nwidths = (argc > 2) ? argc - 2
+        : (int)(sizeof(def_widths) / sizeof(*def_widths));
+    int i;
+
+    /* rows only, columns only, then both to check the scene decodes */
+    scanner[0] = create_scanner("x-density=0");
+    scanner[1] = create_scanner("y-density=0");
+    scanner[2] = create_scanner(NULL);
+    for (i = 0; i < nwidths; i++) {
+        int w = (argc > 2) ? atoi(argv[i + 2]) : def_widths[i];
+        bench_image_t img;
+        scan_text_t res;
+        double ms[3] = { 0, 0, 0 };
+        int r, x, pass;
+
+        if (w < 16) {
+            fprintf(stderr, "width %d too small\n", w);
+            return(1);
+        }
+        synth_scene(&img, w, w * 9 / 16);
+        for (r = 0; r < bench_reps; r++) {
+            double t0;
+            for (pass = 0; pass < 2; pass++)
+                ms[pass] += scan_bench_image(scanner[pass], &img, 0, &res);
+            t0 = bench_now_ms();
+            for (x = 0; x < img.w; x++) {
+                zbar_scanner_new_scan(scn);
+                zbar_scan_row(scn, img.data + x, img.h, img.w);
+            }
+            ms[2] += bench_now_ms() - t0;
+        }
+        scan_bench_image(scanner[2], &img, SCAN_SORTED, &res);
+        printf("widths %dx%d: %d symbols\n%s", img.w, img.h, res.nsyms,
+            res.text);
+        fprintf(stderr, "widths %dx%d: row pass %.3fms column pass %.3fms "
+            "(%.2fx), strided column scan only %.3fms\n",
+            img.w, img.h, ms[0] / bench_reps, ms[1] / bench_reps,
+            ms[0] > 0 ? ms[1] / ms[0] : 0, ms[2] / bench_reps);
+        bench_image_free(&img);
+    }
+    for (i = 0; i < 3; i++)
+        zbar_image_scanner_destroy(scanner[i]);
+    zbar_scanner_destroy(scn);
+    zbar_decoder_destroy(dcode);
+    return(0);
+}
+
+/* NLABELS label windows in a textured frame, scanned as regions of
+ * interest of the one image and as separately cropped copies.  returns
+ * the number of labels either way did not find
+ */
+#define NLABELS 12
+#define LABEL_WIN 240
+static int rois_vs_crops(zbar_image_scanner_t* scanner)
+{
+    zbar_image_t* zimg = zbar_image_create();
+    unsigned char* crop = malloc(LABEL_WIN * LABEL_WIN);
+    bench_image_t img;
+    double ms[3] = { 0, 0, 0 };
+    int nroi = 0, ncrop = 0, nfull = 0;
+    int i, r, y;
+
+    bench_image_init(&img, 1920, 1080, 160, 7);
+    bench_image_texture(&img, 60);
+    for (i = 0; i < NLABELS; i++) {
+        char data[16];
+        bench_qr_t qr;
+        memset(&qr, 0, sizeof(qr));
+        snprintf(data, sizeof(data), "label %d", i);
+        qr.x = 240 + 480 * (i % 4);
+        qr.y = 180 + 360 * (i / 4);
+        qr.mod = 3;
+        qr.ecl = 1;
+        qr.data = data;
+        bench_draw_qr(&img, &qr);
+    }
+    bench_image_noise(&img, 8);
+    zbar_image_set_format(zimg, zbar_fourcc('Y', '8', '0', '0'));
+    zbar_image_set_size(zimg, img.w, img.h);
+
+    for (r = 0; r < bench_reps; r++) {
+        double t0 = bench_now_ms();
+        zbar_image_set_data(zimg, img.data, (unsigned long)img.w * img.h,
+            NULL);
+        nfull = zbar_scan_image(scanner, zimg);
+        ms[0] += bench_now_ms() - t0;
+
+        t0 = bench_now_ms();
+        zbar_image_set_data(zimg, img.data, (unsigned long)img.w * img.h,
+            NULL);
+        for (i = 0; i < NLABELS; i++)
+            zbar_image_add_roi(zimg, 120 + 480 * (i % 4), 60 + 360 * (i / 4),
+                LABEL_WIN, LABEL_WIN);
+        nroi = zbar_scan_image(scanner, zimg);
+        ms[1] += bench_now_ms() - t0;
+        zbar_image_clear_rois(zimg);
+
+        t0 = bench_now_ms();
+        ncrop = 0;
+        zbar_image_set_size(zimg, LABEL_WIN, LABEL_WIN);
+        for (i = 0; i < NLABELS; i++) {
+            const unsigned char* src = img.data +
+                (size_t)(60 + 360 * (i / 4)) * img.w + 120 + 480 * (i % 4);
+            for (y = 0; y < LABEL_WIN; y++)
+                memcpy(crop + y * LABEL_WIN, src + (size_t)y * img.w,
+                    LABEL_WIN);
+            zbar_image_set_data(zimg, crop, LABEL_WIN * LABEL_WIN, NULL);
+            ncrop += zbar_scan_image(scanner, zimg) > 0;
+        }
+        ms[2] += bench_now_ms() - t0;
+        zbar_image_set_size(zimg, img.w, img.h);
+    }
+    printf("rois: %d labels, %d as regions, %d as copies, %d in full "
+        "frame\n", NLABELS, nroi, ncrop, nfull);
+    fprintf(stderr, "rois: %d regions %.3fms, %d cropped copies %.3fms "
+        "(%.2fx), full frame %.3fms\n", NLABELS, ms[1] / bench_reps,
+        NLABELS, ms[2] / bench_reps, ms[1] > 0 ? ms[2] / ms[1] : 0,
+        ms[0] / bench_reps);
+
+    zbar_image_destroy(zimg);
+    free(crop);
+    bench_image_free(&img);
+    return((NLABELS - nroi) + (NLABELS - ncrop));
+}
+
+/* four codes under three overlapping regions, each overlap holding one
+ * code, and a whole image region that adds a fifth code with the same
+ * data as the first, elsewhere.  each code must be reported once,
+ * tagged with the first region that holds it
+ */
+static int bench_rois(int argc, char** argv)
+{
+    static const struct {
+        int x, y, roi;
+        const char* data;
+    } codes[] = {
+        { 160, 200, 0, "roi A" },
+        { 480, 200, 0, "roi B" },
+        { 800, 200, 1, "roi C" },
+        { 1120, 200, 2, "roi D" },
+        { 160, 560, 3, "roi A" },
+    };
+    enum { NCODES = sizeof(codes) / sizeof(*codes) };
+    zbar_image_scanner_t* scanner = create_scanner(NULL);
+    zbar_image_t* zimg = zbar_image_create();
+    const zbar_symbol_t* sym;
+    int found[NCODES] = { 0 };
+    bench_image_t img;
+    int i, n, nbad = 0;
+    double t0;
+
+    (void)argc;
+    (void)argv;
+    bench_image_init(&img, 1280, 720, 200, 1);
+    for (i = 0; i < NCODES; i++) {
+        bench_qr_t qr;
+        memset(&qr, 0, sizeof(qr));
+        qr.x = codes[i].x;
+        qr.y = codes[i].y;
+        qr.mod = 4;
+        qr.ecl = 1;
+        qr.data = codes[i].data;
+        bench_draw_qr(&img, &qr);
+    }
+    bench_image_noise(&img, 8);
+
+    zbar_image_set_format(zimg, zbar_fourcc('Y', '8', '0', '0'));
+    zbar_image_set_size(zimg, img.w, img.h);
+    zbar_image_set_data(zimg, img.data, (unsigned long)img.w * img.h, NULL);
+    zbar_image_add_roi(zimg, 0, 0, 640, 400);
+    zbar_image_add_roi(zimg, 320, 0, 640, 400);
+    zbar_image_add_roi(zimg, 640, 0, 640, 400);
+    zbar_image_add_roi(zimg, 0, 0, img.w, img.h);
+    t0 = bench_now_ms();
+    n = zbar_scan_image(scanner, zimg);
+    fprintf(stderr, "rois: %.3fms\n", bench_now_ms() - t0);
+
+    printf("rois: %d symbols\n", n);
+    for (sym = zbar_image_first_symbol(zimg); sym;
+        sym = zbar_symbol_next(sym)) {
+        int x = zbar_symbol_get_loc_x(sym, 0);
+        int y = zbar_symbol_get_loc_y(sym, 0);
+        int roi = zbar_symbol_get_roi(sym);
+        for (i = 0; i < NCODES; i++)
+            if (!strcmp(zbar_symbol_get_data(sym), codes[i].data) &&
+                abs(x - codes[i].x) < 100 && abs(y - codes[i].y) < 100)
+                break;
+        printf("  [%s] region %d\n", zbar_symbol_get_data(sym), roi);
+        if (i == NCODES || found[i]++ || roi != codes[i].roi)
+            nbad++;
+    }
+    for (i = 0; i < NCODES; i++)
+        if (!found[i]) {
+            printf("rois: [%s] at (%d,%d) not found\n", codes[i].data,
+                codes[i].x, codes[i].y);
+            nbad++;
+        }
+
+    zbar_image_destroy(zimg);
+    bench_image_free(&img);
+    nbad += rois_vs_crops(scanner);
+    zbar_image_scanner_destroy(scanner);
+    return(nbad != 0);
+}
+
+/* what the data handler saw of one streamed image */
+typedef struct stream_seen_s {
+    int nnew;       /* symbols not reported by an earlier call */
+    int nempty;     /* calls without any */
+} stream_seen_t;
+
+static void stream_handler(zbar_image_t* img, const void* userdata)
+{
+    stream_seen_t* seen = (stream_seen_t*)userdata;
+    const zbar_symbol_t* sym;
+    int nnew = 0;
+    for (sym = zbar_image_first_symbol(img); sym; sym = zbar_symbol_next(sym))
+        nnew += !zbar_symbol_get_reported(sym);
+    seen->nnew += nnew;
+    seen->nempty += !nnew;
+}
+
+/* ZBAR_CFG_STREAM_ROWS must not lose codes: scenes with codes anywhere,
+ * the last always right at the bottom edge (where the scan margins of
+ * earlier bands already reach it), scanned in bands of several heights
+ * must decode every symbol a single decode at the end finds.
+ * streaming may find more, as the lines of the codes decoded early no
+ * longer cluster with the others, so those are only counted.  (the
+ * corners are not compared: they may move by a pixel, as a streamed
+ * decode estimates the finder centers from the lines seen so far)
+ * the data handler must be called only when a band adds symbols, and
+ * see each one as new exactly once
+ */
+static int bench_stream(int argc, char** argv)
+{
+    static const int rows[] = { 0, 8, 16, 32, 64, 128 };
+    enum { NROWS = sizeof(rows) / sizeof(*rows) };
+    zbar_image_scanner_t* scanner[NROWS];
+    stream_seen_t seen;
+    int n = (argc > 2) ? atoi(argv[2]) : 32;
+    int i, j, r, nsyms = 0, nextra = 0, nbad = 0, nmisreported = 0;
+
+    for (r = 0; r < NROWS; r++) {
+        char cfg[32];
+        sprintf(cfg, "stream-rows=%d", rows[r]);
+        scanner[r] = create_scanner(cfg);
+        zbar_image_scanner_set_data_handler(scanner[r], stream_handler,
+            &seen);
+    }
+    for (i = 0; i < n; i++) {
+        bench_image_t img;
+        scan_text_t ref;
+        int ncodes = 1 + i % 3;
+
+        bench_image_init(&img, 640, 360 + 8 * (i % 16), 200,
+            (i + 1) * 0x9E3779B9U);
+        for (j = 0; j < ncodes; j++) {
+            char data[32];
+            bench_qr_t qr;
+            memset(&qr, 0, sizeof(qr));
+            qr.mod = 3 + bench_rand(&img.seed) % 3;
+            qr.angle = bench_uniform(&img.seed, -30, 30);
+            qr.x = (j + 0.5) * img.w / ncodes;
+            /* a version 1 code with its quiet zone spans 29 modules */
+            qr.y = (j == ncodes - 1)
+                ? img.h - 29 / 2. * qr.mod * (fabs(cos(qr.angle * M_PI / 180))
+                    + fabs(sin(qr.angle * M_PI / 180))) - 2
+                : bench_uniform(&img.seed, 80, img.h - 80);
+            qr.ecl = 1;
+            sprintf(data, "stream %d.%d", i, j);
+            qr.data = data;
+            bench_draw_qr(&img, &qr);
+        }
+        bench_image_noise(&img, 10);
+
+        scan_bench_image(scanner[0], &img, SCAN_NO_CORNERS, &ref);
+        nsyms += ref.nsyms;
+        for (r = 1; r < NROWS; r++) {
+            scan_text_t res;
+            const char* line;
+            int nlost = 0;
+            memset(&seen, 0, sizeof(seen));
+            scan_bench_image(scanner[r], &img, SCAN_NO_CORNERS, &res);
+            if (seen.nnew != res.nsyms || seen.nempty) {
+                printf("stream: scene %d reports %d of %d symbols as new "
+                    "with %d row bands, %d times none\n", i, seen.nnew,
+                    res.nsyms, rows[r], seen.nempty);
+                nmisreported++;
+            }
+            for (line = ref.text; *line; line = strchr(line, '\n') + 1) {
+                size_t len = strchr(line, '\n') + 1 - line;
+                const char* p;
+                for (p = res.text; *p; p = strchr(p, '\n') + 1)
+                    if (!strncmp(p, line, len))
+                        break;
+                if (!*p) {
+                    printf("stream: scene %d (%dx%d) loses %.*s with %d "
+                        "row bands\n", i, img.w, img.h, (int)len - 3, line + 2,
+                        rows[r]);
+                    nlost++;
+                }
+            }
+            nbad += nlost;
+            nextra += res.nsyms - (ref.nsyms - nlost);
+        }
+        bench_image_free(&img);
+    }
+    printf("stream: %d scenes, %d symbols, %d lost and %d more found "
+        "when streamed\n", n, nsyms, nbad, nextra);
+    printf("stream: %d scans report new symbols wrongly\n", nmisreported);
+    for (r = 0; r < NROWS; r++)
+        zbar_image_scanner_destroy(scanner[r]);
+    return(nbad || nmisreported);
+}
+
+static const struct {
+    const char* name;
+    int (*run)(int argc, char** argv);
+    int minargs;
+    const char* usage;
+} modes[] = {
+    { "scan", bench_scan, 0, "[file.pgm]" },
+    { "binarize", bench_binarize, 0, "[file.pgm]" },
+    { "rs", bench_rs, 0, "[iters]" },
+    { "image", bench_image, 1, "file.pgm..." },
+    { "rotate", bench_rotate, 0, "[n]" },
+    { "widths", bench_widths, 0, "[width...]" },
+    { "rois", bench_rois, 0, "" },
+    { "stream", bench_stream, 0, "[n]" },
+    { "lazybin", bench_lazybin, 0, "[threads]" },
+    { "sampling", bench_sampling, 0, "[n]" },
+    { "finders", bench_finders, 0, "" },
+    { "align", bench_align, 0, "[n]" },
+};
+
+int main(int argc, char** argv)
+{
+    const char* env = getenv("BENCH_REPS");
+    unsigned i;
+    if (env && atoi(env) > 0)
+        bench_reps = atoi(env);
+    for (i = 0; i < sizeof(modes) / sizeof(*modes); i++)
+        if (argc > 1 + modes[i].minargs && !strcmp(argv[1], modes[i].name))
+            return(modes[i].run(argc, argv));
+    for (i = 0; i < sizeof(modes) / sizeof(*modes); i++)
+        fprintf(stderr, "%s %s %s %s\n", i ? "      " : "usage:",
+            argv[0], modes[i].name, modes[i].usage);
+    return(2);
+}
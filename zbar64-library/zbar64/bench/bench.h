@@ -0,0 +1,70 @@
+/* zbar bench - shared helpers */
+#ifndef _ZBAR_BENCH_H_
+#define _ZBAR_BENCH_H_
+
+#include <stddef.h>
+
+/* number of timed repetitions (BENCH_REPS) */
+extern int bench_reps;
+
+/* wall clock in milliseconds */
+extern double bench_now_ms(void);
+
+/* FNV-1a, to compare bulk outputs between builds */
+#define BENCH_HASH_INIT 2166136261U
+extern unsigned bench_hash(unsigned h, const void* data, size_t n);
+
+/* deterministic on every host, unlike rand() */
+extern unsigned bench_rand(unsigned* state);
+
+/* uniform in [lo, hi) */
+extern double bench_uniform(unsigned* state, double lo, double hi);
+
+/* 8-bit grayscale image */
+typedef struct bench_image_s {
+    int w, h;
+    unsigned char* data;
+    unsigned seed;
+} bench_image_t;
+
+extern void bench_image_init(bench_image_t* img, int w, int h, int bg,
+    unsigned seed);
+extern void bench_image_free(bench_image_t* img);
+extern void bench_image_read(bench_image_t* img, const char* path);
+
+/* add uniform noise of +-amp to every pixel */
+extern void bench_image_noise(bench_image_t* img, int amp);
+
+/* paint a code free texture of random blobs and bars, which produces
+ * plenty of finder-like runs without any real finder pattern
+ */
+extern void bench_image_texture(bench_image_t* img, int amp);
+
+/* a QR code to draw: data is encoded in byte mode at error correction
+ * level ecl (0-3 for L, M, Q, H) in the smallest version that holds it
+ * (or exactly version, if non-zero).  the code is centered on (x, y),
+ * mod pixels per module, rotated by angle degrees and foreshortened
+ * along its vertical axis by persp (0 for none)
+ */
+typedef struct bench_qr_s {
+    const char* data;
+    int ecl;
+    int version;
+    double x, y;
+    double mod;
+    double angle;
+    double persp;
+} bench_qr_t;
+
+/* draw a QR code (with its quiet zone).  returns the version, or -1 if
+ * the data does not fit
+ */
+extern int bench_draw_qr(bench_image_t* img, const bench_qr_t* qr);
+
+/* modes that check the QR decoder's internals (qrdec_bench.c) */
+extern int bench_lazybin(int argc, char** argv);
+extern int bench_sampling(int argc, char** argv);
+extern int bench_finders(int argc, char** argv);
+extern int bench_align(int argc, char** argv);
+
+#endif
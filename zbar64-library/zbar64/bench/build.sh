@@ -0,0 +1,79 @@
+#!/bin/sh
+# build the bench against the library sources with gcc or clang, once with
+# the SIMD kernels (build/bench-simd) and once scalar only
+# (build/bench-nosimd).
+#
+#   sh build.sh [extra compiler flags]
+#   sh build.sh --check [file.pgm...]   also diff the two builds' results
+#
+# both builds have the pthread pool; --check also scans the images with
+# four threads and expects the same results as with one.
+#
+# the Visual Studio project remains the real build; this only exists to
+# time and cross-check the kernels on any host with a C compiler.
+set -e
+DIR=$(cd "$(dirname "$0")" && pwd)
+CC=${CC:-cc}
+OUT=${OUT:-$DIR/build}
+CHECK=
+if [ "$1" = "--check" ]; then
+    CHECK=1
+    shift
+fi
+EXTRA=
+[ -n "$CHECK" ] || EXTRA="$*"
+
+Z=$DIR/../zbar
+SRCS="$Z/*.c $Z/decoder/*.c $Z/qrcode/bch15_5.c $Z/qrcode/binarize.c
+      $Z/qrcode/rs.c $Z/qrcode/util.c $Z/qrcode/qrdectxt.c"
+CFLAGS="-std=gnu99 -fgnu89-inline -O2 -g -Wall -Wextra
+        -I$DIR/../include -I$Z -I$Z/qrcode -I$Z/decoder
+        -DHAVE_SYS_TIME_H -DHAVE_LIBPTHREAD"
+
+for variant in simd nosimd; do
+    flags="$CFLAGS $EXTRA"
+    [ $variant = simd ] || flags="$flags -DNO_SIMD"
+    mkdir -p $OUT/$variant
+    for f in $SRCS; do
+        $CC $flags -c $f -o $OUT/$variant/$(echo ${f#$Z/} | tr / _).o
+    done
+    # qrdec_bench.c includes the decoder's own copy of qrdec.c
+    $CC $flags $DIR/*.c $(ls $OUT/$variant/*.o | grep -v decoder_qrdec) \
+        -lm -lpthread \
+        -o $OUT/bench-$variant
+done
+
+[ -n "$CHECK" ] || exit 0
+status=0
+for variant in simd nosimd; do
+    bench="env BENCH_REPS=1 $OUT/bench-$variant"
+    {
+        $bench scan || status=1
+        $bench binarize || status=1
+        $bench rs || status=1
+        $bench rotate || status=1
+        $bench widths || status=1
+        $bench rois || status=1
+        $bench stream || status=1
+        $bench lazybin || status=1
+        $bench lazybin 4 || status=1
+        $bench sampling || status=1
+        $bench finders || status=1
+        $bench align 1 || status=1
+        for f in "$@"; do
+            $bench scan "$f" || status=1
+            $bench binarize "$f" || status=1
+        done
+    } >$OUT/$variant.txt 2>/dev/null
+    if [ $# -gt 0 ]; then
+        $bench image "$@" >$OUT/$variant-st.txt 2>/dev/null || status=1
+        BENCH_THREADS=4 $bench image "$@" >$OUT/$variant-mt.txt 2>/dev/null ||
+            status=1
+        diff $OUT/$variant-st.txt $OUT/$variant-mt.txt || status=1
+        cat $OUT/$variant-st.txt >>$OUT/$variant.txt
+    fi
+done
+cat $OUT/simd.txt
+diff $OUT/simd.txt $OUT/nosimd.txt || status=1
+[ $status -ne 0 ] || echo "simd and nosimd builds agree"
+exit $status
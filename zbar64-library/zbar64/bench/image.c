@@ -0,0 +1,114 @@
+/* zbar bench - timing, hashing, random numbers and 8-bit images */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/time.h>
+#endif
+
+#include "bench.h"
+
+int bench_reps = 10;
+
+unsigned bench_rand(unsigned* state)
+{
+    /* xorshift32 */
+    unsigned x = *state ? *state : 0x9E3779B9U;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return(x);
+}
+
+double bench_uniform(unsigned* state, double lo, double hi)
+{
+    return(lo + (hi - lo) * (bench_rand(state) >> 8) / (double)(1 << 24));
+}
+
+/* wall clock, so threaded scans are timed fairly */
+double bench_now_ms(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, t;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return(t.QuadPart * 1000. / freq.QuadPart);
+#else
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return(t.tv_sec * 1000. + t.tv_usec / 1000.);
+#endif
+}
+
+unsigned bench_hash(unsigned h, const void* data, size_t n)
+{
+    const unsigned char* p = data;
+    while (n--)
+        h = (h ^ *p++) * 16777619U;
+    return(h);
+}
+
+void bench_image_init(bench_image_t* img, int w, int h, int bg,
+    unsigned seed)
+{
+    img->w = w;
+    img->h = h;
+    img->data = malloc((size_t)w * h);
+    memset(img->data, bg, (size_t)w * h);
+    img->seed = seed;
+}
+
+void bench_image_free(bench_image_t* img)
+{
+    free(img->data);
+    img->data = NULL;
+}
+
+void bench_image_read(bench_image_t* img, const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    int maxval;
+    if (!f || fscanf(f, "P5 %d %d %d", &img->w, &img->h, &maxval) != 3 ||
+        img->w <= 0 || img->h <= 0 || maxval != 255) {
+        fprintf(stderr, "%s: not an 8-bit binary PGM\n", path);
+        exit(1);
+    }
+    fgetc(f);
+    img->data = malloc((size_t)img->w * img->h);
+    if (fread(img->data, 1, (size_t)img->w * img->h, f) !=
+        (size_t)img->w * img->h) {
+        fprintf(stderr, "%s: short read\n", path);
+        exit(1);
+    }
+    fclose(f);
+    img->seed = 1;
+}
+
+void bench_image_noise(bench_image_t* img, int amp)
+{
+    size_t i, n = (size_t)img->w * img->h;
+    for (i = 0; i < n; i++) {
+        int v = img->data[i] + (int)(bench_rand(&img->seed) % (2 * amp + 1))
+            - amp;
+        img->data[i] = (v < 0) ? 0 : (v > 255) ? 255 : v;
+    }
+}
+
+void bench_image_texture(bench_image_t* img, int amp)
+{
+    int n = img->w * img->h / 64;
+    int i, x, y;
+    for (i = 0; i < n; i++) {
+        int w = 2 + bench_rand(&img->seed) % 24;
+        int h = 2 + bench_rand(&img->seed) % 24;
+        int x0 = bench_rand(&img->seed) % img->w;
+        int y0 = bench_rand(&img->seed) % img->h;
+        int v = 128 + (int)(bench_rand(&img->seed) % (2 * amp + 1)) - amp;
+        for (y = y0; y < y0 + h && y < img->h; y++)
+            for (x = x0; x < x0 + w && x < img->w; x++)
+                img->data[y * img->w + x] = (v < 0) ? 0 : (v > 255) ? 255 : v;
+    }
+}
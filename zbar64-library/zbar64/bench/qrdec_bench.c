@@ -0,0 +1,793 @@
+/* zbar bench - checks of the QR decoder's internals.
+ *
+ * this includes qrdec.c itself, so its static functions can be called
+ * directly; build.sh links it in place of the library's own copy.
+ */
+#include "decoder/qrdec.c"
+
+#include <stdio.h>
+#include <math.h>
+#include "bench.h"
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+/* one lazily binarized image and the state to check it against */
+typedef struct lazybin_s {
+    qr_bin_image bin;
+    zbar_arena_t arena;
+    const bench_image_t* img;
+    unsigned char* ref;         /* the allowed rects binarized eagerly */
+    unsigned seed;
+    int nchecks, nbad;
+} lazybin_t;
+
+/* binarize every allowed rect of the image up front into cleared bits,
+ * the way the binary image looked before it was binarized lazily
+ */
+static void lazybin_eager(lazybin_t* lb)
+{
+    qr_bin_image* bin = &lb->bin;
+    int w = lb->img->w, h = lb->img->h;
+    int i;
+    memset(lb->ref, 0, (size_t)bin->stride * h);
+    for (i = 0; i < bin->nrects; i++) {
+        const int* r = bin->rects[i];
+        if (bin->method == QR_BINARIZE_GLOBAL)
+            qr_threshold_rect_packed(lb->ref, bin->stride, lb->img->data,
+                w, h, r[0], r[1], r[2], r[3],
+                qr_otsu_threshold(lb->img->data, w, h), NULL);
+        else if (bin->method == QR_BINARIZE_SAUVOLA)
+            qr_sauvola_rect_packed(lb->ref, bin->stride, lb->img->data,
+                w, h, r[0], r[1], r[2], r[3], NULL);
+        else
+            qr_binarize_rect_packed(lb->ref, bin->stride, lb->img->data,
+                w, h, r[0], r[1], r[2], r[3], NULL);
+    }
+}
+
+/* every tile marked done must match the eager binarization of the
+ * rects allowed so far, and (all) must, once all is prefetched
+ */
+static void lazybin_check(lazybin_t* lb, int all, const char* what)
+{
+    qr_bin_image* bin = &lb->bin;
+    int tx, ty, y, nbad = 0;
+    if (all)
+        qr_bin_image_prefetch(bin, 0, 0, bin->width, bin->height);
+    lazybin_eager(lb);
+    for (ty = 0; ty < bin->nty; ty++)
+        for (tx = 0; tx < bin->ntx; tx++) {
+            int x0 = tx << bin->logtw, y0 = ty << bin->logth;
+            int x1 = QR_MINI(x0 + (1 << bin->logtw), bin->width);
+            int y1 = QR_MINI(y0 + (1 << bin->logth), bin->height);
+            if (bin->filled[ty * bin->ntx + tx] != QR_TILE_DONE)
+                continue;
+            for (y = y0; y < y1; y++) {
+                size_t o = (size_t)y * bin->stride + (x0 >> 3);
+                if (memcmp(bin->bits + o, lb->ref + o,
+                        ((x1 + 7) >> 3) - (x0 >> 3)))
+                    break;
+            }
+            nbad += y < y1;
+        }
+    lb->nchecks++;
+    if (nbad) {
+        printf("lazybin: %dx%d method %d, %d tiles differ after %s\n",
+            bin->width, bin->height, bin->method, nbad, what);
+        lb->nbad++;
+    }
+}
+
+/* read pixels anywhere, as the decoder does, a tile at a time */
+static void lazybin_read(lazybin_t* lb, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        qr_bin_image_get(&lb->bin,
+            bench_rand(&lb->seed) % lb->bin.width,
+            bench_rand(&lb->seed) % lb->bin.height);
+}
+
+static void lazybin_prefetch(lazybin_t* lb)
+{
+    int w = lb->bin.width, h = lb->bin.height;
+    int x0 = bench_rand(&lb->seed) % w, y0 = bench_rand(&lb->seed) % h;
+    qr_bin_image_prefetch(&lb->bin, x0, y0,
+        x0 + 1 + bench_rand(&lb->seed) % (w / 2),
+        y0 + 1 + bench_rand(&lb->seed) % (h / 2));
+}
+
+/* allow rows [y0, y1) of the padded crop, as scan_stream() does */
+static void lazybin_band(lazybin_t* lb, int y0, int y1)
+{
+    const bench_image_t* img = lb->img;
+    qr_bin_image_add_rect(&lb->bin, img->data, img->w, img->h,
+        img->w / 16, y0, img->w - img->w / 16, y1);
+}
+
+/* allow a random region of interest */
+static void lazybin_roi(lazybin_t* lb)
+{
+    const bench_image_t* img = lb->img;
+    int x0 = bench_rand(&lb->seed) % img->w;
+    int y0 = bench_rand(&lb->seed) % img->h;
+    int x1 = x0 + 8 + bench_rand(&lb->seed) % (img->w / 3);
+    int y1 = y0 + 8 + bench_rand(&lb->seed) % (img->h / 3);
+    qr_bin_image_add_rect(&lb->bin, img->data, img->w, img->h, x0, y0,
+        QR_MINI(x1, img->w), QR_MINI(y1, img->h));
+}
+
+/* a scene that is not the same from one image to the next */
+static void lazybin_scene(bench_image_t* img, int w, int h, unsigned seed)
+{
+    char data[32];
+    bench_qr_t qr;
+    bench_image_init(img, w, h, 200, seed);
+    bench_image_texture(img, 60);
+    memset(&qr, 0, sizeof(qr));
+    qr.mod = 3;
+    qr.x = bench_uniform(&img->seed, w / 4., w * 3 / 4.);
+    qr.y = bench_uniform(&img->seed, h / 4., h * 3 / 4.);
+    qr.angle = bench_uniform(&img->seed, 0, 90);
+    sprintf(data, "lazybin %u", seed);
+    qr.data = data;
+    bench_draw_qr(img, &qr);
+    bench_image_noise(img, 20);
+}
+
+/* lazily binarized images (tiles filled as they are read, marked stale
+ * when a later band or region of interest overlaps them, and cleared
+ * between images and methods) must read exactly like the rects allowed
+ * so far binarized up front
+ */
+int bench_lazybin(int argc, char** argv)
+{
+    static const int sizes[][2] = { { 320, 240 }, { 640, 480 }, { 1000, 700 } };
+    static const int methods[] = {
+        QR_BINARIZE_MEAN, QR_BINARIZE_SAUVOLA, QR_BINARIZE_GLOBAL
+    };
+    zbar_pool_t* pool = NULL;
+    unsigned h0 = BENCH_HASH_INIT;
+    int nchecks = 0, nbad = 0;
+    int threads = (argc > 2) ? atoi(argv[2]) : 1;
+    unsigned s, m;
+
+    if (threads > 1) {
+        pool = _zbar_pool_create(threads);
+        if (!pool) {
+            fprintf(stderr, "lazybin: no thread pool\n");
+            return(1);
+        }
+    }
+    for (s = 0; s < sizeof(sizes) / sizeof(*sizes); s++)
+        for (m = 0; m < sizeof(methods) / sizeof(*methods); m++) {
+            int w = sizes[s][0], h = sizes[s][1];
+            bench_image_t img[2];
+            lazybin_t lb;
+            int i, y;
+
+            memset(&lb, 0, sizeof(lb));
+            _zbar_arena_init(&lb.arena);
+            lb.bin.arena = &lb.arena;
+            lb.bin.pool = pool;
+            lb.bin.method = methods[m];
+            lb.bin.threshold = -1;
+            lb.seed = (s * 3 + m + 1) * 0x9E3779B9U;
+            lb.ref = calloc((size_t)(((w + 31) >> 5) << 2) * h, 1);
+            lazybin_scene(&img[0], w, h, lb.seed);
+            lazybin_scene(&img[1], w, h, lb.seed + 1);
+
+            /* bands of rows that end inside a tile row, read as they go */
+            lb.img = &img[0];
+            for (y = 0; y < h; ) {
+                int y1 = y + 8 + bench_rand(&lb.seed) % 40;
+                y1 = QR_MINI(y1, h);
+                lazybin_band(&lb, y, y1);
+                lazybin_check(&lb, 0, "a band");
+                lazybin_read(&lb, 16);
+                if (bench_rand(&lb.seed) % 3 == 0)
+                    lazybin_prefetch(&lb);
+                lazybin_check(&lb, 0, "reading a band");
+                y = y1;
+            }
+            lazybin_check(&lb, 1, "the last band");
+            h0 = bench_hash(h0, lb.bin.bits, (size_t)lb.bin.stride * h);
+
+            /* the next image: overlapping regions of interest */
+            qr_bin_image_reset(&lb.bin);
+            lb.img = &img[1];
+            for (i = 0; i < 12; i++) {
+                lazybin_roi(&lb);
+                lazybin_check(&lb, 0, "a region");
+                lazybin_read(&lb, 32);
+                lazybin_prefetch(&lb);
+                lazybin_check(&lb, 0, "reading a region");
+            }
+            lazybin_check(&lb, 1, "the last region");
+            h0 = bench_hash(h0, lb.bin.bits, (size_t)lb.bin.stride * h);
+
+            /* another method over the same regions, as a cascade does */
+            qr_bin_image_set_method(&lb.bin,
+                methods[(m + 1) % (sizeof(methods) / sizeof(*methods))]);
+            lazybin_read(&lb, 64);
+            lazybin_check(&lb, 0, "switching methods");
+            lazybin_check(&lb, 1, "switching methods");
+
+            nchecks += lb.nchecks;
+            nbad += lb.nbad;
+            free(lb.ref);
+            free(lb.bin.bits);
+            free(lb.bin.filled);
+            free(lb.bin.rects);
+            _zbar_arena_destroy(&lb.arena);
+            bench_image_free(&img[0]);
+            bench_image_free(&img[1]);
+        }
+    if (pool)
+        _zbar_pool_destroy(pool);
+    printf("lazybin: %d checks, %d failed, hash %08x\n", nchecks, nbad, h0);
+    return(nbad != 0);
+}
+
+/* the cell qr_sampling_grid_init() would make for a code of dimension
+ * dim with corners (in QR_FINDER_SUBPREC units) near a square of side
+ * s pixels at (cx, cy), turned by angle and with each corner pulled by
+ * up to persp of the side, for perspective
+ */
+static void sampling_cell(qr_hom_cell* cell, unsigned* seed, int dim,
+    double cx, double cy, double s, double angle, double persp)
+{
+    static const int sx[4] = { -1, 1, -1, 1 }, sy[4] = { -1, -1, 1, 1 };
+    double c = cos(angle), sn = sin(angle);
+    int p[4][2];
+    int i;
+    for (i = 0; i < 4; i++) {
+        double x = sx[i] * s / 2 + bench_uniform(seed, -persp, persp) * s;
+        double y = sy[i] * s / 2 + bench_uniform(seed, -persp, persp) * s;
+        p[i][0] = (int)((cx + c * x - sn * y) * (1 << QR_FINDER_SUBPREC));
+        p[i][1] = (int)((cy + sn * x + c * y) * (1 << QR_FINDER_SUBPREC));
+    }
+    qr_hom_cell_init(cell, 0, 0, dim - 1, 0, 0, dim - 1, dim - 1, dim - 1,
+        p[0][0], p[0][1], p[1][0], p[1][1], p[2][0], p[2][1], p[3][0], p[3][1]);
+}
+
+/* project the rows [-dim/2, dim + dim/2) of a cell, a module past each
+ * side of the code and then some, as qr_sampling_grid_sample() does
+ */
+typedef void (*sampling_kernel_t)(int* px, int* py, const qr_hom_cell* cell,
+    int x, int y, int w, int n);
+
+static void sampling_rows(sampling_kernel_t kernel, const qr_hom_cell* cell,
+    int dim, int* px, int* py)
+{
+    int n = 2 * dim, u;
+    for (u = -dim / 2; u < dim + dim / 2; u++) {
+        int du = u - cell->u0, dv = -dim / 2 - cell->v0;
+        kernel(px, py, cell,
+            cell->fwd[0][0] * du + cell->fwd[0][1] * dv + cell->fwd[0][2],
+            cell->fwd[1][0] * du + cell->fwd[1][1] * dv + cell->fwd[1][2],
+            cell->fwd[2][0] * du + cell->fwd[2][1] * dv + cell->fwd[2][2], n);
+        px += n;
+        py += n;
+    }
+}
+
+/* the sampling grid's row projection kernels against the scalar one, over
+ * random warps of every version.  a quarter of the warps are so steep
+ * that the plane at infinity crosses the rows, which the vector kernels
+ * hand back to the scalar code
+ */
+int bench_sampling(int argc, char** argv)
+{
+    enum { NKERNELS = 3 };
+    static const char* names[NKERNELS] = { "c", "sse2", "avx2" };
+    sampling_kernel_t kernels[NKERNELS] = { qr_hom_cell_fproject_row_c };
+    double ms[NKERNELS] = { 0 };
+    unsigned h0 = BENCH_HASH_INIT, seed = 1;
+    long nproj = 0, nbehind = 0, nmodules = 0;
+    int n = (argc > 2) ? atoi(argv[2]) : 2000;
+    int* px[2];
+    int* py[2];
+    int i, k, nbad = 0;
+
+#if defined(ZBAR_SSE2)
+    kernels[1] = qr_hom_cell_fproject_row_sse2;
+#endif
+#if defined(ZBAR_AVX2)
+    if (_zbar_cpu_avx2())
+        kernels[2] = qr_hom_cell_fproject_row_avx2;
+#endif
+    /* at most 2 * 177 rows of 2 * 177 modules */
+    for (k = 0; k < 2; k++) {
+        px[k] = malloc(4 * 177 * 177 * sizeof(int));
+        py[k] = malloc(4 * 177 * 177 * sizeof(int));
+    }
+    for (i = 0; i < n; i++) {
+        int version = 1 + i % 40, dim = 17 + 4 * version;
+        double s = dim * bench_uniform(&seed, 1.5, 12);
+        double persp = (i % 4 == 3) ? 0.6 : bench_uniform(&seed, 0, 0.1);
+        qr_hom_cell cell;
+        int u, v, m = 4 * dim * dim;
+
+        sampling_cell(&cell, &seed, dim, bench_uniform(&seed, 0, 4000),
+            bench_uniform(&seed, 0, 3000), s,
+            bench_uniform(&seed, 0, 2 * M_PI), persp);
+        sampling_rows(kernels[0], &cell, dim, px[0], py[0]);
+        for (u = 0; u < 2 * dim; u++) {
+            int du = u - dim / 2 - cell.u0, dv = -dim / 2 - cell.v0;
+            int w = cell.fwd[2][0] * du + cell.fwd[2][1] * dv + cell.fwd[2][2];
+            for (v = 0; v < 2 * dim; v++, w += cell.fwd[2][1])
+                nbehind += w <= 0;
+        }
+        nproj += m;
+        h0 = bench_hash(h0, px[0], m * sizeof(int));
+        h0 = bench_hash(h0, py[0], m * sizeof(int));
+        for (k = 1; k < NKERNELS; k++) {
+            if (!kernels[k])
+                continue;
+            sampling_rows(kernels[k], &cell, dim, px[1], py[1]);
+            if (memcmp(px[0], px[1], m * sizeof(int)) ||
+                memcmp(py[0], py[1], m * sizeof(int))) {
+                printf("sampling: version %d warp %d differs with %s\n",
+                    version, i, names[k]);
+                nbad++;
+            }
+        }
+    }
+
+    /* time the kernels over one mildly warped code of each version */
+    for (i = 0; i < 40; i++) {
+        int dim = 21 + 4 * i;
+        qr_hom_cell cell;
+        seed = i + 1;
+        sampling_cell(&cell, &seed, dim, 2000, 1500, 6 * dim, 0.3, 0.05);
+        for (k = 0; k < NKERNELS; k++) {
+            double t0;
+            int r;
+            if (!kernels[k])
+                continue;
+            t0 = bench_now_ms();
+            for (r = 0; r < bench_reps; r++)
+                sampling_rows(kernels[k], &cell, dim, px[1], py[1]);
+            ms[k] += bench_now_ms() - t0;
+        }
+        nmodules += 4 * dim * dim;
+    }
+    printf("sampling: %d warps, %ld projections, %ld behind the camera, "
+        "hash %08x\n", n, nproj, nbehind, h0);
+    printf("sampling: %d mismatched warps\n", nbad);
+    for (k = 0; k < NKERNELS; k++)
+        if (kernels[k])
+            fprintf(stderr, "sampling: %s %.2fns per module\n", names[k],
+                ms[k] * 1e6 / bench_reps / nmodules);
+    for (k = 0; k < 2; k++) {
+        free(px[k]);
+        free(py[k]);
+    }
+    return(nbad != 0);
+}
+
+/* finder lines from a full density scan of rows and columns, as the image
+ * scanner's qr_handler() makes them
+ */
+typedef struct finders_scan_s {
+    zbar_scanner_t* scn;
+    qr_finder_lines lines[2];
+    int dir, v;
+} finders_scan_t;
+
+extern qr_finder_line* _zbar_decoder_get_qr_finder_line(zbar_decoder_t*);
+
+static void finders_handler(zbar_decoder_t* dcode)
+{
+    finders_scan_t* fs = zbar_decoder_get_userdata(dcode);
+    qr_finder_line* line;
+    unsigned u;
+    if (zbar_decoder_get_type(dcode) != ZBAR_QRCODE)
+        return;
+    line = _zbar_decoder_get_qr_finder_line(dcode);
+    u = zbar_scanner_get_edge(fs->scn, line->pos[0], QR_FINDER_SUBPREC);
+    line->boffs = u -
+        zbar_scanner_get_edge(fs->scn, line->boffs, QR_FINDER_SUBPREC);
+    line->len = zbar_scanner_get_edge(fs->scn, line->len, QR_FINDER_SUBPREC);
+    line->eoffs = zbar_scanner_get_edge(fs->scn, line->eoffs,
+        QR_FINDER_SUBPREC) - line->len;
+    line->len -= u;
+    line->pos[fs->dir] = u;
+    line->pos[!fs->dir] = ((fs->v << 1) + 1) << (QR_FINDER_SUBPREC - 1);
+    _zbar_qr_lines_add(&fs->lines[fs->dir], line);
+}
+
+static void finders_scan(finders_scan_t* fs, const bench_image_t* img)
+{
+    zbar_decoder_t* dcode = zbar_decoder_create();
+    int dir;
+    fs->scn = zbar_scanner_create(dcode);
+    zbar_decoder_set_userdata(dcode, fs);
+    zbar_decoder_set_handler(dcode, finders_handler);
+    for (dir = 0; dir < 2; dir++) {
+        int n = dir ? img->w : img->h;
+        fs->dir = dir;
+        fs->lines[dir].nlines = 0;
+        for (fs->v = 0; fs->v < n; fs->v++) {
+            zbar_scanner_new_scan(fs->scn);
+            if (dir)
+                zbar_scan_row(fs->scn, img->data + fs->v, img->h, img->w);
+            else
+                zbar_scan_row(fs->scn, img->data + (size_t)fs->v * img->w,
+                    img->w, 1);
+            zbar_scanner_flush(fs->scn);
+            zbar_scanner_flush(fs->scn);
+        }
+    }
+    zbar_scanner_destroy(fs->scn);
+    zbar_decoder_destroy(dcode);
+}
+
+/* a finder pattern of mod pixel modules, its corner at (x, y) */
+static void finders_draw(bench_image_t* img, int x, int y, int mod)
+{
+    int i, j;
+    for (j = 0; j < 7 * mod && y + j < img->h; j++)
+        for (i = 0; i < 7 * mod && x + i < img->w; i++) {
+            int r = QR_MAXI(abs(2 * i / mod - 6), abs(2 * j / mod - 6)) / 2;
+            img->data[(size_t)(y + j) * img->w + x + i] =
+                (r == 2) ? 230 : 25;
+        }
+}
+
+/* the frames: random texture at VGA, 1080p and 4K, and a 3000x3000 frame
+ * scattered with finder patterns of 2-4 pixel modules, each with a code
+ * among them
+ */
+static void finders_frame(bench_image_t* img, int i)
+{
+    static const int sizes[][2] = {
+        { 640, 480 }, { 1920, 1080 }, { 3840, 2160 }, { 3000, 3000 }
+    };
+    bench_qr_t qr;
+    int w = sizes[i][0], h = sizes[i][1];
+    bench_image_init(img, w, h, 200, i + 1);
+    if (i < 3)
+        bench_image_texture(img, 60);
+    else {
+        int x, y;
+        for (y = 8; y < h; y += 40 + bench_rand(&img->seed) % 40)
+            for (x = 8; x < w; x += 40 + bench_rand(&img->seed) % 40)
+                finders_draw(img, x, y, 2 + bench_rand(&img->seed) % 3);
+    }
+    memset(&qr, 0, sizeof(qr));
+    qr.data = "finders";
+    qr.x = w / 2;
+    qr.y = h / 2;
+    qr.mod = 3;
+    qr.angle = 10;
+    bench_draw_qr(img, &qr);
+    bench_image_noise(img, 10);
+}
+
+/* qr_finder_centers_locate() (line clustering and crossing search) and
+ * qr_center_triples_find() on frames full of finder-like runs, with how
+ * many candidates each stage leaves: of all the triples of the ranked
+ * centers, those the size and shape filters pass and those ranked
+ */
+int bench_finders(int argc, char** argv)
+{
+    unsigned h0 = BENCH_HASH_INIT;
+    int i;
+
+    (void)argc;
+    (void)argv;
+    for (i = 0; i < 4; i++) {
+        qr_reader* reader = _zbar_qr_create();
+        finders_scan_t fs;
+        bench_image_t img;
+        qr_finder_center* centers = NULL;
+        qr_finder_edge_pt* edge_pts;
+        qr_center_triple* triples;
+        zbar_arena_mark_t mark;
+        unsigned* r2;
+        long long nall, nplausible = 0;
+        double ms[2] = { 0, 0 };
+        int ncenters = 0, nranked, ntriples = 0, r, a, b, c;
+
+        memset(&fs, 0, sizeof(fs));
+        finders_frame(&img, i);
+        finders_scan(&fs, &img);
+        for (r = 0; r < bench_reps; r++) {
+            double t0;
+            qr_reader_clear_lines(reader);
+            _zbar_qr_found_lines(reader, 0, &fs.lines[0]);
+            _zbar_qr_found_lines(reader, 1, &fs.lines[1]);
+            mark = _zbar_arena_mark(&reader->arena);
+            t0 = bench_now_ms();
+            ncenters = qr_finder_centers_locate(&centers, &edge_pts, reader);
+            ms[0] += bench_now_ms() - t0;
+            nranked = QR_MINI(ncenters, QR_MATCH_RANKED_MAX);
+            r2 = _zbar_arena_alloc(&reader->arena,
+                QR_MAXI(nranked, 1) * sizeof(*r2));
+            for (a = 0; a < nranked; a++)
+                r2[a] = qr_finder_center_r2(centers + a);
+            t0 = bench_now_ms();
+            ntriples = (nranked >= 3) ? qr_center_triples_find(&triples,
+                centers, nranked, r2, &reader->arena) : 0;
+            ms[1] += bench_now_ms() - t0;
+            if (r + 1 < bench_reps)
+                _zbar_arena_release(&reader->arena, mark);
+        }
+
+        /* what the size and shape filters alone leave of every triple */
+        nranked = QR_MINI(ncenters, QR_MATCH_RANKED_MAX);
+        nall = (long long)nranked * (nranked - 1) * (nranked - 2) / 6;
+        for (a = 0; a < nranked; a++)
+            for (b = a + 1; b < nranked; b++) {
+                unsigned d2[3];
+                d2[0] = qr_point_distance2(centers[a].pos, centers[b].pos);
+                if (!qr_finder_centers_compatible(r2[a], r2[b], d2[0]))
+                    continue;
+                for (c = b + 1; c < nranked; c++) {
+                    d2[1] = qr_point_distance2(centers[a].pos, centers[c].pos);
+                    d2[2] = qr_point_distance2(centers[b].pos, centers[c].pos);
+                    nplausible += qr_finder_centers_compatible(r2[a], r2[c],
+                            d2[1]) &&
+                        qr_finder_centers_compatible(r2[b], r2[c], d2[2]) &&
+                        qr_center_triangle_plausible(d2);
+                }
+            }
+        for (a = 0; a < ncenters; a++)
+            h0 = bench_hash(h0, centers[a].pos, sizeof(centers[a].pos));
+        for (a = 0; a < ntriples; a++)
+            h0 = bench_hash(h0, triples[a].c, sizeof(triples[a].c));
+
+        printf("finders %dx%d: %d+%d lines, %d centers, %d ranked: "
+            "%lld triples, %lld pass the filters, %d tried\n",
+            img.w, img.h, fs.lines[0].nlines, fs.lines[1].nlines, ncenters,
+            nranked, nall, nplausible, ntriples);
+        fprintf(stderr, "finders %dx%d: centers %.3fms triples %.3fms\n",
+            img.w, img.h, ms[0] / bench_reps, ms[1] / bench_reps);
+        free(fs.lines[0].lines);
+        free(fs.lines[1].lines);
+        _zbar_qr_destroy(reader);
+        bench_image_free(&img);
+    }
+    printf("finders: hash %08x\n", h0);
+    return(0);
+}
+
+/* a code drawn for the alignment search, and where its modules are */
+typedef struct align_code_s {
+    bench_image_t img;
+    bench_qr_t qr;
+    int dim;
+} align_code_t;
+
+/* the center of module (u, v) in the image, in QR_FINDER_SUBPREC units:
+ * the inverse of the mapping bench_draw_qr() samples through
+ */
+static void align_module(const align_code_t* ac, double u, double v,
+    qr_point p)
+{
+    const bench_qr_t* qr = &ac->qr;
+    double half = ac->dim / 2. + 4;
+    double ca = cos(qr->angle * M_PI / 180), sa = sin(qr->angle * M_PI / 180);
+    double x = u + 4.5 - half, y = v + 4.5 - half;
+    if (qr->persp) {
+        y /= 1 - qr->persp * y / half;
+        x *= 1 + qr->persp * y / half;
+    }
+    x *= qr->mod;
+    y *= qr->mod;
+    p[0] = (int)((qr->x + ca * x - sa * y) * (1 << QR_FINDER_SUBPREC));
+    p[1] = (int)((qr->y + sa * x + ca * y) * (1 << QR_FINDER_SUBPREC));
+}
+
+/* a code of the given version, turned and foreshortened, with noise and,
+ * if damaged, gray blots a few modules across scattered over it
+ */
+static void align_code(align_code_t* ac, int version, unsigned seed,
+    int damaged)
+{
+    bench_qr_t* qr = &ac->qr;
+    int size, i;
+    ac->dim = 17 + 4 * version;
+    memset(qr, 0, sizeof(*qr));
+    qr->data = "align";
+    qr->version = version;
+    qr->mod = 3 + seed % 3;
+    size = (int)((ac->dim + 8) * qr->mod * 1.6);
+    bench_image_init(&ac->img, size, size, 200, seed);
+    qr->x = size / 2.;
+    qr->y = size / 2.;
+    qr->angle = bench_uniform(&ac->img.seed, -45, 45);
+    qr->persp = bench_uniform(&ac->img.seed, -0.15, 0.15);
+    bench_draw_qr(&ac->img, qr);
+    for (i = 0; damaged && i < ac->dim * ac->dim / 64; i++) {
+        qr_point c;
+        int r = (int)(qr->mod * (1 + bench_rand(&ac->img.seed) % 3));
+        int x, y;
+        align_module(ac, bench_rand(&ac->img.seed) % ac->dim,
+            bench_rand(&ac->img.seed) % ac->dim, c);
+        c[0] >>= QR_FINDER_SUBPREC;
+        c[1] >>= QR_FINDER_SUBPREC;
+        for (y = QR_MAXI(c[1] - r, 0); y < QR_MINI(c[1] + r, size); y++)
+            for (x = QR_MAXI(c[0] - r, 0); x < QR_MINI(c[0] + r, size); x++)
+                ac->img.data[y * size + x] = 128;
+    }
+    bench_image_noise(&ac->img, 20);
+}
+
+/* the alignment pattern search as it was, reading the whole template at
+ * every position
+ */
+static int align_spiral_old(qr_point best, unsigned* best_match,
+    qr_point p[5][5], const qr_hom_cell* cell, int u, int v, int r,
+    qr_bin_image* img, int width, int height)
+{
+    int best_dist = qr_hamming_dist(*best_match, QR_ALIGN_TEMPLATE, 25);
+    int x, y, w, i, j;
+    u -= cell->u0;
+    v -= cell->v0;
+    x = (cell->fwd[0][0] * u + cell->fwd[0][1] * v + cell->fwd[0][2]) <<
+        QR_ALIGN_SUBPREC;
+    y = (cell->fwd[1][0] * u + cell->fwd[1][1] * v + cell->fwd[1][2]) <<
+        QR_ALIGN_SUBPREC;
+    w = (cell->fwd[2][0] * u + cell->fwd[2][1] * v + cell->fwd[2][2]) <<
+        QR_ALIGN_SUBPREC;
+    for (i = 1; i < r << QR_ALIGN_SUBPREC && best_dist > 0; i++) {
+        int side_len = (i << 1) - 1;
+        x -= cell->fwd[0][0] + cell->fwd[0][1];
+        y -= cell->fwd[1][0] + cell->fwd[1][1];
+        w -= cell->fwd[2][0] + cell->fwd[2][1];
+        for (j = 0; j < 4 * side_len && best_dist > 0; j++) {
+            qr_point pc;
+            unsigned match;
+            int dist, dir;
+            qr_hom_cell_fproject(pc, cell, x, y, w);
+            match = qr_alignment_pattern_fetch(p, pc[0], pc[1], img, width,
+                height);
+            dist = qr_hamming_dist(match, QR_ALIGN_TEMPLATE, best_dist + 1);
+            if (dist < best_dist) {
+                *best_match = match;
+                best_dist = dist;
+                best[0] = pc[0];
+                best[1] = pc[1];
+            }
+            dir = (j < 2 * side_len) ? j >= side_len : j >= 3 * side_len;
+            if (j < 2 * side_len) {
+                x += cell->fwd[0][dir];
+                y += cell->fwd[1][dir];
+                w += cell->fwd[2][dir];
+            }
+            else {
+                x -= cell->fwd[0][dir];
+                y -= cell->fwd[1][dir];
+                w -= cell->fwd[2][dir];
+            }
+        }
+    }
+    return(best_dist);
+}
+
+/* per version, the alignment pattern search (qr_alignment_pattern_spiral())
+ * against the one it replaced, on codes whose corners are known only to
+ * within a module, as the sampling grid predicts them: how long each
+ * takes, how many patterns each finds within half a module of the truth,
+ * and any where they disagree
+ */
+int bench_align(int argc, char** argv)
+{
+    int ncodes = (argc > 2) ? atoi(argv[2]) : 4;
+    unsigned h0 = BENCH_HASH_INIT;
+    long total = 0, nfound[2] = { 0, 0 }, ndiff = 0;
+    double total_ms[2] = { 0, 0 };
+    int version;
+
+    for (version = 2; version <= 40; version++) {
+        long npatterns = 0, vfound[2] = { 0, 0 }, vdiff = 0;
+        double ms[2] = { 0, 0 };
+        int k;
+        for (k = 0; k < ncodes; k++) {
+            align_code_t ac;
+            qr_bin_image bin;
+            zbar_arena_t arena;
+            qr_hom_cell cell;
+            qr_point q[4];
+            int align_pos[7];
+            int nalign, i, j, r;
+
+            align_code(&ac, version, version * 97 + k, k & 1);
+            memset(&bin, 0, sizeof(bin));
+            _zbar_arena_init(&arena);
+            bin.arena = &arena;
+            bin.threshold = -1;
+            qr_bin_image_add_rect(&bin, ac.img.data, ac.img.w, ac.img.h,
+                0, 0, ac.img.w, ac.img.h);
+            /* the finder centers and the fourth corner, each off by up
+             * to a module
+             */
+            for (i = 0; i < 4; i++)
+                align_module(&ac,
+                    ((i & 1) ? ac.dim - 4 : 3) +
+                        bench_uniform(&ac.img.seed, -1, 1),
+                    ((i & 2) ? ac.dim - 4 : 3) +
+                        bench_uniform(&ac.img.seed, -1, 1), q[i]);
+            qr_hom_cell_init(&cell, 3, 3, ac.dim - 4, 3, 3, ac.dim - 4,
+                ac.dim - 4, ac.dim - 4, q[0][0], q[0][1], q[1][0], q[1][1],
+                q[2][0], q[2][1], q[3][0], q[3][1]);
+            /* read the whole image up front, so neither search pays for
+             * binarizing it
+             */
+            qr_bin_image_prefetch(&bin, 0, 0, ac.img.w, ac.img.h);
+            nalign = qr_alignment_pattern_positions(align_pos, version);
+            for (i = 0; i < nalign; i++)
+                for (j = 0; j < nalign; j++) {
+                    qr_point p[5][5], truth, best[2];
+                    unsigned match[2];
+                    int dist[2], m;
+                    if ((!i || !j) && (i == nalign - 1 || j == nalign - 1 ||
+                            (!i && !j)))
+                        continue;
+                    align_module(&ac, align_pos[j], align_pos[i], truth);
+                    qr_alignment_pattern_template(p, &cell, align_pos[j],
+                        align_pos[i]);
+                    for (m = 0; m < 2; m++) {
+                        double t0 = bench_now_ms();
+                        for (r = 0; r < bench_reps; r++) {
+                            best[m][0] = p[2][2][0];
+                            best[m][1] = p[2][2][1];
+                            match[m] = qr_alignment_pattern_fetch(p,
+                                best[m][0], best[m][1],
+                                &bin, ac.img.w, ac.img.h);
+                            dist[m] = (m ? qr_alignment_pattern_spiral :
+                                align_spiral_old)(best[m],
+                                match + m, p, &cell, align_pos[j],
+                                align_pos[i], 2, &bin, ac.img.w, ac.img.h);
+                        }
+                        ms[m] += bench_now_ms() - t0;
+                        vfound[m] += dist[m] <= 6 &&
+                            abs(best[m][0] - truth[0]) <=
+                                (int)(ac.qr.mod * (1 << QR_FINDER_SUBPREC) / 2) &&
+                            abs(best[m][1] - truth[1]) <=
+                                (int)(ac.qr.mod * (1 << QR_FINDER_SUBPREC) / 2);
+                    }
+                    if (dist[0] != dist[1] || best[0][0] != best[1][0] ||
+                            best[0][1] != best[1][1]) {
+                        if (!vdiff)
+                            printf("align: version %d pattern (%d,%d): "
+                                "the old search found distance %d at "
+                                "(%d,%d), the new one %d at (%d,%d)\n",
+                                version, align_pos[j], align_pos[i],
+                                dist[0], best[0][0], best[0][1],
+                                dist[1], best[1][0], best[1][1]);
+                        vdiff++;
+                    }
+                    h0 = bench_hash(h0, best[1], sizeof(best[1]));
+                    h0 = bench_hash(h0, dist + 1, sizeof(dist[1]));
+                    npatterns++;
+                }
+            free(bin.bits);
+            free(bin.filled);
+            free(bin.rects);
+            _zbar_arena_destroy(&arena);
+            bench_image_free(&ac.img);
+        }
+        printf("align version %d: %ld patterns, found %ld old %ld new, "
+            "%ld differ\n", version, npatterns, vfound[0], vfound[1], vdiff);
+        fprintf(stderr, "align version %d: old %.4fms new %.4fms "
+            "per pattern\n", version, ms[0] / bench_reps / npatterns,
+            ms[1] / bench_reps / npatterns);
+        total += npatterns;
+        nfound[0] += vfound[0];
+        nfound[1] += vfound[1];
+        ndiff += vdiff;
+        total_ms[0] += ms[0];
+        total_ms[1] += ms[1];
+    }
+    printf("align: %ld patterns, found %ld old %ld new, %ld differ, "
+        "hash %08x\n", total, nfound[0], nfound[1], ndiff, h0);
+    fprintf(stderr, "align: old %.4fms new %.4fms per pattern\n",
+        total_ms[0] / bench_reps / total, total_ms[1] / bench_reps / total);
+    return(ndiff != 0);
+}
@@ -0,0 +1,320 @@
+/* zbar bench - synthetic images: a minimal byte mode QR encoder and a
+ * renderer for rotated, foreshortened codes on noisy or textured
+ * backgrounds.  the encoder follows ISO/IEC 18004 closely enough for
+ * any conforming reader, but always uses a fixed mask choice
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "rs.h"
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+/* blocks and parity bytes per block, by version and level (L, M, Q, H) */
+static const unsigned char qr_nblocks[40][4] = {
+    {1,1,1,1},{1,1,1,1},{1,1,2,2},{1,2,2,4},{1,2,4,4},{2,4,4,4},{2,4,6,5},
+    {2,4,6,6},{2,5,8,8},{4,5,8,8},{4,5,8,11},{4,8,10,11},{4,9,12,16},
+    {4,9,16,16},{6,10,12,18},{6,10,17,16},{6,11,16,19},{6,13,18,21},
+    {7,14,21,25},{8,16,20,25},{8,17,23,25},{9,17,23,34},{9,18,25,30},
+    {10,20,27,32},{12,21,29,35},{12,23,34,37},{12,25,34,40},{13,26,35,42},
+    {14,28,38,45},{15,29,40,48},{16,31,43,51},{17,33,45,54},{18,35,48,57},
+    {19,37,51,60},{19,38,53,63},{20,40,56,66},{21,43,59,70},{22,45,62,74},
+    {24,47,65,77},{25,49,68,81}
+};
+
+static const unsigned char qr_npar[40][4] = {
+    {7,10,13,17},{10,16,22,28},{15,26,18,22},{20,18,26,16},{26,24,18,22},
+    {18,16,24,28},{20,18,18,26},{24,22,22,26},{30,22,20,24},{18,26,24,28},
+    {20,30,28,24},{24,22,26,28},{26,22,24,22},{30,24,20,24},{22,24,30,24},
+    {24,28,24,30},{28,28,28,28},{30,26,28,28},{28,26,26,26},{28,26,30,28},
+    {28,26,28,30},{28,28,30,24},{30,28,30,30},{30,28,30,30},{26,28,30,30},
+    {28,28,28,30},{30,28,30,30},{30,28,30,30},{30,28,30,30},{30,28,30,30},
+    {30,28,30,30},{30,28,30,30},{30,28,30,30},{30,28,30,30},{30,28,30,30},
+    {30,28,30,30},{30,28,30,30},{30,28,30,30},{30,28,30,30},{30,28,30,30}
+};
+
+/* format bits of each level, in L, M, Q, H order */
+static const unsigned char qr_ecl_bits[4] = { 1, 0, 3, 2 };
+
+static int qr_ncodewords(int v)
+{
+    int nalign = v / 7 + 2;
+    if (v == 1)
+        return(26);
+    return(((v << 4) * (v + 8) - (5 * nalign) * (5 * nalign - 2) +
+        36 * (v < 7) + 83) >> 3);
+}
+
+/* remainder-appended BCH code of val with generator poly */
+static unsigned qr_bch(unsigned val, unsigned poly)
+{
+    int n = 0, d;
+    unsigned r;
+    while (poly >> (n + 1))
+        n++;
+    r = val << n;
+    for (d = 31; d >= n; d--)
+        if (r >> d & 1)
+            r ^= poly << (d - n);
+    return(val << n | r);
+}
+
+static int qr_align_pos(int v, int pos[7])
+{
+    int num, step, i;
+    if (v == 1)
+        return(0);
+    num = v / 7 + 2;
+    step = (v == 32) ? 26 : (v * 4 + num * 2 + 1) / (num * 2 - 2) * 2;
+    pos[0] = 6;
+    for (i = 1; i < num; i++)
+        pos[i] = v * 4 + 10 - (num - 1 - i) * step;
+    return(num);
+}
+
+static int qr_mask(int m, int x, int y)
+{
+    switch (m) {
+    case 0: return((x + y) % 2 == 0);
+    case 1: return(y % 2 == 0);
+    case 2: return(x % 3 == 0);
+    case 3: return((x + y) % 3 == 0);
+    case 4: return((x / 3 + y / 2) % 2 == 0);
+    case 5: return(x * y % 2 + x * y % 3 == 0);
+    case 6: return((x * y % 2 + x * y % 3) % 2 == 0);
+    default: return(((x + y) % 2 + x * y % 3) % 2 == 0);
+    }
+}
+
+/* encode data into a dim x dim matrix of modules (1 = dark).
+ * returns the matrix (to free), or NULL if data does not fit
+ */
+static unsigned char* qr_encode(const char* data, int ecl, int version,
+    int* dimp)
+{
+    rs_gf256 gf;
+    unsigned char genpoly[256];
+    unsigned char* cw;
+    unsigned char* out;
+    unsigned char* m;
+    unsigned char* fn;
+    int len = (int)strlen(data);
+    int v, nb = 0, npar = 0, ndata = 0, dim, nbits, nout;
+    int i, j, k, x, y, mask, nalign, right;
+    int apos[7];
+    unsigned bits;
+
+    for (v = 1; v <= 40; v++) {
+        int cc = (v < 10) ? 8 : 16;
+        if (version && v != version)
+            continue;
+        nb = qr_nblocks[v - 1][ecl];
+        npar = qr_npar[v - 1][ecl];
+        ndata = qr_ncodewords(v) - nb * npar;
+        if (4 + cc + 8 * len <= ndata * 8)
+            break;
+    }
+    if (v > 40)
+        return(NULL);
+
+    /* data codewords: mode, count, bytes, terminator, padding */
+    cw = calloc(qr_ncodewords(v), 1);
+    out = malloc(qr_ncodewords(v));
+    nbits = 0;
+#define PUT(val, n)                                                  \
+    for (i = (n) - 1; i >= 0; i--, nbits++)                          \
+        if (((val) >> i) & 1)                                        \
+            cw[nbits >> 3] |= 0x80 >> (nbits & 7);
+    PUT(4, 4);
+    PUT(len, (v < 10) ? 8 : 16);
+    for (j = 0; j < len; j++)
+        PUT((unsigned char)data[j], 8);
+#undef PUT
+    nbits += (ndata * 8 - nbits < 4) ? ndata * 8 - nbits : 4;
+    for (j = (nbits + 7) >> 3, k = 0; j < ndata; j++, k ^= 1)
+        cw[j] = (k) ? 0x11 : 0xEC;
+
+    /* parity, then interleave the blocks */
+    rs_gf256_init(&gf, QR_PPOLY);
+    rs_compute_genpoly(&gf, QR_M0, genpoly, npar);
+    {
+        unsigned char blocks[81][256];
+        int nshort = ndata / nb, nlong = ndata % nb;
+        int off = 0;
+        for (j = 0; j < nb; j++) {
+            int n = nshort + (j >= nb - nlong);
+            memcpy(blocks[j], cw + off, n);
+            rs_encode(&gf, blocks[j], n + npar, genpoly, npar);
+            off += n;
+        }
+        nout = 0;
+        for (i = 0; i <= nshort; i++)
+            for (j = 0; j < nb; j++)
+                if (i < nshort + (j >= nb - nlong))
+                    out[nout++] = blocks[j][i];
+        for (i = 0; i < npar; i++)
+            for (j = 0; j < nb; j++)
+                out[nout++] = blocks[j][nshort + (j >= nb - nlong) + i];
+    }
+    free(cw);
+
+    dim = 17 + 4 * v;
+    m = calloc(dim * dim, 1);
+    fn = calloc(dim * dim, 1);
+#define SET(x, y, d)                                                 \
+    do {                                                             \
+        int sx = (x), sy = (y);                                      \
+        if (sx >= 0 && sx < dim && sy >= 0 && sy < dim) {            \
+            m[sy * dim + sx] = !!(d);                                \
+            fn[sy * dim + sx] = 1;                                   \
+        }                                                            \
+    } while (0)
+
+    /* function patterns */
+    for (i = 0; i < dim; i++) {
+        SET(6, i, !(i & 1));
+        SET(i, 6, !(i & 1));
+    }
+    for (k = 0; k < 3; k++) {
+        int cx = (k == 1) ? dim - 4 : 3, cy = (k == 2) ? dim - 4 : 3;
+        for (y = -4; y <= 4; y++)
+            for (x = -4; x <= 4; x++) {
+                int d = (abs(x) > abs(y)) ? abs(x) : abs(y);
+                SET(cx + x, cy + y, d != 2 && d != 4);
+            }
+    }
+    nalign = qr_align_pos(v, apos);
+    for (i = 0; i < nalign; i++)
+        for (j = 0; j < nalign; j++) {
+            int last = nalign - 1;
+            if ((!i && !j) || (!i && j == last) || (i == last && !j))
+                continue;
+            for (y = -2; y <= 2; y++)
+                for (x = -2; x <= 2; x++) {
+                    int d = (abs(x) > abs(y)) ? abs(x) : abs(y);
+                    SET(apos[i] + x, apos[j] + y, d != 1);
+                }
+        }
+    /* reserve the format areas */
+    for (i = 0; i < 9; i++) {
+        if (!fn[8 * dim + i])
+            SET(i, 8, 0);
+        if (!fn[i * dim + 8])
+            SET(8, i, 0);
+    }
+    for (i = 0; i < 8; i++) {
+        SET(dim - 1 - i, 8, 0);
+        SET(8, dim - 1 - i, 0);
+    }
+    if (v >= 7) {
+        bits = qr_bch(v, 0x1F25);
+        for (i = 0; i < 18; i++) {
+            int a = dim - 11 + i % 3, c = i / 3;
+            SET(a, c, bits >> i & 1);
+            SET(c, a, bits >> i & 1);
+        }
+    }
+
+    /* data, in the zigzag order */
+    k = 0;
+    for (right = dim - 1; right >= 1; right -= 2) {
+        if (right == 6)
+            right = 5;
+        for (i = 0; i < dim; i++)
+            for (j = 0; j < 2; j++) {
+                int upward = !((right + 1) & 2);
+                x = right - j;
+                y = (upward) ? dim - 1 - i : i;
+                if (!fn[y * dim + x]) {
+                    m[y * dim + x] = (k < nout * 8)
+                        ? (out[k >> 3] >> (7 - (k & 7))) & 1 : 0;
+                    k++;
+                }
+            }
+    }
+    free(out);
+
+    mask = (len + v) % 8;
+    for (y = 0; y < dim; y++)
+        for (x = 0; x < dim; x++)
+            if (!fn[y * dim + x] && qr_mask(mask, x, y))
+                m[y * dim + x] ^= 1;
+
+    bits = qr_bch(qr_ecl_bits[ecl] << 3 | mask, 0x537) ^ 0x5412;
+    for (i = 0; i < 6; i++)
+        SET(8, i, bits >> i & 1);
+    SET(8, 7, bits >> 6 & 1);
+    SET(8, 8, bits >> 7 & 1);
+    SET(7, 8, bits >> 8 & 1);
+    for (i = 9; i < 15; i++)
+        SET(14 - i, 8, bits >> i & 1);
+    for (i = 0; i < 8; i++)
+        SET(dim - 1 - i, 8, bits >> i & 1);
+    for (i = 8; i < 15; i++)
+        SET(8, dim - 15 + i, bits >> i & 1);
+    SET(8, dim - 8, 1);
+#undef SET
+
+    free(fn);
+    *dimp = dim;
+    return(m);
+}
+
+int bench_draw_qr(bench_image_t* img, const bench_qr_t* qr)
+{
+    const int quiet = 4;
+    double half, ca, sa;
+    unsigned char* m;
+    int dim, ext, x, y;
+
+    m = qr_encode(qr->data, qr->ecl, qr->version, &dim);
+    if (!m)
+        return(-1);
+    half = (dim + 2 * quiet) / 2.;
+    ca = cos(qr->angle * M_PI / 180);
+    sa = sin(qr->angle * M_PI / 180);
+    ext = (int)(half * qr->mod * 1.5 * (1 + fabs(qr->persp))) + 2;
+
+    for (y = (int)qr->y - ext; y < (int)qr->y + ext; y++) {
+        if (y < 0 || y >= img->h)
+            continue;
+        for (x = (int)qr->x - ext; x < (int)qr->x + ext; x++) {
+            int acc = 0, inside = 1, s;
+            if (x < 0 || x >= img->w)
+                continue;
+            /* 2x2 supersampling */
+            for (s = 0; s < 4 && inside; s++) {
+                double dx = x + 0.25 + 0.5 * (s & 1) - qr->x;
+                double dy = y + 0.25 + 0.5 * (s >> 1) - qr->y;
+                double u = (ca * dx + sa * dy) / qr->mod;
+                double w = (-sa * dx + ca * dy) / qr->mod;
+                int mu, mv;
+                if (qr->persp) {
+                    double f = 1 + qr->persp * w / half;
+                    u /= f;
+                    w /= f;
+                }
+                u += half;
+                w += half;
+                if (u < 0 || u >= dim + 2 * quiet ||
+                    w < 0 || w >= dim + 2 * quiet) {
+                    inside = 0;
+                    break;
+                }
+                mu = (int)u - quiet;
+                mv = (int)w - quiet;
+                acc += (mu >= 0 && mu < dim && mv >= 0 && mv < dim &&
+                    m[mv * dim + mu]) ? 30 : 230;
+            }
+            if (inside)
+                img->data[y * img->w + x] = acc / 4;
+        }
+    }
+    free(m);
+    return((dim - 17) / 4);
+}
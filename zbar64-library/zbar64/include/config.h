@@ -1,3 +1,10 @@
 /* whether to build support for QR Code */
 #define	ENABLE_QRCODE 1
 
+/* whether POSIX threads are available (the worker pool behind
+ * ZBAR_CFG_THREADS uses Win32 threads on Windows) */
+#if !defined(_WIN32) && !defined(HAVE_LIBPTHREAD) && \
+    (defined(__unix__) || defined(__APPLE__))
+# define HAVE_LIBPTHREAD 1
+#endif
+
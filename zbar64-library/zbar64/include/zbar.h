@@ -93,8 +93,39 @@ typedef enum zbar_config_e {
 
     ZBAR_CFG_X_DENSITY = 0x100, /**< image scanner vertical scan density */
     ZBAR_CFG_Y_DENSITY,         /**< image scanner horizontal scan density */
+    ZBAR_CFG_THREADS,           /**< image scanner worker threads (QR only,
+                                 *   more than 1 is rejected by builds
+                                 *   without thread support) */
+    ZBAR_CFG_COARSE_DENSITY,    /**< image scanner adaptive coarse density,
+                                 *   at most the finder center width of the
+                                 *   smallest code, and at most 6 whatever
+                                 *   the module size if codes may be
+                                 *   rotated (QR only, 0 disables) */
+    ZBAR_CFG_DIAG_DENSITY,      /**< image scanner diagonal scan density
+                                 *   (QR only, 0 disables) */
+    ZBAR_CFG_EXPECTED_COUNT,    /**< image scanner stops once this many QR
+                                 *   codes are decoded (0 scans everything) */
+    ZBAR_CFG_STREAM_ROWS,       /**< image scanner decodes QR codes after
+                                 *   each band of this many rows, calling
+                                 *   the data handler as soon as new ones
+                                 *   are found (0 decodes once at the end) */
+    ZBAR_CFG_BINARIZER,         /**< image scanner QR binarization method,
+                                 *   one of ::zbar_binarizer_t */
 } zbar_config_t;
 
+/** QR binarization methods (::ZBAR_CFG_BINARIZER values).
+ * @since 0.11
+ */
+typedef enum zbar_binarizer_e {
+    ZBAR_BINARIZER_MEAN = 0,    /**< adaptive mean threshold (default) */
+    ZBAR_BINARIZER_GLOBAL,      /**< single (Otsu) threshold per image */
+    ZBAR_BINARIZER_SAUVOLA,     /**< adaptive mean and contrast threshold */
+    ZBAR_BINARIZER_CASCADE,     /**< global first, then the adaptive ones
+                                 *   in turn while finder patterns are
+                                 *   found but no code decodes */
+    ZBAR_BINARIZER_NUM,         /**< number of binarizer values */
+} zbar_binarizer_t;
+
 /** decoded symbol coarse orientation.
  * @since 0.11
  */
@@ -122,6 +153,21 @@ typedef struct zbar_symbol_set_s zbar_symbol_set_t;
 extern const zbar_symbol_t*
 zbar_symbol_set_first_symbol(const zbar_symbol_set_t* symbols);
 
+/** retrieve the image region of interest a symbol was found in.
+ * @returns the index returned by zbar_image_add_roi() for the first
+ * region the symbol was decoded from, or -1 if the image had no
+ * regions of interest
+ */
+extern int zbar_symbol_get_roi(const zbar_symbol_t* symbol);
+
+/** check whether a symbol was passed to the data handler before.
+ * with ::ZBAR_CFG_STREAM_ROWS the handler is called after each band
+ * that finds new symbols, with all the symbols found so far.
+ * @returns 1 if an earlier handler call for the same image already
+ * included the symbol, 0 if it is new
+ */
+extern int zbar_symbol_get_reported(const zbar_symbol_t* symbol);
+
 
 /** consistently compute fourcc values across architectures
  * (adapted from v4l2 specification)
@@ -303,6 +349,25 @@ extern void zbar_image_set_data(zbar_image_t* image,
  */
 extern void zbar_image_free_data(zbar_image_t* image);
 
+/** add a rectangular region of interest to the image.
+ * when an image has regions of interest, zbar_scan_image() scans
+ * (and binarizes for QR) only those regions, one after the other,
+ * and tags each result with the index of its region.
+ * a symbol decoded again where regions overlap is reported once,
+ * tagged with the first region that found it.
+ * regions are clipped to the image when it is scanned
+ * @returns the index of the new region, or -1 if the region is empty
+ * or out of memory
+ */
+extern int zbar_image_add_roi(zbar_image_t* image,
+    unsigned x,
+    unsigned y,
+    unsigned width,
+    unsigned height);
+
+/** remove all regions of interest, so the whole image is scanned. */
+extern void zbar_image_clear_rois(zbar_image_t* image);
+
 /** retrieve sample position of last edge.
  * @since 0.10
  */
@@ -353,6 +418,18 @@ extern unsigned int zbar_decoder_get_modifiers(const zbar_decoder_t* decoder);
  */
 extern int zbar_decoder_get_direction(const zbar_decoder_t* decoder);
 
+/** setup result handler callback.
+ * the specified function will be called by the scanner whenever
+ * new results are available from a decoded image (with
+ * ::ZBAR_CFG_STREAM_ROWS, possibly several times per image).
+ * pass a NULL value to disable callbacks.
+ * @returns the previously registered handler
+ */
+extern zbar_image_data_handler_t*
+zbar_image_scanner_set_data_handler(zbar_image_scanner_t* scanner,
+    zbar_image_data_handler_t* handler,
+    const void* userdata);
+
 /** set config for indicated symbology (0 for all) to specified value.
  * @returns 0 for success, non-0 for failure (config does not apply to
  * specified symbology, or value out of range)
@@ -430,4 +507,17 @@ extern void zbar_decoder_new_scan(zbar_decoder_t* decoder);
 extern zbar_symbol_type_t zbar_scan_y(zbar_scanner_t* scanner,
     int y);
 
-#endif
\ No newline at end of file
+/** process a run of sample intensities.
+ * equivalent to calling zbar_scan_y() for each of @p n 8-bit samples,
+ * starting at @p data and @p stride bytes apart (negative strides scan
+ * backwards, eg for serpentine or column scans)
+ * @returns the most significant result of the individual samples,
+ * as for zbar_scanner_new_scan()
+ * @since 0.11
+ */
+extern zbar_symbol_type_t zbar_scan_row(zbar_scanner_t* scanner,
+    const unsigned char* data,
+    int n,
+    int stride);
+
+#endif
\ No newline at end of file
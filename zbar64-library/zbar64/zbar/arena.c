@@ -0,0 +1,161 @@
+/*------------------------------------------------------------------------
+ *  Copyright 2007-2010 (c) Jeff Brown <spadix@users.sourceforge.net>
+ *
+ *  This file is part of the ZBar Bar Code Reader.
+ *
+ *  The ZBar Bar Code Reader is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser Public License as
+ *  published by the Free Software Foundation; either version 2.1 of
+ *  the License, or (at your option) any later version.
+ *
+ *  The ZBar Bar Code Reader is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser Public License
+ *  along with the ZBar Bar Code Reader; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *  Boston, MA  02110-1301  USA
+ *
+ *  http://sourceforge.net/projects/zbar
+ *------------------------------------------------------------------------*/
+
+#include <config.h>
+#include <stdlib.h>     /* malloc, free */
+#include <string.h>     /* memset, memcpy */
+
+#include "arena.h"
+
+/* allocations are aligned for vector loads */
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+void _zbar_arena_init(zbar_arena_t* arena)
+{
+    memset(arena, 0, sizeof(*arena));
+}
+
+static void arena_free_fallbacks(zbar_arena_t* arena,
+    int n)
+{
+    while (arena->nfallbacks > n) {
+        zbar_arena_fallback_t* fb = arena->fallbacks + --arena->nfallbacks;
+        arena->fallback_bytes -= fb->size;
+        free(fb->ptr);
+    }
+}
+
+void _zbar_arena_destroy(zbar_arena_t* arena)
+{
+    arena_free_fallbacks(arena, 0);
+    if (arena->fallbacks)
+        free(arena->fallbacks);
+    if (arena->buf)
+        free(arena->buf);
+    memset(arena, 0, sizeof(*arena));
+}
+
+void _zbar_arena_reset(zbar_arena_t* arena)
+{
+    arena_free_fallbacks(arena, 0);
+    arena->used = 0;
+    if (arena->need < arena->peak)
+        arena->need = arena->peak;
+    arena->peak = 0;
+
+    if (arena->need > arena->size) {
+        /* leave some room for the next image to need a little more */
+        size_t size = ARENA_ROUND(arena->need + (arena->need >> 2));
+        if (arena->buf)
+            free(arena->buf);
+        arena->buf = malloc(size);
+        arena->size = (arena->buf) ? size : 0;
+    }
+}
+
+void* _zbar_arena_alloc(zbar_arena_t* arena,
+    size_t size)
+{
+    zbar_arena_fallback_t* fb;
+    size_t total;
+    void* ptr;
+
+    size = ARENA_ROUND((size) ? size : 1);
+    if (size <= arena->size - arena->used) {
+        ptr = arena->buf + arena->used;
+        arena->used += size;
+    }
+    else {
+        if (arena->nfallbacks >= arena->cfallbacks) {
+            int n = arena->cfallbacks * 2 + 8;
+            fb = realloc(arena->fallbacks, n * sizeof(*fb));
+            if (!fb)
+                return(NULL);
+            arena->fallbacks = fb;
+            arena->cfallbacks = n;
+        }
+        ptr = malloc(size);
+        if (!ptr)
+            return(NULL);
+        fb = arena->fallbacks + arena->nfallbacks++;
+        fb->ptr = ptr;
+        fb->size = size;
+        arena->fallback_bytes += size;
+#ifndef NO_STATS
+        arena->stat_fallbacks++;
+        arena->stat_fallback_bytes += size;
+#endif
+    }
+
+    total = arena->used + arena->fallback_bytes;
+    if (arena->peak < total)
+        arena->peak = total;
+    return(ptr);
+}
+
+void* _zbar_arena_calloc(zbar_arena_t* arena,
+    size_t n,
+    size_t size)
+{
+    void* ptr = _zbar_arena_alloc(arena, n * size);
+    if (ptr)
+        memset(ptr, 0, n * size);
+    return(ptr);
+}
+
+void* _zbar_arena_realloc(zbar_arena_t* arena,
+    void* ptr,
+    size_t old_size,
+    size_t size)
+{
+    unsigned char* p = ptr;
+    void* dst;
+    if (!p)
+        return(_zbar_arena_alloc(arena, size));
+
+    /* last allocation from the block */
+    if (arena->buf && p >= arena->buf && p < arena->buf + arena->used &&
+        p + ARENA_ROUND(old_size) == arena->buf + arena->used &&
+        ARENA_ROUND(size) <= arena->size - (size_t)(p - arena->buf))
+    {
+        arena->used = (p - arena->buf) + ARENA_ROUND(size);
+        if (arena->peak < arena->used + arena->fallback_bytes)
+            arena->peak = arena->used + arena->fallback_bytes;
+        return(p);
+    }
+    if (size <= old_size)
+        return(p);
+
+    dst = _zbar_arena_alloc(arena, size);
+    if (dst)
+        memcpy(dst, p, (old_size < size) ? old_size : size);
+    return(dst);
+}
+
+void _zbar_arena_release(zbar_arena_t* arena,
+    zbar_arena_mark_t mark)
+{
+    arena_free_fallbacks(arena, mark.nfallbacks);
+    arena->used = mark.used;
+}
@@ -0,0 +1,101 @@
+/*------------------------------------------------------------------------
+ *  Copyright 2007-2010 (c) Jeff Brown <spadix@users.sourceforge.net>
+ *
+ *  This file is part of the ZBar Bar Code Reader.
+ *
+ *  The ZBar Bar Code Reader is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser Public License as
+ *  published by the Free Software Foundation; either version 2.1 of
+ *  the License, or (at your option) any later version.
+ *
+ *  The ZBar Bar Code Reader is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser Public License
+ *  along with the ZBar Bar Code Reader; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *  Boston, MA  02110-1301  USA
+ *
+ *  http://sourceforge.net/projects/zbar
+ *------------------------------------------------------------------------*/
+#ifndef _ZBAR_ARENA_H_
+#define _ZBAR_ARENA_H_
+
+#include <stddef.h>
+
+/* bump allocator for per image temporaries
+ *
+ * allocations are carved out of one block and are never freed
+ * individually: _zbar_arena_release() drops everything allocated since
+ * a mark, and _zbar_arena_reset() everything at once before the next
+ * image.  when the block is full, requests fall back to malloc until the
+ * next reset, which grows the block to what the previous images needed.
+ *
+ * an arena is not thread safe; use one per thread
+ */
+
+/* block allocated when the arena was full */
+typedef struct zbar_arena_fallback_s {
+    void* ptr;
+    size_t size;
+} zbar_arena_fallback_t;
+
+typedef struct zbar_arena_s {
+    unsigned char* buf;         /* current block */
+    size_t size;                /* size of block */
+    size_t used;                /* bytes handed out from block */
+    zbar_arena_fallback_t* fallbacks; /* live fallback blocks */
+    int nfallbacks, cfallbacks;
+    size_t fallback_bytes;      /* total size of live fallback blocks */
+    size_t peak;                /* most used since the last reset */
+    size_t need;                /* most used by any image so far */
+#ifndef NO_STATS
+    unsigned long stat_fallbacks;       /* mallocs because block was full */
+    unsigned long long stat_fallback_bytes;
+#endif
+} zbar_arena_t;
+
+/* position to release back to */
+typedef struct zbar_arena_mark_s {
+    size_t used;
+    int nfallbacks;
+} zbar_arena_mark_t;
+
+extern void _zbar_arena_init(zbar_arena_t* arena);
+extern void _zbar_arena_destroy(zbar_arena_t* arena);
+
+/* discard all allocations, resizing the block first if the previous
+ * images needed more than it holds
+ */
+extern void _zbar_arena_reset(zbar_arena_t* arena);
+
+/* returns NULL only if a fallback malloc fails */
+extern void* _zbar_arena_alloc(zbar_arena_t* arena,
+    size_t size);
+extern void* _zbar_arena_calloc(zbar_arena_t* arena,
+    size_t n,
+    size_t size);
+
+/* grow (or shrink) an allocation of old_size bytes.  the most recent
+ * allocation is resized in place when it fits, others are copied
+ */
+extern void* _zbar_arena_realloc(zbar_arena_t* arena,
+    void* ptr,
+    size_t old_size,
+    size_t size);
+
+static __inline zbar_arena_mark_t _zbar_arena_mark(const zbar_arena_t* arena)
+{
+    zbar_arena_mark_t mark;
+    mark.used = arena->used;
+    mark.nfallbacks = arena->nfallbacks;
+    return(mark);
+}
+
+/* free everything allocated since mark was taken */
+extern void _zbar_arena_release(zbar_arena_t* arena,
+    zbar_arena_mark_t mark);
+
+#endif
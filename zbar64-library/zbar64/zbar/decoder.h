@@ -59,11 +59,28 @@
 #endif
 #ifdef ENABLE_QRCODE
 # include "decoder/qr_finder.h"
+#endif
+
+/* with only the QR finder compiled in, the width decoder is specialized
+ * for it at compile time (see zbar_decode_width()).
+ * define ZBAR_GENERIC_DECODER to always use the generic dispatch
+ */
+#if defined(ENABLE_QRCODE) && !defined(ZBAR_GENERIC_DECODER) && \
+    !defined(ENABLE_EAN) && !defined(ENABLE_I25) && \
+    !defined(ENABLE_DATABAR) && !defined(ENABLE_CODABAR) && \
+    !defined(ENABLE_CODE39) && !defined(ENABLE_CODE93) && \
+    !defined(ENABLE_CODE128) && !defined(ENABLE_PDF417)
+# define ZBAR_QR_ONLY 1
 #endif
 
  /* size of bar width history (implementation assumes power of two) */
 #ifndef DECODE_WINDOW
-# define DECODE_WINDOW  16
+# ifdef ZBAR_QR_ONLY
+/* finder pattern check only looks back 6 elements */
+#  define DECODE_WINDOW  8
+# else
+#  define DECODE_WINDOW  16
+# endif
 #endif
 
 /* initial data buffer allocation */
@@ -293,4 +310,74 @@ static __inline char size_buf(zbar_decoder_t* dcode,
 extern const char* _zbar_decoder_buf_dump(unsigned char* buf,
     unsigned int buflen);
 
+#ifdef ENABLE_QRCODE
+/* check the latest 5 elements for a 1:1:3:1:1 QR finder pattern.
+ * shared by _zbar_find_qr() and the specialized QR only width decoder
+ */
+static __inline zbar_symbol_type_t qr_finder_decode(zbar_decoder_t* dcode)
+{
+    qr_finder_t* qrf = &dcode->qrf;
+    unsigned s, qz, w;
+    int ei;
+
+    /* update latest finder pattern width */
+    qrf->s5 -= get_width(dcode, 6);
+    qrf->s5 += get_width(dcode, 1);
+    s = qrf->s5;
+
+    /*TODO: The 2005 standard allows reflectance-reversed codes (light on dark
+       instead of dark on light).
+      If we find finder patterns with the opposite polarity, we should invert
+       the final binarized image and use them to search for QR codes in that.*/
+    if (get_color(dcode) != ZBAR_SPACE || s < 7)
+        return(0);
+
+    dbprintf(2, "    qrf: s=%d", s);
+
+    ei = decode_e(pair_width(dcode, 1), s, 7);
+    dbprintf(2, " %d", ei);
+    if (ei)
+        goto invalid;
+
+    ei = decode_e(pair_width(dcode, 2), s, 7);
+    dbprintf(2, "%d", ei);
+    if (ei != 2)
+        goto invalid;
+
+    ei = decode_e(pair_width(dcode, 3), s, 7);
+    dbprintf(2, "%d", ei);
+    if (ei != 2)
+        goto invalid;
+
+    ei = decode_e(pair_width(dcode, 4), s, 7);
+    dbprintf(2, "%d", ei);
+    if (ei)
+        goto invalid;
+ 
+    /* valid QR finder symbol
+     * mark positions needed by decoder
+     */
+    qz = get_width(dcode, 0);
+    w = get_width(dcode, 1);
+    qrf->line.eoffs = qz + (w + 1) / 2;
+    qrf->line.len = qz + w + get_width(dcode, 2);
+    qrf->line.pos[0] = qrf->line.len + get_width(dcode, 3);
+    qrf->line.pos[1] = qrf->line.pos[0];
+    w = get_width(dcode, 5);
+    qrf->line.boffs = qrf->line.pos[0] + get_width(dcode, 4) + (w + 1) / 2;
+
+    dbprintf(2, " boff=%d pos=%d len=%d eoff=%d [valid]\n",
+        qrf->line.boffs, qrf->line.pos[0], qrf->line.len,
+        qrf->line.eoffs);
+
+    dcode->direction = 0;
+    dcode->buflen = 0;
+    return(ZBAR_QRCODE);
+
+invalid:
+    dbprintf(2, " [invalid]\n");
+    return(0);
+}
+#endif
+
 #endif
@@ -12,16 +12,18 @@
 #include "qrdec.h"
 #include "bch15_5.h"
 #include "rs.h"
-#include "isaac.h"
 #include "util.h"
 #include "binarize.h"
 #include "image.h"
 #include "error.h"
 #include "svg.h"
+#include "arena.h"
+#include "simd.h"
 
 typedef int qr_line[3];
 
 typedef struct qr_finder_cluster qr_finder_cluster;
+typedef struct qr_finder_cluster_key qr_finder_cluster_key;
 typedef struct qr_finder_edge_pt  qr_finder_edge_pt;
 typedef struct qr_finder_center   qr_finder_center;
 
@@ -30,9 +32,16 @@ typedef struct qr_hom qr_hom;
 
 typedef struct qr_finder qr_finder;
 
+typedef struct qr_center_triple qr_center_triple;
+typedef struct qr_center_grid   qr_center_grid;
+typedef struct qr_match_batch   qr_match_batch;
+typedef struct qr_try_stats     qr_try_stats;
+
 typedef struct qr_hom_cell      qr_hom_cell;
 typedef struct qr_sampling_grid qr_sampling_grid;
+typedef struct qr_decode_plan   qr_decode_plan;
 typedef struct qr_pack_buf      qr_pack_buf;
+typedef struct qr_bin_image     qr_bin_image;
 
 /*The number of bits in an int.
   Note the cast to (int): this prevents this value from "promoting" whole
@@ -54,31 +63,409 @@ typedef struct qr_pack_buf      qr_pack_buf;
 #define QR_ALIGN_SUBPREC (2)
 
 
-         /* collection of finder lines */
-typedef struct qr_finder_lines {
-    qr_finder_line* lines;
-    int nlines, clines;
-} qr_finder_lines;
+/* binary image of the current frame, binarized a tile at a time the
+ * first time the decoder reads a pixel of the tile, and only inside the
+ * rectangles allowed so far (the padded crops of the regions of interest
+ * scanned, or the bands of rows streamed).  everything else reads light.
+ * pixels are packed 1 bit each, so a whole frame stays cache sized
+ */
+/* tile states: not binarized, binarized within all the rects, or
+ * binarized before a rect was added over it (so not up to date, but
+ * with bits to clear)
+ */
+#define QR_TILE_CLEAN 0
+#define QR_TILE_DONE  1
+#define QR_TILE_STALE 2
+
+struct qr_bin_image {
+    unsigned char* bits;        /* bit x & 7 of byte x >> 3 of each row */
+    int stride;                 /* bytes per row */
+    const unsigned char* gray;  /* grayscale source of the current image */
+    int width, height;
+    /* tiles are the size of the threshold window (log2), so binarizing
+     * one costs a small multiple of its own pixels
+     */
+    int logtw, logth;
+    int ntx, nty;
+    unsigned char* filled;      /* QR_TILE_* state of each tile */
+    int (*rects)[4];            /* areas that may be binarized (x0, y0, x1, y1) */
+    int nrects, crects;
+    zbar_arena_t* arena;        /* for the binarizer's temporaries */
+    zbar_pool_t* pool;          /* threads for large fills, or NULL */
+    int method;                 /* QR_BINARIZE_* */
+    int threshold;              /* QR_BINARIZE_GLOBAL threshold, -1 if unset */
+    unsigned long npixels;      /* pixels binarized for the current image */
+};
+
+/*What decoding a code needs to know about its version and ECC level, besides
+   where it is: the function pattern, the 8 data masks, and where each bit of
+   each codeword lies among the modules, for each ECC level.
+  The masks depend only on the version, so the plan of a version is built the
+   first time a code of that version is decoded and its placements the first
+   time a code of that level is, and they are then kept for all later codes.*/
+struct qr_decode_plan {
+    /*The function pattern mask, and the data masks after it in the same block.*/
+    unsigned* fpmask;
+    unsigned* masks[8];
+    /*The placement (see qr_samples_place()) of each ECC level.*/
+    unsigned short* placement[4];
+};
 
+/* most configurations of finder centers tried at once on the reader's
+ * threads
+ */
+#define QR_MATCH_BATCH_MAX 16
 
 struct qr_reader {
     /*The GF(256) representation used in Reed-Solomon decoding.*/
     rs_gf256  gf;
-    /*The random number generator used by RANSAC.*/
-    isaac_ctx isaac;
-    /* current finder state, horizontal and vertical lines */
-    qr_finder_lines finder_lines[2];
+    /* current finder state, horizontal, vertical and diagonal lines */
+    qr_finder_lines finder_lines[QR_FINDER_NDIRS];
+    /* binary image shared by the regions of interest of one image */
+    qr_bin_image bin;
+    /* stop matching finder centers after this many codes (0: no limit) */
+    int max_codes;
+    /* centers and edge points seen by the last incremental decode, and
+     * the bounding boxes of the codes decoded incrementally so far
+     */
+    int stream_centers, stream_pts;
+    qr_point (*stream_bbox)[4];
+    int nstream_bbox, cstream_bbox;
+    /* per image temporaries, reset by _zbar_qr_reset() */
+    zbar_arena_t arena;
+    /* the same for the configurations tried alongside one using arena */
+    zbar_arena_t match_arena[QR_MATCH_BATCH_MAX - 1];
+    /* module masks and codeword placements of each version, built the
+     * first time a code of that version is decoded
+     */
+    qr_decode_plan* plans;
+    /* configured zbar_binarizer_t */
+    int binarizer;
+#ifndef NO_STATS
+    unsigned long stat_bin_images;
+    unsigned long long stat_bin_pixels, stat_bin_total;
+    /* decode attempts with each binarization method, those that decoded
+     * a code, and the processor time they took
+     */
+    unsigned long stat_method_runs[QR_BINARIZE_NMETHODS];
+    unsigned long stat_method_hits[QR_BINARIZE_NMETHODS];
+    clock_t stat_method_clock[QR_BINARIZE_NMETHODS];
+    /* searches for codes among finder centers, configurations tried */
+    unsigned long stat_match_calls, stat_match_tries;
+    /* configurations checked for timing patterns, those rejected, and
+     * the processor time taken by the checks and by the configurations
+     * that passed and went on to fit a homography (with threads, clock()
+     * also counts the others, which inflates both alike)
+     */
+    unsigned long stat_timing_checks, stat_timing_rejects, stat_fits;
+    clock_t stat_timing_clock, stat_fit_clock;
+    /* RANSAC runs over finder edges and the iterations they took */
+    unsigned long stat_ransac_runs, stat_ransac_iters;
+#endif
 };
 
+/* fills of at least this many missing pixels (and two rows of tiles)
+ * are split into up to QR_BIN_MT_BANDS bands between the reader's threads
+ */
+#define QR_BIN_MT_PIXELS (1 << 16)
+#define QR_BIN_MT_BANDS 64
+
+/* binarize the tiles [tx0, tx1) x [ty0, ty1) that are not yet, within
+ * each of the allowed rectangles.  horizontal runs of missing tiles are
+ * binarized together, which shares their column sums.
+ * temporaries come from arena (malloc if NULL).
+ * returns the number of pixels binarized
+ */
+static unsigned long qr_bin_image_fill_rows(qr_bin_image* bin,
+    int tx0,
+    int ty0,
+    int tx1,
+    int ty1,
+    zbar_arena_t* arena)
+{
+    unsigned long npixels = 0;
+    int tx, ty, i;
+    for (ty = ty0; ty < ty1; ty++) {
+        unsigned char* filled = bin->filled + ty * bin->ntx;
+        int y0 = ty << bin->logth;
+        int y1 = QR_MINI((ty + 1) << bin->logth, bin->height);
+        for (tx = tx0; tx < tx1; tx++) {
+            int run, x0, x1;
+            if (filled[tx] == QR_TILE_DONE)
+                continue;
+            for (run = tx + 1; run < tx1 && filled[run] != QR_TILE_DONE; run++);
+            x0 = tx << bin->logtw;
+            x1 = QR_MINI(run << bin->logtw, bin->width);
+            for (i = 0; i < bin->nrects; i++) {
+                const int* r = bin->rects[i];
+                int rx0 = QR_MAXI(x0, r[0]), ry0 = QR_MAXI(y0, r[1]);
+                int rx1 = QR_MINI(x1, r[2]), ry1 = QR_MINI(y1, r[3]);
+                if (rx0 >= rx1 || ry0 >= ry1)
+                    continue;
+                if (bin->method == QR_BINARIZE_GLOBAL)
+                    qr_threshold_rect_packed(bin->bits, bin->stride, bin->gray,
+                        bin->width, bin->height, rx0, ry0, rx1, ry1,
+                        bin->threshold, arena);
+                else if (bin->method == QR_BINARIZE_SAUVOLA)
+                    qr_sauvola_rect_packed(bin->bits, bin->stride, bin->gray,
+                        bin->width, bin->height, rx0, ry0, rx1, ry1, arena);
+                else
+                    qr_binarize_rect_packed(bin->bits, bin->stride, bin->gray,
+                        bin->width, bin->height, rx0, ry0, rx1, ry1, arena);
+                npixels += (rx1 - rx0) * (ry1 - ry0);
+            }
+            memset(filled + tx, QR_TILE_DONE, run - tx);
+            tx = run;
+        }
+    }
+    return(npixels);
+}
+
+/* a fill split into bands of whole tile rows */
+typedef struct qr_bin_fill_job {
+    qr_bin_image* bin;
+    int tx0, ty0, tx1, ty1;
+    int nbands;
+    unsigned long npixels[QR_BIN_MT_BANDS]; /* per band */
+} qr_bin_fill_job;
+
+static void qr_bin_fill_band(void* arg,
+    int idx)
+{
+    qr_bin_fill_job* job = arg;
+    int nty = job->ty1 - job->ty0;
+    /* bands write disjoint rows of bits and tile states.  each one
+     * starts its own column sums from the windh / 2 rows above it (the
+     * binarizer clamps the window to the image), so the halo rows make
+     * it match a serial pass exactly
+     */
+    job->npixels[idx] = qr_bin_image_fill_rows(job->bin,
+        job->tx0, job->ty0 + nty * idx / job->nbands,
+        job->tx1, job->ty0 + nty * (idx + 1) / job->nbands, NULL);
+}
+
+static void qr_bin_image_fill(qr_bin_image* bin,
+    int tx0,
+    int ty0,
+    int tx1,
+    int ty1)
+{
+    qr_bin_fill_job job;
+    long missing = 0;
+    int tx, ty, i;
+
+    /* nothing is written once the tiles are done, so threads may read
+     * (and prefetch) a fully binarized image at the same time
+     */
+    for (ty = ty0; ty < ty1; ty++)
+        for (tx = tx0; tx < tx1; tx++)
+            missing += bin->filled[ty * bin->ntx + tx] != QR_TILE_DONE;
+    if (!missing)
+        return;
+
+    /* shared by all the tiles (and threads) */
+    if (bin->method == QR_BINARIZE_GLOBAL && bin->threshold < 0)
+        bin->threshold = qr_otsu_threshold(bin->gray, bin->width, bin->height);
+
+    job.nbands = QR_MINI(ty1 - ty0, 2 * _zbar_pool_size(bin->pool));
+    job.nbands = QR_MINI(job.nbands, QR_BIN_MT_BANDS);
+    if (job.nbands < 2 ||
+        (missing << (bin->logtw + bin->logth)) < QR_BIN_MT_PIXELS) {
+        bin->npixels += qr_bin_image_fill_rows(bin, tx0, ty0, tx1, ty1,
+            bin->arena);
+        return;
+    }
+    job.bin = bin;
+    job.tx0 = tx0;
+    job.ty0 = ty0;
+    job.tx1 = tx1;
+    job.ty1 = ty1;
+    _zbar_pool_run(bin->pool, qr_bin_fill_band, &job, job.nbands);
+    for (i = 0; i < job.nbands; i++)
+        bin->npixels += job.npixels[i];
+}
+
+/* binarize (what is allowed of) the pixels [x0, x1) x [y0, y1) */
+static void qr_bin_image_prefetch(qr_bin_image* bin,
+    int x0,
+    int y0,
+    int x1,
+    int y1)
+{
+    x0 = QR_MAXI(x0, 0);
+    y0 = QR_MAXI(y0, 0);
+    x1 = QR_MINI(x1, bin->width);
+    y1 = QR_MINI(y1, bin->height);
+    if (x0 < x1 && y0 < y1)
+        qr_bin_image_fill(bin, x0 >> bin->logtw, y0 >> bin->logth,
+            (x1 - 1 >> bin->logtw) + 1, (y1 - 1 >> bin->logth) + 1);
+}
+
+/* read a pixel of a tile already binarized straight from the bit plane */
+static __inline int qr_bin_image_bit(const qr_bin_image* bin,
+    int x,
+    int y)
+{
+    return((bin->bits[y * bin->stride + (x >> 3)] >> (x & 7)) & 1);
+}
+
+/* read a pixel (inside the image) of the binary image: 1 if dark */
+static __inline int qr_bin_image_get(qr_bin_image* bin,
+    int x,
+    int y)
+{
+    int tx = x >> bin->logtw, ty = y >> bin->logth;
+    if (bin->filled[ty * bin->ntx + tx] != QR_TILE_DONE)
+        qr_bin_image_fill(bin, tx, ty, tx + 1, ty + 1);
+    return(qr_bin_image_bit(bin, x, y));
+}
+
+/* allow the rectangle [x0, x1) x [y0, y1) of a w x h image to be
+ * binarized.  a rectangle directly below the last one (same columns)
+ * extends it, so bands of rows added one after the other make up the
+ * whole crop.  returns -1 if out of memory
+ */
+static int qr_bin_image_add_rect(qr_bin_image* bin,
+    const unsigned char* gray,
+    int w,
+    int h,
+    int x0,
+    int y0,
+    int x1,
+    int y1)
+{
+    int* last;
+    int i, tx, ty;
+
+    if (!bin->bits || bin->width != w || bin->height != h) {
+        if (bin->bits)
+            free(bin->bits);
+        if (bin->filled)
+            free(bin->filled);
+        qr_binarize_window(w, h, &bin->logtw, &bin->logth);
+        bin->ntx = (w + (1 << bin->logtw) - 1) >> bin->logtw;
+        bin->nty = (h + (1 << bin->logth) - 1) >> bin->logth;
+        /* whole 32-bit words per row */
+        bin->stride = ((w + 31) >> 5) << 2;
+        bin->bits = calloc(bin->stride * h, 1);
+        bin->filled = calloc(bin->ntx * bin->nty, 1);
+        bin->nrects = 0;
+        if (!bin->bits || !bin->filled) {
+            free(bin->bits);
+            free(bin->filled);
+            bin->bits = bin->filled = NULL;
+            return(-1);
+        }
+        bin->width = w;
+        bin->height = h;
+    }
+    bin->gray = gray;
+
+    for (i = 0; i < bin->nrects; i++) {
+        const int* r = bin->rects[i];
+        if (r[0] <= x0 && r[1] <= y0 && x1 <= r[2] && y1 <= r[3])
+            return(0);
+    }
+
+    last = (bin->nrects) ? bin->rects[bin->nrects - 1] : NULL;
+    if (last && last[0] == x0 && last[2] == x1 && last[3] == y0)
+        last[3] = y1;
+    else {
+        if (bin->nrects >= bin->crects) {
+            int n = bin->crects * 2 + 4;
+            void* rects = realloc(bin->rects, n * sizeof(*bin->rects));
+            if (!rects)
+                return(-1);
+            bin->rects = rects;
+            bin->crects = n;
+        }
+        last = bin->rects[bin->nrects++];
+        last[0] = x0;
+        last[1] = y0;
+        last[2] = x1;
+        last[3] = y1;
+    }
+
+    /* tiles binarized before now have more to binarize */
+    if (x0 < x1 && y0 < y1)
+        for (ty = y0 >> bin->logth; ty <= (y1 - 1) >> bin->logth; ty++)
+            for (tx = x0 >> bin->logtw; tx <= (x1 - 1) >> bin->logtw; tx++) {
+                unsigned char* t = bin->filled + ty * bin->ntx + tx;
+                if (*t == QR_TILE_DONE)
+                    *t = QR_TILE_STALE;
+            }
+    return(0);
+}
+
+/* clear everything binarized so far */
+static void qr_bin_image_clear(qr_bin_image* bin)
+{
+    int tx, ty, y;
+    for (ty = 0; ty < bin->nty; ty++)
+        for (tx = 0; tx < bin->ntx; tx++) {
+            int x0 = tx << bin->logtw, y0 = ty << bin->logth;
+            int x1 = QR_MINI(x0 + (1 << bin->logtw), bin->width);
+            int y1 = QR_MINI(y0 + (1 << bin->logth), bin->height);
+            if (bin->filled[ty * bin->ntx + tx] == QR_TILE_CLEAN)
+                continue;
+            bin->filled[ty * bin->ntx + tx] = QR_TILE_CLEAN;
+            /* tiles are at least 16 pixels wide, so start on a byte */
+            for (y = y0; y < y1; y++)
+                memset(bin->bits + y * bin->stride + (x0 >> 3), 0,
+                    ((x1 + 7) >> 3) - (x0 >> 3));
+        }
+}
+
+/* clear what the last image binarized, so areas outside the rectangles
+ * allowed for the next one read as light
+ */
+static void qr_bin_image_reset(qr_bin_image* bin)
+{
+    qr_bin_image_clear(bin);
+    bin->nrects = 0;
+    bin->gray = NULL;
+    bin->threshold = -1;
+    bin->npixels = 0;
+}
+
+/* switch to another binarization method, dropping the pixels binarized
+ * with the previous one
+ */
+static void qr_bin_image_set_method(qr_bin_image* bin,
+    int method)
+{
+    if (bin->method != method) {
+        qr_bin_image_clear(bin);
+        bin->method = method;
+    }
+}
+
+/* with threads to spare, binarizing all the allowed rectangles up front
+ * in parallel bands takes less time than the fraction the decoder would
+ * read binarized one tile at a time
+ */
+static void qr_bin_image_prefetch_rects(qr_bin_image* bin)
+{
+    int i;
+    if (bin->pool)
+        for (i = 0; i < bin->nrects; i++)
+            qr_bin_image_prefetch(bin, bin->rects[i][0], bin->rects[i][1],
+                bin->rects[i][2], bin->rects[i][3]);
+}
+
 
 /*Initializes a client reader handle.*/
 static void qr_reader_init(qr_reader* reader)
 {
-    /*time_t now;
-      now=time(NULL);
-      isaac_init(&_reader->isaac,&now,sizeof(now));*/
-    isaac_init(&reader->isaac, NULL, 0);
+    int i;
     rs_gf256_init(&reader->gf, QR_PPOLY);
+    _zbar_arena_init(&reader->arena);
+    for (i = 0; i < QR_MATCH_BATCH_MAX - 1; i++)
+        _zbar_arena_init(&reader->match_arena[i]);
+    reader->plans = calloc(40, sizeof(*reader->plans));
+    reader->bin.arena = &reader->arena;
+    reader->bin.method = QR_BINARIZE_MEAN;
+    reader->bin.threshold = -1;
 }
 
 /*Allocates a client reader handle.*/
@@ -92,21 +479,126 @@ qr_reader* _zbar_qr_create(void)
 /*Frees a client reader handle.*/
 void _zbar_qr_destroy(qr_reader* reader)
 {
-    zprintf(1, "max finder lines = %dx%d\n",
+    int i;
+    zprintf(1, "max finder lines = %dx%d (diagonal %dx%d)\n",
         reader->finder_lines[0].clines,
-        reader->finder_lines[1].clines);
-    if (reader->finder_lines[0].lines)
-        free(reader->finder_lines[0].lines);
-    if (reader->finder_lines[1].lines)
-        free(reader->finder_lines[1].lines);
+        reader->finder_lines[1].clines,
+        reader->finder_lines[2].clines,
+        reader->finder_lines[3].clines);
+#ifndef NO_STATS
+    zprintf(1, "temporaries: high water = %lu bytes, fallback mallocs = %lu (%llu bytes)\n",
+        (unsigned long)((reader->arena.need > reader->arena.peak)
+            ? reader->arena.need : reader->arena.peak),
+        reader->arena.stat_fallbacks, reader->arena.stat_fallback_bytes);
+    if (reader->stat_bin_images)
+        zprintf(1, "binarized pixels = %llu per image (%.1f%%)\n",
+            reader->stat_bin_pixels / reader->stat_bin_images,
+            100. * reader->stat_bin_pixels / reader->stat_bin_total);
+    for (i = 0; i < QR_BINARIZE_NMETHODS; i++) {
+        static const char* const names[QR_BINARIZE_NMETHODS] = {
+            "global", "mean", "sauvola"
+        };
+        if (reader->stat_method_runs[i])
+            zprintf(1, "%s binarizer: %lu decodes, %lu found codes, %.3fms each\n",
+                names[i], reader->stat_method_runs[i],
+                reader->stat_method_hits[i],
+                1000. * reader->stat_method_clock[i] /
+                    CLOCKS_PER_SEC / reader->stat_method_runs[i]);
+    }
+    if (reader->stat_match_calls)
+        zprintf(1, "center matching: %lu searches, %.1f configurations each\n",
+            reader->stat_match_calls,
+            (double)reader->stat_match_tries / reader->stat_match_calls);
+    if (reader->stat_timing_checks) {
+        /* each rejection saves what an average configuration that passed
+         * went on to cost
+         */
+        double fit = (reader->stat_fits)
+            ? (double)reader->stat_fit_clock / reader->stat_fits : 0;
+        zprintf(1, "timing check: %lu configurations, %.1f%% rejected, %.3fms taken, ~%.3fms saved\n",
+            reader->stat_timing_checks,
+            100. * reader->stat_timing_rejects / reader->stat_timing_checks,
+            1000. * reader->stat_timing_clock / CLOCKS_PER_SEC,
+            1000. * (reader->stat_timing_rejects * fit -
+                reader->stat_timing_clock) / CLOCKS_PER_SEC);
+    }
+    if (reader->stat_ransac_runs)
+        zprintf(1, "ransac: %lu edges, %.2f iterations each\n",
+            reader->stat_ransac_runs,
+            (double)reader->stat_ransac_iters / reader->stat_ransac_runs);
+#endif
+    _zbar_arena_destroy(&reader->arena);
+    for (i = 0; i < QR_MATCH_BATCH_MAX - 1; i++)
+        _zbar_arena_destroy(&reader->match_arena[i]);
+    if (reader->plans) {
+        for (i = 0; i < 40; i++) {
+            int j;
+            if (reader->plans[i].fpmask)
+                free(reader->plans[i].fpmask);
+            for (j = 0; j < 4; j++)
+                if (reader->plans[i].placement[j])
+                    free(reader->plans[i].placement[j]);
+        }
+        free(reader->plans);
+    }
+    for (i = 0; i < QR_FINDER_NDIRS; i++)
+        if (reader->finder_lines[i].lines)
+            free(reader->finder_lines[i].lines);
+    if (reader->bin.bits)
+        free(reader->bin.bits);
+    if (reader->bin.filled)
+        free(reader->bin.filled);
+    if (reader->bin.rects)
+        free(reader->bin.rects);
+    if (reader->stream_bbox)
+        free(reader->stream_bbox);
     free(reader);
 }
 
+static void qr_reader_clear_lines(qr_reader* reader)
+{
+    int i;
+    for (i = 0; i < QR_FINDER_NDIRS; i++)
+        reader->finder_lines[i].nlines = 0;
+}
+
+void _zbar_qr_set_pool(qr_reader* reader,
+    zbar_pool_t* pool)
+{
+    reader->bin.pool = pool;
+}
+
+/* the cascade starts each image with the cheapest method */
+void _zbar_qr_set_binarizer(qr_reader* reader,
+    int binarizer)
+{
+    static const int methods[ZBAR_BINARIZER_NUM] = {
+        QR_BINARIZE_MEAN, QR_BINARIZE_GLOBAL, QR_BINARIZE_SAUVOLA,
+        QR_BINARIZE_GLOBAL
+    };
+    reader->binarizer = binarizer;
+    qr_bin_image_set_method(&reader->bin, methods[binarizer]);
+}
+
 /* reset finder state between scans */
 void _zbar_qr_reset(qr_reader* reader)
 {
-    reader->finder_lines[0].nlines = 0;
-    reader->finder_lines[1].nlines = 0;
+    int i;
+    qr_reader_clear_lines(reader);
+
+#ifndef NO_STATS
+    if (reader->bin.gray) {
+        reader->stat_bin_images++;
+        reader->stat_bin_pixels += reader->bin.npixels;
+        reader->stat_bin_total += reader->bin.width * reader->bin.height;
+    }
+#endif
+    qr_bin_image_reset(&reader->bin);
+    reader->stream_centers = reader->stream_pts = 0;
+    reader->nstream_bbox = 0;
+    _zbar_arena_reset(&reader->arena);
+    for (i = 0; i < QR_MATCH_BATCH_MAX - 1; i++)
+        _zbar_arena_reset(&reader->match_arena[i]);
 }
 
 
@@ -151,67 +643,171 @@ struct qr_finder_center {
 };
 
 
-static int qr_finder_vline_cmp(const void* _a, const void* _b) {
+static int qr_finder_line_ptr_cmp(const void* _a, const void* _b) {
     const qr_finder_line* a;
     const qr_finder_line* b;
-    a = (const qr_finder_line*)_a;
-    b = (const qr_finder_line*)_b;
-    return ((a->pos[0] > b->pos[0]) - (a->pos[0] < b->pos[0]) << 1) +
-        (a->pos[1] > b->pos[1]) - (a->pos[1] < b->pos[1]);
+    a = *(qr_finder_line* const*)_a;
+    b = *(qr_finder_line* const*)_b;
+    /*Lines in the same row share one coordinate, so this orders them by the
+       other, with ties left in scan order.*/
+    if (a->pos[0] != b->pos[0])return (a->pos[0] > b->pos[0]) - (a->pos[0] < b->pos[0]);
+    if (a->pos[1] != b->pos[1])return (a->pos[1] > b->pos[1]) - (a->pos[1] < b->pos[1]);
+    return (a > b) - (a < b);
+}
+
+/*Builds an index of a list of lines bucketed by row: the position across the
+   lines (Y for horizontal lines, X for vertical ones), with the lines in each
+   row sorted by position along them.
+  Lines are bucketed with a counting sort in scan order, so only the (short)
+   rows need sorting.
+  _order:   Returns the lines in row order.
+  _rows:    Returns the index in _order of the start of each row that has lines,
+             followed by _nlines.
+  _lines:   The lines to index, in any order.
+  _nlines:  The number of lines.
+  _v:       0 for horizontal lines, or 1 for vertical lines.
+  _arena:   The arena to allocate the index from.
+  Return: The number of rows, or -1 if out of memory.*/
+static int qr_finder_lines_index(qr_finder_line*** _order, int** _rows,
+    qr_finder_line* _lines, int _nlines, int _v, zbar_arena_t* _arena) {
+    zbar_arena_mark_t arena_mark;
+    qr_finder_line** order;
+    int* count;
+    int* rows;
+    int              pmin;
+    int              pmax;
+    int              nrows;
+    int              i;
+    int              r;
+    pmin = pmax = _lines[0].pos[1 - _v];
+    for (i = 1; i < _nlines; i++) {
+        int p;
+        p = _lines[i].pos[1 - _v];
+        if (p < pmin)pmin = p;
+        else if (p > pmax)pmax = p;
+    }
+    order = (qr_finder_line**)_zbar_arena_alloc(_arena, _nlines * sizeof(*order));
+    rows = (int*)_zbar_arena_alloc(_arena, (_nlines + 1) * sizeof(*rows));
+    if (order == NULL || rows == NULL)return -1;
+    arena_mark = _zbar_arena_mark(_arena);
+    count = (int*)_zbar_arena_calloc(_arena, pmax - pmin + 2, sizeof(*count));
+    if (count == NULL)return -1;
+    for (i = 0; i < _nlines; i++)count[_lines[i].pos[1 - _v] - pmin + 1]++;
+    nrows = 0;
+    for (r = 0; r <= pmax - pmin; r++) {
+        if (count[r + 1] > 0)rows[nrows++] = count[r];
+        count[r + 1] += count[r];
+    }
+    rows[nrows] = _nlines;
+    for (i = 0; i < _nlines; i++)order[count[_lines[i].pos[1 - _v] - pmin]++] = _lines + i;
+    _zbar_arena_release(_arena, arena_mark);
+    for (r = 0; r < nrows; r++)if (rows[r + 1] - rows[r] > 1) {
+        qsort(order + rows[r], rows[r + 1] - rows[r], sizeof(*order),
+            qr_finder_line_ptr_cmp);
+    }
+    *_order = order;
+    *_rows = rows;
+    return nrows;
 }
 
 /*Clusters adjacent lines into groups that are large enough to be crossing a
    finder pattern (relative to their length).
+  The lines are visited in order by row, and then by position within the row,
+   and each cluster grows from the first line not yet in one.
+  A row index limits the search for the next line in a cluster to the rows
+   within the clustering threshold, and to the part of each row within the
+   threshold of the last line added, so that dense textures that produce
+   thousands of lines do not make this quadratic.
   _clusters:  The buffer in which to store the clusters found.
   _neighbors: The buffer used to store the lists of lines in each cluster.
-  _lines:     The list of lines to cluster.
-              Horizontal lines must be sorted in ascending order by Y
-               coordinate, with ties broken by X coordinate.
-              Vertical lines must be sorted in ascending order by X coordinate,
-               with ties broken by Y coordinate.
+  _lines:     The list of lines to cluster, in any order.
   _nlines:    The number of lines in the set of lines to cluster.
   _v:         0 for horizontal lines, or 1 for vertical lines.
+  _arena:     The arena to allocate temporaries from.
   Return: The number of clusters.*/
 static int qr_finder_cluster_lines(qr_finder_cluster* _clusters,
-    qr_finder_line** _neighbors, qr_finder_line* _lines, int _nlines, int _v) {
+    qr_finder_line** _neighbors, qr_finder_line* _lines, int _nlines, int _v,
+    zbar_arena_t* _arena) {
+    zbar_arena_mark_t arena_mark;
     unsigned char* mark;
+    qr_finder_line** order;
+    int* rows;
+    int* members;
     qr_finder_line** neighbors;
     int              nneighbors;
     int              nclusters;
+    int              nrows;
+    int              row;
     int              i;
     /*TODO: Kalman filters!*/
-    mark = (unsigned char*)calloc(_nlines, sizeof(*mark));
+    if (_nlines < 2)return 0;
+    arena_mark = _zbar_arena_mark(_arena);
+    nrows = qr_finder_lines_index(&order, &rows, _lines, _nlines, _v, _arena);
+    mark = (unsigned char*)_zbar_arena_calloc(_arena, _nlines, sizeof(*mark));
+    members = (int*)_zbar_arena_alloc(_arena, _nlines * sizeof(*members));
+    if (nrows < 0 || mark == NULL || members == NULL) {
+        _zbar_arena_release(_arena, arena_mark);
+        return 0;
+    }
     neighbors = _neighbors;
     nclusters = 0;
-    for (i = 0; i < _nlines - 1; i++)if (!mark[i]) {
-        int len;
-        int j;
+    row = 0;
+    for (i = 0; i < _nlines - 1; i++) {
+        const qr_finder_line* a;
+        int                   len;
+        int                   r;
+        int                   j;
+        while (rows[row + 1] <= i)row++;
+        if (mark[i])continue;
+        a = order[i];
         nneighbors = 1;
-        neighbors[0] = _lines + i;
-        len = _lines[i].len;
-        for (j = i + 1; j < _nlines; j++)if (!mark[j]) {
-            const qr_finder_line* a;
-            const qr_finder_line* b;
-            int                   thresh;
-            a = neighbors[nneighbors - 1];
-            b = _lines + j;
+        neighbors[0] = order[i];
+        members[0] = i;
+        len = a->len;
+        j = i + 1;
+        for (r = row; r < nrows; r++) {
+            int thresh;
+            int end;
             /*The clustering threshold is proportional to the size of the lines,
                since minor noise in large areas can interrupt patterns more easily
                at high resolutions.*/
-            thresh = a->len + 7 >> 2;
-            if (abs(a->pos[1 - _v] - b->pos[1 - _v]) > thresh)break;
-            if (abs(a->pos[_v] - b->pos[_v]) > thresh)continue;
-            if (abs(a->pos[_v] + a->len - b->pos[_v] - b->len) > thresh)continue;
-            if (a->boffs > 0 && b->boffs > 0 &&
-                abs(a->pos[_v] - a->boffs - b->pos[_v] + b->boffs) > thresh) {
-                continue;
+            thresh = (a->len + 7) >> 2;
+            if (r > row) {
+                int lo;
+                int hi;
+                if (order[rows[r]]->pos[1 - _v] - a->pos[1 - _v] > thresh)break;
+                /*Skip to the first line in the row that is close enough.*/
+                lo = rows[r];
+                hi = rows[r + 1];
+                while (lo < hi) {
+                    int mid;
+                    mid = lo + ((hi - lo) >> 1);
+                    if (order[mid]->pos[_v] < a->pos[_v] - thresh)lo = mid + 1;
+                    else hi = mid;
+                }
+                j = lo;
             }
-            if (a->eoffs > 0 && b->eoffs > 0 &&
-                abs(a->pos[_v] + a->len + a->eoffs - b->pos[_v] - b->len - b->eoffs) > thresh) {
-                continue;
+            for (end = rows[r + 1]; j < end; j++)if (!mark[j]) {
+                const qr_finder_line* b;
+                b = order[j];
+                thresh = a->len + 7 >> 2;
+                /*The rest of the row is even further along.*/
+                if (b->pos[_v] - a->pos[_v] > thresh)break;
+                if (abs(a->pos[_v] - b->pos[_v]) > thresh)continue;
+                if (abs(a->pos[_v] + a->len - b->pos[_v] - b->len) > thresh)continue;
+                if (a->boffs > 0 && b->boffs > 0 &&
+                    abs(a->pos[_v] - a->boffs - b->pos[_v] + b->boffs) > thresh) {
+                    continue;
+                }
+                if (a->eoffs > 0 && b->eoffs > 0 &&
+                    abs(a->pos[_v] + a->len + a->eoffs - b->pos[_v] - b->len - b->eoffs) > thresh) {
+                    continue;
+                }
+                neighbors[nneighbors] = order[j];
+                members[nneighbors++] = j;
+                len += b->len;
+                a = b;
             }
-            neighbors[nneighbors++] = _lines + j;
-            len += b->len;
         }
         /*We require at least three lines to form a cluster, which eliminates a
            large number of false positives, saving considerable decoding time.
@@ -225,12 +821,12 @@ static int qr_finder_cluster_lines(qr_finder_cluster* _clusters,
         if (nneighbors * (5 << QR_FINDER_SUBPREC) >= len) {
             _clusters[nclusters].lines = neighbors;
             _clusters[nclusters].nlines = nneighbors;
-            for (j = 0; j < nneighbors; j++)mark[neighbors[j] - _lines] = 1;
+            for (j = 0; j < nneighbors; j++)mark[members[j]] = 1;
             neighbors += nneighbors;
             nclusters++;
         }
     }
-    free(mark);
+    _zbar_arena_release(_arena, arena_mark);
     return nclusters;
 }
 
@@ -293,8 +889,100 @@ static int qr_finder_lines_are_crossing(const qr_finder_line* _hline,
         _vline->pos[1] <= _hline->pos[1] && _hline->pos[1] < _vline->pos[1] + _vline->len;
 }
 
+/*A cluster in an index of clusters sorted by the position of their middle
+   lines.*/
+struct qr_finder_cluster_key {
+    /*The X coordinate of the middle line of a vertical cluster, or the Y
+       coordinate of the middle line of a horizontal one.*/
+    int pos;
+    /*The index of the cluster.*/
+    int idx;
+};
+
+static int qr_finder_cluster_key_cmp(const void* _a, const void* _b) {
+    const qr_finder_cluster_key* a;
+    const qr_finder_cluster_key* b;
+    a = (const qr_finder_cluster_key*)_a;
+    b = (const qr_finder_cluster_key*)_b;
+    return (((a->pos > b->pos) - (a->pos < b->pos)) << 1) +
+        (a->idx > b->idx) - (a->idx < b->idx);
+}
+
+static int qr_int_cmp(const void* _a, const void* _b) {
+    int a;
+    int b;
+    a = *(const int*)_a;
+    b = *(const int*)_b;
+    return (a > b) - (a < b);
+}
+
+/*Builds an index of clusters sorted by the position of their middle lines
+   across the lines.
+  _keys:      The buffer in which to store the index.
+  _clusters:  The clusters to index.
+  _nclusters: The number of clusters.
+  _v:         0 for horizontal clusters, or 1 for vertical clusters.*/
+static void qr_finder_clusters_index(qr_finder_cluster_key* _keys,
+    const qr_finder_cluster* _clusters, int _nclusters, int _v) {
+    int i;
+    for (i = 0; i < _nclusters; i++) {
+        _keys[i].pos = _clusters[i].lines[_clusters[i].nlines >> 1]->pos[1 - _v];
+        _keys[i].idx = i;
+    }
+    qsort(_keys, _nclusters, sizeof(*_keys), qr_finder_cluster_key_cmp);
+}
+
+/*Finds the clusters in an index whose middle lines cross a given line.
+  _found:     Returns the indices of the clusters found, in increasing order.
+  _keys:      The index of the clusters to search.
+  _clusters:  The clusters in the index.
+  _nclusters: The number of clusters.
+  _mark:      Clusters with a non-zero mark are skipped.
+  _min_idx:   Clusters with a smaller index are skipped.
+  _line:      The line to cross.
+  _v:         0 if _line is horizontal (so the clusters are vertical), or 1 if
+               _line is vertical.
+  Return: The number of clusters found.*/
+static int qr_finder_clusters_crossing(int* _found,
+    const qr_finder_cluster_key* _keys, const qr_finder_cluster* _clusters,
+    int _nclusters, const unsigned char* _mark, int _min_idx,
+    const qr_finder_line* _line, int _v) {
+    int nfound;
+    int lo;
+    int hi;
+    /*Only clusters whose middle lines lie within the extent of _line can
+       cross it.*/
+    lo = 0;
+    hi = _nclusters;
+    while (lo < hi) {
+        int mid;
+        mid = lo + ((hi - lo) >> 1);
+        if (_keys[mid].pos < _line->pos[_v])lo = mid + 1;
+        else hi = mid;
+    }
+    nfound = 0;
+    for (; lo < _nclusters && _keys[lo].pos < _line->pos[_v] + _line->len; lo++) {
+        const qr_finder_line* b;
+        int                   j;
+        j = _keys[lo].idx;
+        if (j < _min_idx || _mark[j])continue;
+        b = _clusters[j].lines[_clusters[j].nlines >> 1];
+        if (_v ? qr_finder_lines_are_crossing(b, _line) :
+            qr_finder_lines_are_crossing(_line, b)) {
+            _found[nfound++] = j;
+        }
+    }
+    /*Keep the order the clusters were found in, which decides which cluster
+       anchors a group and the order of its edge points.*/
+    if (nfound > 1)qsort(_found, nfound, sizeof(*_found), qr_int_cmp);
+    return nfound;
+}
+
 /*Finds horizontal clusters that cross corresponding vertical clusters,
    presumably corresponding to a finder center.
+  Each cluster is represented by its middle line, and the candidates crossing
+   a line are looked up in an index of clusters sorted by the position of their
+   middle lines, rather than by testing every pair.
   _center:     The buffer in which to store putative finder centers.
   _edge_pts:   The buffer to use for the edge point lists for each finder
                 center.
@@ -302,21 +990,42 @@ static int qr_finder_lines_are_crossing(const qr_finder_line* _hline,
   _nhclusters: The number of horizontal line clusters.
   _vclusters:  The clusters of vertical lines crossing finder patterns.
   _nvclusters: The number of vertical line clusters.
+  _arena:      The arena to allocate temporaries from.
   Return: The number of putative finder centers.*/
 static int qr_finder_find_crossings(qr_finder_center* _centers,
     qr_finder_edge_pt* _edge_pts, qr_finder_cluster* _hclusters, int _nhclusters,
-    qr_finder_cluster* _vclusters, int _nvclusters) {
+    qr_finder_cluster* _vclusters, int _nvclusters, zbar_arena_t* _arena) {
+    zbar_arena_mark_t   arena_mark;
     qr_finder_cluster** hneighbors;
     qr_finder_cluster** vneighbors;
+    qr_finder_cluster_key* hkeys;
+    qr_finder_cluster_key* vkeys;
     unsigned char* hmark;
     unsigned char* vmark;
+    int* found;
     int                 ncenters;
     int                 i;
     int                 j;
-    hneighbors = (qr_finder_cluster**)malloc(_nhclusters * sizeof(*hneighbors));
-    vneighbors = (qr_finder_cluster**)malloc(_nvclusters * sizeof(*vneighbors));
-    hmark = (unsigned char*)calloc(_nhclusters, sizeof(*hmark));
-    vmark = (unsigned char*)calloc(_nvclusters, sizeof(*vmark));
+    arena_mark = _zbar_arena_mark(_arena);
+    hneighbors = (qr_finder_cluster**)_zbar_arena_alloc(_arena,
+        _nhclusters * sizeof(*hneighbors));
+    vneighbors = (qr_finder_cluster**)_zbar_arena_alloc(_arena,
+        _nvclusters * sizeof(*vneighbors));
+    hmark = (unsigned char*)_zbar_arena_calloc(_arena, _nhclusters, sizeof(*hmark));
+    vmark = (unsigned char*)_zbar_arena_calloc(_arena, _nvclusters, sizeof(*vmark));
+    hkeys = (qr_finder_cluster_key*)_zbar_arena_alloc(_arena,
+        _nhclusters * sizeof(*hkeys));
+    vkeys = (qr_finder_cluster_key*)_zbar_arena_alloc(_arena,
+        _nvclusters * sizeof(*vkeys));
+    found = (int*)_zbar_arena_alloc(_arena,
+        QR_MAXI(_nhclusters, _nvclusters) * sizeof(*found));
+    if (hneighbors == NULL || vneighbors == NULL || hmark == NULL ||
+        vmark == NULL || hkeys == NULL || vkeys == NULL || found == NULL) {
+        _zbar_arena_release(_arena, arena_mark);
+        return 0;
+    }
+    qr_finder_clusters_index(hkeys, _hclusters, _nhclusters, 0);
+    qr_finder_clusters_index(vkeys, _vclusters, _nvclusters, 1);
     ncenters = 0;
     /*TODO: This may need some re-working.
       We should be finding groups of clusters such that _all_ horizontal lines in
@@ -332,18 +1041,19 @@ static int qr_finder_find_crossings(qr_finder_center* _centers,
         qr_finder_line* a;
         qr_finder_line* b;
         int             nvneighbors;
+        int             nfound;
         int             nedge_pts;
         int             y;
         a = _hclusters[i].lines[_hclusters[i].nlines >> 1];
-        y = nvneighbors = 0;
-        for (j = 0; j < _nvclusters; j++)if (!vmark[j]) {
-            b = _vclusters[j].lines[_vclusters[j].nlines >> 1];
-            if (qr_finder_lines_are_crossing(a, b)) {
-                vmark[j] = 1;
-                y += (b->pos[1] << 1) + b->len;
-                if (b->boffs > 0 && b->eoffs > 0)y += b->eoffs - b->boffs;
-                vneighbors[nvneighbors++] = _vclusters + j;
-            }
+        y = 0;
+        nvneighbors = qr_finder_clusters_crossing(found, vkeys, _vclusters,
+            _nvclusters, vmark, 0, a, 0);
+        for (j = 0; j < nvneighbors; j++) {
+            vmark[found[j]] = 1;
+            b = _vclusters[found[j]].lines[_vclusters[found[j]].nlines >> 1];
+            y += (b->pos[1] << 1) + b->len;
+            if (b->boffs > 0 && b->eoffs > 0)y += b->eoffs - b->boffs;
+            vneighbors[j] = _vclusters + found[j];
         }
         if (nvneighbors > 0) {
             qr_finder_center* c;
@@ -355,14 +1065,14 @@ static int qr_finder_find_crossings(qr_finder_center* _centers,
             nhneighbors = 1;
             j = nvneighbors >> 1;
             b = vneighbors[j]->lines[vneighbors[j]->nlines >> 1];
-            for (j = i + 1; j < _nhclusters; j++)if (!hmark[j]) {
-                a = _hclusters[j].lines[_hclusters[j].nlines >> 1];
-                if (qr_finder_lines_are_crossing(a, b)) {
-                    hmark[j] = 1;
-                    x += (a->pos[0] << 1) + a->len;
-                    if (a->boffs > 0 && a->eoffs > 0)x += a->eoffs - a->boffs;
-                    hneighbors[nhneighbors++] = _hclusters + j;
-                }
+            nfound = qr_finder_clusters_crossing(found, hkeys, _hclusters,
+                _nhclusters, hmark, i + 1, b, 1);
+            for (j = 0; j < nfound; j++) {
+                hmark[found[j]] = 1;
+                a = _hclusters[found[j]].lines[_hclusters[found[j]].nlines >> 1];
+                x += (a->pos[0] << 1) + a->len;
+                if (a->boffs > 0 && a->eoffs > 0)x += a->eoffs - a->boffs;
+                hneighbors[nhneighbors++] = _hclusters + found[j];
             }
             c = _centers + ncenters++;
             c->pos[0] = (x + nhneighbors) / (nhneighbors << 1);
@@ -376,16 +1086,14 @@ static int qr_finder_find_crossings(qr_finder_center* _centers,
             _edge_pts += nedge_pts;
         }
     }
-    free(vmark);
-    free(hmark);
-    free(vneighbors);
-    free(hneighbors);
+    _zbar_arena_release(_arena, arena_mark);
     /*Sort the centers by decreasing numbers of edge points.*/
     qsort(_centers, ncenters, sizeof(*_centers), qr_finder_center_cmp);
     return ncenters;
 }
 
-/*Locates a set of putative finder centers in the image.
+/*Locates a set of putative finder centers from one pair of perpendicular
+   line directions.
   First we search for horizontal and vertical lines that have
    (dark:light:dark:light:dark) runs with size ratios of roughly (1:1:3:1:1).
   Then we cluster them into groups such that each subsequent pair of endpoints
@@ -394,22 +1102,21 @@ static int qr_finder_find_crossings(qr_finder_center* _centers,
    qr_finder_find_crossings() will filter most of them out.
   Where horizontal and vertical clusters cross, a prospective finder center is
    returned.
-  _centers:  Returns a pointer to a freshly-allocated list of finder centers.
-             This must be freed by the caller.
-  _edge_pts: Returns a pointer to a freshly-allocated list of edge points
-              around those centers.
-             This must be freed by the caller.
-  _img:      The binary image to search.
-  _width:    The width of the image.
-  _height:   The height of the image.
+  _centers:  Returns a pointer to a list of finder centers allocated from
+              _arena.
+  _edge_pts: Returns a pointer to a list of edge points around those centers
+              allocated from _arena.
+  _hlines:   The horizontal lines.
+  _vlines:   The vertical lines.
+  _arena:    The arena to allocate the lists and temporaries from.
   Return: The number of putative finder centers located.*/
-static int qr_finder_centers_locate(qr_finder_center** _centers,
-    qr_finder_edge_pt** _edge_pts, qr_reader* reader,
-    int _width, int _height) {
-    qr_finder_line* hlines = reader->finder_lines[0].lines;
-    int                 nhlines = reader->finder_lines[0].nlines;
-    qr_finder_line* vlines = reader->finder_lines[1].lines;
-    int                 nvlines = reader->finder_lines[1].nlines;
+static int qr_finder_centers_find(qr_finder_center** _centers,
+    qr_finder_edge_pt** _edge_pts, qr_finder_lines* _hlines,
+    qr_finder_lines* _vlines, zbar_arena_t* _arena) {
+    qr_finder_line* hlines = _hlines->lines;
+    int                 nhlines = _hlines->nlines;
+    qr_finder_line* vlines = _vlines->lines;
+    int                 nvlines = _vlines->nlines;
 
     qr_finder_line** hneighbors;
     qr_finder_cluster* hclusters;
@@ -419,20 +1126,22 @@ static int qr_finder_centers_locate(qr_finder_center** _centers,
     int                 nvclusters;
     int                 ncenters;
 
+    if (nhlines < 9 || nvlines < 9)return 0;
     /*Cluster the detected lines.*/
-    hneighbors = (qr_finder_line**)malloc(nhlines * sizeof(*hneighbors));
+    hneighbors = (qr_finder_line**)_zbar_arena_alloc(_arena,
+        nhlines * sizeof(*hneighbors));
     /*We require more than one line per cluster, so there are at most nhlines/2.*/
-    hclusters = (qr_finder_cluster*)malloc((nhlines >> 1) * sizeof(*hclusters));
-    nhclusters = qr_finder_cluster_lines(hclusters, hneighbors, hlines, nhlines, 0);
-    /*We need vertical lines to be sorted by X coordinate, with ties broken by Y
-       coordinate, for clustering purposes.
-      We scan the image in the opposite order for cache efficiency, so sort the
-       lines we found here.*/
-    qsort(vlines, nvlines, sizeof(*vlines), qr_finder_vline_cmp);
-    vneighbors = (qr_finder_line**)malloc(nvlines * sizeof(*vneighbors));
+    hclusters = (qr_finder_cluster*)_zbar_arena_alloc(_arena,
+        (nhlines >> 1) * sizeof(*hclusters));
+    nhclusters = qr_finder_cluster_lines(hclusters, hneighbors, hlines, nhlines, 0,
+        _arena);
+    vneighbors = (qr_finder_line**)_zbar_arena_alloc(_arena,
+        nvlines * sizeof(*vneighbors));
     /*We require more than one line per cluster, so there are at most nvlines/2.*/
-    vclusters = (qr_finder_cluster*)malloc((nvlines >> 1) * sizeof(*vclusters));
-    nvclusters = qr_finder_cluster_lines(vclusters, vneighbors, vlines, nvlines, 1);
+    vclusters = (qr_finder_cluster*)_zbar_arena_alloc(_arena,
+        (nvlines >> 1) * sizeof(*vclusters));
+    nvclusters = qr_finder_cluster_lines(vclusters, vneighbors, vlines, nvlines, 1,
+        _arena);
     /*Find line crossings among the clusters.*/
     if (nhclusters >= 3 && nvclusters >= 3) {
         qr_finder_edge_pt* edge_pts;
@@ -443,22 +1152,151 @@ static int qr_finder_centers_locate(qr_finder_center** _centers,
         for (i = 0; i < nhclusters; i++)nedge_pts += hclusters[i].nlines;
         for (i = 0; i < nvclusters; i++)nedge_pts += vclusters[i].nlines;
         nedge_pts <<= 1;
-        edge_pts = (qr_finder_edge_pt*)malloc(nedge_pts * sizeof(*edge_pts));
-        centers = (qr_finder_center*)malloc(
+        edge_pts = (qr_finder_edge_pt*)_zbar_arena_alloc(_arena,
+            nedge_pts * sizeof(*edge_pts));
+        centers = (qr_finder_center*)_zbar_arena_alloc(_arena,
             QR_MINI(nhclusters, nvclusters) * sizeof(*centers));
         ncenters = qr_finder_find_crossings(centers, edge_pts,
-            hclusters, nhclusters, vclusters, nvclusters);
+            hclusters, nhclusters, vclusters, nvclusters, _arena);
         *_centers = centers;
         *_edge_pts = edge_pts;
     }
     else ncenters = 0;
-    free(vclusters);
-    free(vneighbors);
-    free(hclusters);
-    free(hneighbors);
     return ncenters;
 }
 
+/*Maps a point from the rotated diagonal line frame (see QR_FINDER_NDIRS) back
+   to image coordinates.*/
+static void qr_point_unrotate(qr_point _p) {
+    int u;
+    int v;
+    u = _p[0];
+    v = _p[1];
+    _p[0] = u - v >> 1;
+    _p[1] = u + v >> 1;
+}
+
+/*Merges the finder centers found by the diagonal scans into those found by
+   the horizontal and vertical scans.
+  A diagonal center closer to an axis center than half its mean edge radius
+   is taken to be the same finder pattern and dropped: mixing in its edge
+   points, which sample the pattern's corners, makes the edge fits worse.
+  The others are appended as new centers.
+  _centers:   The axis aligned centers, replaced by the merged list.
+  _edge_pts:  The edge points of the axis aligned centers, replaced by the
+               merged list.
+  _ncenters:  The number of axis aligned centers.
+  _dcenters:  The diagonal centers, already in image coordinates.
+  _ndcenters: The number of diagonal centers.
+  _arena:     The arena to allocate the merged lists from.
+  Return: The number of merged centers, or -1 if out of memory (in which case
+   the axis aligned centers are left unchanged).*/
+static int qr_finder_centers_merge(qr_finder_center** _centers,
+    qr_finder_edge_pt** _edge_pts, int _ncenters,
+    const qr_finder_center* _dcenters, int _ndcenters, zbar_arena_t* _arena) {
+    qr_finder_center* centers;
+    qr_finder_edge_pt* edge_pts;
+    unsigned char* dup;
+    int                 nedge_pts;
+    int                 ncenters;
+    int                 i;
+    int                 j;
+    nedge_pts = 0;
+    for (i = 0; i < _ncenters; i++)nedge_pts += (*_centers)[i].nedge_pts;
+    for (j = 0; j < _ndcenters; j++)nedge_pts += _dcenters[j].nedge_pts;
+    centers = (qr_finder_center*)_zbar_arena_alloc(_arena,
+        (_ncenters + _ndcenters) * sizeof(*centers));
+    edge_pts = (qr_finder_edge_pt*)_zbar_arena_alloc(_arena,
+        QR_MAXI(nedge_pts, 1) * sizeof(*edge_pts));
+    dup = (unsigned char*)_zbar_arena_calloc(_arena,
+        QR_MAXI(_ndcenters, 1), sizeof(*dup));
+    if (centers == NULL || edge_pts == NULL || dup == NULL)return -1;
+    /*Look for an axis aligned center at each diagonal one.*/
+    for (i = 0; i < _ncenters; i++) {
+        const qr_finder_center* c;
+        unsigned                 r2;
+        int                      k;
+        c = *_centers + i;
+        if (c->nedge_pts <= 0)continue;
+        r2 = 0;
+        for (k = 0; k < c->nedge_pts; k++) {
+            int dx;
+            int dy;
+            dx = c->edge_pts[k].pos[0] - c->pos[0];
+            dy = c->edge_pts[k].pos[1] - c->pos[1];
+            r2 += (unsigned)(dx * dx + dy * dy) / c->nedge_pts;
+        }
+        for (j = 0; j < _ndcenters; j++)if (!dup[j]) {
+            const qr_finder_center* d;
+            unsigned                 d2;
+            d = _dcenters + j;
+            d2 = (unsigned)((d->pos[0] - c->pos[0]) * (d->pos[0] - c->pos[0]) +
+                (d->pos[1] - c->pos[1]) * (d->pos[1] - c->pos[1]));
+            if (d2 <= r2 >> 2)dup[j] = 1;
+        }
+    }
+    /*Pack the merged centers and their edge points contiguously.*/
+    ncenters = 0;
+    nedge_pts = 0;
+    for (i = 0; i < _ncenters + _ndcenters; i++) {
+        const qr_finder_center* src;
+        qr_finder_center* c;
+        if (i < _ncenters)src = *_centers + i;
+        else {
+            if (dup[i - _ncenters])continue;
+            src = _dcenters + i - _ncenters;
+        }
+        c = centers + ncenters++;
+        *c = *src;
+        c->edge_pts = edge_pts + nedge_pts;
+        memcpy(c->edge_pts, src->edge_pts, src->nedge_pts * sizeof(*edge_pts));
+        nedge_pts += c->nedge_pts;
+    }
+    qsort(centers, ncenters, sizeof(*centers), qr_finder_center_cmp);
+    *_centers = centers;
+    *_edge_pts = edge_pts;
+    return ncenters;
+}
+
+/*Locates a set of putative finder centers in the image, from the horizontal
+   and vertical lines and, if the image was also scanned diagonally, from the
+   diagonal lines.
+  _centers:  Returns a pointer to a list of finder centers allocated from the
+              reader's arena.
+  _edge_pts: Returns a pointer to a list of edge points around those centers
+              allocated from the reader's arena.
+  Return: The number of putative finder centers located.*/
+static int qr_finder_centers_locate(qr_finder_center** _centers,
+    qr_finder_edge_pt** _edge_pts, qr_reader* reader) {
+    qr_finder_center* dcenters;
+    qr_finder_edge_pt* dedge_pts;
+    int                 ncenters;
+    int                 ndcenters;
+    int                 nmerged;
+    int                 i;
+    int                 j;
+    ncenters = qr_finder_centers_find(_centers, _edge_pts,
+        reader->finder_lines + 0, reader->finder_lines + 1, &reader->arena);
+    dcenters = NULL;
+    dedge_pts = NULL;
+    ndcenters = qr_finder_centers_find(&dcenters, &dedge_pts,
+        reader->finder_lines + 2, reader->finder_lines + 3, &reader->arena);
+    if (ndcenters <= 0)return ncenters;
+    for (i = 0; i < ndcenters; i++) {
+        qr_point_unrotate(dcenters[i].pos);
+        for (j = 0; j < dcenters[i].nedge_pts; j++)
+            qr_point_unrotate(dcenters[i].edge_pts[j].pos);
+    }
+    if (ncenters <= 0) {
+        *_centers = dcenters;
+        *_edge_pts = dedge_pts;
+        return ndcenters;
+    }
+    nmerged = qr_finder_centers_merge(_centers, _edge_pts, ncenters,
+        dcenters, ndcenters, &reader->arena);
+    return nmerged < 0 ? ncenters : nmerged;
+}
+
 
 
 static void qr_point_translate(qr_point _point, int _dx, int _dy) {
@@ -1036,9 +1874,54 @@ static int qr_finder_estimate_module_size_and_version(qr_finder* _f,
     return 0;
 }
 
-/*Eliminate outliers from the classified edge points with RANSAC.*/
+/*The work done by configuration attempts, kept per attempt so that they can run
+   in parallel, for the reader's statistics.*/
+struct qr_try_stats {
+    unsigned long timing_checks;
+    unsigned long timing_rejects;
+    unsigned long fits;
+    unsigned long ransac_runs;
+    unsigned long ransac_iters;
+    clock_t       timing_clock;
+    clock_t       fit_clock;
+};
+
+/*A counter-based random number generator: the _ctr'th number of stream _key
+   is a hash of the two, so the numbers a RANSAC run draws depend on nothing
+   that ran before it, or alongside it on other threads.*/
+static unsigned qr_ransac_rand(unsigned _key, unsigned _ctr) {
+    unsigned x;
+    x = _key ^ _ctr * 0x9E3779B9U;
+    /*The finalizer of MurmurHash3, a bijection that mixes every input bit into
+       every output bit.*/
+    x ^= x >> 16;
+    x *= 0x85EBCA6BU;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35U;
+    x ^= x >> 16;
+    return x;
+}
+
+/*Returns a number in [0,_n) from the _ctr'th number of stream _key.*/
+static int qr_ransac_rand_below(unsigned _key, unsigned _ctr, int _n) {
+    return (int)((unsigned long long)qr_ransac_rand(_key, _ctr) * (unsigned)_n >> 32);
+}
+
+/*The number of RANSAC iterations needed to draw a sample with no outliers
+   with 99% probability, when at least a fraction k/16 of the points are
+   inliers: ceil(log(1-0.99)/log(1-(k/16)**2)).
+  It is capped at 17, which suffices for as many as 50% outliers; with fewer
+   inliers than that, more iterations would not help much.*/
+static const unsigned char QR_RANSAC_ITERS[17] = {
+  17,17,17,17,17,17,17,17,17,13,10, 8, 6, 5, 4, 3, 1
+};
+
+/*Eliminate outliers from the classified edge points with RANSAC.
+  The random samples come from a stream keyed by the position of the finder
+   center in the image and the edge, so each run on an edge draws the same
+   samples whenever it is repeated.*/
 static void qr_finder_ransac(qr_finder* _f, const qr_aff* _hom,
-    isaac_ctx* _isaac, int _e) {
+    qr_try_stats* _stats, int _e) {
     qr_finder_edge_pt* edge_pts;
     int                best_ninliers;
     int                n;
@@ -1046,12 +1929,13 @@ static void qr_finder_ransac(qr_finder* _f, const qr_aff* _hom,
     n = _f->nedge_pts[_e];
     best_ninliers = 0;
     if (n > 1) {
-        int max_iters;
-        int i;
-        int j;
-        /*17 iterations is enough to guarantee an outlier-free sample with more
-           than 99% probability given as many as 50% outliers.*/
-        max_iters = 17;
+        unsigned key;
+        int      max_iters;
+        int      i;
+        int      j;
+        key = qr_ransac_rand(qr_ransac_rand((unsigned)_f->c->pos[0],
+            (unsigned)_f->c->pos[1]), (unsigned)_e);
+        max_iters = QR_RANSAC_ITERS[0];
         for (i = 0; i < max_iters; i++) {
             qr_point  q0;
             qr_point  q1;
@@ -1063,8 +1947,8 @@ static void qr_finder_ransac(qr_finder* _f, const qr_aff* _hom,
             int* p1;
             int       j;
             /*Pick two random points on this edge.*/
-            p0i = isaac_next_uint(_isaac, n);
-            p1i = isaac_next_uint(_isaac, n - 1);
+            p0i = qr_ransac_rand_below(key, (unsigned)i << 1, n);
+            p1i = qr_ransac_rand_below(key, (unsigned)i << 1 | 1, n - 1);
             if (p1i >= p0i)p1i++;
             p0 = edge_pts[p0i].pos;
             p1 = edge_pts[p1i].pos;
@@ -1099,17 +1983,16 @@ static void qr_finder_ransac(qr_finder* _f, const qr_aff* _hom,
             if (ninliers > best_ninliers) {
                 for (j = 0; j < n; j++)edge_pts[j].extent <<= 1;
                 best_ninliers = ninliers;
-                /*The actual number of iterations required is
-                    log(1-\alpha)/log(1-r*r),
-                   where \alpha is the required probability of taking a sample with
-                    no outliers (e.g., 0.99) and r is the estimated ratio of inliers
-                    (e.g. ninliers/n).
-                  This is just a rough (but conservative) approximation, but it
-                   should be good enough to stop the iteration early when we find
-                   a good set of inliers.*/
-                if (ninliers > n >> 1)max_iters = (67 * n - 63 * ninliers - 1) / (n << 1);
+                /*Stop as soon as the ratio of inliers found so far gives the target
+                   confidence.
+                  Rounding the ratio down keeps the estimate conservative.*/
+                max_iters = QR_RANSAC_ITERS[(ninliers << 4) / n];
             }
         }
+#ifndef NO_STATS
+        _stats->ransac_runs++;
+        _stats->ransac_iters += i;
+#endif
         /*Now collect all the inliers at the beginning of the list.*/
         for (i = j = 0; j < best_ninliers; i++)if (edge_pts[i].extent & 2) {
             if (j < i) {
@@ -1127,7 +2010,8 @@ static void qr_finder_ransac(qr_finder* _f, const qr_aff* _hom,
 /*Perform a least-squares line fit to an edge of a finder pattern using the
    inliers found by RANSAC.*/
 static int qr_line_fit_finder_edge(qr_line _l,
-    const qr_finder* _f, int _e, int _res) {
+    const qr_finder* _f, int _e, int _res, zbar_arena_t* _arena) {
+    zbar_arena_mark_t  arena_mark;
     qr_finder_edge_pt* edge_pts;
     qr_point* pts;
     int                npts;
@@ -1137,7 +2021,8 @@ static int qr_line_fit_finder_edge(qr_line _l,
     /*We could write a custom version of qr_line_fit_points that accesses
        edge_pts directly, but this saves on code size and doesn't measurably slow
        things down.*/
-    pts = (qr_point*)malloc(npts * sizeof(*pts));
+    arena_mark = _zbar_arena_mark(_arena);
+    pts = (qr_point*)_zbar_arena_alloc(_arena, npts * sizeof(*pts));
     edge_pts = _f->edge_pts[_e];
     for (i = 0; i < npts; i++) {
         pts[i][0] = edge_pts[i].pos[0];
@@ -1147,7 +2032,7 @@ static int qr_line_fit_finder_edge(qr_line _l,
     /*Make sure the center of the finder pattern lies in the positive halfspace
        of the line.*/
     qr_line_orient(_l, _f->c->pos[0], _f->c->pos[1]);
-    free(pts);
+    _zbar_arena_release(_arena, arena_mark);
     return 0;
 }
 
@@ -1157,7 +2042,8 @@ static int qr_line_fit_finder_edge(qr_line _l,
    least one point on each edge using the estimated module size if it has no
    inliers.*/
 static void qr_line_fit_finder_pair(qr_line _l, const qr_aff* _aff,
-    const qr_finder* _f0, const qr_finder* _f1, int _e) {
+    const qr_finder* _f0, const qr_finder* _f1, int _e, zbar_arena_t* _arena) {
+    zbar_arena_mark_t  arena_mark;
     qr_point* pts;
     int                npts;
     qr_finder_edge_pt* edge_pts;
@@ -1171,7 +2057,8 @@ static void qr_line_fit_finder_pair(qr_line _l, const qr_aff* _aff,
        edge_pts directly, but this saves on code size and doesn't measurably slow
        things down.*/
     npts = QR_MAXI(n0, 1) + QR_MAXI(n1, 1);
-    pts = (qr_point*)malloc(npts * sizeof(*pts));
+    arena_mark = _zbar_arena_mark(_arena);
+    pts = (qr_point*)_zbar_arena_alloc(_arena, npts * sizeof(*pts));
     if (n0 > 0) {
         edge_pts = _f0->edge_pts[_e];
         for (i = 0; i < n0; i++) {
@@ -1203,10 +2090,10 @@ static void qr_line_fit_finder_pair(qr_line _l, const qr_aff* _aff,
     qr_line_fit_points(_l, pts, npts, _aff->res);
     /*Make sure at least one finder center lies in the positive halfspace.*/
     qr_line_orient(_l, _f0->c->pos[0], _f0->c->pos[1]);
-    free(pts);
+    _zbar_arena_release(_arena, arena_mark);
 }
 
-static int qr_finder_quick_crossing_check(const unsigned char* _img,
+static int qr_finder_quick_crossing_check(qr_bin_image* _img,
     int _width, int _height, int _x0, int _y0, int _x1, int _y1, int _v) {
     /*The points must be inside the image, and have a !_v:_v:!_v pattern.
       We don't scan the whole line initially, but quickly reject if the endpoints
@@ -1219,8 +2106,11 @@ static int qr_finder_quick_crossing_check(const unsigned char* _img,
         _x1 < 0 || _x1 >= _width || _y1 < 0 || _y1 >= _height) {
         return -1;
     }
-    if (!_img[_y0 * _width + _x0] != _v || !_img[_y1 * _width + _x1] != _v)return 1;
-    if (!_img[(_y0 + _y1 >> 1) * _width + (_x0 + _x1 >> 1)] == _v)return -1;
+    if (!qr_bin_image_get(_img, _x0, _y0) != _v ||
+        !qr_bin_image_get(_img, _x1, _y1) != _v) {
+        return 1;
+    }
+    if (!qr_bin_image_get(_img, _x0 + _x1 >> 1, _y0 + _y1 >> 1) == _v)return -1;
     return 0;
 }
 
@@ -1229,8 +2119,8 @@ static int qr_finder_quick_crossing_check(const unsigned char* _img,
   All coordinates, which are NOT in subpel resolution, must lie inside the
    image, and the endpoints are already assumed to have the value !_v.
   The returned value is in subpel resolution.*/
-static int qr_finder_locate_crossing(const unsigned char* _img,
-    int _width, int _height, int _x0, int _y0, int _x1, int _y1, int _v, qr_point _p) {
+static int qr_finder_locate_crossing(qr_bin_image* _img,
+    int _x0, int _y0, int _x1, int _y1, int _v, qr_point _p) {
     qr_point x0;
     qr_point x1;
     qr_point dx;
@@ -1261,7 +2151,7 @@ static int qr_finder_locate_crossing(const unsigned char* _img,
             x0[1 - steep] += step[1 - steep];
             err -= dx[steep];
         }
-        if (!_img[x0[1] * _width + x0[0]] != _v)break;
+        if (!qr_bin_image_get(_img, x0[0], x0[1]) != _v)break;
     }
     /*Find the last crossing from _v to !_v.*/
     err = 0;
@@ -1273,7 +2163,7 @@ static int qr_finder_locate_crossing(const unsigned char* _img,
             x1[1 - steep] -= step[1 - steep];
             err -= dx[steep];
         }
-        if (!_img[x1[1] * _width + x1[0]] != _v)break;
+        if (!qr_bin_image_get(_img, x1[0], x1[1]) != _v)break;
     }
     /*Return the midpoint of the _v segment.*/
     _p[0] = (x0[0] + x1[0] + 1 << QR_FINDER_SUBPREC) >> 1;
@@ -1323,18 +2213,19 @@ static int qr_hamming_dist(unsigned _y1, unsigned _y2, int _maxdiff) {
 
 /*Retrieve a bit (guaranteed to be 0 or 1) from the image, given coordinates in
    subpel resolution which have not been bounds checked.*/
-static int qr_img_get_bit(const unsigned char* _img, int _width, int _height,
+static int qr_img_get_bit(qr_bin_image* _img, int _width, int _height,
     int _x, int _y) {
     _x >>= QR_FINDER_SUBPREC;
     _y >>= QR_FINDER_SUBPREC;
-    return _img[QR_CLAMPI(0, _y, _height - 1) * _width + QR_CLAMPI(0, _x, _width - 1)] != 0;
+    return qr_bin_image_get(_img, QR_CLAMPI(0, _x, _width - 1),
+        QR_CLAMPI(0, _y, _height - 1)) != 0;
 }
 
 #if defined(QR_DEBUG)
 #include "image.h"
 
 static void qr_finder_dump_aff_undistorted(qr_finder* _ul, qr_finder* _ur,
-    qr_finder* _dl, qr_aff* _aff, const unsigned char* _img, int _width, int _height) {
+    qr_finder* _dl, qr_aff* _aff, qr_bin_image* _img, int _width, int _height) {
     unsigned char* gimg;
     FILE* fout;
     int            lpsz;
@@ -1353,9 +2244,8 @@ static void qr_finder_dump_aff_undistorted(qr_finder* _ul, qr_finder* _ur,
     for (i = 0; i < dim; i++)for (j = 0; j < dim; j++) {
         qr_point p;
         qr_aff_project(p, _aff, (j - 64) << lpsz, (i - 64) << lpsz);
-        gimg[i * dim + j] = _img[
-            QR_CLAMPI(0, p[1] >> QR_FINDER_SUBPREC, _height - 1) * _width +
-                QR_CLAMPI(0, p[0] >> QR_FINDER_SUBPREC, _width - 1)];
+        gimg[i * dim + j] = (unsigned char)
+            -qr_img_get_bit(_img, _width, _height, p[0], p[1]);
     }
     {
         min = (_ur->o[0] - 7 * _ur->size[0] >> lpsz) + 64;
@@ -1404,7 +2294,7 @@ static void qr_finder_dump_aff_undistorted(qr_finder* _ul, qr_finder* _ur,
 }
 
 static void qr_finder_dump_hom_undistorted(qr_finder* _ul, qr_finder* _ur,
-    qr_finder* _dl, qr_hom* _hom, const unsigned char* _img, int _width, int _height) {
+    qr_finder* _dl, qr_hom* _hom, qr_bin_image* _img, int _width, int _height) {
     unsigned char* gimg;
     FILE* fout;
     int            lpsz;
@@ -1423,9 +2313,8 @@ static void qr_finder_dump_hom_undistorted(qr_finder* _ul, qr_finder* _ur,
     for (i = 0; i < dim; i++)for (j = 0; j < dim; j++) {
         qr_point p;
         qr_hom_project(p, _hom, (j - 128) << lpsz, (i - 128) << lpsz);
-        gimg[i * dim + j] = _img[
-            QR_CLAMPI(0, p[1] >> QR_FINDER_SUBPREC, _height - 1) * _width +
-                QR_CLAMPI(0, p[0] >> QR_FINDER_SUBPREC, _width - 1)];
+        gimg[i * dim + j] = (unsigned char)
+            -qr_img_get_bit(_img, _width, _height, p[0], p[1]);
     }
     {
         min = (_ur->o[0] - 7 * _ur->size[0] >> lpsz) + 128;
@@ -1669,6 +2558,167 @@ static void qr_hom_cell_fproject(qr_point _p, const qr_hom_cell* _cell,
     }
 }
 
+/*Finishes the projections of _n consecutive grid points along a row of a cell,
+   starting from the partial projection (_x,_y,_w) of the first, exactly as
+   qr_hom_cell_fproject() would, into (_px[k],_py[k]).*/
+static void qr_hom_cell_fproject_row_c(int* _px, int* _py,
+    const qr_hom_cell* _cell, int _x, int _y, int _w, int _n) {
+    int k;
+    for (k = 0; k < _n; k++) {
+        qr_point p;
+        qr_hom_cell_fproject(p, _cell, _x, _y, _w);
+        _px[k] = p[0];
+        _py[k] = p[1];
+        _x += _cell->fwd[0][1];
+        _y += _cell->fwd[1][1];
+        _w += _cell->fwd[2][1];
+    }
+}
+
+/*The vector versions divide in double precision.
+  Every 32-bit integer is exact in a double, and the correctly rounded quotient
+   of two of them never rounds across an integer (it is within |q|*2**-53 of
+   the true quotient q, while a non-integer quotient is at least 1/|w| away
+   from the nearest integer), so truncating it gives exactly the C integer
+   division QR_DIVROUND() does.
+  Lanes with _w<=0 are rare, and left to the scalar version.*/
+#if defined(ZBAR_SSE2)
+/*QR_DIVROUND() of 4 lanes, all with _w>0.*/
+static __inline __m128i qr_divround_sse2(__m128i _x, __m128i _w) {
+    __m128i s;
+    __m128i n;
+    __m128i lo;
+    __m128i hi;
+    s = _mm_srai_epi32(_x, 31);
+    n = _mm_add_epi32(_x, _mm_xor_si128(_mm_add_epi32(_mm_srai_epi32(_w, 1), s), s));
+    lo = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(n), _mm_cvtepi32_pd(_w)));
+    hi = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(n, 0xEE)),
+        _mm_cvtepi32_pd(_mm_shuffle_epi32(_w, 0xEE))));
+    return _mm_unpacklo_epi64(lo, hi);
+}
+
+static void qr_hom_cell_fproject_row_sse2(int* _px, int* _py,
+    const qr_hom_cell* _cell, int _x, int _y, int _w, int _n) {
+    __m128i zero;
+    __m128i x;
+    __m128i y;
+    __m128i w;
+    __m128i dx;
+    __m128i dy;
+    __m128i dw;
+    int     k;
+    zero = _mm_setzero_si128();
+    x = _mm_add_epi32(_mm_set1_epi32(_x), _mm_setr_epi32(0, _cell->fwd[0][1],
+        2 * _cell->fwd[0][1], 3 * _cell->fwd[0][1]));
+    y = _mm_add_epi32(_mm_set1_epi32(_y), _mm_setr_epi32(0, _cell->fwd[1][1],
+        2 * _cell->fwd[1][1], 3 * _cell->fwd[1][1]));
+    w = _mm_add_epi32(_mm_set1_epi32(_w), _mm_setr_epi32(0, _cell->fwd[2][1],
+        2 * _cell->fwd[2][1], 3 * _cell->fwd[2][1]));
+    dx = _mm_set1_epi32(4 * _cell->fwd[0][1]);
+    dy = _mm_set1_epi32(4 * _cell->fwd[1][1]);
+    dw = _mm_set1_epi32(4 * _cell->fwd[2][1]);
+    for (k = 0; k + 4 <= _n; k += 4) {
+        if (_mm_movemask_epi8(_mm_cmpgt_epi32(w, zero)) != 0xFFFF) {
+            qr_hom_cell_fproject_row_c(_px + k, _py + k, _cell, _mm_cvtsi128_si32(x),
+                _mm_cvtsi128_si32(y), _mm_cvtsi128_si32(w), 4);
+        }
+        else {
+            _mm_storeu_si128((__m128i*)(_px + k),
+                _mm_add_epi32(qr_divround_sse2(x, w), _mm_set1_epi32(_cell->x0)));
+            _mm_storeu_si128((__m128i*)(_py + k),
+                _mm_add_epi32(qr_divround_sse2(y, w), _mm_set1_epi32(_cell->y0)));
+        }
+        x = _mm_add_epi32(x, dx);
+        y = _mm_add_epi32(y, dy);
+        w = _mm_add_epi32(w, dw);
+    }
+    qr_hom_cell_fproject_row_c(_px + k, _py + k, _cell, _mm_cvtsi128_si32(x),
+        _mm_cvtsi128_si32(y), _mm_cvtsi128_si32(w), _n - k);
+}
+#endif
+
+#if defined(ZBAR_AVX2)
+/*QR_DIVROUND() of 8 lanes, all with _w>0.*/
+static ZBAR_TARGET_AVX2 __inline __m256i qr_divround_avx2(__m256i _x, __m256i _w) {
+    __m256i s;
+    __m256i n;
+    __m128i lo;
+    __m128i hi;
+    s = _mm256_srai_epi32(_x, 31);
+    n = _mm256_add_epi32(_x,
+        _mm256_xor_si256(_mm256_add_epi32(_mm256_srai_epi32(_w, 1), s), s));
+    lo = _mm256_cvttpd_epi32(_mm256_div_pd(
+        _mm256_cvtepi32_pd(_mm256_castsi256_si128(n)),
+        _mm256_cvtepi32_pd(_mm256_castsi256_si128(_w))));
+    hi = _mm256_cvttpd_epi32(_mm256_div_pd(
+        _mm256_cvtepi32_pd(_mm256_extracti128_si256(n, 1)),
+        _mm256_cvtepi32_pd(_mm256_extracti128_si256(_w, 1))));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+static ZBAR_TARGET_AVX2 void qr_hom_cell_fproject_row_avx2(int* _px, int* _py,
+    const qr_hom_cell* _cell, int _x, int _y, int _w, int _n) {
+    __m256i order;
+    __m256i zero;
+    __m256i x;
+    __m256i y;
+    __m256i w;
+    __m256i dx;
+    __m256i dy;
+    __m256i dw;
+    int     k;
+    order = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    zero = _mm256_setzero_si256();
+    x = _mm256_add_epi32(_mm256_set1_epi32(_x),
+        _mm256_mullo_epi32(order, _mm256_set1_epi32(_cell->fwd[0][1])));
+    y = _mm256_add_epi32(_mm256_set1_epi32(_y),
+        _mm256_mullo_epi32(order, _mm256_set1_epi32(_cell->fwd[1][1])));
+    w = _mm256_add_epi32(_mm256_set1_epi32(_w),
+        _mm256_mullo_epi32(order, _mm256_set1_epi32(_cell->fwd[2][1])));
+    dx = _mm256_set1_epi32(8 * _cell->fwd[0][1]);
+    dy = _mm256_set1_epi32(8 * _cell->fwd[1][1]);
+    dw = _mm256_set1_epi32(8 * _cell->fwd[2][1]);
+    for (k = 0; k + 8 <= _n; k += 8) {
+        if (_mm256_movemask_epi8(_mm256_cmpgt_epi32(w, zero)) != -1) {
+            qr_hom_cell_fproject_row_c(_px + k, _py + k, _cell,
+                _mm_cvtsi128_si32(_mm256_castsi256_si128(x)),
+                _mm_cvtsi128_si32(_mm256_castsi256_si128(y)),
+                _mm_cvtsi128_si32(_mm256_castsi256_si128(w)), 8);
+        }
+        else {
+            _mm256_storeu_si256((__m256i*)(_px + k),
+                _mm256_add_epi32(qr_divround_avx2(x, w), _mm256_set1_epi32(_cell->x0)));
+            _mm256_storeu_si256((__m256i*)(_py + k),
+                _mm256_add_epi32(qr_divround_avx2(y, w), _mm256_set1_epi32(_cell->y0)));
+        }
+        x = _mm256_add_epi32(x, dx);
+        y = _mm256_add_epi32(y, dy);
+        w = _mm256_add_epi32(w, dw);
+    }
+    _x = _mm_cvtsi128_si32(_mm256_castsi256_si128(x));
+    _y = _mm_cvtsi128_si32(_mm256_castsi256_si128(y));
+    _w = _mm_cvtsi128_si32(_mm256_castsi256_si128(w));
+    /*Leave no dirty upper halves behind for the SSE code of our callers.*/
+    _mm256_zeroupper();
+    qr_hom_cell_fproject_row_c(_px + k, _py + k, _cell, _x, _y, _w, _n - k);
+}
+#endif
+
+static void qr_hom_cell_fproject_row(int* _px, int* _py,
+    const qr_hom_cell* _cell, int _x, int _y, int _w, int _n) {
+#if defined(ZBAR_AVX2)
+    if (_zbar_cpu_avx2()) {
+        qr_hom_cell_fproject_row_avx2(_px, _py, _cell, _x, _y, _w, _n);
+        return;
+    }
+#endif
+#if defined(ZBAR_SSE2)
+    qr_hom_cell_fproject_row_sse2(_px, _py, _cell, _x, _y, _w, _n);
+#else
+    qr_hom_cell_fproject_row_c(_px, _py, _cell, _x, _y, _w, _n);
+#endif
+}
+
 static void qr_hom_cell_project(qr_point _p, const qr_hom_cell* _cell,
     int _u, int _v, int _res) {
     _u -= _cell->u0 << _res;
@@ -1681,10 +2731,24 @@ static void qr_hom_cell_project(qr_point _p, const qr_hom_cell* _cell,
 
 
 
+/*The alignment pattern template: bit 5*i+j is set if module j of row i is
+   dark.*/
+#define QR_ALIGN_TEMPLATE    (0x1F8D63F)
+
+/*The order in which the search compares the template modules: first the
+   center and the midpoints of the outer ring, the coarsest features of the
+   pattern, then the rest of the cross through the center, which alternates
+   dark and light along both axes, and then the remaining modules.*/
+static const unsigned char QR_ALIGN_ORDER[25] = {
+    12, 2, 10, 14, 22,
+    7, 11, 13, 17,
+    0, 1, 3, 4, 5, 6, 8, 9, 15, 16, 18, 19, 20, 21, 23, 24
+};
+
 /*Retrieves the bits corresponding to the alignment pattern template centered
    at the given location in the original image (at subpel precision).*/
 static unsigned qr_alignment_pattern_fetch(qr_point _p[5][5], int _x0, int _y0,
-    const unsigned char* _img, int _width, int _height) {
+    qr_bin_image* _img, int _width, int _height) {
     unsigned v;
     int      i;
     int      j;
@@ -1700,45 +2764,63 @@ static unsigned qr_alignment_pattern_fetch(qr_point _p[5][5], int _x0, int _y0,
     return v;
 }
 
-/*Searches for an alignment pattern near the given location.*/
-static int qr_alignment_pattern_search(qr_point _p, const qr_hom_cell* _cell,
-    int _u, int _v, int _r, const unsigned char* _img, int _width, int _height) {
-    qr_point c[4];
-    int      nc[4];
-    qr_point p[5][5];
-    qr_point pc;
-    unsigned best_match;
-    int      best_dist;
-    int      bestx;
-    int      besty;
-    unsigned match;
+/*Compares the alignment pattern template centered at the given location with
+   the image, in the order of QR_ALIGN_ORDER, stopping as soon as _max modules
+   differ.
+  Returns the number of modules that differ, which is only exact if it is less
+   than _max; in that case the bits read are stored in *_match.*/
+static int qr_alignment_pattern_match(unsigned* _match, qr_point _p[5][5],
+    int _x0, int _y0, int _max, qr_bin_image* _img, int _width, int _height) {
+    unsigned v;
     int      dist;
-    int      u;
-    int      v;
-    int      x0;
-    int      y0;
-    int      w0;
-    int      x;
-    int      y;
-    int      w;
-    int      dxdu;
-    int      dydu;
-    int      dwdu;
-    int      dxdv;
-    int      dydv;
-    int      dwdv;
     int      dx;
     int      dy;
     int      i;
-    int      j;
-    /*Build up a basic template using _cell to control shape and scale.
-      We project the points in the template back to the image just once, since if
-       the alignment pattern has moved, we don't really know why.
-      If it's because of radial distortion, or the code wasn't flat, or something
-       else, there's no reason to expect that a re-projection around each
-       subsequent search point would be any closer to the actual shape than our
-       first projection.
-      Therefore we simply slide this template around, as is.*/
+    dx = _x0 - _p[2][2][0];
+    dy = _y0 - _p[2][2][1];
+    v = 0;
+    dist = 0;
+    for (i = 0; i < 25; i++) {
+        unsigned bit;
+        int      k;
+        k = QR_ALIGN_ORDER[i];
+        bit = qr_img_get_bit(_img, _width, _height,
+            _p[k / 5][k % 5][0] + dx, _p[k / 5][k % 5][1] + dy);
+        v |= bit << k;
+        dist += bit != (QR_ALIGN_TEMPLATE >> k & 1);
+        if (dist >= _max)return dist;
+    }
+    *_match = v;
+    return dist;
+}
+
+/*Builds up a basic template centered on (_u,_v), using _cell to control shape
+   and scale.
+  We project the points in the template back to the image just once, since if
+   the alignment pattern has moved, we don't really know why.
+  If it's because of radial distortion, or the code wasn't flat, or something
+   else, there's no reason to expect that a re-projection around each
+   subsequent search point would be any closer to the actual shape than our
+   first projection.
+  Therefore we simply slide this template around, as is.*/
+static void qr_alignment_pattern_template(qr_point _p[5][5],
+    const qr_hom_cell* _cell, int _u, int _v) {
+    int u;
+    int v;
+    int x0;
+    int y0;
+    int w0;
+    int x;
+    int y;
+    int w;
+    int dxdu;
+    int dydu;
+    int dwdu;
+    int dxdv;
+    int dydv;
+    int dwdv;
+    int i;
+    int j;
     u = (_u - 2) - _cell->u0;
     v = (_v - 2) - _cell->v0;
     x0 = _cell->fwd[0][0] * u + _cell->fwd[0][1] * v + _cell->fwd[0][2];
@@ -1755,7 +2837,7 @@ static int qr_alignment_pattern_search(qr_point _p, const qr_hom_cell* _cell,
         y = y0;
         w = w0;
         for (j = 0; j < 5; j++) {
-            qr_hom_cell_fproject(p[i][j], _cell, x, y, w);
+            qr_hom_cell_fproject(_p[i][j], _cell, x, y, w);
             x += dxdu;
             y += dydu;
             w += dwdu;
@@ -1764,67 +2846,112 @@ static int qr_alignment_pattern_search(qr_point _p, const qr_hom_cell* _cell,
         y0 += dydv;
         w0 += dwdv;
     }
-    bestx = p[2][2][0];
-    besty = p[2][2][1];
-    best_match = qr_alignment_pattern_fetch(p, bestx, besty, _img, _width, _height);
-    best_dist = qr_hamming_dist(best_match, 0x1F8D63F, 25);
-    if (best_dist > 0) {
-        u = _u - _cell->u0;
-        v = _v - _cell->v0;
-        x = _cell->fwd[0][0] * u + _cell->fwd[0][1] * v + _cell->fwd[0][2] << QR_ALIGN_SUBPREC;
-        y = _cell->fwd[1][0] * u + _cell->fwd[1][1] * v + _cell->fwd[1][2] << QR_ALIGN_SUBPREC;
-        w = _cell->fwd[2][0] * u + _cell->fwd[2][1] * v + _cell->fwd[2][2] << QR_ALIGN_SUBPREC;
-        /*Search an area at most _r modules around the target location, in
-           concentric squares..*/
-        for (i = 1; i < _r << QR_ALIGN_SUBPREC; i++) {
-            int side_len;
-            side_len = (i << 1) - 1;
-            x -= dxdu + dxdv;
-            y -= dydu + dydv;
-            w -= dwdu + dwdv;
-            for (j = 0; j < 4 * side_len; j++) {
-                int      dir;
-                qr_hom_cell_fproject(pc, _cell, x, y, w);
-                match = qr_alignment_pattern_fetch(p, pc[0], pc[1], _img, _width, _height);
-                dist = qr_hamming_dist(match, 0x1F8D63F, best_dist + 1);
-                if (dist < best_dist) {
-                    best_match = match;
-                    best_dist = dist;
-                    bestx = pc[0];
-                    besty = pc[1];
-                }
-                if (j < 2 * side_len) {
-                    dir = j >= side_len;
-                    x += _cell->fwd[0][dir];
-                    y += _cell->fwd[1][dir];
-                    w += _cell->fwd[2][dir];
-                }
-                else {
-                    dir = j >= 3 * side_len;
-                    x -= _cell->fwd[0][dir];
-                    y -= _cell->fwd[1][dir];
-                    w -= _cell->fwd[2][dir];
-                }
-                if (!best_dist)break;
+}
+
+/*Searches every position at most _r modules around the target location, in
+   concentric squares, for the one where the template _p matches best.
+  _best and *_match hold the target and the template read there on input, and
+   the first of the best positions and the template read there on output.
+  Returns the Hamming distance of that match.
+  Each position is compared coarse to fine with qr_alignment_pattern_match(),
+   and dropped as soon as it differs in as many modules as the best match so
+   far: it could at most tie it, and ties go to the position visited first.*/
+static int qr_alignment_pattern_spiral(qr_point _best, unsigned* _match,
+    qr_point _p[5][5], const qr_hom_cell* _cell, int _u, int _v, int _r,
+    qr_bin_image* _img, int _width, int _height) {
+    qr_point pc;
+    unsigned match;
+    int      best_dist;
+    int      dist;
+    int      u;
+    int      v;
+    int      x;
+    int      y;
+    int      w;
+    int      i;
+    int      j;
+    best_dist = qr_hamming_dist(*_match, QR_ALIGN_TEMPLATE, 25);
+    u = _u - _cell->u0;
+    v = _v - _cell->v0;
+    x = _cell->fwd[0][0] * u + _cell->fwd[0][1] * v + _cell->fwd[0][2] << QR_ALIGN_SUBPREC;
+    y = _cell->fwd[1][0] * u + _cell->fwd[1][1] * v + _cell->fwd[1][2] << QR_ALIGN_SUBPREC;
+    w = _cell->fwd[2][0] * u + _cell->fwd[2][1] * v + _cell->fwd[2][2] << QR_ALIGN_SUBPREC;
+    for (i = 1; i < _r << QR_ALIGN_SUBPREC && best_dist > 0; i++) {
+        int side_len;
+        side_len = (i << 1) - 1;
+        x -= _cell->fwd[0][0] + _cell->fwd[0][1];
+        y -= _cell->fwd[1][0] + _cell->fwd[1][1];
+        w -= _cell->fwd[2][0] + _cell->fwd[2][1];
+        for (j = 0; j < 4 * side_len; j++) {
+            int      dir;
+            qr_hom_cell_fproject(pc, _cell, x, y, w);
+            dist = qr_alignment_pattern_match(&match, _p, pc[0], pc[1],
+                best_dist, _img, _width, _height);
+            if (dist < best_dist) {
+                *_match = match;
+                best_dist = dist;
+                _best[0] = pc[0];
+                _best[1] = pc[1];
+            }
+            if (j < 2 * side_len) {
+                dir = j >= side_len;
+                x += _cell->fwd[0][dir];
+                y += _cell->fwd[1][dir];
+                w += _cell->fwd[2][dir];
+            }
+            else {
+                dir = j >= 3 * side_len;
+                x -= _cell->fwd[0][dir];
+                y -= _cell->fwd[1][dir];
+                w -= _cell->fwd[2][dir];
             }
             if (!best_dist)break;
         }
     }
-    /*If the best result we got was sufficiently bad, reject the match.
-      If we're wrong and we include it, we can grossly distort the nearby
-       region, whereas using the initial starting point should at least be
-       consistent with the geometry we already have.*/
-    if (best_dist > 6) {
-        _p[0] = p[2][2][0];
-        _p[1] = p[2][2][1];
-        return -1;
-    }
-    /*Now try to get a more accurate location of the pattern center.*/
-    dx = bestx - p[2][2][0];
-    dy = besty - p[2][2][1];
-    memset(nc, 0, sizeof(nc));
-    memset(c, 0, sizeof(c));
-    /*We consider 8 lines across the finder pattern in turn.
+    return best_dist;
+}
+
+/*Searches for an alignment pattern near the given location.*/
+static int qr_alignment_pattern_search(qr_point _p, const qr_hom_cell* _cell,
+    int _u, int _v, int _r, qr_bin_image* _img, int _width, int _height) {
+    qr_point c[4];
+    int      nc[4];
+    qr_point p[5][5];
+    qr_point pc;
+    qr_point best;
+    unsigned best_match;
+    int      best_dist;
+    int      bestx;
+    int      besty;
+    unsigned match;
+    int      dist;
+    int      dx;
+    int      dy;
+    int      i;
+    qr_alignment_pattern_template(p, _cell, _u, _v);
+    best[0] = p[2][2][0];
+    best[1] = p[2][2][1];
+    best_match = qr_alignment_pattern_fetch(p, best[0], best[1],
+        _img, _width, _height);
+    best_dist = qr_alignment_pattern_spiral(best, &best_match, p, _cell,
+        _u, _v, _r, _img, _width, _height);
+    bestx = best[0];
+    besty = best[1];
+    /*If the best result we got was sufficiently bad, reject the match.
+      If we're wrong and we include it, we can grossly distort the nearby
+       region, whereas using the initial starting point should at least be
+       consistent with the geometry we already have.*/
+    if (best_dist > 6) {
+        _p[0] = p[2][2][0];
+        _p[1] = p[2][2][1];
+        return -1;
+    }
+    /*Now try to get a more accurate location of the pattern center.*/
+    dx = bestx - p[2][2][0];
+    dy = besty - p[2][2][1];
+    memset(nc, 0, sizeof(nc));
+    memset(c, 0, sizeof(c));
+    /*We consider 8 lines across the finder pattern in turn.
       If we actually found a symmetric pattern along that line, search for its
        exact center in the image.
       There are plenty more lines we could use if these don't work, but if we've
@@ -1853,7 +2980,7 @@ static int qr_alignment_pattern_search(qr_point _p, const qr_hom_cell* _cell,
             if (x1 < 0 || x1 >= _width)continue;
             y1 = p[4 - MASK_COORDS[i][1]][4 - MASK_COORDS[i][0]][1] + dy >> QR_FINDER_SUBPREC;
             if (y1 < 0 || y1 >= _height)continue;
-            if (!qr_finder_locate_crossing(_img, _width, _height, x0, y0, x1, y1, i & 1, pc)) {
+            if (!qr_finder_locate_crossing(_img, x0, y0, x1, y1, i & 1, pc)) {
                 int w;
                 int cx;
                 int cy;
@@ -1901,8 +3028,9 @@ static int qr_alignment_pattern_search(qr_point _p, const qr_hom_cell* _cell,
         dx = QR_DIVROUND(c[0][0], nc[0]);
         dy = QR_DIVROUND(c[0][1], nc[0]);
         /*But only if it doesn't make things too much worse.*/
-        match = qr_alignment_pattern_fetch(p, bestx + dx, besty + dy, _img, _width, _height);
-        dist = qr_hamming_dist(match, 0x1F8D63F, best_dist + 1);
+        match = qr_alignment_pattern_fetch(p, bestx + dx, besty + dy,
+            _img, _width, _height);
+        dist = qr_hamming_dist(match, QR_ALIGN_TEMPLATE, best_dist + 1);
         if (dist <= best_dist + 1) {
             bestx += dx;
             besty += dy;
@@ -1914,8 +3042,9 @@ static int qr_alignment_pattern_search(qr_point _p, const qr_hom_cell* _cell,
 }
 
 static int qr_hom_fit(qr_hom* _hom, qr_finder* _ul, qr_finder* _ur,
-    qr_finder* _dl, qr_point _p[4], const qr_aff* _aff, isaac_ctx* _isaac,
-    const unsigned char* _img, int _width, int _height) {
+    qr_finder* _dl, qr_point _p[4], const qr_aff* _aff, qr_try_stats* _stats,
+    qr_bin_image* _img, int _width, int _height, zbar_arena_t* _arena) {
+    zbar_arena_mark_t arena_mark;
     qr_point* b;
     int       nb;
     int       cb;
@@ -1968,16 +3097,16 @@ static int qr_hom_fit(qr_hom* _hom, qr_finder* _ul, qr_finder* _ur,
        /*Fitting lines is easy for the edges on which we have two finder patterns.
          After the fit, UL is guaranteed to be on the proper side, but if either of
           the other two finder patterns aren't, something is wrong.*/
-    qr_finder_ransac(_ul, _aff, _isaac, 0);
-    qr_finder_ransac(_dl, _aff, _isaac, 0);
-    qr_line_fit_finder_pair(l[0], _aff, _ul, _dl, 0);
+    qr_finder_ransac(_ul, _aff, _stats, 0);
+    qr_finder_ransac(_dl, _aff, _stats, 0);
+    qr_line_fit_finder_pair(l[0], _aff, _ul, _dl, 0, _arena);
     if (qr_line_eval(l[0], _dl->c->pos[0], _dl->c->pos[1]) < 0 ||
         qr_line_eval(l[0], _ur->c->pos[0], _ur->c->pos[1]) < 0) {
         return -1;
     }
-    qr_finder_ransac(_ul, _aff, _isaac, 2);
-    qr_finder_ransac(_ur, _aff, _isaac, 2);
-    qr_line_fit_finder_pair(l[2], _aff, _ul, _ur, 2);
+    qr_finder_ransac(_ul, _aff, _stats, 2);
+    qr_finder_ransac(_ur, _aff, _stats, 2);
+    qr_line_fit_finder_pair(l[2], _aff, _ul, _ur, 2, _arena);
     if (qr_line_eval(l[2], _dl->c->pos[0], _dl->c->pos[1]) < 0 ||
         qr_line_eval(l[2], _ur->c->pos[0], _ur->c->pos[1]) < 0) {
         return -1;
@@ -1996,8 +3125,8 @@ static int qr_hom_fit(qr_hom* _hom, qr_finder* _ul, qr_finder* _ur,
        additional sample point.
       At the end, we re-fit the line using all such sample points found.*/
     drv = _ur->size[1] >> 1;
-    qr_finder_ransac(_ur, _aff, _isaac, 1);
-    if (qr_line_fit_finder_edge(l[1], _ur, 1, _aff->res) >= 0) {
+    qr_finder_ransac(_ur, _aff, _stats, 1);
+    if (qr_line_fit_finder_edge(l[1], _ur, 1, _aff->res, _arena) >= 0) {
         if (qr_line_eval(l[1], _ul->c->pos[0], _ul->c->pos[1]) < 0 ||
             qr_line_eval(l[1], _dl->c->pos[0], _dl->c->pos[1]) < 0) {
             return -1;
@@ -2010,8 +3139,8 @@ static int qr_hom_fit(qr_hom* _hom, qr_finder* _ul, qr_finder* _ur,
     ru = _ur->o[0] + 3 * _ur->size[0] - 2 * dru;
     rv = _ur->o[1] - 2 * drv;
     dbu = _dl->size[0] >> 1;
-    qr_finder_ransac(_dl, _aff, _isaac, 3);
-    if (qr_line_fit_finder_edge(l[3], _dl, 3, _aff->res) >= 0) {
+    qr_finder_ransac(_dl, _aff, _stats, 3);
+    if (qr_line_fit_finder_edge(l[3], _dl, 3, _aff->res, _arena) >= 0) {
         if (qr_line_eval(l[3], _ul->c->pos[0], _ul->c->pos[1]) < 0 ||
             qr_line_eval(l[3], _ur->c->pos[0], _ur->c->pos[1]) < 0) {
             return -1;
@@ -2026,13 +3155,14 @@ static int qr_hom_fit(qr_hom* _hom, qr_finder* _ul, qr_finder* _ur,
     /*Set up the initial point lists.*/
     nr = rlastfit = _ur->ninliers[1];
     cr = nr + (_dl->o[1] - rv + drv - 1) / drv;
-    r = (qr_point*)malloc(cr * sizeof(*r));
+    arena_mark = _zbar_arena_mark(_arena);
+    r = (qr_point*)_zbar_arena_alloc(_arena, cr * sizeof(*r));
     for (i = 0; i < _ur->ninliers[1]; i++) {
         memcpy(r[i], _ur->edge_pts[1][i].pos, sizeof(r[i]));
     }
     nb = blastfit = _dl->ninliers[3];
     cb = nb + (_ur->o[0] - bu + dbu - 1) / dbu;
-    b = (qr_point*)malloc(cb * sizeof(*b));
+    b = (qr_point*)_zbar_arena_alloc(_arena, cb * sizeof(*b));
     for (i = 0; i < _dl->ninliers[3]; i++) {
         memcpy(b[i], _dl->edge_pts[3][i].pos, sizeof(b[i]));
     }
@@ -2075,12 +3205,13 @@ static int qr_hom_fit(qr_hom* _hom, qr_finder* _ul, qr_finder* _ur,
             x1 = rx - drxj >> _aff->res + QR_FINDER_SUBPREC;
             y1 = ry - dryj >> _aff->res + QR_FINDER_SUBPREC;
             if (nr >= cr) {
+                r = (qr_point*)_zbar_arena_realloc(_arena, r,
+                    cr * sizeof(*r), (cr << 1 | 1) * sizeof(*r));
                 cr = cr << 1 | 1;
-                r = (qr_point*)realloc(r, cr * sizeof(*r));
             }
             ret = qr_finder_quick_crossing_check(_img, _width, _height, x0, y0, x1, y1, 1);
             if (!ret) {
-                ret = qr_finder_locate_crossing(_img, _width, _height, x0, y0, x1, y1, 1, r[nr]);
+                ret = qr_finder_locate_crossing(_img, x0, y0, x1, y1, 1, r[nr]);
             }
             if (ret >= 0) {
                 if (!ret) {
@@ -2119,12 +3250,13 @@ static int qr_hom_fit(qr_hom* _hom, qr_finder* _ul, qr_finder* _ur,
             x1 = bx - dbxj >> _aff->res + QR_FINDER_SUBPREC;
             y1 = by - dbyj >> _aff->res + QR_FINDER_SUBPREC;
             if (nb >= cb) {
+                b = (qr_point*)_zbar_arena_realloc(_arena, b,
+                    cb * sizeof(*b), (cb << 1 | 1) * sizeof(*b));
                 cb = cb << 1 | 1;
-                b = (qr_point*)realloc(b, cb * sizeof(*b));
             }
             ret = qr_finder_quick_crossing_check(_img, _width, _height, x0, y0, x1, y1, 1);
             if (!ret) {
-                ret = qr_finder_locate_crossing(_img, _width, _height, x0, y0, x1, y1, 1, b[nb]);
+                ret = qr_finder_locate_crossing(_img, x0, y0, x1, y1, 1, b[nb]);
             }
             if (ret >= 0) {
                 if (!ret) {
@@ -2174,7 +3306,6 @@ static int qr_hom_fit(qr_hom* _hom, qr_finder* _ul, qr_finder* _ur,
         l[1][1] = -_aff->fwd[0][1] + round >> shift;
         l[1][2] = -(l[1][0] * p[0] + l[1][1] * p[1]);
     }
-    free(r);
     if (nb > 1)qr_line_fit_points(l[3], b, nb, _aff->res);
     else {
         qr_aff_project(p, _aff, _dl->o[0], _dl->o[1] + 3 * _dl->size[1]);
@@ -2186,7 +3317,7 @@ static int qr_hom_fit(qr_hom* _hom, qr_finder* _ul, qr_finder* _ur,
         l[3][1] = -_aff->fwd[0][0] + round >> shift;
         l[3][2] = -(l[1][0] * p[0] + l[1][1] * p[1]);
     }
-    free(b);
+    _zbar_arena_release(_arena, arena_mark);
     for (i = 0; i < 4; i++) {
         if (qr_line_isect(_p[i], l[i & 1], l[2 + (i >> 1)]) < 0)return -1;
         /*It's plausible for points to be somewhat outside the image, but too far
@@ -2318,7 +3449,7 @@ static unsigned bch18_6_encode(unsigned _x) {
 
 /*Reads the version bits near a finder module and decodes the version number.*/
 static int qr_finder_version_decode(qr_finder* _f, const qr_hom* _hom,
-    const unsigned char* _img, int _width, int _height, int _dir) {
+    qr_bin_image* _img, int _width, int _height, int _dir) {
     qr_point q;
     unsigned v;
     int      x0;
@@ -2395,7 +3526,7 @@ static int qr_finder_version_decode(qr_finder* _f, const qr_hom* _hom,
 /*Reads the format info bits near the finder modules and decodes them.*/
 static int qr_finder_fmt_info_decode(qr_finder* _ul, qr_finder* _ur,
     qr_finder* _dl, const qr_hom* _hom,
-    const unsigned char* _img, int _width, int _height) {
+    qr_bin_image* _img, int _width, int _height) {
     qr_point p;
     unsigned lo[2];
     unsigned hi[2];
@@ -2537,14 +3668,14 @@ static int qr_finder_fmt_info_decode(qr_finder* _ul, qr_finder* _ur,
    during decode.*/
 struct qr_sampling_grid {
     qr_hom_cell* cells[6];
-    unsigned* fpmask;
+    const unsigned* fpmask;
     int             cell_limits[6];
     int             ncells;
 };
 
 
 /*Mark a given region as belonging to the function pattern.*/
-static void qr_sampling_grid_fp_mask_rect(qr_sampling_grid* _grid, int _dim,
+static void qr_fp_mask_rect(unsigned* _fpmask, int _dim,
     int _u, int _v, int _w, int _h) {
     int i;
     int j;
@@ -2553,7 +3684,7 @@ static void qr_sampling_grid_fp_mask_rect(qr_sampling_grid* _grid, int _dim,
     /*Note that we store bits column-wise, since that's how they're read out of
        the grid.*/
     for (j = _u; j < _u + _w; j++)for (i = _v; i < _v + _h; i++) {
-        _grid->fpmask[j * stride + (i >> QR_INT_LOGBITS)] |= 1 << (i & QR_INT_BITS - 1);
+        _fpmask[j * stride + (i >> QR_INT_LOGBITS)] |= 1 << (i & QR_INT_BITS - 1);
     }
 }
 
@@ -2575,6 +3706,54 @@ static const unsigned char QR_ALIGNMENT_SPACING[34] = {
   24,26,26,26,28,28
 };
 
+/*Computes the row and column coordinates of the alignment patterns of a
+   version >= 2.
+  Return: The number of coordinates.*/
+static int qr_alignment_pattern_positions(int _align_pos[7], int _version) {
+    int nalign;
+    int i;
+    nalign = (_version / 7) + 2;
+    _align_pos[0] = 6;
+    _align_pos[nalign - 1] = 17 + (_version << 2) - 7;
+    if (_version > 6) {
+        int d;
+        d = QR_ALIGNMENT_SPACING[_version - 7];
+        for (i = nalign - 1; i-- > 1;)_align_pos[i] = _align_pos[i + 1] - d;
+    }
+    return nalign;
+}
+
+/*Marks the function pattern of a version in a zeroed mask.*/
+static void qr_fp_mask_fill(unsigned* _fpmask, int _version) {
+    int dim;
+    dim = 17 + (_version << 2);
+    /*Mask out the finder patterns (and separators and format info bits).*/
+    qr_fp_mask_rect(_fpmask, dim, 0, 0, 9, 9);
+    qr_fp_mask_rect(_fpmask, dim, 0, dim - 8, 9, 8);
+    qr_fp_mask_rect(_fpmask, dim, dim - 8, 0, 8, 9);
+    /*Mask out the version number bits.*/
+    if (_version > 6) {
+        qr_fp_mask_rect(_fpmask, dim, 0, dim - 11, 6, 3);
+        qr_fp_mask_rect(_fpmask, dim, dim - 11, 0, 3, 6);
+    }
+    /*Mask out the timing patterns.*/
+    qr_fp_mask_rect(_fpmask, dim, 9, 6, dim - 17, 1);
+    qr_fp_mask_rect(_fpmask, dim, 6, 9, 1, dim - 17);
+    /*Mask out the alignment patterns, except at the three corners that use a
+       finder pattern instead.*/
+    if (_version >= 2) {
+        int align_pos[7];
+        int nalign;
+        int i;
+        int j;
+        nalign = qr_alignment_pattern_positions(align_pos, _version);
+        for (i = 0; i < nalign; i++)for (j = 0; j < nalign; j++) {
+            if (((i == 0 || i == nalign - 1) && j == 0) || (i == 0 && j == nalign - 1))continue;
+            qr_fp_mask_rect(_fpmask, dim, align_pos[j] - 2, align_pos[i] - 2, 5, 5);
+        }
+    }
+}
+
 static __inline void qr_svg_points(const char* cls,
     qr_point* p,
     int n)
@@ -2596,10 +3775,13 @@ static __inline void qr_svg_points(const char* cls,
   _img:      The binary input image.
   _width:    The width of the input image.
   _height:   The height of the input image.
+  _fpmask:   The function pattern mask of the version (see qr_fp_mask_fill()).
+  _arena:    The arena to allocate the grid from.
   Return: 0 on success, or a negative value on error.*/
 static void qr_sampling_grid_init(qr_sampling_grid* _grid, int _version,
     const qr_point _ul_pos, const qr_point _ur_pos, const qr_point _dl_pos,
-    qr_point _p[4], const unsigned char* _img, int _width, int _height) {
+    qr_point _p[4], qr_bin_image* _img, int _width, int _height,
+    const unsigned* _fpmask, zbar_arena_t* _arena) {
     qr_hom_cell          base_cell;
     int                  align_pos[7];
     int                  dim;
@@ -2612,24 +3794,10 @@ static void qr_sampling_grid_init(qr_sampling_grid* _grid, int _version,
         _p[0][0], _p[0][1], _p[1][0], _p[1][1], _p[2][0], _p[2][1], _p[3][0], _p[3][1]);
     /*Allocate the array of cells.*/
     _grid->ncells = nalign - 1;
-    _grid->cells[0] = (qr_hom_cell*)malloc(
+    _grid->cells[0] = (qr_hom_cell*)_zbar_arena_alloc(_arena,
         (nalign - 1) * (nalign - 1) * sizeof(*_grid->cells[0]));
     for (i = 1; i < _grid->ncells; i++)_grid->cells[i] = _grid->cells[i - 1] + _grid->ncells;
-    /*Initialize the function pattern mask.*/
-    _grid->fpmask = (unsigned*)calloc(dim,
-        (dim + QR_INT_BITS - 1 >> QR_INT_LOGBITS) * sizeof(*_grid->fpmask));
-    /*Mask out the finder patterns (and separators and format info bits).*/
-    qr_sampling_grid_fp_mask_rect(_grid, dim, 0, 0, 9, 9);
-    qr_sampling_grid_fp_mask_rect(_grid, dim, 0, dim - 8, 9, 8);
-    qr_sampling_grid_fp_mask_rect(_grid, dim, dim - 8, 0, 8, 9);
-    /*Mask out the version number bits.*/
-    if (_version > 6) {
-        qr_sampling_grid_fp_mask_rect(_grid, dim, 0, dim - 11, 6, 3);
-        qr_sampling_grid_fp_mask_rect(_grid, dim, dim - 11, 0, 3, 6);
-    }
-    /*Mask out the timing patterns.*/
-    qr_sampling_grid_fp_mask_rect(_grid, dim, 9, 6, dim - 17, 1);
-    qr_sampling_grid_fp_mask_rect(_grid, dim, 6, 9, 1, dim - 17);
+    _grid->fpmask = _fpmask;
     /*If we have no alignment patterns (e.g., this is a version 1 code), just use
        the base cell and hope it's good enough.*/
     if (_version < 2)memcpy(_grid->cells[0], &base_cell, sizeof(base_cell));
@@ -2638,16 +3806,10 @@ static void qr_sampling_grid_init(qr_sampling_grid* _grid, int _version,
         qr_point* p;
         int       j;
         int       k;
-        q = (qr_point*)malloc(nalign * nalign * sizeof(*q));
-        p = (qr_point*)malloc(nalign * nalign * sizeof(*p));
+        q = (qr_point*)_zbar_arena_alloc(_arena, nalign * nalign * sizeof(*q));
+        p = (qr_point*)_zbar_arena_alloc(_arena, nalign * nalign * sizeof(*p));
         /*Initialize the alignment pattern position list.*/
-        align_pos[0] = 6;
-        align_pos[nalign - 1] = dim - 7;
-        if (_version > 6) {
-            int d;
-            d = QR_ALIGNMENT_SPACING[_version - 7];
-            for (i = nalign - 1; i-- > 1;)align_pos[i] = align_pos[i + 1] - d;
-        }
+        qr_alignment_pattern_positions(align_pos, _version);
         /*Three of the corners use a finder pattern instead of a separate
            alignment pattern.*/
         q[0][0] = 3;
@@ -2679,8 +3841,6 @@ static void qr_sampling_grid_init(qr_sampling_grid* _grid, int _version,
                 v = align_pos[i];
                 q[k][0] = u;
                 q[k][1] = v;
-                /*Mask out the alignment pattern.*/
-                qr_sampling_grid_fp_mask_rect(_grid, dim, u - 2, v - 2, 5, 5);
                 /*Pick a cell to use to govern the alignment pattern search.*/
                 if (i > 1 && j > 1) {
                     qr_point p0;
@@ -2727,8 +3887,6 @@ static void qr_sampling_grid_init(qr_sampling_grid* _grid, int _version,
             }
         }
         qr_svg_points("align", p, nalign * nalign);
-        free(q);
-        free(p);
     }
     /*Set the limits over which each cell is used.*/
     memcpy(_grid->cell_limits, align_pos + 1,
@@ -2758,16 +3916,12 @@ static void qr_sampling_grid_init(qr_sampling_grid* _grid, int _version,
        transitions to the ideal grid locations.*/
 }
 
-static void qr_sampling_grid_clear(qr_sampling_grid* _grid) {
-    free(_grid->fpmask);
-    free(_grid->cells[0]);
-}
 
 
 
 #if defined(QR_DEBUG)
 static void qr_sampling_grid_dump(qr_sampling_grid* _grid, int _version,
-    const unsigned char* _img, int _width, int _height) {
+    qr_bin_image* _img, int _width, int _height) {
     unsigned char* gimg;
     FILE* fout;
     int            dim;
@@ -2802,9 +3956,8 @@ static void qr_sampling_grid_dump(qr_sampling_grid* _grid, int _version,
             y = cell->fwd[1][0] * u + cell->fwd[1][1] * v + (cell->fwd[1][2] << QR_ALIGN_SUBPREC);
             w = cell->fwd[2][0] * u + cell->fwd[2][1] * v + (cell->fwd[2][2] << QR_ALIGN_SUBPREC);
             qr_hom_cell_fproject(p, cell, x, y, w);
-            gimg[i * dim + j] = _img[
-                QR_CLAMPI(0, p[1] >> QR_FINDER_SUBPREC, _height - 1) * _width +
-                    QR_CLAMPI(0, p[0] >> QR_FINDER_SUBPREC, _width - 1)];
+            gimg[i * dim + j] = (unsigned char)
+                -qr_img_get_bit(_img, _width, _height, p[0], p[1]);
         }
     }
     for (v = 0; v < 17 + (_version << 2); v++)for (u = 0; u < 17 + (_version << 2); u++) {
@@ -2947,17 +4100,25 @@ static void qr_data_mask_fill(unsigned* _mask, int _dim, int _pattern) {
     }
 }
 
+/*The number of modules of a row of a cell projected at once.*/
+#define QR_SAMPLE_RUN (16)
+
+/*Reads the data bits out of the image.
+  _mask:  The data mask of the code, as filled by qr_data_mask_fill().
+  _ready: The pixels [_ready[0], _ready[2]) x [_ready[1], _ready[3]), which
+           are already binarized, so runs that fall inside are read straight
+           from the bit plane.*/
 static void qr_sampling_grid_sample(const qr_sampling_grid* _grid,
-    unsigned* _data_bits, int _dim, int _fmt_info,
-    const unsigned char* _img, int _width, int _height) {
+    unsigned* _data_bits, int _dim, const unsigned* _mask, const int _ready[4],
+    qr_bin_image* _img, int _width, int _height) {
     int stride;
     int u0;
     int u1;
     int j;
+    stride = _dim + QR_INT_BITS - 1 >> QR_INT_LOGBITS;
     /*We initialize the buffer with the data mask and XOR bits into it as we read
        them out of the image instead of unmasking in a separate step.*/
-    qr_data_mask_fill(_data_bits, _dim, _fmt_info & 7);
-    stride = _dim + QR_INT_BITS - 1 >> QR_INT_LOGBITS;
+    memcpy(_data_bits, _mask, _dim * stride * sizeof(*_data_bits));
     u0 = 0;
     svg_path_start("sampling-grid", 1, 0, 0);
     /*We read data cell-by-cell to avoid having to constantly change which
@@ -2991,22 +4152,65 @@ static void qr_sampling_grid_sample(const qr_sampling_grid* _grid,
                 int y;
                 int w;
                 int v;
+                int n;
                 x = x0;
                 y = y0;
                 w = w0;
-                for (v = v0; v < v1; v++) {
-                    /*Skip doing all the divisions and bounds checks if the bit is in the
-                       function pattern.*/
-                    if (!qr_sampling_grid_is_in_fp(_grid, _dim, u, v)) {
-                        qr_point p;
-                        qr_hom_cell_fproject(p, cell, x, y, w);
-                        _data_bits[u * stride + (v >> QR_INT_LOGBITS)] ^=
-                            qr_img_get_bit(_img, _width, _height, p[0], p[1]) << (v & QR_INT_BITS - 1);
-                        svg_path_moveto(SVG_ABS, p[0], p[1]);
+                /*Project a run of the row at a time with the vector kernels.
+                  This also projects the bits in the function pattern, but skipping
+                   them would break up the runs.*/
+                for (v = v0; v < v1; v += n) {
+                    int      px[QR_SAMPLE_RUN];
+                    int      py[QR_SAMPLE_RUN];
+                    unsigned bits;
+                    int      inside;
+                    int      wi;
+                    int      sh;
+                    int      k;
+                    n = QR_MINI(v1 - v, QR_SAMPLE_RUN);
+                    qr_hom_cell_fproject_row(px, py, cell, x, y, w, n);
+                    /*Clamp the run to the image, as qr_img_get_bit() does.*/
+                    inside = 1;
+                    for (k = 0; k < n; k++) {
+                        px[k] = QR_CLAMPI(0, px[k] >> QR_FINDER_SUBPREC, _width - 1);
+                        py[k] = QR_CLAMPI(0, py[k] >> QR_FINDER_SUBPREC, _height - 1);
+                        inside &= px[k] >= _ready[0] && px[k] < _ready[2] &&
+                            py[k] >= _ready[1] && py[k] < _ready[3];
+                    }
+                    /*Gather the bits of the run, straight from the bit plane if
+                       it is all binarized, and XOR them into the data bits but
+                       for the ones in the function pattern.*/
+                    bits = 0;
+                    if (inside) {
+                        for (k = 0; k < n; k++)
+                            bits |= (unsigned)qr_bin_image_bit(_img, px[k], py[k]) << k;
+                    }
+                    else {
+                        /*Skip the function pattern here, which might be in tiles
+                           that need not be binarized otherwise.*/
+                        for (k = 0; k < n; k++)
+                            if (!qr_sampling_grid_is_in_fp(_grid, _dim, u, v + k)) {
+                                bits |= (unsigned)qr_bin_image_get(_img, px[k], py[k]) << k;
+                            }
+                    }
+                    wi = u * stride + (v >> QR_INT_LOGBITS);
+                    sh = v & QR_INT_BITS - 1;
+                    _data_bits[wi] ^= bits << sh & ~_grid->fpmask[wi];
+                    if (sh + n > QR_INT_BITS) {
+                        _data_bits[wi + 1] ^= bits >> QR_INT_BITS - sh &
+                            ~_grid->fpmask[wi + 1];
+                    }
+#if defined(QR_DEBUG)
+                    for (k = 0; k < n; k++) {
+                        if (!qr_sampling_grid_is_in_fp(_grid, _dim, u, v + k)) {
+                            svg_path_moveto(SVG_ABS, px[k] << QR_FINDER_SUBPREC,
+                                py[k] << QR_FINDER_SUBPREC);
+                        }
                     }
-                    x += cell->fwd[0][1];
-                    y += cell->fwd[1][1];
-                    w += cell->fwd[2][1];
+#endif
+                    x += n * cell->fwd[0][1];
+                    y += n * cell->fwd[1][1];
+                    w += n * cell->fwd[2][1];
                 }
                 x0 += cell->fwd[0][0];
                 y0 += cell->fwd[1][0];
@@ -3019,103 +4223,139 @@ static void qr_sampling_grid_sample(const qr_sampling_grid* _grid,
     svg_path_end();
 }
 
-/*Arranges the sample bits read by qr_sampling_grid_sample() into bytes and
-   groups those bytes into Reed-Solomon blocks.
-  The individual block pointers are destroyed by this routine.*/
-static void qr_samples_unpack(unsigned char** _blocks, int _nblocks,
-    int _nshort_data, int _nshort_blocks, const unsigned* _data_bits,
+/*Markers in a codeword placement (see qr_samples_place()); no bit index of a
+   version 40 code is this large.*/
+#define QR_PLACE_DOWN (0xFFFE)
+#define QR_PLACE_UP   (0xFFFF)
+
+/*Computes where each bit of each codeword lies in the sample bits read by
+   qr_sampling_grid_sample(), so qr_samples_gather() can pick them out directly.
+  The modules are read in pairs of columns from right to left, going up and
+   down alternately and skipping the function pattern, and the bytes they form
+   are dealt out to the Reed-Solomon blocks in turn.
+  Most codewords fill two columns of four rows each within a single word of
+   both; their entries are replaced by the bit indices of the lowest of those
+   rows and a marker, so they can be read four bits at a time.
+  _placement: Returns the bit index in the samples of bit 7-b of byte k of the
+               blocks at entry 8*k+b, with the blocks stored one after another.
+              If entry 8*k+1 is QR_PLACE_UP or QR_PLACE_DOWN instead, then
+               entries 8*k and 8*k+2 give the lowest row of the right and left
+               column, read in that direction.
+  _block_sz:  The size of the short blocks.
+  _fp_mask:   The function pattern mask of the version.*/
+static void qr_samples_place(unsigned short* _placement, int _ncodewords,
+    int _nblocks, int _nshort_data, int _block_sz, int _nshort_blocks,
     const unsigned* _fp_mask, int _dim) {
-    unsigned bits;
-    int      biti;
-    int      stride;
-    int      blocki;
-    int      blockj;
-    int      i;
-    int      j;
-    stride = _dim + QR_INT_BITS - 1 >> QR_INT_LOGBITS;
+    /*Version 40-H has the most blocks.*/
+    int offs[81];
+    int nbytes;
+    int biti;
+    int stride;
+    int blocki;
+    int blockj;
+    int up;
+    int i;
+    int j;
+    stride = (_dim + QR_INT_BITS - 1) >> QR_INT_LOGBITS;
+    for (i = 0; i < _nblocks; i++) {
+        offs[i] = (i * _block_sz + QR_MAXI(i - _nshort_blocks, 0)) << 3;
+    }
     /*If _all_ the blocks are short, don't skip anything (see below).*/
     if (_nshort_blocks >= _nblocks)_nshort_blocks = 0;
-    /*Scan columns in pairs from right to left.*/
-    bits = 0;
-    for (blocki = blockj = biti = 0, j = _dim - 1; j > 0; j -= 2) {
-        unsigned data1;
-        unsigned data2;
-        unsigned fp_mask1;
-        unsigned fp_mask2;
-        int      nbits;
-        int      l;
-        /*Scan up a pair of columns.*/
-        nbits = (_dim - 1 & QR_INT_BITS - 1) + 1;
-        l = j * stride;
-        for (i = stride; i-- > 0;) {
-            data1 = _data_bits[l + i];
-            fp_mask1 = _fp_mask[l + i];
-            data2 = _data_bits[l + i - stride];
-            fp_mask2 = _fp_mask[l + i - stride];
-            while (nbits-- > 0) {
-                /*Pull a bit from the right column.*/
-                if (!(fp_mask1 >> nbits & 1)) {
-                    bits = bits << 1 | data1 >> nbits & 1;
-                    biti++;
-                }
-                /*Pull a bit from the left column.*/
-                if (!(fp_mask2 >> nbits & 1)) {
-                    bits = bits << 1 | data2 >> nbits & 1;
-                    biti++;
+    nbytes = blocki = blockj = biti = 0;
+    for (up = 1, j = _dim - 1; j > 0; up = !up, j -= 2) {
+        /*Skip the column with the vertical timing pattern.*/
+        if (j == 6)j--;
+        for (i = 0; i < _dim; i++) {
+            int u;
+            int v;
+            v = up ? _dim - 1 - i : i;
+            /*Pull a bit from the right column, then one from the left.*/
+            for (u = j; u >= j - 1; u--) {
+                if (_fp_mask[u * stride + (v >> QR_INT_LOGBITS)] >> (v & (QR_INT_BITS - 1)) & 1) {
+                    continue;
                 }
-                /*If we finished a byte, drop it in a block.*/
-                if (biti >= 8) {
-                    biti -= 8;
-                    *_blocks[blocki++]++ = (unsigned char)(bits >> biti);
+                /*The remainder bits after the last codeword are not used.*/
+                if (nbytes >= _ncodewords)continue;
+                _placement[offs[blocki] + biti] = (unsigned short)((u * stride << QR_INT_LOGBITS) + v);
+                /*If we finished a byte, move on to the next block.*/
+                if (++biti >= 8) {
+                    biti = 0;
+                    nbytes++;
+                    offs[blocki++] += 8;
                     /*For whatever reason, the long blocks are at the _end_ of the list,
                        instead of the beginning.
                       Even worse, the extra bytes they get come at the end of the data
                        bytes, before the parity bytes.
                       Hence the logic here: when we've filled up the data portion of the
-                       short blocks, skip directly to the long blocks for the next byte.
-                      It's also the reason we increment _blocks[blocki] on each store,
-                       instead of just indexing with blockj (after this iteration the
-                       number of bytes in each block differs).*/
+                       short blocks, skip directly to the long blocks for the next byte.*/
                     if (blocki >= _nblocks)blocki = ++blockj == _nshort_data ? _nshort_blocks : 0;
                 }
             }
-            nbits = QR_INT_BITS;
         }
-        j -= 2;
-        /*Skip the column with the vertical timing pattern.*/
-        if (j == 6)j--;
-        /*Scan down a pair of columns.*/
-        l = j * stride;
-        for (i = 0; i < stride; i++) {
-            data1 = _data_bits[l + i];
-            fp_mask1 = _fp_mask[l + i];
-            data2 = _data_bits[l + i - stride];
-            fp_mask2 = _fp_mask[l + i - stride];
-            nbits = QR_MINI(_dim - (i << QR_INT_LOGBITS), QR_INT_BITS);
-            while (nbits-- > 0) {
-                /*Pull a bit from the right column.*/
-                if (!(fp_mask1 & 1)) {
-                    bits = bits << 1 | data1 & 1;
-                    biti++;
-                }
-                data1 >>= 1;
-                fp_mask1 >>= 1;
-                /*Pull a bit from the left column.*/
-                if (!(fp_mask2 & 1)) {
-                    bits = bits << 1 | data2 & 1;
-                    biti++;
-                }
-                data2 >>= 1;
-                fp_mask2 >>= 1;
-                /*If we finished a byte, drop it in a block.*/
-                if (biti >= 8) {
-                    biti -= 8;
-                    *_blocks[blocki++]++ = (unsigned char)(bits >> biti);
-                    /*See comments on the "up" loop for the reason behind this mess.*/
-                    if (blocki >= _nblocks)blocki = ++blockj == _nshort_data ? _nshort_blocks : 0;
-                }
+    }
+    /*Mark the codewords that can be read a column nibble at a time.*/
+    for (i = 0; i < _ncodewords; i++) {
+        unsigned short* p;
+        int             d;
+        int             k;
+        p = _placement + (i << 3);
+        d = p[2] - p[0];
+        if ((d != 1 && d != -1) || p[0] - p[1] != stride << QR_INT_LOGBITS)continue;
+        for (k = 1; k < 4; k++) {
+            if (p[k << 1] != p[0] + d * k || p[k << 1 | 1] != p[1] + d * k)break;
+        }
+        if (k < 4 || (p[0] >> QR_INT_LOGBITS) != (p[6] >> QR_INT_LOGBITS))continue;
+        if (d < 0) {
+            p[0] = p[6];
+            p[2] = p[7];
+            p[1] = QR_PLACE_UP;
+        }
+        else {
+            p[2] = p[1];
+            p[1] = QR_PLACE_DOWN;
+        }
+    }
+}
+
+/*Arranges the sample bits read by qr_sampling_grid_sample() into bytes and
+   groups those bytes into Reed-Solomon blocks, using a placement computed by
+   qr_samples_place().*/
+static void qr_samples_gather(unsigned char* _block_data, int _ncodewords,
+    const unsigned* _data_bits, const unsigned short* _placement) {
+    /*Spreads the 4 bits of a column over every other bit of a byte, with the
+       highest row first (going up) or the lowest row first (going down).*/
+    static const unsigned char SPREAD_UP[16] = {
+      0x00,0x01,0x04,0x05,0x10,0x11,0x14,0x15,
+      0x40,0x41,0x44,0x45,0x50,0x51,0x54,0x55
+    };
+    static const unsigned char SPREAD_DOWN[16] = {
+      0x00,0x40,0x10,0x50,0x04,0x44,0x14,0x54,
+      0x01,0x41,0x11,0x51,0x05,0x45,0x15,0x55
+    };
+    int i;
+    for (i = 0; i < _ncodewords; i++) {
+        unsigned bits;
+        unsigned p;
+        unsigned q;
+        p = _placement[0];
+        q = _placement[2];
+        if (_placement[1] >= QR_PLACE_DOWN) {
+            const unsigned char* spread;
+            spread = _placement[1] == QR_PLACE_UP ? SPREAD_UP : SPREAD_DOWN;
+            bits = spread[_data_bits[p >> QR_INT_LOGBITS] >> (p & (QR_INT_BITS - 1)) & 15] << 1 |
+                spread[_data_bits[q >> QR_INT_LOGBITS] >> (q & (QR_INT_BITS - 1)) & 15];
+        }
+        else {
+            int b;
+            bits = 0;
+            for (b = 0; b < 8; b++) {
+                p = _placement[b];
+                bits = bits << 1 | (_data_bits[p >> QR_INT_LOGBITS] >> (p & (QR_INT_BITS - 1)) & 1);
             }
         }
+        _block_data[i] = (unsigned char)bits;
+        _placement += 8;
     }
 }
 
@@ -3184,7 +4424,7 @@ static const unsigned char QR_ALNUM_TABLE[45] = {
 };
 
 static int qr_code_data_parse(qr_code_data* _qrdata, int _version,
-    const unsigned char* _data, int _ndata) {
+    const unsigned char* _data, int _ndata, zbar_arena_t* _arena) {
     qr_pack_buf qpb;
     unsigned    self_parity;
     int         centries;
@@ -3208,9 +4448,10 @@ static int qr_code_data_parse(qr_code_data* _qrdata, int _version,
         /*Mode 0 is a terminator.*/
         if (!mode)break;
         if (_qrdata->nentries >= centries) {
+            _qrdata->entries = (qr_code_data_entry*)_zbar_arena_realloc(_arena,
+                _qrdata->entries, centries * sizeof(*_qrdata->entries),
+                (centries << 1 | 1) * sizeof(*_qrdata->entries));
             centries = centries << 1 | 1;
-            _qrdata->entries = (qr_code_data_entry*)realloc(_qrdata->entries,
-                centries * sizeof(*_qrdata->entries));
         }
         entry = _qrdata->entries + _qrdata->nentries++;
         entry->mode = mode;
@@ -3239,7 +4480,8 @@ static int qr_code_data_parse(qr_code_data* _qrdata, int _version,
             count = len / 3;
             rem = len % 3;
             if (qr_pack_buf_avail(&qpb) < 10 * count + 7 * (rem >> 1 & 1) + 4 * (rem & 1))return -1;
-            entry->payload.data.buf = buf = (unsigned char*)malloc(len * sizeof(*buf));
+            entry->payload.data.buf = buf = (unsigned char*)_zbar_arena_alloc(_arena,
+                len * sizeof(*buf));
             entry->payload.data.len = len;
             /*Read groups of 3 digits encoded in 10 bits.*/
             while (count-- > 0) {
@@ -3290,7 +4532,8 @@ static int qr_code_data_parse(qr_code_data* _qrdata, int _version,
             count = len >> 1;
             rem = len & 1;
             if (qr_pack_buf_avail(&qpb) < 11 * count + 6 * rem)return -1;
-            entry->payload.data.buf = buf = (unsigned char*)malloc(len * sizeof(*buf));
+            entry->payload.data.buf = buf = (unsigned char*)_zbar_arena_alloc(_arena,
+                len * sizeof(*buf));
             entry->payload.data.len = len;
             /*Read groups of two characters encoded in 11 bits.*/
             while (count-- > 0) {
@@ -3341,7 +4584,8 @@ static int qr_code_data_parse(qr_code_data* _qrdata, int _version,
             /*Check to see if there are enough bits left now, so we don't have to
                in the decode loop.*/
             if (qr_pack_buf_avail(&qpb) < len << 3)return -1;
-            entry->payload.data.buf = buf = (unsigned char*)malloc(len * sizeof(*buf));
+            entry->payload.data.buf = buf = (unsigned char*)_zbar_arena_alloc(_arena,
+                len * sizeof(*buf));
             entry->payload.data.len = len;
             while (len-- > 0) {
                 c = qr_pack_buf_read(&qpb, 8);
@@ -3389,7 +4633,8 @@ static int qr_code_data_parse(qr_code_data* _qrdata, int _version,
             /*Check to see if there are enough bits left now, so we don't have to
                in the decode loop.*/
             if (qr_pack_buf_avail(&qpb) < 13 * len)return -1;
-            entry->payload.data.buf = buf = (unsigned char*)malloc(2 * len * sizeof(*buf));
+            entry->payload.data.buf = buf = (unsigned char*)_zbar_arena_alloc(_arena,
+                2 * len * sizeof(*buf));
             entry->payload.data.len = 2 * len;
             /*Decode 2-byte SJIS characters encoded in 13 bits.*/
             while (len-- > 0) {
@@ -3432,41 +4677,27 @@ static int qr_code_data_parse(qr_code_data* _qrdata, int _version,
       We don't combine the 2-byte kanji codes into one byte in the loops above,
        because we can just do it here instead.*/
     _qrdata->self_parity = ((self_parity >> 8) ^ self_parity) & 0xFF;
-    /*Success.*/
-    _qrdata->entries = (qr_code_data_entry*)realloc(_qrdata->entries,
-        _qrdata->nentries * sizeof(*_qrdata->entries));
+    /*Success.
+      The entries and their payloads live in the arena until the caller releases
+       it, so there is nothing to free on failure either.*/
     return 0;
 }
 
-static void qr_code_data_clear(qr_code_data* _qrdata) {
-    int i;
-    for (i = 0; i < _qrdata->nentries; i++) {
-        if (QR_MODE_HAS_DATA(_qrdata->entries[i].mode)) {
-            free(_qrdata->entries[i].payload.data.buf);
-        }
-    }
-    free(_qrdata->entries);
-}
-
 
+/*The list and the codes in it are allocated from the reader's arena, so it is
+   released along with the rest of the temporaries of the decode.*/
 void qr_code_data_list_init(qr_code_data_list* _qrlist) {
     _qrlist->qrdata = NULL;
     _qrlist->nqrdata = _qrlist->cqrdata = 0;
 }
 
-void qr_code_data_list_clear(qr_code_data_list* _qrlist) {
-    int i;
-    for (i = 0; i < _qrlist->nqrdata; i++)qr_code_data_clear(_qrlist->qrdata + i);
-    free(_qrlist->qrdata);
-    qr_code_data_list_init(_qrlist);
-}
-
 static void qr_code_data_list_add(qr_code_data_list* _qrlist,
-    qr_code_data* _qrdata) {
+    const qr_code_data* _qrdata, zbar_arena_t* _arena) {
     if (_qrlist->nqrdata >= _qrlist->cqrdata) {
+        _qrlist->qrdata = (qr_code_data*)_zbar_arena_realloc(_arena,
+            _qrlist->qrdata, _qrlist->cqrdata * sizeof(*_qrlist->qrdata),
+            (_qrlist->cqrdata << 1 | 1) * sizeof(*_qrlist->qrdata));
         _qrlist->cqrdata = _qrlist->cqrdata << 1 | 1;
-        _qrlist->qrdata = (qr_code_data*)realloc(_qrlist->qrdata,
-            _qrlist->cqrdata * sizeof(*_qrlist->qrdata));
     }
     memcpy(_qrlist->qrdata + _qrlist->nqrdata++, _qrdata, sizeof(*_qrdata));
 }
@@ -3544,9 +4775,63 @@ static const unsigned char QR_RS_NBLOCKS[40][4] = {
   {21,43,59,70},{22,45,62,74},{24,47,65,77},{25,49,68,81}
 };
 
+/*Returns the plan of a version, with the placement of an ECC level, building
+   whatever it is missing.
+  _plans: The plans of all versions, which the tasks of _pool may share.
+  _pool:  The pool whose lock guards the plans, or NULL.
+  Return: The plan, or NULL if out of memory.*/
+static const qr_decode_plan* qr_decode_plan_get(qr_decode_plan* _plans,
+    zbar_pool_t* _pool, int _version, int _ecc_level) {
+    qr_decode_plan* plan;
+    int             dim;
+    int             stride;
+    int             ret;
+    if (_plans == NULL)return NULL;
+    plan = _plans + _version - 1;
+    dim = 17 + (_version << 2);
+    stride = (dim + QR_INT_BITS - 1) >> QR_INT_LOGBITS;
+    ret = 0;
+    _zbar_pool_lock(_pool);
+    if (plan->fpmask == NULL) {
+        unsigned* masks;
+        masks = (unsigned*)calloc(9 * dim * stride, sizeof(*masks));
+        if (masks == NULL)ret = -1;
+        else {
+            int i;
+            qr_fp_mask_fill(masks, _version);
+            for (i = 0; i < 8; i++) {
+                plan->masks[i] = masks + (i + 1) * dim * stride;
+                qr_data_mask_fill(plan->masks[i], dim, i);
+            }
+            plan->fpmask = masks;
+        }
+    }
+    if (ret >= 0 && plan->placement[_ecc_level] == NULL) {
+        unsigned short* placement;
+        int             ncodewords;
+        ncodewords = qr_code_ncodewords(_version);
+        placement = (unsigned short*)malloc(ncodewords * 8 * sizeof(*placement));
+        if (placement == NULL)ret = -1;
+        else {
+            int nblocks;
+            int npar;
+            int block_sz;
+            nblocks = QR_RS_NBLOCKS[_version - 1][_ecc_level];
+            npar = *(QR_RS_NPAR_VALS + QR_RS_NPAR_OFFS[_version - 1] + _ecc_level);
+            block_sz = ncodewords / nblocks;
+            qr_samples_place(placement, ncodewords, nblocks, block_sz - npar, block_sz,
+                nblocks - (ncodewords % nblocks), plan->fpmask, dim);
+            plan->placement[_ecc_level] = placement;
+        }
+    }
+    _zbar_pool_unlock(_pool);
+    return ret < 0 ? NULL : plan;
+}
+
 /*Attempts to fully decode a QR code.
   _qrdata:   Returns the parsed code data.
   _gf:       Used for Reed-Solomon error correction.
+  _plans:    The decode plans of all versions (see qr_decode_plan_get()).
   _ul_pos:   The location of the UL finder pattern.
   _ur_pos:   The location of the UR finder pattern.
   _dl_pos:   The location of the DL finder pattern.
@@ -3555,14 +4840,18 @@ static const unsigned char QR_RS_NBLOCKS[40][4] = {
   _img:      The binary input image.
   _width:    The width of the input image.
   _height:   The height of the input image.
+  _arena:    The arena to allocate the code data and temporaries from.
+             Everything allocated is released again on failure.
   Return: 0 on success, or a negative value on error.*/
 static int qr_code_decode(qr_code_data* _qrdata, const rs_gf256* _gf,
-    const qr_point _ul_pos, const qr_point _ur_pos, const qr_point _dl_pos,
+    qr_decode_plan* _plans, const qr_point _ul_pos, const qr_point _ur_pos, const qr_point _dl_pos,
     int _version, int _fmt_info,
-    const unsigned char* _img, int _width, int _height) {
+    qr_bin_image* _img, int _width, int _height, zbar_arena_t* _arena) {
+    zbar_arena_mark_t  arena_mark;
     qr_sampling_grid   grid;
+    const qr_decode_plan* plan;
+    int                ready[4];
     unsigned* data_bits;
-    unsigned char** blocks;
     unsigned char* block_data;
     int                nblocks;
     int                nshort_blocks;
@@ -3574,32 +4863,53 @@ static int qr_code_decode(qr_code_data* _qrdata, const rs_gf256* _gf,
     int                dim;
     int                ret;
     int                i;
+    ecc_level = (_fmt_info >> 3) ^ 1;
+    plan = qr_decode_plan_get(_plans, _img->pool, _version, ecc_level);
+    if (plan == NULL)return -1;
+    arena_mark = _zbar_arena_mark(_arena);
+    /*Binarize the code's bounding box at once, rather than a tile at a time as
+       sampling reaches each one, so that sampling can read its bits straight
+       from the bit plane.*/
+    {
+        int x0;
+        int y0;
+        int x1;
+        int y1;
+        x0 = QR_MINI(QR_MINI(_qrdata->bbox[0][0], _qrdata->bbox[1][0]),
+            QR_MINI(_qrdata->bbox[2][0], _qrdata->bbox[3][0])) >> QR_FINDER_SUBPREC;
+        y0 = QR_MINI(QR_MINI(_qrdata->bbox[0][1], _qrdata->bbox[1][1]),
+            QR_MINI(_qrdata->bbox[2][1], _qrdata->bbox[3][1])) >> QR_FINDER_SUBPREC;
+        x1 = QR_MAXI(QR_MAXI(_qrdata->bbox[0][0], _qrdata->bbox[1][0]),
+            QR_MAXI(_qrdata->bbox[2][0], _qrdata->bbox[3][0])) >> QR_FINDER_SUBPREC;
+        y1 = QR_MAXI(QR_MAXI(_qrdata->bbox[0][1], _qrdata->bbox[1][1]),
+            QR_MAXI(_qrdata->bbox[2][1], _qrdata->bbox[3][1])) >> QR_FINDER_SUBPREC;
+        ready[0] = QR_MAXI(x0, 0);
+        ready[1] = QR_MAXI(y0, 0);
+        ready[2] = QR_MINI(x1 + 1, _width);
+        ready[3] = QR_MINI(y1 + 1, _height);
+        qr_bin_image_prefetch(_img, ready[0], ready[1], ready[2], ready[3]);
+    }
     /*Read the bits out of the image.*/
     qr_sampling_grid_init(&grid, _version, _ul_pos, _ur_pos, _dl_pos, _qrdata->bbox,
-        _img, _width, _height);
+        _img, _width, _height, plan->fpmask, _arena);
 #if defined(QR_DEBUG)
     qr_sampling_grid_dump(&grid, _version, _img, _width, _height);
 #endif
     dim = 17 + (_version << 2);
-    data_bits = (unsigned*)malloc(
+    data_bits = (unsigned*)_zbar_arena_alloc(_arena,
         dim * (dim + QR_INT_BITS - 1 >> QR_INT_LOGBITS) * sizeof(*data_bits));
-    qr_sampling_grid_sample(&grid, data_bits, dim, _fmt_info, _img, _width, _height);
+    qr_sampling_grid_sample(&grid, data_bits, dim, plan->masks[_fmt_info & 7],
+        ready, _img, _width, _height);
     /*Group those bits into Reed-Solomon codewords.*/
-    ecc_level = (_fmt_info >> 3) ^ 1;
     nblocks = QR_RS_NBLOCKS[_version - 1][ecc_level];
     npar = *(QR_RS_NPAR_VALS + QR_RS_NPAR_OFFS[_version - 1] + ecc_level);
     ncodewords = qr_code_ncodewords(_version);
     block_sz = ncodewords / nblocks;
     nshort_blocks = nblocks - (ncodewords % nblocks);
-    blocks = (unsigned char**)malloc(nblocks * sizeof(*blocks));
-    block_data = (unsigned char*)malloc(ncodewords * sizeof(*block_data));
-    blocks[0] = block_data;
-    for (i = 1; i < nblocks; i++)blocks[i] = blocks[i - 1] + block_sz + (i > nshort_blocks);
-    qr_samples_unpack(blocks, nblocks, block_sz - npar, nshort_blocks,
-        data_bits, grid.fpmask, dim);
-    qr_sampling_grid_clear(&grid);
-    free(blocks);
-    free(data_bits);
+    block_data = (unsigned char*)_zbar_arena_alloc(_arena,
+        ncodewords * sizeof(*block_data));
+    qr_samples_gather(block_data, ncodewords, data_bits,
+        plan->placement[ecc_level]);
     /*Perform the error correction.*/
     ndata = 0;
     ncodewords = 0;
@@ -3629,29 +4939,122 @@ static int qr_code_decode(qr_code_data* _qrdata, const rs_gf256* _gf,
     }
     /*Parse the corrected bitstream.*/
     if (ret >= 0) {
-        ret = qr_code_data_parse(_qrdata, _version, block_data, ndata);
+        ret = qr_code_data_parse(_qrdata, _version, block_data, ndata, _arena);
         /*We could return any partially decoded data, but then we'd have to have
            API support for that; a mode ignoring ECC errors might also be useful.*/
-        if (ret < 0)qr_code_data_clear(_qrdata);
         _qrdata->version = _version;
         _qrdata->ecc_level = ecc_level;
     }
-    free(block_data);
+    if (ret < 0)_zbar_arena_release(_arena, arena_mark);
     return ret;
 }
 
+/*The fewest transitions a timing pattern must show to pass
+   qr_timing_pattern_check(), in 1/16ths of the number it should have.
+  Blur and the error of the affine estimate of the grid lose a few, while the
+   quiet zones and the background between unrelated finder patterns show next
+   to none.*/
+#define QR_TIMING_MIN_TRANSITIONS (8)
+
+/*Counts the transitions between dark and light along a timing pattern, sampled
+   every quarter of a module.
+  _p0, _p1:     The centers of the finder patterns at either end, in the square
+                 domain of _aff.
+  _n:           The number of modules between them.
+  _offu, _offv: The offset from the line through the centers to the row or
+                 column of the timing pattern.
+  Return: The number of transitions, which should be _n-10.*/
+static int qr_timing_pattern_transitions(const qr_aff* _aff,
+    const qr_point _p0, const qr_point _p1, int _n, int _offu, int _offv,
+    qr_bin_image* _img, int _width, int _height) {
+    qr_point p;
+    int      du;
+    int      dv;
+    int      ntransitions;
+    int      prev;
+    int      bit;
+    int      k;
+    du = _p1[0] - _p0[0];
+    dv = _p1[1] - _p0[1];
+    ntransitions = 0;
+    prev = 0;
+    /*From the first module past the separator of one finder pattern to the
+       last one before the separator of the other, both of which are dark.*/
+    for (k = 20; k <= (_n - 5) << 2; k++) {
+        qr_aff_project(p, _aff, _p0[0] + _offu + du * k / (_n << 2),
+            _p0[1] + _offv + dv * k / (_n << 2));
+        bit = qr_img_get_bit(_img, _width, _height, p[0], p[1]);
+        ntransitions += k > 20 && bit != prev;
+        prev = bit;
+    }
+    return ntransitions;
+}
+
+/*Checks that both timing patterns of a configuration alternate like they
+   should, sampling the image along the affine estimate of the grid.
+  This rejects many configurations of unrelated finder patterns for a small
+   fraction of the cost of fitting a homography to them and decoding the
+   format information.
+  Return: A non-zero value if the configuration is plausible.*/
+static int qr_timing_pattern_check(const qr_finder* _ul, const qr_finder* _ur,
+    const qr_finder* _dl, const qr_aff* _aff,
+    qr_bin_image* _img, int _width, int _height) {
+    int size;
+    int n;
+    int i;
+    for (i = 0; i < 2; i++) {
+        const qr_finder* f;
+        int              ntransitions;
+        /*The row between UL and UR, and the column between UL and DL, 3
+           modules from the line through their centers.*/
+        f = i ? _dl : _ur;
+        size = (_ul->size[i] + f->size[i] + 1) >> 1;
+        n = QR_DIVROUND(f->o[i] - _ul->o[i], size);
+        /*Too short to tell.*/
+        if (n <= 10)return 1;
+        ntransitions = i ?
+            qr_timing_pattern_transitions(_aff, _ul->o, _dl->o, n,
+                3 * (_ul->size[0] + _dl->size[0]) >> 1, 0, _img, _width, _height) :
+            qr_timing_pattern_transitions(_aff, _ul->o, _ur->o, n,
+                0, 3 * (_ul->size[1] + _ur->size[1]) >> 1, _img, _width, _height);
+        if (ntransitions << 4 < (n - 10) * QR_TIMING_MIN_TRANSITIONS)return 0;
+    }
+    return 1;
+}
+
+#ifndef NO_STATS
+/*Charges the time since a configuration passed the timing check (if one is
+   being timed) to the configurations that went on to fit a homography.*/
+static void qr_try_stats_fit_done(qr_try_stats* _stats, clock_t* _start) {
+    if (*_start != (clock_t)-1) {
+        _stats->fit_clock += clock() - *_start;
+        *_start = (clock_t)-1;
+    }
+}
+#endif
+
 /*Searches for an arrangement of these three finder centers that yields a valid
    configuration.
-  _c: On input, the three finder centers to consider in any order.
+  Only reads the reader and the image, so several configurations can be tried
+   at once, each with its own arena.
+  _arena: The arena to allocate the code data and temporaries from.
+  _stats: Accumulates the work done.
+  _c:     On input, the three finder centers to consider in any order.
+          Their edge points are reordered.
   Return: The detected version number, or a negative value on error.*/
-static int qr_reader_try_configuration(qr_reader* _reader,
-    qr_code_data* _qrdata, const unsigned char* _img, int _width, int _height,
+static int qr_reader_try_configuration(const qr_reader* _reader,
+    qr_code_data* _qrdata, zbar_arena_t* _arena,
+    qr_try_stats* _stats, qr_bin_image* _img, int _width, int _height,
     qr_finder_center* _c[3]) {
     int      ci[7];
     unsigned maxd;
     int      ccw;
     int      i0;
     int      i;
+#ifndef NO_STATS
+    clock_t  fit_start;
+    fit_start = (clock_t)-1;
+#endif
     /*Sort the points in counter-clockwise order.*/
     ccw = qr_point_ccw(_c[0]->pos, _c[1]->pos, _c[2]->pos);
     /*Colinear points can't be the corners of a quadrilateral.*/
@@ -3685,6 +5088,11 @@ static int qr_reader_try_configuration(qr_reader* _reader,
         int       ur_version;
         int       dl_version;
         int       fmt_info;
+        int       timing;
+#ifndef NO_STATS
+        clock_t   start;
+        qr_try_stats_fit_done(_stats, &fit_start);
+#endif
         ul.c = _c[ci[i]];
         ur.c = _c[ci[i + 1]];
         dl.c = _c[ci[i + 2]];
@@ -3715,10 +5123,26 @@ static int qr_reader_try_configuration(qr_reader* _reader,
 #if defined(QR_DEBUG)
         qr_finder_dump_aff_undistorted(&ul, &ur, &dl, &aff, _img, _width, _height);
 #endif
+        /*Before going any further, make sure the timing patterns are where the
+           finder patterns say they should be.*/
+#ifndef NO_STATS
+        start = clock();
+#endif
+        timing = qr_timing_pattern_check(&ul, &ur, &dl, &aff,
+            _img, _width, _height);
+#ifndef NO_STATS
+        _stats->timing_checks++;
+        _stats->timing_rejects += !timing;
+        fit_start = clock();
+        _stats->timing_clock += fit_start - start;
+        if (timing)_stats->fits++;
+        else fit_start = (clock_t)-1;
+#endif
+        if (!timing)continue;
         /*If we made it this far, upgrade the affine homography to a full
            homography.*/
         if (qr_hom_fit(&hom, &ul, &ur, &dl, bbox, &aff,
-            &_reader->isaac, _img, _width, _height) < 0) {
+            _stats, _img, _width, _height, _arena) < 0) {
             continue;
         }
         memcpy(_qrdata->bbox, bbox, sizeof(bbox));
@@ -3794,10 +5218,11 @@ static int qr_reader_try_configuration(qr_reader* _reader,
                 qr_line            l0;
                 int* p;
                 t = LINE_TESTS[j];
-                qr_finder_ransac(f[t[0]], &aff, &_reader->isaac, t[1]);
+                qr_finder_ransac(f[t[0]], &aff, _stats, t[1]);
                 /*We may not have enough points to fit a line accurately here.
                   If not, we just skip the test.*/
-                if (qr_line_fit_finder_edge(l0, f[t[0]], t[1], res) < 0)continue;
+                if (qr_line_fit_finder_edge(l0, f[t[0]], t[1], res,
+                    _arena) < 0)continue;
                 p = f[t[2]]->c->pos;
                 if (qr_line_eval(l0, p[0], p[1]) * t[3] < 0)break;
                 p = f[t[4]]->c->pos;
@@ -3845,8 +5270,10 @@ static int qr_reader_try_configuration(qr_reader* _reader,
         }
         fmt_info = qr_finder_fmt_info_decode(&ul, &ur, &dl, &hom, _img, _width, _height);
         if (fmt_info < 0 ||
-            qr_code_decode(_qrdata, &_reader->gf, ul.c->pos, ur.c->pos, dl.c->pos,
-                ur_version, fmt_info, _img, _width, _height) < 0) {
+            qr_code_decode(_qrdata, &_reader->gf, _reader->plans,
+                ul.c->pos, ur.c->pos, dl.c->pos,
+                ur_version, fmt_info, _img, _width, _height,
+                _arena) < 0) {
             /*The code may be flipped.
               Try again, swapping the UR and DL centers.
               We should get a valid version either way, so it's relatively cheap to
@@ -3871,103 +5298,598 @@ static int qr_reader_try_configuration(qr_reader* _reader,
             QR_SWAP2I(bbox[1][0], bbox[2][0]);
             QR_SWAP2I(bbox[1][1], bbox[2][1]);
             memcpy(_qrdata->bbox, bbox, sizeof(bbox));
-            if (qr_code_decode(_qrdata, &_reader->gf, ul.c->pos, dl.c->pos, ur.c->pos,
-                ur_version, fmt_info, _img, _width, _height) < 0) {
+            if (qr_code_decode(_qrdata, &_reader->gf, _reader->plans,
+                ul.c->pos, dl.c->pos, ur.c->pos,
+                ur_version, fmt_info, _img, _width, _height,
+                _arena) < 0) {
                 continue;
             }
         }
+#ifndef NO_STATS
+        qr_try_stats_fit_done(_stats, &fit_start);
+#endif
         return ur_version;
     }
+#ifndef NO_STATS
+    qr_try_stats_fit_done(_stats, &fit_start);
+#endif
     return -1;
 }
 
+/*The number of configurations qr_reader_match_centers() collects at a time
+   in its exhaustive search.*/
+#define QR_MATCH_REST_MAX       (256)
+/*The most finder centers (the ones with the most edge points) among which
+   qr_reader_match_centers() looks for likely configurations.*/
+#define QR_MATCH_RANKED_MAX     (128)
+
+/*A candidate configuration of three finder centers, for
+   qr_reader_match_centers().*/
+struct qr_center_triple {
+    /*How far the configuration is from the corners of a square: smaller is
+       more likely.*/
+    int score;
+    /*The indices of the centers, in increasing order.*/
+    int c[3];
+};
+
+static int qr_center_triple_cmp(const void* _a, const void* _b) {
+    const qr_center_triple* a;
+    const qr_center_triple* b;
+    int                     i;
+    a = (const qr_center_triple*)_a;
+    b = (const qr_center_triple*)_b;
+    for (i = 0; i < 3; i++)if (a->c[i] != b->c[i])return (a->c[i] > b->c[i]) - (a->c[i] < b->c[i]);
+    return 0;
+}
+
+static int qr_center_triple_idx_cmp(const void* _a, const void* _b) {
+    const qr_center_triple* a;
+    const qr_center_triple* b;
+    int                     c;
+    a = (const qr_center_triple*)_a;
+    b = (const qr_center_triple*)_b;
+    c = qr_center_triple_cmp(_a, _b);
+    return c ? c : (a->score > b->score) - (a->score < b->score);
+}
+
+static int qr_center_triple_score_cmp(const void* _a, const void* _b) {
+    const qr_center_triple* a;
+    const qr_center_triple* b;
+    a = (const qr_center_triple*)_a;
+    b = (const qr_center_triple*)_b;
+    if (a->score != b->score)return (a->score > b->score) - (a->score < b->score);
+    return qr_center_triple_cmp(_a, _b);
+}
+
+/*Returns the mean squared distance of the edge points of a finder center from
+   the center, a measure of its size, or 0 if it has no edge points.*/
+static unsigned qr_finder_center_r2(const qr_finder_center* _c) {
+    unsigned r2;
+    int      i;
+    r2 = 0;
+    for (i = 0; i < _c->nedge_pts; i++) {
+        int dx;
+        int dy;
+        dx = _c->edge_pts[i].pos[0] - _c->pos[0];
+        dy = _c->edge_pts[i].pos[1] - _c->pos[1];
+        r2 += (unsigned)(dx * dx + dy * dy) / _c->nedge_pts;
+    }
+    return r2;
+}
+
+/*Checks whether two finder centers could belong to the same code.
+  The edge points of a finder pattern lie 3.5 to 5 modules from its center,
+   while the centers of two patterns of the same code are between 14 (version
+   1, adjacent) and 240 (version 40, opposite) modules apart.
+  The limits allow for twice that, and for a factor of 4 between the sizes of
+   the two patterns under perspective.
+  _r2a: The size of the first center from qr_finder_center_r2().
+  _r2b: The size of the second center.
+  _d2:  The squared distance between the centers.
+  Return: A non-zero value if the two centers are compatible.*/
+static int qr_finder_centers_compatible(unsigned _r2a, unsigned _r2b,
+    unsigned _d2) {
+    unsigned r2min;
+    unsigned r2max;
+    /*Without edge points we know nothing about the size of a pattern.*/
+    if (_r2a == 0 || _r2b == 0)return 1;
+    r2min = QR_MINI(_r2a, _r2b);
+    r2max = QR_MAXI(_r2a, _r2b);
+    return (r2max >> 4) <= r2min && _d2 >= (r2min << 2) && (_d2 >> 14) <= r2max;
+}
+
+/*Checks whether three finder centers are not so far from the corners of a
+   square that no plausible projection of a code could place them there: the
+   two sides around the largest angle may differ in length by a factor of 6,
+   and that angle may be up to about 160 degrees.
+  _d2: The squared lengths of the three sides of the triangle.
+  Return: A non-zero value if the triangle is plausible.*/
+static int qr_center_triangle_plausible(const unsigned _d2[3]) {
+    long long a2;
+    long long b2;
+    long long c2;
+    long long e;
+    int       s;
+    int       i;
+    /*Put the longest side (opposite the largest angle) in c2.*/
+    i = _d2[1] > _d2[0];
+    if (_d2[2] > _d2[i])i = 2;
+    c2 = _d2[i];
+    a2 = _d2[i == 0];
+    b2 = _d2[2 - (i == 2)];
+    if (QR_MINI(a2, b2) * 36 < QR_MAXI(a2, b2))return 0;
+    /*cos(C) = (a2+b2-c2)/(2*a*b) < -0.94, scaled down to avoid overflow.*/
+    e = c2 - a2 - b2;
+    if (e <= 0)return 1;
+    s = QR_MAXI(qr_ilog((unsigned)c2) - 24, 0);
+    e >>= s;
+    return e * e * 100 <= 353 * (a2 >> s) * (b2 >> s);
+}
+
+/*A uniform grid of finder centers, used to look up the centers near a point.*/
+struct qr_center_grid {
+    /*The indices of the centers, by cell.*/
+    int* idx;
+    /*The index in idx of the first center of each cell, followed by the
+       number of centers.*/
+    int* start;
+    int  x0;
+    int  y0;
+    /*The log2 of the size of a cell.*/
+    int  logcs;
+    int  nx;
+    int  ny;
+};
+
+/*Builds a grid over the centers with about one center per cell.
+  Return: 0 on success, or -1 if out of memory.*/
+static int qr_center_grid_init(qr_center_grid* _grid,
+    const qr_finder_center* _centers, int _ncenters, zbar_arena_t* _arena) {
+    int* count;
+    int  x1;
+    int  y1;
+    int  ext;
+    int  ncells;
+    int  i;
+    _grid->x0 = x1 = _centers[0].pos[0];
+    _grid->y0 = y1 = _centers[0].pos[1];
+    for (i = 1; i < _ncenters; i++) {
+        _grid->x0 = QR_MINI(_grid->x0, _centers[i].pos[0]);
+        _grid->y0 = QR_MINI(_grid->y0, _centers[i].pos[1]);
+        x1 = QR_MAXI(x1, _centers[i].pos[0]);
+        y1 = QR_MAXI(y1, _centers[i].pos[1]);
+    }
+    ext = QR_MAXI(x1 - _grid->x0, y1 - _grid->y0) + 1;
+    _grid->logcs = QR_MAXI(qr_ilog((unsigned)(ext / (qr_isqrt(_ncenters) + 1))), 0);
+    _grid->nx = ((x1 - _grid->x0) >> _grid->logcs) + 1;
+    _grid->ny = ((y1 - _grid->y0) >> _grid->logcs) + 1;
+    ncells = _grid->nx * _grid->ny;
+    _grid->idx = (int*)_zbar_arena_alloc(_arena, _ncenters * sizeof(*_grid->idx));
+    _grid->start = (int*)_zbar_arena_calloc(_arena, ncells + 1,
+        sizeof(*_grid->start));
+    count = (int*)_zbar_arena_calloc(_arena, ncells + 1, sizeof(*count));
+    if (_grid->idx == NULL || _grid->start == NULL || count == NULL)return -1;
+    for (i = 0; i < _ncenters; i++) {
+        count[((_centers[i].pos[1] - _grid->y0) >> _grid->logcs) * _grid->nx +
+            ((_centers[i].pos[0] - _grid->x0) >> _grid->logcs) + 1]++;
+    }
+    for (i = 0; i < ncells; i++)count[i + 1] += count[i];
+    memcpy(_grid->start, count, (ncells + 1) * sizeof(*count));
+    for (i = 0; i < _ncenters; i++) {
+        _grid->idx[count[((_centers[i].pos[1] - _grid->y0) >> _grid->logcs) * _grid->nx +
+            ((_centers[i].pos[0] - _grid->x0) >> _grid->logcs)]++] = i;
+    }
+    return 0;
+}
+
+/*Generates the candidate configurations for qr_reader_match_centers().
+  Each pair of compatible centers is taken as one side of a code from its
+   upper-left corner, and the third corner is looked up in the grid at a
+   right angle to it, on either side: the compatible center nearest to where it
+   should be completes the configuration.
+  Return: The number of configurations, sorted by the indices of their centers
+   (the caller sorts them by score), or -1 if out of memory.*/
+static int qr_center_triples_find(qr_center_triple** _triples,
+    const qr_finder_center* _centers, int _ncenters, const unsigned* _r2,
+    zbar_arena_t* _arena) {
+    qr_center_grid    grid;
+    qr_center_triple* triples;
+    int               ntriples;
+    int               ctriples;
+    int               i;
+    int               j;
+    if (qr_center_grid_init(&grid, _centers, _ncenters, _arena) < 0)return -1;
+    ctriples = 2 * _ncenters;
+    triples = (qr_center_triple*)_zbar_arena_alloc(_arena,
+        ctriples * sizeof(*triples));
+    if (triples == NULL)return -1;
+    ntriples = 0;
+    for (i = 0; i < _ncenters; i++)for (j = 0; j < _ncenters; j++)if (j != i) {
+        unsigned dij2;
+        int      vx;
+        int      vy;
+        int      side;
+        vx = _centers[j].pos[0] - _centers[i].pos[0];
+        vy = _centers[j].pos[1] - _centers[i].pos[1];
+        dij2 = (unsigned)(vx * vx) + (unsigned)(vy * vy);
+        if (!qr_finder_centers_compatible(_r2[i], _r2[j], dij2))continue;
+        for (side = -1; side <= 1; side += 2) {
+            unsigned best2;
+            int      best;
+            int      px;
+            int      py;
+            int      rad;
+            int      cx0;
+            int      cy0;
+            int      cx1;
+            int      cy1;
+            int      cx;
+            int      cy;
+            px = _centers[i].pos[0] - side * vy;
+            py = _centers[i].pos[1] + side * vx;
+            /*Search within about 0.4 of the side length, which allows for a
+               view up to about 50 degrees off axis.*/
+            best2 = dij2 / 6;
+            best = -1;
+            /*A cheap bound on the search radius, for the cells to visit.*/
+            rad = (abs(vx) + abs(vy)) >> 1;
+            cx0 = QR_MAXI((px - rad - grid.x0) >> grid.logcs, 0);
+            cy0 = QR_MAXI((py - rad - grid.y0) >> grid.logcs, 0);
+            cx1 = QR_MINI((px + rad - grid.x0) >> grid.logcs, grid.nx - 1);
+            cy1 = QR_MINI((py + rad - grid.y0) >> grid.logcs, grid.ny - 1);
+            for (cy = cy0; cy <= cy1; cy++)for (cx = cx0; cx <= cx1; cx++) {
+                int l;
+                int cell;
+                cell = cy * grid.nx + cx;
+                for (l = grid.start[cell]; l < grid.start[cell + 1]; l++) {
+                    unsigned d2[3];
+                    unsigned e2;
+                    int      k;
+                    int      ex;
+                    int      ey;
+                    k = grid.idx[l];
+                    if (k == i || k == j)continue;
+                    ex = _centers[k].pos[0] - px;
+                    ey = _centers[k].pos[1] - py;
+                    e2 = (unsigned)(ex * ex) + (unsigned)(ey * ey);
+                    if (e2 > best2 || (e2 == best2 && k > best))continue;
+                    d2[0] = dij2;
+                    d2[1] = qr_point_distance2(_centers[i].pos, _centers[k].pos);
+                    d2[2] = qr_point_distance2(_centers[j].pos, _centers[k].pos);
+                    if (!qr_finder_centers_compatible(_r2[i], _r2[k], d2[1]) ||
+                        !qr_finder_centers_compatible(_r2[j], _r2[k], d2[2]) ||
+                        !qr_center_triangle_plausible(d2)) {
+                        continue;
+                    }
+                    best2 = e2;
+                    best = k;
+                }
+            }
+            if (best >= 0) {
+                qr_center_triple* t;
+                if (ntriples >= ctriples) {
+                    t = (qr_center_triple*)_zbar_arena_realloc(_arena, triples,
+                        ctriples * sizeof(*triples), 2 * ctriples * sizeof(*triples));
+                    if (t == NULL)return -1;
+                    triples = t;
+                    ctriples <<= 1;
+                }
+                t = triples + ntriples++;
+                /*The distance from the ideal corner, relative to the side.*/
+                t->score = (int)(((long long)best2 << 16) / QR_MAXI(dij2, 1));
+                t->c[0] = i;
+                t->c[1] = j;
+                t->c[2] = best;
+                QR_SORT2I(t->c[0], t->c[1]);
+                QR_SORT2I(t->c[1], t->c[2]);
+                QR_SORT2I(t->c[0], t->c[1]);
+            }
+        }
+    }
+    /*The same configuration is usually found from both of its sides: keep
+       the best score of each.*/
+    qsort(triples, ntriples, sizeof(*triples), qr_center_triple_idx_cmp);
+    for (i = j = 0; i < ntriples; i++) {
+        if (j > 0 && !qr_center_triple_cmp(triples + j - 1, triples + i))continue;
+        triples[j++] = triples[i];
+    }
+    ntriples = j;
+    *_triples = triples;
+    return ntriples;
+}
+
 void qr_reader_match_centers(qr_reader* _reader, qr_code_data_list* _qrlist,
     qr_finder_center* _centers, int _ncenters,
-    const unsigned char* _img, int _width, int _height) {
-    /*The number of centers should be small, so an O(n^3) exhaustive search of
-       which ones go together should be reasonable.*/
-    unsigned char* mark;
-    int            nfailures_max;
-    int            nfailures;
+    qr_bin_image* _img, int _width, int _height);
+
+/*Adds a code found from the finder centers _c to the list and marks its
+   centers used, searching the other centers found inside it for another
+   code.*/
+static void qr_reader_add_code(qr_reader* _reader, qr_code_data_list* _qrlist,
+    qr_finder_center* _centers, int _ncenters, unsigned char* _mark,
+    const int _c[3], const qr_code_data* _qrdata,
+    qr_bin_image* _img, int _width, int _height) {
+    qr_code_data* qrdata;
+    int           ninside;
+    int           l;
+    /*Add the data to the list.*/
+    qr_code_data_list_add(_qrlist, _qrdata, &_reader->arena);
+    /*Convert the bounding box we're returning to the user to normal image
+       coordinates.*/
+    qrdata = _qrlist->qrdata + _qrlist->nqrdata - 1;
+    for (l = 0; l < 4; l++) {
+        qrdata->bbox[l][0] >>= QR_FINDER_SUBPREC;
+        qrdata->bbox[l][1] >>= QR_FINDER_SUBPREC;
+    }
+    /*Mark these centers as used.*/
+    _mark[_c[0]] = _mark[_c[1]] = _mark[_c[2]] = 1;
+    /*Find any other finder centers located inside this code.*/
+    for (l = ninside = 0; l < _ncenters; l++)if (!_mark[l]) {
+        if (qr_point_ccw(_qrdata->bbox[0], _qrdata->bbox[1], _centers[l].pos) >= 0 &&
+            qr_point_ccw(_qrdata->bbox[1], _qrdata->bbox[3], _centers[l].pos) >= 0 &&
+            qr_point_ccw(_qrdata->bbox[3], _qrdata->bbox[2], _centers[l].pos) >= 0 &&
+            qr_point_ccw(_qrdata->bbox[2], _qrdata->bbox[0], _centers[l].pos) >= 0) {
+            _mark[l] = 2;
+            ninside++;
+        }
+    }
+    if (ninside >= 3) {
+        /*We might have a "Double QR": a code inside a code.
+          Copy the relevant centers to a new array and do a search confined to
+           that subset.*/
+        qr_finder_center* inside;
+        inside = (qr_finder_center*)_zbar_arena_alloc(&_reader->arena,
+            ninside * sizeof(*inside));
+        for (l = ninside = 0; l < _ncenters; l++) {
+            if (_mark[l] == 2)*&inside[ninside++] = *&_centers[l];
+        }
+        qr_reader_match_centers(_reader, _qrlist, inside, ninside,
+            _img, _width, _height);
+    }
+    /*Mark _all_ such centers used: codes cannot partially overlap.*/
+    for (l = 0; l < _ncenters; l++)if (_mark[l] == 2)_mark[l] = 1;
+}
+
+/*The configurations qr_reader_try_triples() tries at once, one per task.*/
+struct qr_match_batch {
+    const qr_reader*        reader;
+    const qr_finder_center* centers;
+    const qr_center_triple* triples;
+    qr_bin_image*           img;
+    int                     width;
+    int                     height;
+    /*The index in triples of the configuration each task tries.*/
+    int                     idx[QR_MATCH_BATCH_MAX];
+    /*The arena of each task (the reader's own for the first), and where it
+       stood before the attempt.*/
+    zbar_arena_t*           arena[QR_MATCH_BATCH_MAX];
+    zbar_arena_mark_t       arena_mark[QR_MATCH_BATCH_MAX];
+    /*The code each task found, and its version (negative if none).*/
+    qr_code_data            qrdata[QR_MATCH_BATCH_MAX];
+    int                     ret[QR_MATCH_BATCH_MAX];
+    /*The work each task did.*/
+    qr_try_stats            stats[QR_MATCH_BATCH_MAX];
+};
+
+static void qr_match_batch_try(void* _batch, int _idx) {
+    qr_match_batch*   batch;
+    qr_finder_center* c[3];
+    zbar_arena_t*     arena;
+    const int*        t;
+    int               i;
+    batch = (qr_match_batch*)_batch;
+    arena = batch->arena[_idx];
+    t = batch->triples[batch->idx[_idx]].c;
+    batch->arena_mark[_idx] = _zbar_arena_mark(arena);
+    batch->ret[_idx] = -1;
+    memset(batch->stats + _idx, 0, sizeof(*batch->stats));
+    /*Trying a configuration reorders the edge points of its centers, so each
+       attempt gets its own copy of them.
+      That way (and since RANSAC keys its random samples on the centers) the
+       outcome does not depend on what else was tried before, or alongside it on
+       other threads.*/
+    for (i = 0; i < 3; i++) {
+        const qr_finder_center* src;
+        qr_finder_edge_pt* edge_pts;
+        src = batch->centers + t[i];
+        c[i] = (qr_finder_center*)_zbar_arena_alloc(arena, sizeof(*c[i]));
+        edge_pts = (qr_finder_edge_pt*)_zbar_arena_alloc(arena,
+            src->nedge_pts * sizeof(*edge_pts));
+        if (c[i] == NULL || edge_pts == NULL)return;
+        *c[i] = *src;
+        memcpy(edge_pts, src->edge_pts, src->nedge_pts * sizeof(*edge_pts));
+        c[i]->edge_pts = edge_pts;
+    }
+    batch->ret[_idx] = qr_reader_try_configuration(batch->reader,
+        batch->qrdata + _idx, arena, batch->stats + _idx,
+        batch->img, batch->width, batch->height, c);
+}
+
+/*Tries the configurations of finder centers _triples in order, skipping the
+   ones with a center already used, and adds the codes found to the list.
+  With threads, a batch of configurations is tried at once, but the results
+   are still taken in order: after a code is found, the rest of the batch is
+   dropped and tried again against the centers it leaves unused.
+  So the codes found do not depend on the number of threads.
+  _nfailures:     The number of failures since the last code was found, updated
+                   on return.
+  _nfailures_max: The number of failures in a row to give up after.
+  _ntried:        If not NULL, returns the number of configurations at the
+                   start of _triples that were tried (or skipped).
+  Return: A non-zero value if the search should stop, because the caller has
+   all the codes it expects or we gave up.*/
+static int qr_reader_try_triples(qr_reader* _reader, qr_code_data_list* _qrlist,
+    qr_finder_center* _centers, int _ncenters, unsigned char* _mark,
+    const qr_center_triple* _triples, int _ntriples,
+    int* _nfailures, int _nfailures_max, int* _ntried,
+    qr_bin_image* _img, int _width, int _height) {
+    qr_match_batch batch;
+    int            nbatch;
+    int            n;
     int            i;
     int            j;
-    int            k;
-    mark = (unsigned char*)calloc(_ncenters, sizeof(*mark));
+    int            t;
+    /*Twice as many as the threads, so that a slow attempt does not leave the
+       others idle.*/
+    nbatch = _zbar_pool_size(_img->pool);
+    nbatch = nbatch > 1 ? QR_MINI(nbatch << 1, QR_MATCH_BATCH_MAX) : 1;
+    batch.reader = _reader;
+    batch.centers = _centers;
+    batch.triples = _triples;
+    batch.img = _img;
+    batch.width = _width;
+    batch.height = _height;
+    batch.arena[0] = &_reader->arena;
+    for (t = 1; t < nbatch; t++)batch.arena[t] = _reader->match_arena + t - 1;
+    /*The tasks must only read the binary image, so binarize all of it that
+       they are allowed to read up front (with threads, that was mostly done
+       already), and mark the rest done.*/
+    if (nbatch > 1)qr_bin_image_fill(_img, 0, 0, _img->ntx, _img->nty);
+    for (i = 0; i < _ntriples;) {
+        for (n = 0; i < _ntriples && n < nbatch; i++) {
+            const int* c;
+            c = _triples[i].c;
+            if (!_mark[c[0]] && !_mark[c[1]] && !_mark[c[2]])batch.idx[n++] = i;
+        }
+        if (n <= 0)break;
+        _zbar_pool_run(_img->pool, qr_match_batch_try, &batch, n);
+#ifndef NO_STATS
+        for (t = 0; t < n; t++) {
+            _reader->stat_timing_checks += batch.stats[t].timing_checks;
+            _reader->stat_timing_rejects += batch.stats[t].timing_rejects;
+            _reader->stat_timing_clock += batch.stats[t].timing_clock;
+            _reader->stat_fits += batch.stats[t].fits;
+            _reader->stat_fit_clock += batch.stats[t].fit_clock;
+            _reader->stat_ransac_runs += batch.stats[t].ransac_runs;
+            _reader->stat_ransac_iters += batch.stats[t].ransac_iters;
+        }
+#endif
+        for (t = 0; t < n; t++) {
+#ifndef NO_STATS
+            _reader->stat_match_tries++;
+#endif
+            if (batch.ret[t] >= 0 || ++*_nfailures > _nfailures_max)break;
+            _zbar_arena_release(batch.arena[t], batch.arena_mark[t]);
+        }
+        /*Drop what came after the first code found (or the last attempt before
+           giving up), in reverse, as the first arena may be shared.*/
+        for (j = n; j-- > t + 1;)_zbar_arena_release(batch.arena[j], batch.arena_mark[j]);
+        if (t >= n)continue;
+        if (batch.ret[t] < 0) {
+            _zbar_arena_release(batch.arena[t], batch.arena_mark[t]);
+            if (_ntried != NULL)*_ntried = batch.idx[t] + 1;
+            return 1;
+        }
+        *_nfailures = 0;
+        qr_reader_add_code(_reader, _qrlist, _centers, _ncenters, _mark,
+            _triples[batch.idx[t]].c, batch.qrdata + t, _img, _width, _height);
+        /*Stop once the caller has all the codes it expects.*/
+        i = batch.idx[t] + 1;
+        if (_ntried != NULL)*_ntried = i;
+        if (_reader->max_codes > 0 && _qrlist->nqrdata >= _reader->max_codes) {
+            return 1;
+        }
+    }
+    if (_ntried != NULL)*_ntried = _ntriples;
+    return 0;
+}
+
+void qr_reader_match_centers(qr_reader* _reader, qr_code_data_list* _qrlist,
+    qr_finder_center* _centers, int _ncenters,
+    qr_bin_image* _img, int _width, int _height) {
+    qr_center_triple* triples;
+    qr_center_triple* rest;
+    unsigned char* mark;
+    unsigned* r2;
+    int               ntriples;
+    int               ntried;
+    int               nfailures_max;
+    int               nfailures;
+    int               nrest;
+    int               i;
+    int               j;
+    int               k;
+    mark = (unsigned char*)_zbar_arena_calloc(&_reader->arena,
+        _ncenters, sizeof(*mark));
+    r2 = (unsigned*)_zbar_arena_alloc(&_reader->arena, _ncenters * sizeof(*r2));
+    if (mark == NULL || r2 == NULL || _ncenters < 3)return;
+    for (i = 0; i < _ncenters; i++)r2[i] = qr_finder_center_r2(_centers + i);
+#ifndef NO_STATS
+    _reader->stat_match_calls++;
+#endif
     nfailures_max = QR_MAXI(8192, _width * _height >> 9);
     nfailures = 0;
-    for (i = 0; i < _ncenters; i++) {
-        /*TODO: We might be able to accelerate this step significantly by
-           considering the remaining finder centers in a more intelligent order,
-           based on the first finder center we just chose.*/
-        for (j = i + 1; !mark[i] && j < _ncenters; j++) {
-            for (k = j + 1; !mark[j] && k < _ncenters; k++)if (!mark[k]) {
-                qr_finder_center* c[3];
-                qr_code_data      qrdata;
-                int               version;
-                c[0] = _centers + i;
-                c[1] = _centers + j;
-                c[2] = _centers + k;
-                version = qr_reader_try_configuration(_reader, &qrdata,
-                    _img, _width, _height, c);
-                if (version >= 0) {
-                    int ninside;
-                    int l;
-                    /*Add the data to the list.*/
-                    qr_code_data_list_add(_qrlist, &qrdata);
-                    /*Convert the bounding box we're returning to the user to normal
-                       image coordinates.*/
-                    for (l = 0; l < 4; l++) {
-                        _qrlist->qrdata[_qrlist->nqrdata - 1].bbox[l][0] >>= QR_FINDER_SUBPREC;
-                        _qrlist->qrdata[_qrlist->nqrdata - 1].bbox[l][1] >>= QR_FINDER_SUBPREC;
-                    }
-                    /*Mark these centers as used.*/
-                    mark[i] = mark[j] = mark[k] = 1;
-                    /*Find any other finder centers located inside this code.*/
-                    for (l = ninside = 0; l < _ncenters; l++)if (!mark[l]) {
-                        if (qr_point_ccw(qrdata.bbox[0], qrdata.bbox[1], _centers[l].pos) >= 0 &&
-                            qr_point_ccw(qrdata.bbox[1], qrdata.bbox[3], _centers[l].pos) >= 0 &&
-                            qr_point_ccw(qrdata.bbox[3], qrdata.bbox[2], _centers[l].pos) >= 0 &&
-                            qr_point_ccw(qrdata.bbox[2], qrdata.bbox[0], _centers[l].pos) >= 0) {
-                            mark[l] = 2;
-                            ninside++;
-                        }
-                    }
-                    if (ninside >= 3) {
-                        /*We might have a "Double QR": a code inside a code.
-                          Copy the relevant centers to a new array and do a search confined
-                           to that subset.*/
-                        qr_finder_center* inside;
-                        inside = (qr_finder_center*)malloc(ninside * sizeof(*inside));
-                        for (l = ninside = 0; l < _ncenters; l++) {
-                            if (mark[l] == 2)*&inside[ninside++] = *&_centers[l];
-                        }
-                        qr_reader_match_centers(_reader, _qrlist, inside, ninside,
-                            _img, _width, _height);
-                        free(inside);
-                    }
-                    /*Mark _all_ such centers used: codes cannot partially overlap.*/
-                    for (l = 0; l < _ncenters; l++)if (mark[l] == 2)mark[l] = 1;
-                    nfailures = 0;
+    /*First try the configurations that look like the corners of a square,
+       most likely first, which finds most codes in a handful of attempts even
+       among dozens of centers.*/
+    ntriples = qr_center_triples_find(&triples, _centers,
+        QR_MINI(_ncenters, QR_MATCH_RANKED_MAX), r2, &_reader->arena);
+    rest = (qr_center_triple*)_zbar_arena_alloc(&_reader->arena,
+        QR_MATCH_REST_MAX * sizeof(*rest));
+    if (ntriples < 0 || rest == NULL)return;
+    qsort(triples, ntriples, sizeof(*triples), qr_center_triple_score_cmp);
+    /*Move on to the exhaustive search after fewer failures.
+      These configurations only get less likely, and each one that looks like a
+       code costs more to reject than a random one.*/
+    if (qr_reader_try_triples(_reader, _qrlist, _centers, _ncenters, mark,
+        triples, ntriples, &nfailures, nfailures_max >> 5, &ntried,
+        _img, _width, _height) &&
+        _reader->max_codes > 0 && _qrlist->nqrdata >= _reader->max_codes) {
+        return;
+    }
+    qsort(triples, ntried, sizeof(*triples), qr_center_triple_cmp);
+    /*Then fall back to an exhaustive search of the rest, for codes seen under
+       severe distortion, skipping the configurations no projection of a code
+       could produce.
+      The failures above count against the same budget, so we still give up
+       after nfailures_max in a row, as if every configuration was tried here.*/
+    nrest = 0;
+    for (i = 0; i < _ncenters; i++)if (!mark[i]) {
+        for (j = i + 1; j < _ncenters; j++)if (!mark[j]) {
+            unsigned dij2;
+            dij2 = qr_point_distance2(_centers[i].pos, _centers[j].pos);
+            if (!qr_finder_centers_compatible(r2[i], r2[j], dij2))continue;
+            for (k = j + 1; k < _ncenters; k++)if (!mark[k]) {
+                qr_center_triple* t;
+                unsigned          d2[3];
+                d2[0] = dij2;
+                d2[1] = qr_point_distance2(_centers[i].pos, _centers[k].pos);
+                d2[2] = qr_point_distance2(_centers[j].pos, _centers[k].pos);
+                if (!qr_finder_centers_compatible(r2[i], r2[k], d2[1]) ||
+                    !qr_finder_centers_compatible(r2[j], r2[k], d2[2]) ||
+                    !qr_center_triangle_plausible(d2)) {
+                    continue;
+                }
+                /*Skip the configurations already tried.*/
+                t = rest + nrest;
+                t->score = 0;
+                t->c[0] = i;
+                t->c[1] = j;
+                t->c[2] = k;
+                if (ntried > 0 && bsearch(t, triples, ntried, sizeof(*triples),
+                    qr_center_triple_cmp) != NULL) {
+                    continue;
                 }
-                else if (++nfailures > nfailures_max) {
-                    /*Give up.
-                      We're unlikely to find a valid code in all this clutter, and we
-                       could spent quite a lot of time trying.*/
-                    i = j = k = _ncenters;
+                if (++nrest >= QR_MATCH_REST_MAX) {
+                    if (qr_reader_try_triples(_reader, _qrlist, _centers,
+                        _ncenters, mark, rest, nrest, &nfailures, nfailures_max,
+                        NULL, _img, _width, _height)) {
+                        return;
+                    }
+                    nrest = 0;
                 }
             }
         }
     }
-    free(mark);
+    qr_reader_try_triples(_reader, _qrlist, _centers, _ncenters, mark,
+        rest, nrest, &nfailures, nfailures_max, NULL, _img, _width, _height);
 }
 
-int _zbar_qr_found_line(qr_reader* reader,
-    int dir,
+int _zbar_qr_lines_add(qr_finder_lines* lines,
     const qr_finder_line* line)
 {
     /* minimally intrusive brute force version */
-    qr_finder_lines* lines = &reader->finder_lines[dir];
-
     if (lines->nlines >= lines->clines) {
         lines->clines *= 2;
         lines->lines = realloc(lines->lines,
@@ -3979,6 +5901,28 @@ int _zbar_qr_found_line(qr_reader* reader,
     return(0);
 }
 
+int _zbar_qr_found_lines(qr_reader* reader,
+    int dir,
+    const qr_finder_lines* src)
+{
+    qr_finder_lines* lines = &reader->finder_lines[dir];
+    int nlines = lines->nlines + src->nlines;
+
+    if (!src->nlines)
+        return(0);
+    if (nlines > lines->clines) {
+        lines->clines = QR_MAXI(lines->clines * 2 + 1, nlines);
+        lines->lines = realloc(lines->lines,
+            lines->clines * sizeof(*lines->lines));
+    }
+
+    memcpy(lines->lines + lines->nlines, src->lines,
+        src->nlines * sizeof(*lines->lines));
+    lines->nlines = nlines;
+
+    return(0);
+}
+
 static __inline void qr_svg_centers(const qr_finder_center* centers,
     int ncenters)
 {
@@ -3998,48 +5942,303 @@ static __inline void qr_svg_centers(const qr_finder_center* centers,
     svg_path_end();
 }
 
-int _zbar_qr_decode(qr_reader* reader,
+/* allow a rectangle of the image to be binarized into the binary image
+ * shared by its regions of interest (and decode attempts).  pixels are
+ * only binarized as the decoder reads them.
+ * returns the binary image, or NULL if out of memory
+ */
+static qr_bin_image* qr_reader_binarize_rect(qr_reader* reader,
+    const zbar_image_t* img,
+    int x0,
+    int y0,
+    int x1,
+    int y1)
+{
+    if (qr_bin_image_add_rect(&reader->bin, img->data, img->width, img->height,
+            x0, y0, x1, y1))
+        return(NULL);
+    return(&reader->bin);
+}
+
+/* codes with finders inside the crop may extend a bit past it */
+#define QR_CROP_PAD(img) (QR_MAXI((img)->crop_w, (img)->crop_h) >> 3)
+
+/* allow the padded crop rectangle of an image to be binarized */
+static qr_bin_image* qr_reader_binarize(qr_reader* reader,
+    const zbar_image_t* img)
+{
+    int pad = QR_CROP_PAD(img);
+    return(qr_reader_binarize_rect(reader, img,
+        QR_MAXI((int)img->crop_x - pad, 0),
+        QR_MAXI((int)img->crop_y - pad, 0),
+        QR_MINI((int)(img->crop_x + img->crop_w) + pad, (int)img->width),
+        QR_MINI((int)(img->crop_y + img->crop_h) + pad, (int)img->height)));
+}
+
+/* remember the codes found by an incremental decode */
+static void qr_reader_add_decoded(qr_reader* reader,
+    const qr_code_data_list* qrlist)
+{
+    int i;
+    if (reader->nstream_bbox + qrlist->nqrdata > reader->cstream_bbox) {
+        int n = reader->nstream_bbox + qrlist->nqrdata + 4;
+        void* bbox = realloc(reader->stream_bbox,
+            n * sizeof(*reader->stream_bbox));
+        if (!bbox)
+            return;
+        reader->stream_bbox = bbox;
+        reader->cstream_bbox = n;
+    }
+    for (i = 0; i < qrlist->nqrdata; i++)
+        memcpy(reader->stream_bbox[reader->nstream_bbox++],
+            qrlist->qrdata[i].bbox, sizeof(*reader->stream_bbox));
+}
+
+/* drop the finder lines crossing codes already decoded, so later
+ * incremental decodes (or the diagonal passes) do not find them again
+ */
+static void qr_reader_drop_lines(qr_reader* reader)
+{
+    int dir, i, j;
+    for (dir = 0; dir < QR_FINDER_NDIRS; dir++) {
+        qr_finder_lines* lines = reader->finder_lines + dir;
+        int n = 0;
+        for (i = 0; i < lines->nlines; i++) {
+            const qr_finder_line* line = lines->lines + i;
+            qr_point p;
+            /* middle of the center section */
+            p[0] = line->pos[0];
+            p[1] = line->pos[1];
+            p[dir & 1] += line->len >> 1;
+            if (dir >= 2)
+                qr_point_unrotate(p);
+            p[0] >>= QR_FINDER_SUBPREC;
+            p[1] >>= QR_FINDER_SUBPREC;
+            for (j = 0; j < reader->nstream_bbox; j++) {
+                const qr_point* bbox = reader->stream_bbox[j];
+                if (qr_point_ccw(bbox[0], bbox[1], p) >= 0 &&
+                    qr_point_ccw(bbox[1], bbox[3], p) >= 0 &&
+                    qr_point_ccw(bbox[3], bbox[2], p) >= 0 &&
+                    qr_point_ccw(bbox[2], bbox[0], p) >= 0)
+                    break;
+            }
+            if (j >= reader->nstream_bbox)
+                lines->lines[n++] = *line;
+        }
+        lines->nlines = n;
+    }
+}
+
+/* drop the finder lines that end above row keep_y (in subpel units) and
+ * are not part of any cluster: all the lines that could join them have
+ * been seen, so they will not form a finder center
+ */
+static void qr_reader_prune_lines(qr_reader* reader,
+    int keep_y)
+{
+    int dir, i, j;
+    for (dir = 0; dir < 2; dir++) {
+        qr_finder_lines* lines = reader->finder_lines + dir;
+        qr_finder_line** neighbors;
+        qr_finder_cluster* clusters;
+        unsigned char* mark;
+        zbar_arena_mark_t arena_mark;
+        int nclusters, n = 0;
+
+        if (lines->nlines < 2)
+            continue;
+        arena_mark = _zbar_arena_mark(&reader->arena);
+        neighbors = _zbar_arena_alloc(&reader->arena,
+            lines->nlines * sizeof(*neighbors));
+        clusters = _zbar_arena_alloc(&reader->arena,
+            (lines->nlines >> 1) * sizeof(*clusters));
+        mark = _zbar_arena_calloc(&reader->arena, lines->nlines, sizeof(*mark));
+        if (neighbors && clusters && mark) {
+            nclusters = qr_finder_cluster_lines(clusters, neighbors,
+                lines->lines, lines->nlines, dir, &reader->arena);
+            for (i = 0; i < nclusters; i++)
+                for (j = 0; j < clusters[i].nlines; j++)
+                    mark[clusters[i].lines[j] - lines->lines] = 1;
+            for (i = 0; i < lines->nlines; i++) {
+                const qr_finder_line* line = lines->lines + i;
+                int y = line->pos[1];
+                if (dir)
+                    y += line->len + line->eoffs;
+                if (mark[i] || y >= keep_y)
+                    lines->lines[n++] = *line;
+            }
+            lines->nlines = n;
+        }
+        _zbar_arena_release(&reader->arena, arena_mark);
+    }
+}
+
+/* decode the collected finder lines into at most max_codes codes (0 for
+ * no limit), but only extract them if there are at least min_codes.
+ * an incremental decode (keep_y >= 0, see _zbar_qr_decode_rows()) uses
+ * the image binarized so far, skips matching if the centers have not
+ * changed since the last one (except in the final decode, where last
+ * is set, as a code may have failed for lack of binarized rows below
+ * its finders), drops the lines of the codes it finds and prunes those
+ * above row keep_y.  the final decode is also where a binarizer cascade
+ * moves on to its next method while centers are found but no code
+ * decodes.  returns the number of symbols added
+ */
+static int qr_reader_decode(qr_reader* reader,
     zbar_image_scanner_t* iscn,
-    zbar_image_t* img)
+    zbar_image_t* img,
+    int min_codes,
+    int max_codes,
+    int keep_y,
+    int last)
 {
-    int nqrdata = 0, ncenters;
+    int incremental = keep_y >= 0;
+    int nqrdata = 0, ncenters, nmatch;
     qr_finder_edge_pt* edge_pts = NULL;
     qr_finder_center* centers = NULL;
+    zbar_arena_mark_t arena_mark;
+
+    if (incremental && reader->nstream_bbox)
+        qr_reader_drop_lines(reader);
 
-    if (reader->finder_lines[0].nlines < 9 ||
-        reader->finder_lines[1].nlines < 9)
+    if ((reader->finder_lines[0].nlines < 9 ||
+            reader->finder_lines[1].nlines < 9) &&
+        (reader->finder_lines[2].nlines < 9 ||
+            reader->finder_lines[3].nlines < 9))
         return(0);
 
     svg_group_start("finder", 0, 1. / (1 << QR_FINDER_SUBPREC), 0, 0, 0);
 
-    ncenters = qr_finder_centers_locate(&centers, &edge_pts, reader, 0, 0);
+    /* everything from here to the extracted symbols is a temporary */
+    arena_mark = _zbar_arena_mark(&reader->arena);
+    ncenters = qr_finder_centers_locate(&centers, &edge_pts, reader);
 
-    zprintf(14, "%dx%d finders, %d centers:\n",
+    zprintf(14, "%dx%d finders (diagonal %dx%d), %d centers:\n",
         reader->finder_lines[0].nlines,
         reader->finder_lines[1].nlines,
+        reader->finder_lines[2].nlines,
+        reader->finder_lines[3].nlines,
         ncenters);
     qr_svg_centers(centers, ncenters);
 
-    if (ncenters >= 3) {
-        void* bin = qr_binarize(img->data, img->width, img->height);
-
-        qr_code_data_list qrlist;
-        qr_code_data_list_init(&qrlist);
-
-        qr_reader_match_centers(reader, &qrlist, centers, ncenters,
-            bin, img->width, img->height);
+    nmatch = ncenters;
+    if (incremental && ncenters >= 3) {
+        int npts = 0, i;
+        for (i = 0; i < ncenters; i++)
+            npts += centers[i].nedge_pts;
+        if (ncenters == reader->stream_centers &&
+            npts == reader->stream_pts && !last)
+            nmatch = 0;
+        else {
+            reader->stream_centers = ncenters;
+            reader->stream_pts = npts;
+        }
+    }
 
-        if (qrlist.nqrdata > 0)
-            nqrdata = qr_code_data_list_extract_text(&qrlist, iscn, img);
+    if (nmatch >= 3 && nmatch >= 3 * min_codes) {
+        /* a cropped image (or region of interest) only binarizes around
+         * the crop, into a buffer kept until the next image
+         */
+        qr_bin_image* bin = (incremental)
+            ? &reader->bin
+            : qr_reader_binarize(reader, img);
+
+        if (bin) {
+            qr_code_data_list qrlist;
+            qr_code_data_list_init(&qrlist);
+
+            reader->max_codes = max_codes;
+            for (;;) {
+#ifndef NO_STATS
+                int method = bin->method;
+                clock_t start = clock();
+#endif
+                qr_bin_image_prefetch_rects(bin);
+                qr_reader_match_centers(reader, &qrlist, centers, ncenters,
+                    bin, img->width, img->height);
+#ifndef NO_STATS
+                reader->stat_method_clock[method] += clock() - start;
+                reader->stat_method_runs[method]++;
+                if (qrlist.nqrdata > 0)
+                    reader->stat_method_hits[method]++;
+#endif
+                if (qrlist.nqrdata > 0 || !last ||
+                    reader->binarizer != ZBAR_BINARIZER_CASCADE ||
+                    bin->method + 1 >= QR_BINARIZE_NMETHODS)
+                    break;
+                zprintf(14, "no code with binarizer %d, trying the next\n",
+                    bin->method);
+                qr_bin_image_set_method(bin, bin->method + 1);
+            }
 
-        qr_code_data_list_clear(&qrlist);
-        free(bin);
+            if (qrlist.nqrdata > 0 && qrlist.nqrdata >= min_codes) {
+                if (incremental)
+                    qr_reader_add_decoded(reader, &qrlist);
+                nqrdata = qr_code_data_list_extract_text(&qrlist, iscn, img);
+            }
+        }
     }
     svg_group_end();
+    _zbar_arena_release(&reader->arena, arena_mark);
+
+    if (incremental && keep_y > 0)
+        qr_reader_prune_lines(reader, keep_y << QR_FINDER_SUBPREC);
+    return(nqrdata);
+}
+
+int _zbar_qr_decode(qr_reader* reader,
+    zbar_image_scanner_t* iscn,
+    zbar_image_t* img,
+    int max_codes)
+{
+    int nqrdata = qr_reader_decode(reader, iscn, img, 0, max_codes, -1, 1);
+    qr_reader_clear_lines(reader);
+    return(nqrdata);
+}
+
+int _zbar_qr_decode_partial(qr_reader* reader,
+    zbar_image_scanner_t* iscn,
+    zbar_image_t* img,
+    int ncodes)
+{
+    int nqrdata = qr_reader_decode(reader, iscn, img, ncodes, ncodes, -1, 0);
+    if (nqrdata)
+        qr_reader_clear_lines(reader);
+    return(nqrdata);
+}
+
+int _zbar_qr_decode_rows(qr_reader* reader,
+    zbar_image_scanner_t* iscn,
+    zbar_image_t* img,
+    int y0,
+    int y1,
+    int keep_y,
+    int last,
+    int max_codes)
+{
+    int pad = QR_CROP_PAD(img);
+    int cy1 = img->crop_y + img->crop_h;
+    int nqrdata;
+
+    /* pad at the crop edges like qr_reader_binarize(), so the bands add
+     * up to the same rectangle
+     */
+    if (y0 <= (int)img->crop_y)
+        y0 = QR_MAXI((int)img->crop_y - pad, 0);
+    if (y1 >= cy1)
+        y1 = QR_MINI(cy1 + pad, (int)img->height);
+    if (y0 < y1 &&
+        !qr_reader_binarize_rect(reader, img,
+            QR_MAXI((int)img->crop_x - pad, 0), y0,
+            QR_MINI((int)(img->crop_x + img->crop_w) + pad, (int)img->width),
+            y1))
+        return(0);
+    if (!reader->bin.bits)
+        return(0);
 
-    if (centers)
-        free(centers);
-    if (edge_pts)
-        free(edge_pts);
+    nqrdata = qr_reader_decode(reader, iscn, img, 0, max_codes,
+        QR_MAXI(keep_y, 0), last);
+    if (last)
+        qr_reader_clear_lines(reader);
     return(nqrdata);
 }
@@ -42,6 +42,8 @@ void _zbar_image_free(zbar_image_t* img)
         zbar_symbol_set_ref(img->syms, -1);
         img->syms = NULL;
     }
+    if (img->rois)
+        free(img->rois);
     free(img);
 }
 
@@ -109,6 +111,36 @@ __inline void zbar_image_free_data(zbar_image_t* img)
     img->data = NULL;
 }
 
+int zbar_image_add_roi(zbar_image_t* img,
+    unsigned x,
+    unsigned y,
+    unsigned w,
+    unsigned h)
+{
+    image_roi_t* roi;
+    if (!w || !h)
+        return(-1);
+    if (img->nrois >= img->rois_alloc) {
+        int n = img->rois_alloc * 2 + 4;
+        image_roi_t* rois = realloc(img->rois, n * sizeof(image_roi_t));
+        if (!rois)
+            return(-1);
+        img->rois = rois;
+        img->rois_alloc = n;
+    }
+    roi = img->rois + img->nrois;
+    roi->x = x;
+    roi->y = y;
+    roi->w = w;
+    roi->h = h;
+    return(img->nrois++);
+}
+
+void zbar_image_clear_rois(zbar_image_t* img)
+{
+    img->nrois = 0;
+}
+
 const zbar_symbol_t* zbar_image_first_symbol(const zbar_image_t* img)
 {
     return((img->syms) ? img->syms->head : NULL);
@@ -29,6 +29,11 @@
 
 #define fourcc zbar_fourcc
 
+/* rectangular region of interest */
+typedef struct image_roi_s {
+    unsigned x, y, w, h;
+} image_roi_t;
+
 struct zbar_image_s {
     uint32_t format;            /* fourcc image format code */
     unsigned width, height;     /* image size */
@@ -47,6 +52,9 @@ struct zbar_image_s {
 
     unsigned seq;               /* page/frame sequence number */
     zbar_symbol_set_t* syms;    /* decoded result set */
+
+    image_roi_t* rois;          /* regions of interest (none: scan crop) */
+    int nrois, rois_alloc;
 };
 
 extern void _zbar_image_free(zbar_image_t*);
@@ -39,6 +39,8 @@
 #include "image.h"
 #include "timer.h"
 #include "symbol.h"
+#include "pool.h"
+#include "simd.h"
 
 #ifdef ENABLE_QRCODE
 # include "qrcode.h"
@@ -46,16 +48,9 @@
 
 #include "svg.h"
 
-#if 1
-# define ASSERT_POS \
-    assert(p == data + x + y * (intptr_t)w)
-#else
-# define ASSERT_POS
-#endif
-
 #define RECYCLE_BUCKETS     5
 
-#define NUM_SCN_CFGS (ZBAR_CFG_Y_DENSITY - ZBAR_CFG_X_DENSITY + 1)
+#define NUM_SCN_CFGS (ZBAR_CFG_BINARIZER - ZBAR_CFG_X_DENSITY + 1)
 
 #define CFG(iscn, cfg) ((iscn)->configs[(cfg) - ZBAR_CFG_X_DENSITY])
 #define TEST_CFG(iscn, cfg) (((iscn)->config >> ((cfg) - ZBAR_CFG_POSITION)) & 1)
@@ -85,10 +80,43 @@ typedef struct recycle_bucket_s {
     zbar_symbol_t* head;
 } recycle_bucket_t;
 
-/* image scanner state */
-struct zbar_image_scanner_s {
+#if defined(ENABLE_EAN) || defined(ENABLE_I25) || defined(ENABLE_DATABAR) || \
+    defined(ENABLE_CODABAR) || defined(ENABLE_CODE39) || \
+    defined(ENABLE_CODE93) || defined(ENABLE_CODE128) || defined(ENABLE_PDF417)
+/* linear symbols are added to the result set directly from the decoder
+ * callback, which is not safe from multiple threads
+ */
+# define MAX_SCAN_THREADS 1
+#else
+# define MAX_SCAN_THREADS 64
+#endif
+
+/* bands per thread for parallel passes (evens out uneven content) */
+#define SCAN_BANDS_PER_THREAD 4
+
+/* linear scan state.
+ * lane 0 is always present; parallel passes use one lane per band,
+ * each with its own scanner, decoder and finder line buffers
+ */
+typedef struct scan_lane_s {
+    zbar_image_scanner_t* iscn; /* owning image scanner */
     zbar_scanner_t* scn;        /* associated linear intensity scanner */
     zbar_decoder_t* dcode;      /* associated symbol decoder */
+    int dx, dy, du, umin, v;    /* current scan direction */
+    int ldir;                   /* 0 rows, 1 columns, 2-3 diagonals */
+    unsigned long npixels;      /* pixels scanned by last band */
+    uint8_t* tile;              /* transposed columns for vertical pass */
+    size_t tile_size;
+#ifdef ENABLE_QRCODE
+    qr_finder_lines qr_lines[QR_FINDER_NDIRS]; /* QR finder lines found */
+#endif
+} scan_lane_t;
+
+/* image scanner state */
+struct zbar_image_scanner_s {
+    scan_lane_t* lanes;         /* linear scan lanes (at least one) */
+    int nlanes;
+    zbar_pool_t* pool;          /* worker threads for parallel passes */
 #ifdef ENABLE_QRCODE
     qr_reader* qr;              /* QR Code 2D reader */
 #endif
@@ -99,7 +127,8 @@ struct zbar_image_scanner_s {
 
     unsigned long time;         /* scan start time */
     zbar_image_t* img;          /* currently scanning image *root* */
-    int dx, dy, du, umin, v;    /* current scan direction */
+    int roi;                    /* current image region of interest */
+    int nqr;                    /* QR symbols found in current image */
     zbar_symbol_set_t* syms;    /* previous decode results */
     /* recycled symbols in 4^n size buckets */
     recycle_bucket_t recycle[RECYCLE_BUCKETS];
@@ -119,6 +148,8 @@ struct zbar_image_scanner_s {
     int stat_img_syms_inuse, stat_img_syms_recycle;
     int stat_sym_new;
     int stat_sym_recycle[RECYCLE_BUCKETS];
+    uint64_t stat_pixels_scanned;   /* pixels touched by linear scans */
+    uint64_t stat_pixels_total;     /* pixels a full density scan touches */
 #endif
 };
 
@@ -126,39 +157,47 @@ struct zbar_image_scanner_s {
 #ifdef ENABLE_QRCODE
 extern qr_finder_line* _zbar_decoder_get_qr_finder_line(zbar_decoder_t*);
 
-# define QR_FIXED(v, rnd) ((((v) << 1) + (rnd)) << (QR_FINDER_SUBPREC - 1))
+/* multiply rather than shift, diagonal coordinates may be negative */
+# define QR_FIXED(v, rnd) (((v) * 2 + (rnd)) * (1 << (QR_FINDER_SUBPREC - 1)))
 # define PRINT_FIXED(val, prec) \
     ((val) >> (prec)),         \
         (1000 * ((val) & ((1 << (prec)) - 1)) / (1 << (prec)))
 
-static __inline void qr_handler(zbar_image_scanner_t* iscn)
+static __inline void qr_handler(scan_lane_t* lane)
 {
     unsigned u;
-    int vert;
-    qr_finder_line* line = _zbar_decoder_get_qr_finder_line(iscn->dcode);
+    int vert, scale;
+    qr_finder_line* line = _zbar_decoder_get_qr_finder_line(lane->dcode);
     assert(line);
-    u = zbar_scanner_get_edge(iscn->scn, line->pos[0],
+    u = zbar_scanner_get_edge(lane->scn, line->pos[0],
         QR_FINDER_SUBPREC);
-    line->boffs = u - zbar_scanner_get_edge(iscn->scn, line->boffs,
+    line->boffs = u - zbar_scanner_get_edge(lane->scn, line->boffs,
         QR_FINDER_SUBPREC);
-    line->len = zbar_scanner_get_edge(iscn->scn, line->len,
+    line->len = zbar_scanner_get_edge(lane->scn, line->len,
         QR_FINDER_SUBPREC);
-    line->eoffs = zbar_scanner_get_edge(iscn->scn, line->eoffs,
+    line->eoffs = zbar_scanner_get_edge(lane->scn, line->eoffs,
         QR_FINDER_SUBPREC) - line->len;
     line->len -= u;
 
-    u = QR_FIXED(iscn->umin, 0) + iscn->du * u;
-    if (iscn->du < 0) {
+    /* diagonal samples are 2 units apart in the rotated frame */
+    scale = (lane->ldir < 2) ? 1 : 2;
+    line->boffs *= scale;
+    line->len *= scale;
+    line->eoffs *= scale;
+
+    u = QR_FIXED(lane->umin, 0) + lane->du * scale * u;
+    if (lane->du < 0) {
         int tmp = line->boffs;
         line->boffs = line->eoffs;
         line->eoffs = tmp;
         u -= line->len;
     }
-    vert = !iscn->dx;
+    vert = lane->ldir & 1;
     line->pos[vert] = u;
-    line->pos[!vert] = QR_FIXED(iscn->v, 1);
+    /* diagonals run through pixel centers and corners alike */
+    line->pos[!vert] = QR_FIXED(lane->v, lane->ldir < 2);
     
-    _zbar_qr_found_line(iscn->qr, vert, line); 
+    _zbar_qr_lines_add(&lane->qr_lines[lane->ldir], line); 
 }
 #endif
 
@@ -198,6 +237,8 @@ _zbar_image_scanner_alloc_sym(zbar_image_scanner_t* iscn,
     sym->orient = ZBAR_ORIENT_UNKNOWN;
     sym->cache_count = 0;
     sym->time = iscn->time;
+    sym->roi = iscn->roi;
+    sym->reported = 0;
     assert(!sym->syms);
 
     if (datalen > 0) {
@@ -333,10 +374,63 @@ static __inline void cache_sym(zbar_image_scanner_t* iscn,
 }
 
 
+/* whether the center of a's location lies within b's bounding box */
+static int sym_overlaps(const zbar_symbol_t* a,
+    const zbar_symbol_t* b)
+{
+    long cx = 0, cy = 0;
+    int x0, y0, x1, y1;
+    unsigned i;
+    if (!a->npts || !b->npts)
+        return(0);
+    for (i = 0; i < a->npts; i++) {
+        cx += a->pts[i].x;
+        cy += a->pts[i].y;
+    }
+    cx /= (long)a->npts;
+    cy /= (long)a->npts;
+    x0 = x1 = b->pts[0].x;
+    y0 = y1 = b->pts[0].y;
+    for (i = 1; i < b->npts; i++) {
+        if (x0 > b->pts[i].x) x0 = b->pts[i].x;
+        if (x1 < b->pts[i].x) x1 = b->pts[i].x;
+        if (y0 > b->pts[i].y) y0 = b->pts[i].y;
+        if (y1 < b->pts[i].y) y1 = b->pts[i].y;
+    }
+    return(cx >= x0 && cx <= x1 && cy >= y0 && cy <= y1);
+}
+
+/* find a symbol an earlier region of interest already reported: the
+ * same data at the same place, decoded again where regions overlap
+ */
+static zbar_symbol_t* roi_dup(zbar_image_scanner_t* iscn,
+    const zbar_symbol_t* sym)
+{
+    zbar_symbol_t* dup;
+    for (dup = iscn->syms->head; dup; dup = dup->next)
+        if (dup->roi != sym->roi &&
+            dup->type == sym->type &&
+            dup->datalen == sym->datalen &&
+            (!sym->datalen || !memcmp(dup->data, sym->data, sym->datalen)) &&
+            (sym_overlaps(sym, dup) || sym_overlaps(dup, sym)))
+            return(dup);
+    return(NULL);
+}
+
 void _zbar_image_scanner_add_sym(zbar_image_scanner_t* iscn,
     zbar_symbol_t* sym)
 {
     zbar_symbol_set_t* syms;
+
+    if (iscn->roi > 0) {
+        /* keep the first region's result */
+        zbar_symbol_t* dup = roi_dup(iscn, sym);
+        if (dup) {
+            dup->quality++;
+            _zbar_image_scanner_recycle_syms(iscn, sym);
+            return;
+        }
+    }
     cache_sym(iscn, sym);
 
     syms = iscn->syms;
@@ -353,6 +447,8 @@ void _zbar_image_scanner_add_sym(zbar_image_scanner_t* iscn,
         syms->nsyms++;
     else if (!syms->tail)
         syms->tail = sym;
+    if (sym->type == ZBAR_QRCODE)
+        iscn->nqr++;
 
     _zbar_symbol_refcnt(sym, 1);
 }
@@ -360,7 +456,8 @@ void _zbar_image_scanner_add_sym(zbar_image_scanner_t* iscn,
 
 static void symbol_handler(zbar_decoder_t* dcode)
 {
-      zbar_image_scanner_t* iscn = zbar_decoder_get_userdata(dcode);
+      scan_lane_t* lane = zbar_decoder_get_userdata(dcode);
+      zbar_image_scanner_t* iscn = lane->iscn;
       zbar_symbol_type_t type = zbar_decoder_get_type(dcode);
       int x = 0, y = 0, dir;
       const char* data;
@@ -369,7 +466,7 @@ static void symbol_handler(zbar_decoder_t* dcode)
 
   #ifdef ENABLE_QRCODE
       if (type == ZBAR_QRCODE) {
-          qr_handler(iscn);
+          qr_handler(lane);
           return;
       }
   #else
@@ -378,14 +475,21 @@ static void symbol_handler(zbar_decoder_t* dcode)
      
       if (TEST_CFG(iscn, ZBAR_CFG_POSITION)) { 
       /* tmp position fixup */
-       int w = zbar_scanner_get_width(iscn->scn);
-       int u = iscn->umin + iscn->du * zbar_scanner_get_edge(iscn->scn, w, 0);
-       if (iscn->dx) {
+       int w = zbar_scanner_get_width(lane->scn);
+       int u = lane->umin + lane->du * zbar_scanner_get_edge(lane->scn, w, 0);
+       if (lane->ldir >= 2) {
+           /* back from the rotated diagonal frame */
+           int ru = (lane->ldir == 2) ? u + (u - lane->umin) : lane->v;
+           int rv = (lane->ldir == 2) ? lane->v : u + (u - lane->umin);
+           x = (ru - rv) / 2;
+           y = (ru + rv) / 2;
+       }
+       else if (lane->dx) {
            x = u;
-           y = iscn->v;
+           y = lane->v;
        }
        else {
-           x = iscn->v;
+           x = lane->v;
            y = u;
        } 
    }
@@ -432,7 +536,7 @@ static void symbol_handler(zbar_decoder_t* dcode)
  
  dir = zbar_decoder_get_direction(dcode);
  if (dir)
-     sym->orient = (iscn->dy != 0) + ((iscn->du ^ dir) & 2);
+     sym->orient = (lane->dy != 0) + ((lane->du ^ dir) & 2);
 
  _zbar_image_scanner_add_sym(iscn, sym);
 
@@ -440,22 +544,93 @@ static void symbol_handler(zbar_decoder_t* dcode)
 }
 
 
+static int lane_init(zbar_image_scanner_t* iscn,
+    scan_lane_t* lane)
+{
+    memset(lane, 0, sizeof(*lane));
+    lane->iscn = iscn;
+    lane->dcode = zbar_decoder_create();
+    lane->scn = zbar_scanner_create(lane->dcode);
+    if (!lane->dcode || !lane->scn)
+        return(1);
+    zbar_decoder_set_userdata(lane->dcode, lane);
+    zbar_decoder_set_handler(lane->dcode, symbol_handler);
+    return(0);
+}
+
+static void lane_cleanup(scan_lane_t* lane)
+{
+#ifdef ENABLE_QRCODE
+    int i;
+#endif
+    if (lane->scn)
+        zbar_scanner_destroy(lane->scn);
+    lane->scn = NULL;
+    if (lane->dcode)
+        zbar_decoder_destroy(lane->dcode);
+    lane->dcode = NULL;
+    if (lane->tile)
+        free(lane->tile);
+    lane->tile = NULL;
+    lane->tile_size = 0;
+#ifdef ENABLE_QRCODE
+    for (i = 0; i < QR_FINDER_NDIRS; i++) {
+        if (lane->qr_lines[i].lines)
+            free(lane->qr_lines[i].lines);
+        lane->qr_lines[i].lines = NULL;
+    }
+#endif
+}
+
+/* extra lanes only run the QR finder (see MAX_SCAN_THREADS),
+ * so only its configuration needs to follow lane 0
+ */
+static void lane_sync_config(scan_lane_t* lane,
+    const zbar_decoder_t* dcode)
+{
+    unsigned configs = zbar_decoder_get_configs(dcode, ZBAR_QRCODE);
+    int cfg;
+    for (cfg = 0; cfg < ZBAR_CFG_NUM; cfg++)
+        zbar_decoder_set_config(lane->dcode, ZBAR_QRCODE, cfg,
+            (configs >> cfg) & 1);
+}
+
+/* make sure at least n lanes exist, returns number available */
+static int alloc_lanes(zbar_image_scanner_t* iscn,
+    int n)
+{
+    scan_lane_t* lanes;
+    int i;
+    if (n <= iscn->nlanes)
+        return(n);
+    lanes = realloc(iscn->lanes, n * sizeof(*lanes));
+    if (!lanes)
+        return(iscn->nlanes);
+    /* fix back references of existing lanes */
+    for (i = 0; i < iscn->nlanes; i++)
+        zbar_decoder_set_userdata(lanes[i].dcode, lanes + i);
+    iscn->lanes = lanes;
+    for (; iscn->nlanes < n; iscn->nlanes++) {
+        scan_lane_t* lane = lanes + iscn->nlanes;
+        if (lane_init(iscn, lane)) {
+            lane_cleanup(lane);
+            break;
+        }
+    }
+    return(iscn->nlanes);
+}
+
 zbar_image_scanner_t* zbar_image_scanner_create(void)
 {
 	printf("zbar_image_scanner_create  in\r\n");
     zbar_image_scanner_t* iscn = calloc(1, sizeof(zbar_image_scanner_t));
     if (!iscn)
         return(NULL);
-    iscn->dcode = zbar_decoder_create();
-    iscn->scn = zbar_scanner_create(iscn->dcode);
-    if (!iscn->dcode || !iscn->scn) {
+    if (alloc_lanes(iscn, 1) < 1) {
         zbar_image_scanner_destroy(iscn);
         return(NULL);
     }
 
-    zbar_decoder_set_userdata(iscn->dcode, iscn);
-    zbar_decoder_set_handler(iscn->dcode, symbol_handler);
-
 #ifdef ENABLE_QRCODE
     iscn->qr = _zbar_qr_create();
 #endif
@@ -463,6 +638,8 @@ zbar_image_scanner_t* zbar_image_scanner_create(void)
     /* apply default configuration */
     CFG(iscn, ZBAR_CFG_X_DENSITY) = 1;
     CFG(iscn, ZBAR_CFG_Y_DENSITY) = 1;
+    CFG(iscn, ZBAR_CFG_THREADS) = 1;
+    iscn->roi = -1;
     
     printf("set_config \r\n");
     zbar_image_scanner_set_config(iscn, 0, ZBAR_CFG_POSITION, 1);
@@ -478,6 +655,17 @@ zbar_image_scanner_t* zbar_image_scanner_create(void)
     return(iscn);
 }
 
+zbar_image_data_handler_t*
+zbar_image_scanner_set_data_handler(zbar_image_scanner_t* iscn,
+    zbar_image_data_handler_t* handler,
+    const void* userdata)
+{
+    zbar_image_data_handler_t* result = iscn->handler;
+    iscn->handler = handler;
+    iscn->userdata = userdata;
+    return(result);
+}
+
 #ifndef NO_STATS
 static __inline void dump_stats(const zbar_image_scanner_t* iscn)
 {
@@ -491,6 +679,9 @@ static __inline void dump_stats(const zbar_image_scanner_t* iscn)
       for (i = 0; i < RECYCLE_BUCKETS; i++)
         zprintf(1, "     recycled[%d]        = %-4d\n",
             i, iscn->stat_sym_recycle[i]);
+      if (iscn->stat_pixels_total)
+        zprintf(1, "pixels scanned          = %.1f%%\n",
+            100. * iscn->stat_pixels_scanned / iscn->stat_pixels_total);
   
 }
 #endif
@@ -507,7 +698,7 @@ int zbar_image_scanner_set_config(zbar_image_scanner_t* iscn,
     }
     
     if (cfg < ZBAR_CFG_UNCERTAINTY)
-        return(zbar_decoder_set_config(iscn->dcode, sym, cfg, val));
+        return(zbar_decoder_set_config(iscn->lanes[0].dcode, sym, cfg, val));
     
     if (cfg < ZBAR_CFG_POSITION) {
         int c, i;
@@ -529,7 +720,31 @@ int zbar_image_scanner_set_config(zbar_image_scanner_t* iscn,
     if (sym > ZBAR_PARTIAL)
         return(1);
 
-    if (cfg >= ZBAR_CFG_X_DENSITY && cfg <= ZBAR_CFG_Y_DENSITY) {
+    if (cfg == ZBAR_CFG_THREADS) {
+        if (val < 1)
+            return(1);
+#ifndef ZBAR_POOL_THREADS
+        /* no thread backend in this build */
+        if (val > 1)
+            return(1);
+#endif
+        if (val > MAX_SCAN_THREADS)
+            val = MAX_SCAN_THREADS;
+        if (val != CFG(iscn, cfg)) {
+            /* (re)started lazily by the next scan */
+            _zbar_pool_destroy(iscn->pool);
+            iscn->pool = NULL;
+        }
+        CFG(iscn, cfg) = val;
+        return(0);
+    }
+
+    if (cfg == ZBAR_CFG_BINARIZER &&
+        (val < 0 || val >= ZBAR_BINARIZER_NUM))
+        return(1);
+
+    if (cfg >= ZBAR_CFG_X_DENSITY &&
+        cfg < ZBAR_CFG_X_DENSITY + NUM_SCN_CFGS) {
         CFG(iscn, cfg) = val;
         return(0);
     }
@@ -562,12 +777,14 @@ void zbar_image_scanner_destroy (zbar_image_scanner_t *iscn)
             _zbar_symbol_set_free(iscn->syms);
         iscn->syms = NULL;
     }
-    if(iscn->scn)
-        zbar_scanner_destroy(iscn->scn);
-    iscn->scn = NULL;
-    if(iscn->dcode)
-        zbar_decoder_destroy(iscn->dcode);
-    iscn->dcode = NULL;
+    _zbar_pool_destroy(iscn->pool);
+    iscn->pool = NULL;
+    for(i = 0; i < iscn->nlanes; i++)
+        lane_cleanup(&iscn->lanes[i]);
+    if(iscn->lanes)
+        free(iscn->lanes);
+    iscn->lanes = NULL;
+    iscn->nlanes = 0;
     for(i = 0; i < RECYCLE_BUCKETS; i++) {
         zbar_symbol_t *sym, *next;
         for(sym = iscn->recycle[i].head; sym; sym = next) {
@@ -625,29 +842,801 @@ __inline void zbar_image_scanner_recycle_image(zbar_image_scanner_t* iscn,
     }
 }
 
-static __inline void quiet_border(zbar_image_scanner_t* iscn)
+static __inline void quiet_border(scan_lane_t* lane)
 {
     /* flush scanner pipeline */
-    zbar_scanner_t* scn = iscn->scn;
+    zbar_scanner_t* scn = lane->scn;
     zbar_scanner_flush(scn);
     zbar_scanner_flush(scn);
     zbar_scanner_new_scan(scn);
 }
 
 
-#define movedelta(dx, dy) do {                  \
-        x += (dx);                              \
-        y += (dy);                              \
-        p += (dx) + ((uintptr_t)(dy) * w);       \
-    } while(0);
+/* segment of a scan line, used for partial passes */
+typedef struct scan_span_s {
+    int k;                      /* scan line index */
+    int u0, u1;                 /* pixel range along the line */
+} scan_span_t;
+
+/* one scan pass (rows for vert == 0, columns for vert == 1) */
+typedef struct scan_pass_s {
+    zbar_image_scanner_t* iscn;
+    const zbar_image_t* img;
+    int vert;                   /* scan columns */
+    int density;
+    int border;                 /* first scan line */
+    int count;                  /* total number of scan lines */
+    int step;                   /* scan every step-th line (no spans) */
+    const scan_span_t* spans;   /* or only these segments */
+    int first;                  /* first line (or span) to scan */
+    int nlines;                 /* lines (or spans) to scan */
+    int nbands;                 /* number of independent bands */
+} scan_pass_t;
+
+/* number of columns transposed together for the vertical pass */
+#define TILE_LINES 16
+
+#ifdef ZBAR_SSE2
+/* transpose a 16x16 byte block */
+static __inline void transpose16(const uint8_t* src,
+    intptr_t sstride,
+    uint8_t* dst,
+    intptr_t dstride)
+{
+    __m128i a[16], b[16];
+    int i, r;
+    for (i = 0; i < 16; i++)
+        a[i] = _mm_loadu_si128((const __m128i*)(src + i * sstride));
+    /* four perfect shuffles of the rows */
+    for (r = 0; r < 4; r++) {
+        __m128i* s = (r & 1) ? b : a;
+        __m128i* d = (r & 1) ? a : b;
+        for (i = 0; i < 8; i++) {
+            d[2 * i] = _mm_unpacklo_epi8(s[i], s[i + 8]);
+            d[2 * i + 1] = _mm_unpackhi_epi8(s[i], s[i + 8]);
+        }
+    }
+    for (i = 0; i < 16; i++)
+        _mm_storeu_si128((__m128i*)(dst + i * dstride), a[i]);
+}
+#endif
+
+/* copy image columns x0, x0 + density, ... (nc of them) over rows
+ * [y0, y0 + n) into consecutive rows of n bytes, so the vertical pass
+ * reads memory sequentially instead of striding a whole image row per
+ * sample
+ */
+static void transpose_columns(const zbar_image_t* img,
+    int x0,
+    int density,
+    int nc,
+    int y0,
+    int n,
+    uint8_t* dst)
+{
+    intptr_t w = img->width;
+    const uint8_t* src = (const uint8_t*)img->data + x0 + y0 * w;
+    int y = 0, c;
+#ifdef ZBAR_SSE2
+    if (density == 1 && nc == TILE_LINES)
+        for (; y + 16 <= n; y += 16)
+            transpose16(src + y * w, w, dst + y, n);
+#endif
+    for (; y < n; y++) {
+        const uint8_t* row = src + y * w;
+        for (c = 0; c < nc; c++)
+            dst[c * n + y] = row[c * density];
+    }
+}
+
+/* scan lines [i0, i1) of a pass.
+ * lines are scanned alternately forward and backward, exactly as a
+ * single boustrophedon pass would, so the per line results do not
+ * depend on how the pass is split up
+ */
+static void scan_lines(const scan_pass_t* pass,
+    scan_lane_t* lane,
+    int i0,
+    int i1)
+{
+    const zbar_image_t* img = pass->img;
+    zbar_scanner_t* scn = lane->scn;
+    unsigned w = img->width;
+    int crop0 = (pass->vert) ? img->crop_y : img->crop_x;
+    int crop1 = crop0 + ((pass->vert) ? img->crop_h : img->crop_w);
+    int tile_i = i0, tile_u0 = 0, tile_n = 0;
+    int i;
+
+    zbar_scanner_new_scan(scn);
+    for (i = i0; i < i1; i++) {
+        int k = (pass->spans) ? pass->spans[i].k : i * pass->step;
+        int c0 = (pass->spans) ? pass->spans[i].u0 : crop0;
+        int c1 = (pass->spans) ? pass->spans[i].u1 : crop1;
+        int n = c1 - c0;
+        int v = pass->border + k * pass->density;
+        int u = (i & 1) ? c1 - 1 : c0;
+        int dir = (i & 1) ? -1 : 1;
+        int x = (pass->vert) ? v : u;
+        int y = (pass->vert) ? u : v;
+        const uint8_t* p = (const uint8_t*)img->data + x + (uintptr_t)y * w;
+
+        if (pass->vert && lane->tile && (i - i0) % TILE_LINES == 0) {
+            /* transpose the next group of columns */
+            int nc = (i1 - i < TILE_LINES) ? i1 - i : TILE_LINES;
+            int j, c1max = c1;
+            tile_i = i;
+            tile_u0 = c0;
+            if (pass->spans) {
+                for (j = i + 1; j < i + nc; j++) {
+                    if (tile_u0 > pass->spans[j].u0)
+                        tile_u0 = pass->spans[j].u0;
+                    if (c1max < pass->spans[j].u1)
+                        c1max = pass->spans[j].u1;
+                }
+            }
+            tile_n = c1max - tile_u0;
+            if (!pass->spans || pass->spans[i + nc - 1].k - k == nc - 1)
+                transpose_columns(img, x, pass->density * pass->step, nc,
+                    tile_u0, tile_n, lane->tile);
+            else
+                /* spans skip lines, gather each one separately */
+                for (j = 0; j < nc; j++)
+                    transpose_columns(img,
+                        pass->border + pass->spans[i + j].k * pass->density,
+                        1, 1, tile_u0, tile_n, lane->tile + j * tile_n);
+        }
+
+        lane->v = v;
+        lane->du = dir;
+        lane->umin = (i & 1) ? c1 : c0;
+        lane->ldir = pass->vert;
+        lane->npixels += n;
+        if (!pass->vert) {
+            lane->dx = dir;
+            lane->dy = 0;
+            zprintf(128, "img_x%c: %04d,%04d @%p\n",
+                (i & 1) ? '-' : '+', x, y, p);
+            svg_path_start("vedge", dir / 32., (i & 1) ? w : 0, y + 0.5);
+            zbar_scan_row(scn, p, n, dir);
+        }
+        else {
+            lane->dx = 0;
+            lane->dy = dir;
+            zprintf(128, "img_y%c: %04d,%04d @%p\n",
+                (i & 1) ? '-' : '+', x, y, p);
+            svg_path_start("vedge", dir / 32., (i & 1) ? img->height : 0,
+                x + 0.5);
+            if (lane->tile)
+                zbar_scan_row(scn,
+                    lane->tile + (i - tile_i) * tile_n + (u - tile_u0),
+                    n, dir);
+            else
+                zbar_scan_row(scn, p, n, dir * (int)w);
+        }
+        quiet_border(lane);
+        svg_path_end();
+    }
+}
+
+/* scan diagonal lines [i0, i1) of a pass.
+ * pass->vert 2 scans along (1,1), lines indexed by y - x,
+ * pass->vert 3 scans along (1,-1), lines indexed by x + y.
+ * positions are reported in the rotated frame u = x + y, v = y - x
+ * (see qrcode.h), so lines along (1,1) run in +u and lines along
+ * (1,-1) in -v; either way a sample covers 2 units
+ */
+static void scan_diagonals(const scan_pass_t* pass,
+    scan_lane_t* lane,
+    int i0,
+    int i1)
+{
+    const zbar_image_t* img = pass->img;
+    zbar_scanner_t* scn = lane->scn;
+    int cw = img->crop_w, ch = img->crop_h;
+    int w = img->width;
+    int i;
+
+    zbar_scanner_new_scan(scn);
+    for (i = i0; i < i1; i++) {
+        int s = pass->border + i * pass->density;
+        int xs, xe, ys, x0, y0, x1, y1, n, stride;
+        const uint8_t* p;
+
+        if (pass->vert == 2) {
+            int c = s - (cw - 1);
+            xs = (c < 0) ? -c : 0;
+            xe = (ch - 1 - c < cw - 1) ? ch - 1 - c : cw - 1;
+            ys = xs + c;
+            stride = w + 1;
+        }
+        else {
+            xs = (s > ch - 1) ? s - (ch - 1) : 0;
+            xe = (s < cw - 1) ? s : cw - 1;
+            ys = s - xs;
+            stride = 1 - w;
+        }
+        n = xe - xs + 1;
+        x0 = img->crop_x + xs;
+        y0 = img->crop_y + ys;
+        x1 = x0 + n - 1;
+        y1 = (pass->vert == 2) ? y0 + n - 1 : y0 - (n - 1);
+
+        lane->dx = lane->dy = 0;
+        if (pass->vert == 2) {
+            lane->v = y0 - x0;
+            lane->du = (i & 1) ? -1 : 1;
+            lane->umin = (i & 1) ? x1 + y1 + 2 : x0 + y0;
+        }
+        else {
+            lane->v = x0 + y0 + 1;
+            lane->du = (i & 1) ? 1 : -1;
+            lane->umin = (i & 1) ? y1 - x1 - 1 : y0 - x0 + 1;
+        }
+        lane->npixels += n;
+
+        if (i & 1) {
+            p = (const uint8_t*)img->data + x1 + (intptr_t)y1 * w;
+            stride = -stride;
+        }
+        else
+            p = (const uint8_t*)img->data + x0 + (intptr_t)y0 * w;
+        zprintf(128, "img_d%d%c: %04d,%04d @%p\n", pass->vert,
+            (i & 1) ? '-' : '+', (i & 1) ? x1 : x0, (i & 1) ? y1 : y0, p);
+        zbar_scan_row(scn, p, n, stride);
+        quiet_border(lane);
+    }
+}
+
+static void scan_band(void* arg,
+    int idx)
+{
+    const scan_pass_t* pass = arg;
+    scan_lane_t* lane = &pass->iscn->lanes[idx];
+    int i0 = pass->first +
+        (int)((long long)pass->nlines * idx / pass->nbands);
+    int i1 = pass->first +
+        (int)((long long)pass->nlines * (idx + 1) / pass->nbands);
+#ifdef ENABLE_QRCODE
+    lane->qr_lines[pass->vert].nlines = 0;
+#endif
+    lane->npixels = 0;
+    if (pass->vert >= 2) {
+        lane->ldir = pass->vert;
+        scan_diagonals(pass, lane, i0, i1);
+        return;
+    }
+    if (pass->vert) {
+        /* (re)allocate column tile, fall back to strided access */
+        size_t size = (size_t)TILE_LINES * pass->img->crop_h;
+        if (size > lane->tile_size) {
+            if (lane->tile)
+                free(lane->tile);
+            lane->tile = malloc(size);
+            lane->tile_size = (lane->tile) ? size : 0;
+        }
+    }
+    scan_lines(pass, lane, i0, i1);
+}
+
+/* scan pass->nlines lines (or spans), split into bands when threaded.
+ * results are left in the first pass->nbands lanes
+ */
+static void scan_run(zbar_image_scanner_t* iscn,
+    scan_pass_t* pass)
+{
+    int nthreads = _zbar_pool_size(iscn->pool);
+    int i;
+
+    pass->nbands = 1;
+    if (nthreads > 1) {
+        pass->nbands = nthreads * SCAN_BANDS_PER_THREAD;
+        if (pass->nbands > pass->nlines)
+            pass->nbands = pass->nlines;
+        if (pass->nbands < 1)
+            pass->nbands = 1;
+        pass->nbands = alloc_lanes(iscn, pass->nbands);
+        for (i = 1; i < pass->nbands; i++)
+            lane_sync_config(&iscn->lanes[i], iscn->lanes[0].dcode);
+    }
+
+    _zbar_pool_run((pass->nbands > 1) ? iscn->pool : NULL,
+        scan_band, pass, pass->nbands);
+
+#ifndef NO_STATS
+    for (i = 0; i < pass->nbands; i++)
+        iscn->stat_pixels_scanned += iscn->lanes[i].npixels;
+#endif
+}
+
+#ifdef ENABLE_QRCODE
+/* area around a candidate finder pattern, in image coordinates */
+typedef struct scan_window_s {
+    int x0, y0, x1, y1;         /* inclusive */
+} scan_window_t;
+
+/* build the spans of a pass that intersect any of the windows.
+ * returns the number of spans, or -1 if out of memory
+ */
+static int window_spans(const scan_pass_t* pass,
+    const scan_window_t* windows,
+    int nwindows,
+    scan_span_t** spansp)
+{
+    const zbar_image_t* img = pass->img;
+    int vert = pass->vert;
+    int crop0 = (vert) ? img->crop_y : img->crop_x;
+    int crop1 = crop0 + ((vert) ? img->crop_h : img->crop_w);
+    scan_span_t* spans;
+    int nspans = 0;
+    int i, k;
+
+    *spansp = NULL;
+    if (!nwindows || !pass->count)
+        return(0);
+    spans = malloc(pass->count * sizeof(*spans));
+    if (!spans)
+        return(-1);
+
+    for (k = 0; k < pass->count; k++) {
+        int v = pass->border + k * pass->density;
+        int u0 = crop1, u1 = crop0;
+        for (i = 0; i < nwindows; i++) {
+            const scan_window_t* win = windows + i;
+            int v0 = (vert) ? win->x0 : win->y0;
+            int v1 = (vert) ? win->x1 : win->y1;
+            if (v < v0 || v > v1)
+                continue;
+            if (u0 > ((vert) ? win->y0 : win->x0))
+                u0 = (vert) ? win->y0 : win->x0;
+            if (u1 <= ((vert) ? win->y1 : win->x1))
+                u1 = ((vert) ? win->y1 : win->x1) + 1;
+        }
+        if (u0 < crop0)
+            u0 = crop0;
+        if (u1 > crop1)
+            u1 = crop1;
+        if (u0 < u1) {
+            spans[nspans].k = k;
+            spans[nspans].u0 = u0;
+            spans[nspans].u1 = u1;
+            nspans++;
+        }
+    }
+    *spansp = spans;
+    return(nspans);
+}
+
+/* look for another line in lines (found scanning in direction dir, so
+ * sorted by pos[!dir]) whose center is within tol of c
+ */
+static int find_hit(const qr_finder_lines* lines,
+    int dir,
+    const int c[2],
+    const int tol[2],
+    const qr_finder_line* self)
+{
+    int lo = 0, hi = lines->nlines;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (lines->lines[mid].pos[!dir] < c[!dir] - tol[!dir])
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (; lo < lines->nlines; lo++) {
+        const qr_finder_line* line = lines->lines + lo;
+        if (line->pos[!dir] > c[!dir] + tol[!dir])
+            break;
+        if (line != self &&
+            abs(line->pos[dir] + (line->len >> 1) - c[dir]) <= tol[dir] &&
+            abs(line->len - self->len) <= (self->len >> 1))
+            return(1);
+    }
+    return(0);
+}
+
+/* keep coarse hits confirmed by a line crossing their center run in the
+ * other direction (the same test used to locate finder centers), or by
+ * a hit on a neighboring coarse line, which rejects most of the short
+ * patterns found in noise and texture.
+ * a rotated finder is often cut by a single coarse line, so a lone hit
+ * is kept too if its center run is at least a coarse spacing long:
+ * noise rarely produces runs that long.
+ * each kept hit marks a window large enough to hold the whole finder
+ * pattern in any orientation, with the coarse line spacing as slack for
+ * the size estimate of a single line (twice that for a lone hit).
+ * returns the number of windows, or -1 if out of memory
+ */
+static int adaptive_windows(const qr_finder_lines* hits,
+    int coarse,
+    scan_window_t** windowsp)
+{
+    scan_window_t* windows;
+    int nwindows = 0;
+    int dir, i;
+
+    *windowsp = NULL;
+    if (!hits[0].nlines && !hits[1].nlines)
+        return(0);
+    windows = malloc((hits[0].nlines + hits[1].nlines) * sizeof(*windows));
+    if (!windows)
+        return(-1);
+
+    for (dir = 0; dir < 2; dir++) {
+        for (i = 0; i < hits[dir].nlines; i++) {
+            const qr_finder_line* line = hits[dir].lines + i;
+            int c[2], tol[2];
+            int s;
+            c[dir] = line->pos[dir] + (line->len >> 1);
+            c[!dir] = line->pos[!dir];
+            tol[0] = tol[1] = line->len;
+            s = ((line->boffs + line->len + line->eoffs) >>
+                QR_FINDER_SUBPREC) + 1 + coarse;
+            if (!find_hit(&hits[!dir], !dir, c, tol, line)) {
+                tol[!dir] = QR_FIXED(coarse, 0);
+                if (!find_hit(&hits[dir], dir, c, tol, line)) {
+                    if (line->len < QR_FIXED(coarse, 0))
+                        continue;
+                    s += coarse;
+                }
+            }
+            windows[nwindows].x0 = (c[0] >> QR_FINDER_SUBPREC) - s;
+            windows[nwindows].x1 = (c[0] >> QR_FINDER_SUBPREC) + s;
+            windows[nwindows].y0 = (c[1] >> QR_FINDER_SUBPREC) - s;
+            windows[nwindows].y1 = (c[1] >> QR_FINDER_SUBPREC) + s;
+            nwindows++;
+        }
+    }
+    *windowsp = windows;
+    return(nwindows);
+}
+#endif
+
+/* set up a pass over the crop area, returns 0 if the pass is disabled */
+static int scan_pass_init(zbar_image_scanner_t* iscn,
+    const zbar_image_t* img,
+    int vert,
+    scan_pass_t* pass)
+{
+    int crop = (vert) ? img->crop_w : img->crop_h;
+    int start = (vert) ? img->crop_x : img->crop_y;
+
+    pass->iscn = iscn;
+    pass->img = img;
+    pass->vert = vert;
+    if (vert >= 2) {
+        /* diagonal lines, indexed from 0 (see scan_diagonals) */
+        crop = img->crop_w + img->crop_h - 1;
+        start = 0;
+        pass->density = CFG(iscn, ZBAR_CFG_DIAG_DENSITY);
+    }
+    else
+        pass->density = CFG(iscn, (vert) ? ZBAR_CFG_X_DENSITY : ZBAR_CFG_Y_DENSITY);
+    if (pass->density <= 0)
+        return(0);
+
+    pass->border = (((crop - 1) % pass->density) + 1) / 2;
+    if (pass->border > crop / 2)
+        pass->border = crop / 2;
+    pass->count = (crop > pass->border)
+        ? (crop - pass->border + pass->density - 1) / pass->density
+        : 0;
+    pass->border += start;
+    pass->step = 1;
+    pass->spans = NULL;
+    pass->first = 0;
+    pass->nlines = pass->count;
+    return(1);
+}
+
+/* number of QR decode attempts spread over the vertical pass
+ * when ZBAR_CFG_EXPECTED_COUNT is set
+ */
+#define SCAN_CHECKPOINTS 4
+
+/* whether the expected number of QR codes has been found */
+static __inline int scan_done(const zbar_image_scanner_t* iscn)
+{
+    int n = CFG(iscn, ZBAR_CFG_EXPECTED_COUNT);
+    return(n > 0 && iscn->nqr >= n);
+}
+
+#ifdef ENABLE_QRCODE
+/* try to decode the rest of the expected QR codes from the finder lines
+ * found so far, keeping the results only if all of them are found
+ */
+static void scan_try_early(zbar_image_scanner_t* iscn)
+{
+    int n = CFG(iscn, ZBAR_CFG_EXPECTED_COUNT) - iscn->nqr;
+    if (CFG(iscn, ZBAR_CFG_EXPECTED_COUNT) > 0 && n > 0)
+        _zbar_qr_decode_partial(iscn->qr, iscn, iscn->img, n);
+}
+#endif
+
+static void scan_pass(zbar_image_scanner_t* iscn,
+    scan_pass_t* pass)
+{
+    int nlines = pass->nlines, nsegs = 1, seg;
+    int i;
+
+#ifdef ENABLE_QRCODE
+    /* stop partway through the vertical pass if the expected codes
+     * can already be decoded
+     */
+    if (pass->vert == 1 && CFG(iscn, ZBAR_CFG_EXPECTED_COUNT) > 0)
+        nsegs = SCAN_CHECKPOINTS;
+#endif
+
+    svg_group_start("scanner", (pass->vert == 1) ? 90 : 0, 1,
+        (pass->vert == 1) ? -1 : 1, 0, 0);
+    for (seg = 0; seg < nsegs && !scan_done(iscn); seg++) {
+        pass->first = (int)((long long)nlines * seg / nsegs);
+        pass->nlines = (int)((long long)nlines * (seg + 1) / nsegs) -
+            pass->first;
+        scan_run(iscn, pass);
+
+#ifndef NO_STATS
+        if (pass->vert >= 2)
+            for (i = 0; i < pass->nbands; i++)
+                iscn->stat_pixels_total += iscn->lanes[i].npixels;
+#endif
+
+#ifdef ENABLE_QRCODE
+        /* merge in band order, same as a serial scan */
+        for (i = 0; i < pass->nbands; i++)
+            _zbar_qr_found_lines(iscn->qr, pass->vert,
+                &iscn->lanes[i].qr_lines[pass->vert]);
+        if (seg + 1 < nsegs)
+            scan_try_early(iscn);
+#endif
+    }
+    pass->first = 0;
+    pass->nlines = nlines;
+    svg_group_end();
+
+#ifndef NO_STATS
+    if (pass->vert < 2)
+        iscn->stat_pixels_total += (uint64_t)pass->count *
+            ((pass->vert) ? pass->img->crop_h : pass->img->crop_w);
+#endif
+}
+
+#ifdef ENABLE_QRCODE
+/* coarse to fine scan: sparse passes in both directions find candidate
+ * finder patterns, then only their neighborhoods are rescanned at full
+ * density.  returns 0 if the image was not (completely) scanned
+ */
+static int scan_adaptive(zbar_image_scanner_t* iscn,
+    const zbar_image_t* img)
+{
+    int coarse = CFG(iscn, ZBAR_CFG_COARSE_DENSITY);
+    scan_pass_t pass[2];
+    qr_finder_lines hits[2];
+    scan_window_t* windows = NULL;
+    int nwindows = -1;
+    int vert, i;
+
+    if (!scan_pass_init(iscn, img, 0, &pass[0]) ||
+        !scan_pass_init(iscn, img, 1, &pass[1]) ||
+        coarse < 2 * pass[0].density || coarse < 2 * pass[1].density)
+        return(0);
+
+    memset(hits, 0, sizeof(hits));
+    for (vert = 0; vert < 2; vert++) {
+        scan_pass_t* p = &pass[vert];
+        p->step = coarse / p->density;
+        p->nlines = (p->count + p->step - 1) / p->step;
+        scan_run(iscn, p);
+        for (i = 0; i < p->nbands; i++) {
+            const qr_finder_lines* lines = &iscn->lanes[i].qr_lines[vert];
+            int j;
+            for (j = 0; j < lines->nlines; j++)
+                _zbar_qr_lines_add(&hits[vert], lines->lines + j);
+        }
+    }
+    nwindows = adaptive_windows(hits, coarse, &windows);
+    if (hits[0].lines)
+        free(hits[0].lines);
+    if (hits[1].lines)
+        free(hits[1].lines);
+    if (nwindows < 0)
+        return(0);
+
+    for (vert = 0; vert < 2; vert++) {
+        scan_pass_t* p = &pass[vert];
+        scan_span_t* spans = NULL;
+        p->step = 1;
+        p->nlines = window_spans(p, windows, nwindows, &spans);
+        if (p->nlines < 0) {
+            /* out of memory, fall back to a full scan */
+            p->nlines = p->count;
+            spans = NULL;
+        }
+        p->spans = spans;
+        scan_pass(iscn, p);
+        if (spans)
+            free(spans);
+    }
+    if (windows)
+        free(windows);
+    return(1);
+}
+#endif
+
+/* pass the symbols found so far to the data handler, if any of them
+ * are new, and mark them reported so a streaming handler can tell
+ * which ones the last band added
+ */
+static void scan_report(zbar_image_scanner_t* iscn,
+    zbar_image_t* img)
+{
+    zbar_symbol_set_t* syms = img->syms;
+    /* the entries up to tail are held back by the result cache */
+    zbar_symbol_t* first = (syms->tail) ? syms->tail->next : syms->head;
+    zbar_symbol_t* sym;
+    if (!iscn->handler)
+        return;
+    for (sym = first; sym && sym->reported; sym = sym->next);
+    if (!sym)
+        return;
+    iscn->handler(img, iscn->userdata);
+    for (sym = first; sym; sym = sym->next)
+        sym->reported = 1;
+}
+
+#ifdef ENABLE_QRCODE
+/* optional diagonal passes for codes rotated near 45 degrees */
+static void scan_diagonal_passes(zbar_image_scanner_t* iscn,
+    const zbar_image_t* img)
+{
+    scan_pass_t pass;
+    if (!scan_done(iscn) && scan_pass_init(iscn, img, 2, &pass))
+        scan_pass(iscn, &pass);
+    if (!scan_done(iscn) && scan_pass_init(iscn, img, 3, &pass))
+        scan_pass(iscn, &pass);
+}
+
+/* streaming scan: the crop is scanned in bands of rows and QR codes are
+ * decoded after each band, so codes near the top of a tall image are
+ * reported long before the bottom has been scanned.
+ * the columns are scanned a little past each band, so finder patterns
+ * crossing the boundary are seen whole, but only keep the lines whose
+ * center section starts inside it (that is 2 modules into the pattern
+ * and 5 from its end, so less is needed above the band than below).
+ * large finder patterns need more: a column scan only settles a few
+ * edges after it starts, so the margins also cover the widest finder
+ * pattern crossed by a row so far, plus as much again to settle in.
+ * returns 0 if the crop was not scanned
+ */
+static int scan_stream(zbar_image_scanner_t* iscn,
+    zbar_image_t* img)
+{
+    int rows = CFG(iscn, ZBAR_CFG_STREAM_ROWS);
+    int overlap = (rows / 4 > 32) ? rows / 4 : 32;
+    int finder = 0;                 /* widest finder pattern so far */
+    int cy1 = img->crop_y + img->crop_h;
+    scan_pass_t hpass, vpass;
+    scan_span_t* spans;
+    int nb, k0, y0, biny, i, j;
+
+    if (!scan_pass_init(iscn, img, 0, &hpass) ||
+        !scan_pass_init(iscn, img, 1, &vpass) ||
+        !vpass.count)
+        return(0);
+    spans = malloc(vpass.count * sizeof(scan_span_t));
+    if (!spans)
+        return(0);
+    nb = (rows + hpass.density - 1) / hpass.density;
+
+    for (k0 = 0, y0 = biny = img->crop_y; y0 < cy1 && !scan_done(iscn);
+         k0 += nb) {
+        int k1 = (k0 + nb < hpass.count) ? k0 + nb : hpass.count;
+        int y1 = (k1 < hpass.count) ? hpass.border + k1 * hpass.density : cy1;
+        int u0, u1;
+
+        hpass.first = k0;
+        hpass.nlines = k1 - k0;
+        if (hpass.nlines > 0) {
+            scan_run(iscn, &hpass);
+            for (i = 0; i < hpass.nbands; i++) {
+                qr_finder_lines* lines = &iscn->lanes[i].qr_lines[0];
+                for (j = 0; j < lines->nlines; j++) {
+                    /* the center section is 3 of the 7 modules */
+                    int w = (lines->lines[j].len * 7 / 3) >> QR_FINDER_SUBPREC;
+                    if (finder < w)
+                        finder = w;
+                }
+                _zbar_qr_found_lines(iscn->qr, 0, lines);
+            }
+        }
+        u0 = y0 - ((overlap / 2 > finder) ? overlap / 2 : finder);
+        if (u0 < (int)img->crop_y)
+            u0 = img->crop_y;
+        u1 = y1 + ((overlap > finder * 3 / 2) ? overlap : finder * 3 / 2);
+        if (u1 > cy1)
+            u1 = cy1;
+
+        for (i = 0; i < vpass.count; i++) {
+            spans[i].k = i;
+            spans[i].u0 = u0;
+            spans[i].u1 = u1;
+        }
+        vpass.spans = spans;
+        scan_run(iscn, &vpass);
+        for (i = 0; i < vpass.nbands; i++) {
+            qr_finder_lines* lines = &iscn->lanes[i].qr_lines[1];
+            int nlines = 0;
+            for (j = 0; j < lines->nlines; j++) {
+                int y = lines->lines[j].pos[1] >> QR_FINDER_SUBPREC;
+                if (y >= y0 && y < y1)
+                    lines->lines[nlines++] = lines->lines[j];
+            }
+            lines->nlines = nlines;
+            _zbar_qr_found_lines(iscn->qr, 1, lines);
+        }
+
+        if (y1 >= cy1) {
+            /* the diagonal passes need the whole crop */
+            if (CFG(iscn, ZBAR_CFG_DIAG_DENSITY) > 0)
+                scan_diagonal_passes(iscn, img);
+            u1 = cy1;
+        }
+        if (!scan_done(iscn)) {
+            /* lines well above the next band cannot join a new cluster */
+            int expected = CFG(iscn, ZBAR_CFG_EXPECTED_COUNT);
+            _zbar_qr_decode_rows(iscn->qr, iscn, img, biny, u1,
+                y1 - 2 * ((overlap > finder) ? overlap : finder), y1 >= cy1,
+                (expected > 0) ? expected - iscn->nqr : 0);
+        }
+        biny = u1;
+        scan_report(iscn, img);
+        y0 = y1;
+    }
+    free(spans);
+
+#ifndef NO_STATS
+    iscn->stat_pixels_total += (uint64_t)hpass.count * img->crop_w +
+        (uint64_t)vpass.count * img->crop_h;
+#endif
+    return(1);
+}
+#endif
+
+/* scan the current crop rectangle of an image */
+static void scan_crop(zbar_image_scanner_t* iscn,
+    zbar_image_t* img)
+{
+#ifdef ENABLE_QRCODE
+    if (CFG(iscn, ZBAR_CFG_STREAM_ROWS) > 0 && scan_stream(iscn, img))
+        return;
+    if (!CFG(iscn, ZBAR_CFG_COARSE_DENSITY) || !scan_adaptive(iscn, img))
+#endif
+    {
+        scan_pass_t pass;
+        if (scan_pass_init(iscn, img, 0, &pass))
+            scan_pass(iscn, &pass);
+        if (scan_pass_init(iscn, img, 1, &pass))
+            scan_pass(iscn, &pass);
+    }
+#ifdef ENABLE_QRCODE
+    if (CFG(iscn, ZBAR_CFG_DIAG_DENSITY) > 0 && !scan_done(iscn)) {
+        scan_try_early(iscn);
+        scan_diagonal_passes(iscn, img);
+    }
+
+    /* consumes the finder lines */
+    if (!scan_done(iscn)) {
+        int n = CFG(iscn, ZBAR_CFG_EXPECTED_COUNT);
+        _zbar_qr_decode(iscn->qr, iscn, img, (n > 0) ? n - iscn->nqr : 0);
+    }
+#endif
+}
 
 int zbar_scan_image(zbar_image_scanner_t* iscn,
     zbar_image_t* img)
 {
     zbar_symbol_set_t* syms;
-    const uint8_t* data;
-    zbar_scanner_t* scn = iscn->scn;
-    unsigned w, h, cx1, cy1;
+    unsigned w, h;
     int density;
 
     /* timestamp image
@@ -664,6 +1653,7 @@ int zbar_scan_image(zbar_image_scanner_t* iscn,
         img->format != fourcc('G', 'R', 'E', 'Y'))
         return(-1);
     iscn->img = img;
+    iscn->nqr = 0;
 
     /* recycle previous scanner and image results */
     zbar_image_scanner_recycle_image(iscn, img);
@@ -679,133 +1669,54 @@ int zbar_scan_image(zbar_image_scanner_t* iscn,
 
     w = img->width;
     h = img->height;
-    cx1 = img->crop_x + img->crop_w;
-    assert(cx1 <= w);
-    cy1 = img->crop_y + img->crop_h;
-    assert(cy1 <= h);
-    data = img->data;
+    assert(img->crop_x + img->crop_w <= w);
+    assert(img->crop_y + img->crop_h <= h);
 
     zbar_image_write_png(img, "debug.png");
     svg_open("debug.svg", 0, 0, w, h);
     svg_image("debug.png", w, h);
 
-    zbar_scanner_new_scan(scn);
-
-    density = CFG(iscn, ZBAR_CFG_Y_DENSITY);
-    if (density > 0) {
-        const uint8_t* p = data;
-        int x = 0, y = 0;
-
-        int border = (((img->crop_h - 1) % density) + 1) / 2;
-        if (border > img->crop_h / 2)
-            border = img->crop_h / 2;
-        border += img->crop_y;
-        assert(border <= h);
-        svg_group_start("scanner", 0, 1, 1, 0, 0);
-        iscn->dy = 0;
-
-        movedelta(img->crop_x, border);
-        iscn->v = y;
-
-        while (y < cy1) {
-            int cx0 = img->crop_x;;
-            zprintf(128, "img_x+: %04d,%04d @%p\n", x, y, p);
-            svg_path_start("vedge", 1. / 32, 0, y + 0.5);
-            iscn->dx = iscn->du = 1;
-            iscn->umin = cx0;
-            while (x < cx1) {
-                uint8_t d = *p;
-                movedelta(1, 0);
-                zbar_scan_y(scn, d);
-            }
-            ASSERT_POS;
-            quiet_border(iscn);
-            svg_path_end();
-
-            movedelta(-1, density);
-            iscn->v = y;
-            if (y >= cy1)
-                break;
-
-            zprintf(128, "img_x-: %04d,%04d @%p\n", x, y, p);
-            svg_path_start("vedge", -1. / 32, w, y + 0.5);
-            iscn->dx = iscn->du = -1;
-            iscn->umin = cx1;
-            while (x >= cx0) {
-                uint8_t d = *p;
-                movedelta(-1, 0);
-                zbar_scan_y(scn, d);
-            }
-            ASSERT_POS;
-            quiet_border(iscn);
-            svg_path_end();
+    if (CFG(iscn, ZBAR_CFG_THREADS) > 1 && !iscn->pool)
+        iscn->pool = _zbar_pool_create(CFG(iscn, ZBAR_CFG_THREADS));
+#ifdef ENABLE_QRCODE
+    _zbar_qr_set_pool(iscn->qr, iscn->pool);
+    _zbar_qr_set_binarizer(iscn->qr, CFG(iscn, ZBAR_CFG_BINARIZER));
+#endif
 
-            movedelta(1, density);
-            iscn->v = y;  
+    if (!img->nrois)
+        scan_crop(iscn, img);
+    else {
+        /* scan each region of interest (within the crop) in turn */
+        unsigned x0 = img->crop_x, y0 = img->crop_y;
+        unsigned x1 = x0 + img->crop_w, y1 = y0 + img->crop_h;
+        int i;
+        for (i = 0; i < img->nrois && !scan_done(iscn); i++) {
+            const image_roi_t* roi = img->rois + i;
+            unsigned rx0, ry0, rx1, ry1;
+            if (roi->x >= x1 || roi->y >= y1)
+                continue;
+            rx0 = (roi->x > x0) ? roi->x : x0;
+            ry0 = (roi->y > y0) ? roi->y : y0;
+            rx1 = (roi->w < x1 - roi->x) ? roi->x + roi->w : x1;
+            ry1 = (roi->h < y1 - roi->y) ? roi->y + roi->h : y1;
+            if (rx1 <= rx0 || ry1 <= ry0)
+                continue;
+            img->crop_x = rx0;
+            img->crop_y = ry0;
+            img->crop_w = rx1 - rx0;
+            img->crop_h = ry1 - ry0;
+            iscn->roi = i;
+            scan_crop(iscn, img);
         }
-        svg_group_end(); 
+        iscn->roi = -1;
+        img->crop_x = x0;
+        img->crop_y = y0;
+        img->crop_w = x1 - x0;
+        img->crop_h = y1 - y0;
     }
-    iscn->dx = 0;
-
     density = CFG(iscn, ZBAR_CFG_X_DENSITY);
-    if (density > 0) {
-        const uint8_t* p = data;
-        int x = 0, y = 0;
-
-        int border = (((img->crop_w - 1) % density) + 1) / 2;
-        if (border > img->crop_w / 2)
-            border = img->crop_w / 2;
-        border += img->crop_x;
-        assert(border <= w);
-        svg_group_start("scanner", 90, 1, -1, 0, 0);
-        movedelta(border, img->crop_y);
-        iscn->v = x;
-
-        while (x < cx1) {
-            int cy0 = img->crop_y;
-            zprintf(128, "img_y+: %04d,%04d @%p\n", x, y, p);
-            svg_path_start("vedge", 1. / 32, 0, x + 0.5);
-            iscn->dy = iscn->du = 1;
-            iscn->umin = cy0;
-            while (y < cy1) {
-                uint8_t d = *p;
-                movedelta(0, 1);
-                zbar_scan_y(scn, d);
-            }
-            ASSERT_POS;
-            quiet_border(iscn);
-            svg_path_end();
-
-            movedelta(density, -1);
-            iscn->v = x;
-            if (x >= cx1)
-                break;
-
-            zprintf(128, "img_y-: %04d,%04d @%p\n", x, y, p);
-            svg_path_start("vedge", -1. / 32, h, x + 0.5);
-            iscn->dy = iscn->du = -1;
-            iscn->umin = cy1;
-            while (y >= cy0) {
-                uint8_t d = *p;
-                movedelta(0, -1);
-                zbar_scan_y(scn, d);
-            }
-            ASSERT_POS;
-            quiet_border(iscn);
-            svg_path_end();
-
-            movedelta(density, 1);
-            iscn->v = x;
-        }
-        svg_group_end();
-    }
-    iscn->dy = 0;
     iscn->img = NULL;
 
-#ifdef ENABLE_QRCODE
-    _zbar_qr_decode(iscn->qr, iscn, img);
-#endif
-
     /* FIXME tmp hack to filter bad EAN results */
     /* FIXME tmp hack to merge simple case EAN add-ons */
     char filter = (!iscn->enable_cache &&
@@ -886,8 +1797,8 @@ int zbar_scan_image(zbar_image_scanner_t* iscn,
         }
     }
 
-    if (syms->nsyms && iscn->handler)
-        iscn->handler(img, iscn->userdata);
+    /* unless a streaming scan already reported all of them */
+    scan_report(iscn, img);
        
     svg_close();
     return(syms->nsyms);
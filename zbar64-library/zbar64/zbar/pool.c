@@ -0,0 +1,267 @@
+/*------------------------------------------------------------------------
+ *  Copyright 2007-2010 (c) Jeff Brown <spadix@users.sourceforge.net>
+ *
+ *  This file is part of the ZBar Bar Code Reader.
+ *
+ *  The ZBar Bar Code Reader is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser Public License as
+ *  published by the Free Software Foundation; either version 2.1 of
+ *  the License, or (at your option) any later version.
+ *
+ *  The ZBar Bar Code Reader is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser Public License
+ *  along with the ZBar Bar Code Reader; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *  Boston, MA  02110-1301  USA
+ *
+ *  http://sourceforge.net/projects/zbar
+ *------------------------------------------------------------------------*/
+
+#include <config.h>
+#include <stdlib.h>     /* malloc, calloc, free */
+
+#include "pool.h"
+
+#if defined(_WIN32)
+# include <windows.h>
+
+typedef HANDLE pool_thread_t;
+typedef CRITICAL_SECTION pool_lock_t;
+typedef CONDITION_VARIABLE pool_cond_t;
+
+# define pool_lock_init(l)    InitializeCriticalSection(l)
+# define pool_lock_destroy(l) DeleteCriticalSection(l)
+# define pool_lock(l)         EnterCriticalSection(l)
+# define pool_unlock(l)       LeaveCriticalSection(l)
+# define pool_cond_init(c)    InitializeConditionVariable(c)
+# define pool_cond_destroy(c)
+# define pool_cond_wait(c, l) SleepConditionVariableCS(c, l, INFINITE)
+# define pool_cond_wake(c)    WakeAllConditionVariable(c)
+
+#elif defined(ZBAR_POOL_THREADS)
+# include <pthread.h>
+
+typedef pthread_t pool_thread_t;
+typedef pthread_mutex_t pool_lock_t;
+typedef pthread_cond_t pool_cond_t;
+
+# define pool_lock_init(l)    pthread_mutex_init(l, NULL)
+# define pool_lock_destroy(l) pthread_mutex_destroy(l)
+# define pool_lock(l)         pthread_mutex_lock(l)
+# define pool_unlock(l)       pthread_mutex_unlock(l)
+# define pool_cond_init(c)    pthread_cond_init(c, NULL)
+# define pool_cond_destroy(c) pthread_cond_destroy(c)
+# define pool_cond_wait(c, l) pthread_cond_wait(c, l)
+# define pool_cond_wake(c)    pthread_cond_broadcast(c)
+
+#endif
+
+#ifdef ZBAR_POOL_THREADS
+
+struct zbar_pool_s {
+    int nworkers;               /* started worker threads */
+    pool_thread_t* workers;
+
+    pool_lock_t lock;
+    pool_cond_t work;           /* signalled when a job is posted */
+    pool_cond_t done;           /* signalled when the last task finishes */
+
+    /* current job, protected by lock */
+    zbar_pool_task_t* task;
+    void* arg;
+    int ntasks;                 /* number of tasks in job */
+    int next;                   /* next task to hand out */
+    int pending;                /* tasks not yet completed */
+    int quit;                   /* shutdown request */
+};
+
+/* run tasks until the current job has none left to hand out.
+ * called and returns with the lock held
+ */
+static void pool_work(zbar_pool_t* pool)
+{
+    while (pool->next < pool->ntasks) {
+        int idx = pool->next++;
+        zbar_pool_task_t* task = pool->task;
+        void* arg = pool->arg;
+        pool_unlock(&pool->lock);
+        task(arg, idx);
+        pool_lock(&pool->lock);
+        if (!--pool->pending)
+            pool_cond_wake(&pool->done);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI pool_worker(void* arg)
+#else
+static void* pool_worker(void* arg)
+#endif
+{
+    zbar_pool_t* pool = arg;
+    pool_lock(&pool->lock);
+    while (!pool->quit) {
+        if (pool->next < pool->ntasks)
+            pool_work(pool);
+        else
+            pool_cond_wait(&pool->work, &pool->lock);
+    }
+    pool_unlock(&pool->lock);
+    return(0);
+}
+
+zbar_pool_t* _zbar_pool_create(int nthreads)
+{
+    zbar_pool_t* pool;
+    int i;
+    if (nthreads <= 1)
+        return(NULL);
+
+    pool = calloc(1, sizeof(zbar_pool_t));
+    if (!pool)
+        return(NULL);
+    pool->workers = calloc(nthreads - 1, sizeof(pool_thread_t));
+    if (!pool->workers) {
+        free(pool);
+        return(NULL);
+    }
+    pool_lock_init(&pool->lock);
+    pool_cond_init(&pool->work);
+    pool_cond_init(&pool->done);
+
+    for (i = 0; i < nthreads - 1; i++) {
+#ifdef _WIN32
+        pool->workers[i] = CreateThread(NULL, 0, pool_worker, pool, 0, NULL);
+        if (!pool->workers[i])
+            break;
+#else
+        if (pthread_create(&pool->workers[i], NULL, pool_worker, pool))
+            break;
+#endif
+    }
+    pool->nworkers = i;
+    if (!pool->nworkers) {
+        _zbar_pool_destroy(pool);
+        return(NULL);
+    }
+    return(pool);
+}
+
+void _zbar_pool_destroy(zbar_pool_t* pool)
+{
+    int i;
+    if (!pool)
+        return;
+
+    pool_lock(&pool->lock);
+    pool->quit = 1;
+    pool_cond_wake(&pool->work);
+    pool_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nworkers; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(pool->workers[i], INFINITE);
+        CloseHandle(pool->workers[i]);
+#else
+        pthread_join(pool->workers[i], NULL);
+#endif
+    }
+    pool_cond_destroy(&pool->done);
+    pool_cond_destroy(&pool->work);
+    pool_lock_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+int _zbar_pool_size(const zbar_pool_t* pool)
+{
+    return((pool) ? pool->nworkers + 1 : 1);
+}
+
+void _zbar_pool_run(zbar_pool_t* pool,
+    zbar_pool_task_t* task,
+    void* arg,
+    int ntasks)
+{
+    int i;
+    if (!pool || ntasks <= 1) {
+        for (i = 0; i < ntasks; i++)
+            task(arg, i);
+        return;
+    }
+
+    pool_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->next = 0;
+    pool->ntasks = pool->pending = ntasks;
+    pool_cond_wake(&pool->work);
+
+    /* help out, then wait for stragglers */
+    pool_work(pool);
+    while (pool->pending)
+        pool_cond_wait(&pool->done, &pool->lock);
+
+    pool->task = NULL;
+    pool->arg = NULL;
+    pool->next = pool->ntasks = 0;
+    pool_unlock(&pool->lock);
+}
+
+void _zbar_pool_lock(zbar_pool_t* pool)
+{
+    if (pool)
+        pool_lock(&pool->lock);
+}
+
+void _zbar_pool_unlock(zbar_pool_t* pool)
+{
+    if (pool)
+        pool_unlock(&pool->lock);
+}
+
+#else
+
+zbar_pool_t* _zbar_pool_create(int nthreads)
+{
+    (void)nthreads;
+    return(NULL);
+}
+
+void _zbar_pool_destroy(zbar_pool_t* pool)
+{
+    (void)pool;
+}
+
+int _zbar_pool_size(const zbar_pool_t* pool)
+{
+    (void)pool;
+    return(1);
+}
+
+void _zbar_pool_run(zbar_pool_t* pool,
+    zbar_pool_task_t* task,
+    void* arg,
+    int ntasks)
+{
+    int i;
+    (void)pool;
+    for (i = 0; i < ntasks; i++)
+        task(arg, i);
+}
+
+void _zbar_pool_lock(zbar_pool_t* pool)
+{
+    (void)pool;
+}
+
+void _zbar_pool_unlock(zbar_pool_t* pool)
+{
+    (void)pool;
+}
+
+#endif
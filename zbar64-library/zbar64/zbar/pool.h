@@ -0,0 +1,73 @@
+/*------------------------------------------------------------------------
+ *  Copyright 2007-2010 (c) Jeff Brown <spadix@users.sourceforge.net>
+ *
+ *  This file is part of the ZBar Bar Code Reader.
+ *
+ *  The ZBar Bar Code Reader is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser Public License as
+ *  published by the Free Software Foundation; either version 2.1 of
+ *  the License, or (at your option) any later version.
+ *
+ *  The ZBar Bar Code Reader is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser Public License
+ *  along with the ZBar Bar Code Reader; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *  Boston, MA  02110-1301  USA
+ *
+ *  http://sourceforge.net/projects/zbar
+ *------------------------------------------------------------------------*/
+#ifndef _ZBAR_POOL_H_
+#define _ZBAR_POOL_H_
+
+/* minimal worker pool for data parallel passes
+ *
+ * _zbar_pool_run() calls task(arg, i) for each i in [0, ntasks) and
+ * returns once all of them have completed.  the calling thread works
+ * on tasks too, so a pool of n threads starts n-1 workers.
+ *
+ * tasks are handed out in index order but may complete in any order;
+ * callers that need deterministic results must only write to per-task
+ * state and combine it by index afterwards.
+ *
+ * a NULL pool (or a build without thread support) runs all tasks
+ * serially on the calling thread
+ */
+
+typedef struct zbar_pool_s zbar_pool_t;
+
+typedef void (zbar_pool_task_t)(void* arg,
+    int idx);
+
+/* defined when the build has a thread backend for the pool */
+#if defined(_WIN32) || defined(HAVE_LIBPTHREAD)
+# define ZBAR_POOL_THREADS 1
+#endif
+
+/* create a pool of nthreads threads (including the caller).
+ * returns NULL if nthreads <= 1 or threads are unavailable
+ */
+extern zbar_pool_t* _zbar_pool_create(int nthreads);
+
+extern void _zbar_pool_destroy(zbar_pool_t* pool);
+
+/* number of threads that run tasks (including the caller) */
+extern int _zbar_pool_size(const zbar_pool_t* pool);
+
+extern void _zbar_pool_run(zbar_pool_t* pool,
+    zbar_pool_task_t* task,
+    void* arg,
+    int ntasks);
+
+/* serialize the tasks' updates of state they share (such as caches
+ * filled on first use) with the pool's own lock, which the tasks do not
+ * hold while they run.  keep the critical sections short: workers wait
+ * on the same lock for their next task.  no-ops for a NULL pool
+ */
+extern void _zbar_pool_lock(zbar_pool_t* pool);
+extern void _zbar_pool_unlock(zbar_pool_t* pool);
+
+#endif
@@ -7,6 +7,7 @@
 #define _QRCODE_H_
 
 #include <zbar.h>
+#include "pool.h"
 
 typedef struct qr_reader qr_reader;
 
@@ -52,15 +53,79 @@ struct qr_finder_line {
     int      eoffs;
 };
 
+/*The number of line directions collected by the scanner.
+  Lines 0 and 1 are horizontal and vertical in image coordinates.
+  Lines 2 and 3 come from the optional diagonal scans and are stored in a frame
+   rotated by 45 degrees (and scaled by sqrt(2)), with u=x+y and v=y-x:
+   lines along (1,1) are horizontal (2) and lines along (1,-1) are vertical (3)
+   in that frame.*/
+#define QR_FINDER_NDIRS (4)
+
+/* collection of finder lines */
+typedef struct qr_finder_lines {
+    qr_finder_line* lines;
+    int nlines, clines;
+} qr_finder_lines;
+
 qr_reader* _zbar_qr_create(void);
-int _zbar_qr_found_line(qr_reader* reader,
-    int direction,
+
+/* finder lines are collected separately (eg, per scan thread or band)
+ * and appended to the reader in bulk before decoding
+ */
+int _zbar_qr_lines_add(qr_finder_lines* lines,
     const qr_finder_line* line);
+int _zbar_qr_found_lines(qr_reader* reader,
+    int direction,
+    const qr_finder_lines* lines);
 
 void _zbar_qr_destroy(qr_reader* reader);
 void _zbar_qr_reset(qr_reader* reader);
+
+/* threads to binarize large areas of the image with (NULL for none).
+ * the pool is not owned by the reader
+ */
+void _zbar_qr_set_pool(qr_reader* reader,
+    zbar_pool_t* pool);
+
+/* binarization method (zbar_binarizer_t) for the next image */
+void _zbar_qr_set_binarizer(qr_reader* reader,
+    int binarizer);
+/* decode the finder lines collected so far (and consume them),
+ * stopping after max_codes codes (0 for no limit).
+ * a cropped image is only binarized around its crop rectangle
+ */
 int _zbar_qr_decode(qr_reader* reader,
     zbar_image_scanner_t* iscn,
-    zbar_image_t* img);
+    zbar_image_t* img,
+    int max_codes);
+
+/* try to decode ncodes codes from the finder lines collected so far,
+ * before the image is completely scanned.  the results are only kept
+ * (and the finder lines consumed) if all of them are found.
+ * returns the number of symbols added
+ */
+int _zbar_qr_decode_partial(qr_reader* reader,
+    zbar_image_scanner_t* iscn,
+    zbar_image_t* img,
+    int ncodes);
+
+/* binarize rows [y0, y1) of the crop and decode the codes that the finder
+ * lines collected so far allow (at most max_codes, 0 for no limit), while
+ * the rest of the image is still being scanned.  the lines crossing the
+ * decoded codes are consumed, as are those ending above row keep_y that
+ * are not near a finder center (no line found later can join them); the
+ * others are kept for the next band of rows.  the last band (last set
+ * once the rows scanned reach the bottom of the crop, which [y0, y1) may
+ * do earlier) consumes all of them.
+ * returns the number of symbols added
+ */
+int _zbar_qr_decode_rows(qr_reader* reader,
+    zbar_image_scanner_t* iscn,
+    zbar_image_t* img,
+    int y0,
+    int y1,
+    int keep_y,
+    int last,
+    int max_codes);
 
 #endif
\ No newline at end of file
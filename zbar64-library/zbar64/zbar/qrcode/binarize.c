@@ -8,6 +8,7 @@
 #include <string.h>
 #include "util.h"
 #include "image.h"
+#include "simd.h"
 #include "binarize.h"
 
 #if 0
@@ -517,76 +518,572 @@ void qr_binarize(unsigned char* _img, int _width, int _height) {
       detected and decoded successfully than the Sauvola or Gatos binarization
       methods.*/
 
+/*The inner loops of the thresholder below, with SSE2 and AVX2 versions.
+  Both work on exact integer sums, so every version produces the same mask.*/
+
+/*Adds the row _add to the column sums _col_sums[0..._n), and subtracts the
+   row _sub from them if it is not NULL.*/
+static void qr_col_sums_update_c(unsigned* _col_sums,
+    const unsigned char* _add, const unsigned char* _sub, int _n) {
+    int x;
+    for (x = 0; x < _n; x++)_col_sums[x] += _add[x];
+    if (_sub != NULL)for (x = 0; x < _n; x++)_col_sums[x] -= _sub[x];
+}
+
+/*Thresholds _n pixels of a row whose windows lie entirely inside the image,
+   so that the window sum is updated without clamping.
+  _m:     The window sum for the first pixel.
+  _hi:    The column sums entering the window after each pixel.
+  _lo:    The column sums leaving the window after each pixel.
+  _shift: The log2 of the window area.
+  Return: The window sum for the pixel after the last one.*/
+static unsigned qr_binarize_row_c(unsigned char* _mask,
+    const unsigned char* _img, const unsigned* _hi, const unsigned* _lo,
+    int _n, unsigned _m, int _shift) {
+    int x;
+    for (x = 0; x < _n; x++) {
+        _mask[x] = -((unsigned)(_img[x] + 3) << _shift < _m) & 0xFF;
+        _m += _hi[x] - _lo[x];
+    }
+    return _m;
+}
+
+#if defined(ZBAR_SSE2)
+static void qr_col_sums_update_sse2(unsigned* _col_sums,
+    const unsigned char* _add, const unsigned char* _sub, int _n) {
+    __m128i zero;
+    int     x;
+    zero = _mm_setzero_si128();
+    for (x = 0; x + 16 <= _n; x += 16) {
+        __m128i a;
+        __m128i s;
+        __m128i d;
+        __m128i* c;
+        a = _mm_loadu_si128((const __m128i*)(_add + x));
+        s = _sub != NULL ? _mm_loadu_si128((const __m128i*)(_sub + x)) : zero;
+        c = (__m128i*)(_col_sums + x);
+        /*The difference fits in 16 bits; sign extend it to 32.*/
+        d = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(s, zero));
+        _mm_storeu_si128(c + 0, _mm_add_epi32(_mm_loadu_si128(c + 0),
+            _mm_srai_epi32(_mm_unpacklo_epi16(d, d), 16)));
+        _mm_storeu_si128(c + 1, _mm_add_epi32(_mm_loadu_si128(c + 1),
+            _mm_srai_epi32(_mm_unpackhi_epi16(d, d), 16)));
+        d = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(s, zero));
+        _mm_storeu_si128(c + 2, _mm_add_epi32(_mm_loadu_si128(c + 2),
+            _mm_srai_epi32(_mm_unpacklo_epi16(d, d), 16)));
+        _mm_storeu_si128(c + 3, _mm_add_epi32(_mm_loadu_si128(c + 3),
+            _mm_srai_epi32(_mm_unpackhi_epi16(d, d), 16)));
+    }
+    qr_col_sums_update_c(_col_sums + x, _add + x,
+        _sub != NULL ? _sub + x : NULL, _n - x);
+}
+
+/*The window sums of 4 pixels are the running sum plus the exclusive prefix
+   sums of the 4 updates; the sums stay below 2**31, so a signed compare
+   works.*/
+static unsigned qr_binarize_row_sse2(unsigned char* _mask,
+    const unsigned char* _img, const unsigned* _hi, const unsigned* _lo,
+    int _n, unsigned _m, int _shift) {
+    __m128i zero;
+    __m128i three;
+    __m128i shift;
+    __m128i m;
+    int     x;
+    zero = _mm_setzero_si128();
+    three = _mm_set1_epi16(3);
+    shift = _mm_cvtsi32_si128(_shift);
+    m = _mm_set1_epi32((int)_m);
+    for (x = 0; x + 16 <= _n; x += 16) {
+        __m128i g;
+        __m128i g16[2];
+        __m128i c[4];
+        int     k;
+        g = _mm_loadu_si128((const __m128i*)(_img + x));
+        g16[0] = _mm_add_epi16(_mm_unpacklo_epi8(g, zero), three);
+        g16[1] = _mm_add_epi16(_mm_unpackhi_epi8(g, zero), three);
+        for (k = 0; k < 4; k++) {
+            __m128i t;
+            __m128i d;
+            __m128i e;
+            t = k & 1 ? _mm_unpackhi_epi16(g16[k >> 1], zero) :
+                _mm_unpacklo_epi16(g16[k >> 1], zero);
+            t = _mm_sll_epi32(t, shift);
+            d = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(_hi + x + 4 * k)),
+                _mm_loadu_si128((const __m128i*)(_lo + x + 4 * k)));
+            e = _mm_slli_si128(d, 4);
+            e = _mm_add_epi32(e, _mm_slli_si128(e, 4));
+            e = _mm_add_epi32(e, _mm_slli_si128(e, 8));
+            c[k] = _mm_cmpgt_epi32(_mm_add_epi32(m, e), t);
+            m = _mm_add_epi32(m, _mm_shuffle_epi32(_mm_add_epi32(e, d), 0xFF));
+        }
+        _mm_storeu_si128((__m128i*)(_mask + x), _mm_packs_epi16(
+            _mm_packs_epi32(c[0], c[1]), _mm_packs_epi32(c[2], c[3])));
+    }
+    return qr_binarize_row_c(_mask + x, _img + x, _hi + x, _lo + x, _n - x,
+        (unsigned)_mm_cvtsi128_si32(m), _shift);
+}
+#endif
+
+#if defined(ZBAR_AVX2)
+static ZBAR_TARGET_AVX2 void qr_col_sums_update_avx2(unsigned* _col_sums,
+    const unsigned char* _add, const unsigned char* _sub, int _n) {
+    int x;
+    for (x = 0; x + 16 <= _n; x += 16) {
+        __m256i d;
+        __m256i* c;
+        d = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(_add + x)));
+        if (_sub != NULL) {
+            d = _mm256_sub_epi16(d,
+                _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(_sub + x))));
+        }
+        c = (__m256i*)(_col_sums + x);
+        _mm256_storeu_si256(c + 0, _mm256_add_epi32(_mm256_loadu_si256(c + 0),
+            _mm256_cvtepi16_epi32(_mm256_castsi256_si128(d))));
+        _mm256_storeu_si256(c + 1, _mm256_add_epi32(_mm256_loadu_si256(c + 1),
+            _mm256_cvtepi16_epi32(_mm256_extracti128_si256(d, 1))));
+    }
+    qr_col_sums_update_c(_col_sums + x, _add + x,
+        _sub != NULL ? _sub + x : NULL, _n - x);
+}
+
+static ZBAR_TARGET_AVX2 unsigned qr_binarize_row_avx2(unsigned char* _mask,
+    const unsigned char* _img, const unsigned* _hi, const unsigned* _lo,
+    int _n, unsigned _m, int _shift) {
+    __m256i three;
+    __m128i shift;
+    __m256i last;
+    __m256i order;
+    __m256i m;
+    int     x;
+    three = _mm256_set1_epi32(3);
+    shift = _mm_cvtsi32_si128(_shift);
+    last = _mm256_set1_epi32(7);
+    /*Undoes the 128-bit lane interleaving of the packs.*/
+    order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    m = _mm256_set1_epi32((int)_m);
+    for (x = 0; x + 32 <= _n; x += 32) {
+        __m256i c[4];
+        int     k;
+        for (k = 0; k < 4; k++) {
+            __m256i t;
+            __m256i d;
+            __m256i e;
+            __m256i s;
+            t = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(_img + x + 8 * k)));
+            t = _mm256_sll_epi32(_mm256_add_epi32(t, three), shift);
+            d = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(_hi + x + 8 * k)),
+                _mm256_loadu_si256((const __m256i*)(_lo + x + 8 * k)));
+            /*Exclusive prefix sums within each 128-bit lane, then carry the low
+               lane's total into the high lane.*/
+            e = _mm256_slli_si256(d, 4);
+            e = _mm256_add_epi32(e, _mm256_slli_si256(e, 4));
+            e = _mm256_add_epi32(e, _mm256_slli_si256(e, 8));
+            s = _mm256_shuffle_epi32(_mm256_add_epi32(e, d), 0xFF);
+            e = _mm256_add_epi32(e, _mm256_permute2x128_si256(s, s, 0x08));
+            c[k] = _mm256_cmpgt_epi32(_mm256_add_epi32(m, e), t);
+            m = _mm256_add_epi32(m,
+                _mm256_permutevar8x32_epi32(_mm256_add_epi32(e, d), last));
+        }
+        _mm256_storeu_si256((__m256i*)(_mask + x), _mm256_permutevar8x32_epi32(
+            _mm256_packs_epi16(_mm256_packs_epi32(c[0], c[1]),
+                _mm256_packs_epi32(c[2], c[3])), order));
+    }
+    return qr_binarize_row_c(_mask + x, _img + x, _hi + x, _lo + x, _n - x,
+        (unsigned)_mm_cvtsi128_si32(_mm256_castsi256_si128(m)), _shift);
+}
+#endif
+
+static void qr_col_sums_update(unsigned* _col_sums,
+    const unsigned char* _add, const unsigned char* _sub, int _n) {
+#if defined(ZBAR_AVX2)
+    if (_zbar_cpu_avx2()) {
+        qr_col_sums_update_avx2(_col_sums, _add, _sub, _n);
+        return;
+    }
+#endif
+#if defined(ZBAR_SSE2)
+    qr_col_sums_update_sse2(_col_sums, _add, _sub, _n);
+#else
+    qr_col_sums_update_c(_col_sums, _add, _sub, _n);
+#endif
+}
+
+static unsigned qr_binarize_row(unsigned char* _mask,
+    const unsigned char* _img, const unsigned* _hi, const unsigned* _lo,
+    int _n, unsigned _m, int _shift) {
+#if defined(ZBAR_AVX2)
+    if (_zbar_cpu_avx2()) {
+        return qr_binarize_row_avx2(_mask, _img, _hi, _lo, _n, _m, _shift);
+    }
+#endif
+#if defined(ZBAR_SSE2)
+    return qr_binarize_row_sse2(_mask, _img, _hi, _lo, _n, _m, _shift);
+#else
+    return qr_binarize_row_c(_mask, _img, _hi, _lo, _n, _m, _shift);
+#endif
+}
+
+/*Thresholds the pixels [_x0,_x1) of a row, clamping their windows to the
+   image.
+  Return: The window sum for pixel _x1.*/
+static unsigned qr_binarize_row_clamped(unsigned char* _mask,
+    const unsigned char* _img, const unsigned* _col_sums, int _cx0,
+    int _x0, int _x1, int _width, int _windw, unsigned _m, int _shift) {
+    int x;
+    for (x = _x0; x < _x1; x++) {
+        int x0;
+        int x1;
+        /*Perform the test against the threshold T = (m/n)-D,
+           where n=windw*windh and D=3.*/
+        _mask[x] = -((unsigned)(_img[x] + 3) << _shift < _m) & 0xFF;
+        /*Update the window sum.*/
+        x0 = QR_MAXI(0, x - (_windw >> 1));
+        x1 = QR_MINI(x + (_windw >> 1), _width - 1);
+        _m += _col_sums[x1 - _cx0] - _col_sums[x0 - _cx0];
+    }
+    return _m;
+}
+
+/*Packs the thresholded pixels [_x0,_x1) of a row into bits _x0 to _x1-1 of
+   _bits (bit x&7 of byte x>>3), leaving the other bits untouched.
+  _row:   The mask values (0 or 0xFF) of the pixels, starting with _x0.*/
+static void qr_pack_row(unsigned char* _bits, const unsigned char* _row,
+    int _x0, int _x1) {
+    int x;
+    int xa;
+    int xb;
+    /*Only the bytes [xa,xb)/8 are entirely inside the row.*/
+    xa = QR_MINI((_x0 + 7) & ~7, _x1);
+    xb = QR_MAXI(_x1 & ~7, xa);
+    for (x = _x0; x < xa; x++) {
+        unsigned char b;
+        b = (unsigned char)(1 << (x & 7));
+        _bits[x >> 3] = (unsigned char)((_bits[x >> 3] & ~b) | (_row[x - _x0] & b));
+    }
+#if defined(ZBAR_SSE2)
+    /*The mask values are 0 or 0xFF, so their top bits are the pixels.*/
+    for (; x + 16 <= xb; x += 16) {
+        int v;
+        v = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(_row + x - _x0)));
+        _bits[x >> 3] = (unsigned char)v;
+        _bits[(x >> 3) + 1] = (unsigned char)(v >> 8);
+    }
+#endif
+    for (; x < xb; x += 8) {
+        const unsigned char* r;
+        r = _row + x - _x0;
+        _bits[x >> 3] = (unsigned char)((r[0] & 1) | (r[1] & 2) | (r[2] & 4) |
+            (r[3] & 8) | (r[4] & 16) | (r[5] & 32) | (r[6] & 64) | (r[7] & 128));
+    }
+    for (; x < _x1; x++) {
+        unsigned char b;
+        b = (unsigned char)(1 << (x & 7));
+        _bits[x >> 3] = (unsigned char)((_bits[x >> 3] & ~b) | (_row[x - _x0] & b));
+    }
+}
+
+void qr_binarize_window(int _width, int _height, int* _logwindw, int* _logwindh) {
+    int logwindw;
+    int logwindh;
+    /*We keep the window size fairly large to ensure it doesn't fit completely
+       inside the center of a finder pattern of a version 1 QR code at full
+       resolution.
+      The window depends only on the full image size, so that any rectangle is
+       thresholded exactly as it would be as part of the whole image.*/
+    for (logwindw = 4; logwindw < 8 && (1 << logwindw) < (_width + 7 >> 3); logwindw++);
+    for (logwindh = 4; logwindh < 8 && (1 << logwindh) < (_height + 7 >> 3); logwindh++);
+    *_logwindw = logwindw;
+    *_logwindh = logwindh;
+}
+
       /*A simplified adaptive thresholder.
         This compares the current pixel value to the mean value of a (large) window
          surrounding it.*/
-unsigned char* qr_binarize(const unsigned char* _img, int _width, int _height) {
-    unsigned char* mask = NULL;
-    if (_width > 0 && _height > 0) {
-        unsigned* col_sums;
-        int            logwindw;
-        int            logwindh;
-        int            windw;
-        int            windh;
-        int            y0offs;
-        int            y1offs;
-        unsigned       g;
-        int            x;
-        int            y;
-        mask = (unsigned char*)malloc(_width * _height * sizeof(*mask));
-        /*We keep the window size fairly large to ensure it doesn't fit completely
-           inside the center of a finder pattern of a version 1 QR code at full
-           resolution.*/
-        for (logwindw = 4; logwindw < 8 && (1 << logwindw) < (_width + 7 >> 3); logwindw++);
-        for (logwindh = 4; logwindh < 8 && (1 << logwindh) < (_height + 7 >> 3); logwindh++);
-        windw = 1 << logwindw;
-        windh = 1 << logwindh;
-        col_sums = (unsigned*)malloc(_width * sizeof(*col_sums));
-        /*Initialize sums down each column.*/
-        for (x = 0; x < _width; x++) {
-            g = _img[x];
-            col_sums[x] = (g << logwindh - 1) + g;
+/*Thresholds the rectangle [_x0,_x1)x[_y0,_y1) into _mask, or packs it into
+   the rows of _bits (_stride bytes apart) if that is not NULL.*/
+static void qr_binarize_rect_rows(unsigned char* _mask,
+    unsigned char* _bits, int _stride, const unsigned char* _img,
+    int _width, int _height, int _x0, int _y0, int _x1, int _y1,
+    zbar_arena_t* _arena) {
+    zbar_arena_mark_t arena_mark;
+    unsigned* col_sums;
+    unsigned char* row;
+    int       logwindw;
+    int       logwindh;
+    int       windw;
+    int       windh;
+    int       cx0;
+    int       cx1;
+    int       xa;
+    int       xb;
+    int       y0offs;
+    int       y1offs;
+    int       x;
+    int       y;
+    _x0 = QR_MAXI(_x0, 0);
+    _y0 = QR_MAXI(_y0, 0);
+    _x1 = QR_MINI(_x1, _width);
+    _y1 = QR_MINI(_y1, _height);
+    if (_x0 >= _x1 || _y0 >= _y1)return;
+    qr_binarize_window(_width, _height, &logwindw, &logwindh);
+    windw = 1 << logwindw;
+    windh = 1 << logwindh;
+    /*The window around x covers the columns [x-windw/2,x+windw/2), and the
+       window around y the rows [y-windh/2,y+windh/2), both clamped to the
+       image.
+      Only keep the column sums the rectangle's windows touch, starting from
+       column cx0.*/
+    cx0 = QR_MAXI(0, _x0 - (windw >> 1));
+    cx1 = QR_MINI(_x1 + (windw >> 1), _width);
+    /*When packing, each row is thresholded into a temporary first, kept after
+       the column sums.*/
+    if (_arena) {
+        arena_mark = _zbar_arena_mark(_arena);
+        col_sums = (unsigned*)_zbar_arena_alloc(_arena,
+            (cx1 - cx0) * sizeof(*col_sums) + (_bits != NULL ? _x1 - _x0 : 0));
+    }
+    else {
+        col_sums = (unsigned*)malloc(
+            (cx1 - cx0) * sizeof(*col_sums) + (_bits != NULL ? _x1 - _x0 : 0));
+    }
+    row = (unsigned char*)(col_sums + (cx1 - cx0));
+    /*Initialize sums down each column.*/
+    memset(col_sums, 0, (cx1 - cx0) * sizeof(*col_sums));
+    for (y = _y0 - (windh >> 1); y < _y0 + (windh >> 1); y++) {
+        y1offs = QR_CLAMPI(0, y, _height - 1) * _width;
+        qr_col_sums_update(col_sums, _img + y1offs + cx0, NULL, cx1 - cx0);
+    }
+    /*The windows of the pixels in [xa,xb) lie inside the image horizontally,
+       so those can use the vector kernels.*/
+    xa = QR_CLAMPI(_x0, windw >> 1, _x1);
+    xb = QR_CLAMPI(xa, _width - (windw >> 1), _x1);
+    for (y = _y0; y < _y1; y++) {
+        unsigned char* mask;
+        unsigned m;
+        int      x1;
+        /*Initialize the sum over the window.*/
+        m = 0;
+        for (x = _x0 - (windw >> 1); x < _x0 + (windw >> 1); x++) {
+            x1 = QR_CLAMPI(0, x, _width - 1);
+            m += col_sums[x1 - cx0];
         }
-        for (y = 1; y < (windh >> 1); y++) {
-            y1offs = QR_MINI(y, _height - 1) * _width;
-            for (x = 0; x < _width; x++) {
-                g = _img[y1offs + x];
-                col_sums[x] += g;
-            }
+        y1offs = y * _width;
+        /*mask[x] is pixel x of the row either way.*/
+        mask = _bits != NULL ? row - _x0 : _mask + y1offs;
+        m = qr_binarize_row_clamped(mask, _img + y1offs, col_sums, cx0,
+            _x0, xa, _width, windw, m, logwindw + logwindh);
+        m = qr_binarize_row(mask + xa, _img + y1offs + xa,
+            col_sums + xa + (windw >> 1) - cx0, col_sums + xa - (windw >> 1) - cx0,
+            xb - xa, m, logwindw + logwindh);
+        qr_binarize_row_clamped(mask, _img + y1offs, col_sums, cx0,
+            xb, _x1, _width, windw, m, logwindw + logwindh);
+        if (_bits != NULL)qr_pack_row(_bits + y * _stride, row, _x0, _x1);
+        /*Update the column sums.*/
+        if (y + 1 < _y1) {
+            y0offs = QR_MAXI(0, y - (windh >> 1)) * _width;
+            y1offs = QR_MINI(y + (windh >> 1), _height - 1) * _width;
+            qr_col_sums_update(col_sums, _img + y1offs + cx0, _img + y0offs + cx0,
+                cx1 - cx0);
         }
-        for (y = 0; y < _height; y++) {
-            unsigned m;
-            int      x0;
-            int      x1;
-            /*Initialize the sum over the window.*/
-            m = (col_sums[0] << logwindw - 1) + col_sums[0];
-            for (x = 1; x < (windw >> 1); x++) {
-                x1 = QR_MINI(x, _width - 1);
-                m += col_sums[x1];
-            }
-            for (x = 0; x < _width; x++) {
-                /*Perform the test against the threshold T = (m/n)-D,
-                   where n=windw*windh and D=3.*/
-                g = _img[y * _width + x];
-                mask[y * _width + x] = -(g + 3 << logwindw + logwindh < m) & 0xFF;
-                /*Update the window sum.*/
-                if (x + 1 < _width) {
-                    x0 = QR_MAXI(0, x - (windw >> 1));
-                    x1 = QR_MINI(x + (windw >> 1), _width - 1);
-                    m += col_sums[x1] - col_sums[x0];
-                }
-            }
-            /*Update the column sums.*/
-            if (y + 1 < _height) {
-                y0offs = QR_MAXI(0, y - (windh >> 1)) * _width;
-                y1offs = QR_MINI(y + (windh >> 1), _height - 1) * _width;
-                for (x = 0; x < _width; x++) {
-                    col_sums[x] -= _img[y0offs + x];
-                    col_sums[x] += _img[y1offs + x];
-                }
+    }
+    if (_arena)_zbar_arena_release(_arena, arena_mark);
+    else free(col_sums);
+}
+
+void qr_binarize_rect(unsigned char* _mask, const unsigned char* _img,
+    int _width, int _height, int _x0, int _y0, int _x1, int _y1,
+    zbar_arena_t* _arena) {
+    qr_binarize_rect_rows(_mask, NULL, 0, _img, _width, _height,
+        _x0, _y0, _x1, _y1, _arena);
+}
+
+void qr_binarize_rect_packed(unsigned char* _bits, int _stride,
+    const unsigned char* _img, int _width, int _height,
+    int _x0, int _y0, int _x1, int _y1, zbar_arena_t* _arena) {
+    qr_binarize_rect_rows(NULL, _bits, _stride, _img, _width, _height,
+        _x0, _y0, _x1, _y1, _arena);
+}
+
+/*The other binarizers, for images the adaptive mean does poorly on.
+  Both take the same rectangles and produce the same packed rows, so the
+   decoder can switch between them per image.*/
+
+int qr_otsu_threshold(const unsigned char* _img, int _width, int _height) {
+    unsigned hist[256];
+    double   sum;
+    double   sumb;
+    double   best;
+    unsigned n;
+    unsigned nb;
+    int      threshold;
+    int      x;
+    int      y;
+    int      t;
+    /*Every fourth pixel of every fourth row is plenty for a histogram.*/
+    memset(hist, 0, sizeof(hist));
+    for (y = QR_MINI(2, _height - 1); y < _height; y += 4) {
+        for (x = QR_MINI(2, _width - 1); x < _width; x += 4)hist[_img[y * _width + x]]++;
+    }
+    n = 0;
+    sum = 0;
+    for (t = 0; t < 256; t++) {
+        n += hist[t];
+        sum += t * (double)hist[t];
+    }
+    /*Pick the split maximizing the variance between the two classes,
+       nb*(n-nb)*(mean_b-mean_f)**2.*/
+    threshold = 0;
+    best = -1;
+    nb = 0;
+    sumb = 0;
+    for (t = 0; t < 256; t++) {
+        double d;
+        double v;
+        nb += hist[t];
+        if (nb == 0)continue;
+        if (nb == n)break;
+        sumb += t * (double)hist[t];
+        d = sumb / nb - (sum - sumb) / (n - nb);
+        v = (double)nb * (n - nb) * d * d;
+        if (v > best) {
+            best = v;
+            threshold = t;
+        }
+    }
+    return threshold;
+}
+
+void qr_threshold_rect_packed(unsigned char* _bits, int _stride,
+    const unsigned char* _img, int _width, int _height,
+    int _x0, int _y0, int _x1, int _y1, int _threshold, zbar_arena_t* _arena) {
+    zbar_arena_mark_t arena_mark;
+    unsigned char* row;
+    int            x;
+    int            y;
+    _x0 = QR_MAXI(_x0, 0);
+    _y0 = QR_MAXI(_y0, 0);
+    _x1 = QR_MINI(_x1, _width);
+    _y1 = QR_MINI(_y1, _height);
+    if (_x0 >= _x1 || _y0 >= _y1)return;
+    if (_arena) {
+        arena_mark = _zbar_arena_mark(_arena);
+        row = (unsigned char*)_zbar_arena_alloc(_arena, _x1 - _x0);
+    }
+    else row = (unsigned char*)malloc(_x1 - _x0);
+    for (y = _y0; y < _y1; y++) {
+        const unsigned char* img;
+        img = _img + y * _width + _x0;
+        for (x = 0; x < _x1 - _x0; x++)row[x] = -(img[x] <= _threshold) & 0xFF;
+        qr_pack_row(_bits + y * _stride, row, _x0, _x1);
+    }
+    if (_arena)_zbar_arena_release(_arena, arena_mark);
+    else free(row);
+}
+
+/*Sauvola's threshold (see qr_sauvola_mask() above) over the same windows as
+   qr_binarize_rect(), clamped to the image in the same way, so that any
+   rectangle is thresholded exactly as it would be as part of the whole image.
+  The threshold is T=(m/n)*(1+k*(s/R-1)), where m is the window sum, n its
+   area, s the standard deviation over it, k=1/5 and R=128.*/
+void qr_sauvola_rect_packed(unsigned char* _bits, int _stride,
+    const unsigned char* _img, int _width, int _height,
+    int _x0, int _y0, int _x1, int _y1, zbar_arena_t* _arena) {
+    zbar_arena_mark_t arena_mark;
+    unsigned*      col_sums;
+    unsigned*      col2_sums;
+    unsigned char* row;
+    int            logwindw;
+    int            logwindh;
+    int            windw;
+    int            windh;
+    int            cx0;
+    int            cx1;
+    int            y0offs;
+    int            y1offs;
+    double         n;
+    int            x;
+    int            y;
+    _x0 = QR_MAXI(_x0, 0);
+    _y0 = QR_MAXI(_y0, 0);
+    _x1 = QR_MINI(_x1, _width);
+    _y1 = QR_MINI(_y1, _height);
+    if (_x0 >= _x1 || _y0 >= _y1)return;
+    qr_binarize_window(_width, _height, &logwindw, &logwindh);
+    windw = 1 << logwindw;
+    windh = 1 << logwindh;
+    n = (double)(windw * windh);
+    cx0 = QR_MAXI(0, _x0 - (windw >> 1));
+    cx1 = QR_MINI(_x1 + (windw >> 1), _width);
+    /*The window sums of squares are at most 255*255*2**16, which still fits in
+       32 bits.*/
+    if (_arena) {
+        arena_mark = _zbar_arena_mark(_arena);
+        col_sums = (unsigned*)_zbar_arena_alloc(_arena,
+            2 * (cx1 - cx0) * sizeof(*col_sums) + _x1 - _x0);
+    }
+    else {
+        col_sums = (unsigned*)malloc(
+            2 * (cx1 - cx0) * sizeof(*col_sums) + _x1 - _x0);
+    }
+    col2_sums = col_sums + (cx1 - cx0);
+    row = (unsigned char*)(col2_sums + (cx1 - cx0));
+    memset(col_sums, 0, 2 * (cx1 - cx0) * sizeof(*col_sums));
+    for (y = _y0 - (windh >> 1); y < _y0 + (windh >> 1); y++) {
+        y1offs = QR_CLAMPI(0, y, _height - 1) * _width;
+        for (x = cx0; x < cx1; x++) {
+            unsigned g;
+            g = _img[y1offs + x];
+            col_sums[x - cx0] += g;
+            col2_sums[x - cx0] += g * g;
+        }
+    }
+    for (y = _y0; y < _y1; y++) {
+        unsigned m;
+        unsigned m2;
+        int      x0;
+        int      x1;
+        m = 0;
+        m2 = 0;
+        for (x = _x0 - (windw >> 1); x < _x0 + (windw >> 1); x++) {
+            x1 = QR_CLAMPI(0, x, _width - 1);
+            m += col_sums[x1 - cx0];
+            m2 += col2_sums[x1 - cx0];
+        }
+        for (x = _x0; x < _x1; x++) {
+            double mean;
+            double var;
+            mean = m / n;
+            var = m2 / n - mean * mean;
+            row[x - _x0] = -(_img[y * _width + x] <
+                mean * (0.8 + 0.2 / 128 * sqrt(var > 0 ? var : 0))) & 0xFF;
+            x0 = QR_MAXI(0, x - (windw >> 1));
+            x1 = QR_MINI(x + (windw >> 1), _width - 1);
+            m += col_sums[x1 - cx0] - col_sums[x0 - cx0];
+            m2 += col2_sums[x1 - cx0] - col2_sums[x0 - cx0];
+        }
+        qr_pack_row(_bits + y * _stride, row, _x0, _x1);
+        if (y + 1 < _y1) {
+            y0offs = QR_MAXI(0, y - (windh >> 1)) * _width;
+            y1offs = QR_MINI(y + (windh >> 1), _height - 1) * _width;
+            for (x = cx0; x < cx1; x++) {
+                unsigned g0;
+                unsigned g1;
+                g0 = _img[y0offs + x];
+                g1 = _img[y1offs + x];
+                col_sums[x - cx0] += g1 - g0;
+                col2_sums[x - cx0] += g1 * g1 - g0 * g0;
             }
         }
-        free(col_sums);
+    }
+    if (_arena)_zbar_arena_release(_arena, arena_mark);
+    else free(col_sums);
+}
+
+unsigned char* qr_binarize(const unsigned char* _img, int _width, int _height) {
+    unsigned char* mask = NULL;
+    if (_width > 0 && _height > 0) {
+        mask = (unsigned char*)malloc(_width * _height * sizeof(*mask));
+        qr_binarize_rect(mask, _img, _width, _height, 0, 0, _width, _height, NULL);
     }
 #if defined(QR_DEBUG)
     {
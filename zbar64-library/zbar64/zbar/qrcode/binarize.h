@@ -6,6 +6,8 @@
 #if !defined(_qrcode_binarize_H)
 # define _qrcode_binarize_H (1)
 
+#include "arena.h"
+
 void qr_image_cross_masking_median_filter(unsigned char* _img,
 	int _width, int _height);
 
@@ -14,5 +16,47 @@ void qr_wiener_filter(unsigned char* _img, int _width, int _height);
 /*Binarizes a grayscale image.*/
 unsigned char* qr_binarize(const unsigned char* _img, int _width, int _height);
 
+/*Returns the log2 of the width and height of the window qr_binarize() uses
+   to threshold an image of the given size.*/
+void qr_binarize_window(int _width, int _height, int* _logwindw, int* _logwindh);
+
+/*Binarizes the rectangle [_x0,_x1)x[_y0,_y1) of a grayscale image into the
+   corresponding pixels of _mask (of the same size as the image), exactly as
+   qr_binarize() would.
+  Pixels outside the rectangle are left untouched.
+  Temporaries come from _arena, or from malloc() if it is NULL.*/
+void qr_binarize_rect(unsigned char* _mask, const unsigned char* _img,
+    int _width, int _height, int _x0, int _y0, int _x1, int _y1,
+    zbar_arena_t* _arena);
+
+/*Like qr_binarize_rect(), but packs the result 1 bit per pixel into the rows
+   of _bits, _stride bytes apart: pixel x of a row is bit x&7 of its byte x>>3,
+   set if the pixel is dark.*/
+void qr_binarize_rect_packed(unsigned char* _bits, int _stride,
+    const unsigned char* _img, int _width, int _height,
+    int _x0, int _y0, int _x1, int _y1, zbar_arena_t* _arena);
+
+/*The binarization methods, cheapest first.*/
+#define QR_BINARIZE_GLOBAL   (0)
+#define QR_BINARIZE_MEAN     (1)
+#define QR_BINARIZE_SAUVOLA  (2)
+#define QR_BINARIZE_NMETHODS (3)
+
+/*Returns Otsu's threshold for a grayscale image, estimated from a subsample of
+   its pixels: pixels at or below it are dark.*/
+int qr_otsu_threshold(const unsigned char* _img, int _width, int _height);
+
+/*Packs the rectangle [_x0,_x1)x[_y0,_y1) into _bits like
+   qr_binarize_rect_packed(), but against the single threshold _threshold.*/
+void qr_threshold_rect_packed(unsigned char* _bits, int _stride,
+    const unsigned char* _img, int _width, int _height,
+    int _x0, int _y0, int _x1, int _y1, int _threshold, zbar_arena_t* _arena);
+
+/*Like qr_binarize_rect_packed(), but with Sauvola's threshold, which also
+   adapts to the local contrast.*/
+void qr_sauvola_rect_packed(unsigned char* _bits, int _stride,
+    const unsigned char* _img, int _width, int _height,
+    int _x0, int _y0, int _x1, int _y1, zbar_arena_t* _arena);
+
 #endif
 
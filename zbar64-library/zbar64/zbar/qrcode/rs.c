@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "rs.h"
+#include "simd.h"
 
    /*Reed-Solomon encoder and decoder.
      Original implementation (C) Henry Minsky (hqm@ua.com, hqm@ai.mit.edu),
@@ -30,6 +31,7 @@
 void rs_gf256_init(rs_gf256* _gf, unsigned _ppoly) {
     unsigned p;
     int      i;
+    int      j;
     /*Initialize the table of powers of a primtive root, alpha=0x02.*/
     p = 1;
     for (i = 0; i < 256; i++) {
@@ -40,6 +42,11 @@ void rs_gf256_init(rs_gf256* _gf, unsigned _ppoly) {
     for (i = 0; i < 255; i++)_gf->log[_gf->exp[i]] = i;
     /*Note that we rely on the fact that _gf->log[0]=0 below.*/
     _gf->log[0] = 0;
+    /*Build the split-nibble tables for every multiplier.*/
+    for (i = 0; i < 256; i++)for (j = 0; j < 16; j++) {
+        _gf->nib[i][j] = i && j ? _gf->exp[_gf->log[i] + _gf->log[j]] : 0;
+        _gf->nib[i][16 + j] = i && j ? _gf->exp[_gf->log[i] + _gf->log[j << 4]] : 0;
+    }
 }
 
 /*Multiplication in GF(2**8) using logarithms.*/
@@ -367,21 +374,179 @@ static void rs_poly_mult(const rs_gf256* _gf, unsigned char* _p, int _dp1,
     }
 }
 
+/*Evaluates the polynomial with the _np1<256 coefficients _p, highest degree
+   first, at each of the _nx points alpha**_logx[k], and stores the values in
+   _y.*/
+static void rs_poly_eval_c(const rs_gf256* _gf, unsigned char* _y,
+    const unsigned char* _logx, int _nx, const unsigned char* _p, int _np1) {
+    int i;
+    int k;
+    for (k = 0; k < _nx; k++) {
+        unsigned logx;
+        unsigned y;
+        y = 0;
+        logx = _logx[k];
+        for (i = 0; i < _np1; i++)y = _p[i] ^ rs_hgmul(_gf, y, logx);
+        _y[k] = y;
+    }
+}
+
+#if defined(ZBAR_SSSE3)
+/*Multiplies each byte of _x by the constant whose split-nibble tables are
+   _lo and _hi.*/
+static ZBAR_TARGET_SSSE3 __m128i rs_gmul_ssse3(__m128i _x,
+    __m128i _lo, __m128i _hi) {
+    __m128i mask;
+    mask = _mm_set1_epi8(0x0F);
+    return _mm_xor_si128(_mm_shuffle_epi8(_lo, _mm_and_si128(_x, mask)),
+        _mm_shuffle_epi8(_hi, _mm_and_si128(_mm_srli_epi16(_x, 4), mask)));
+}
+
+static ZBAR_TARGET_SSSE3 __m128i rs_hgmul128_ssse3(const rs_gf256* _gf,
+    __m128i _x, unsigned _logc) {
+    const unsigned char* nib;
+    nib = _gf->nib[_gf->exp[_logc]];
+    return rs_gmul_ssse3(_x, _mm_loadu_si128((const __m128i*)nib),
+        _mm_loadu_si128((const __m128i*)(nib + 16)));
+}
+
+/*The same as rs_poly_eval_avx2() below, with 16 lanes, for CPUs without
+   AVX2.*/
+static ZBAR_TARGET_SSSE3 void rs_poly_eval_ssse3(const rs_gf256* _gf,
+    unsigned char* _y, const unsigned char* _logx, int _nx,
+    const unsigned char* _p, int _np1) {
+    unsigned char buf[16];
+    __m128i       d[16];
+    int           nv;
+    int           r;
+    int           i;
+    int           k;
+    if (_np1 <= 0) {
+        memset(_y, 0, _nx * sizeof(*_y));
+        return;
+    }
+    nv = (_np1 + 15) >> 4;
+    r = _np1 - ((nv - 1) << 4);
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf + 16 - r, _p, r);
+    d[0] = _mm_loadu_si128((const __m128i*)buf);
+    for (i = 1; i < nv; i++) {
+        d[i] = _mm_loadu_si128((const __m128i*)(_p + r + ((i - 1) << 4)));
+    }
+    for (k = 0; k < _nx; k++) {
+        const unsigned char* nib;
+        __m128i              lo;
+        __m128i              hi;
+        __m128i              w;
+        unsigned             logx;
+        logx = _logx[k];
+        nib = _gf->nib[_gf->exp[(logx << 4) % 255]];
+        lo = _mm_loadu_si128((const __m128i*)nib);
+        hi = _mm_loadu_si128((const __m128i*)(nib + 16));
+        w = d[0];
+        for (i = 1; i < nv; i++)w = _mm_xor_si128(rs_gmul_ssse3(w, lo, hi), d[i]);
+        w = _mm_xor_si128(rs_hgmul128_ssse3(_gf, w, (logx << 3) % 255), _mm_srli_si128(w, 8));
+        w = _mm_xor_si128(rs_hgmul128_ssse3(_gf, w, (logx << 2) % 255), _mm_srli_si128(w, 4));
+        w = _mm_xor_si128(rs_hgmul128_ssse3(_gf, w, (logx << 1) % 255), _mm_srli_si128(w, 2));
+        w = _mm_xor_si128(rs_hgmul128_ssse3(_gf, w, logx % 255), _mm_srli_si128(w, 1));
+        _y[k] = (unsigned char)_mm_cvtsi128_si32(w);
+    }
+}
+#endif
+
+#if defined(ZBAR_AVX2)
+/*Multiplies each byte of _x by the constant whose split-nibble tables are
+   _lo and _hi.*/
+static ZBAR_TARGET_AVX2 __m256i rs_gmul_avx2(__m256i _x,
+    __m256i _lo, __m256i _hi) {
+    __m256i mask;
+    mask = _mm256_set1_epi8(0x0F);
+    return _mm256_xor_si256(_mm256_shuffle_epi8(_lo, _mm256_and_si256(_x, mask)),
+        _mm256_shuffle_epi8(_hi, _mm256_and_si256(_mm256_srli_epi16(_x, 4), mask)));
+}
+
+/*Splits the coefficients into 32 interleaved polynomials in x**32, with
+   lane t of vector i holding the coefficient of x**(32*(nv-1-i)+31-t), so
+   that Horner's rule runs on all the lanes at once, one multiply by x**32
+   per 32 coefficients.
+  The lanes are then folded in halves, lane t+16 onto lane t times x**16,
+   and so on down to x.*/
+static ZBAR_TARGET_AVX2 void rs_poly_eval_avx2(const rs_gf256* _gf,
+    unsigned char* _y, const unsigned char* _logx, int _nx,
+    const unsigned char* _p, int _np1) {
+    unsigned char buf[32];
+    __m256i       d[8];
+    int           nv;
+    int           r;
+    int           i;
+    int           k;
+    if (_np1 <= 0) {
+        memset(_y, 0, _nx * sizeof(*_y));
+        return;
+    }
+    /*Load the whole polynomial once, padding the highest degree vector with
+       leading zeros.*/
+    nv = (_np1 + 31) >> 5;
+    r = _np1 - ((nv - 1) << 5);
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf + 32 - r, _p, r);
+    d[0] = _mm256_loadu_si256((const __m256i*)buf);
+    for (i = 1; i < nv; i++) {
+        d[i] = _mm256_loadu_si256((const __m256i*)(_p + r + ((i - 1) << 5)));
+    }
+    for (k = 0; k < _nx; k++) {
+        const unsigned char* nib;
+        __m256i              lo;
+        __m256i              hi;
+        __m256i              v;
+        __m128i              w;
+        unsigned             logx;
+        logx = _logx[k];
+        nib = _gf->nib[_gf->exp[(logx << 5) % 255]];
+        lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)nib));
+        hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(nib + 16)));
+        v = d[0];
+        for (i = 1; i < nv; i++)v = _mm256_xor_si256(rs_gmul_avx2(v, lo, hi), d[i]);
+        w = _mm_xor_si128(rs_hgmul128_ssse3(_gf, _mm256_castsi256_si128(v), (logx << 4) % 255),
+            _mm256_extracti128_si256(v, 1));
+        w = _mm_xor_si128(rs_hgmul128_ssse3(_gf, w, (logx << 3) % 255), _mm_srli_si128(w, 8));
+        w = _mm_xor_si128(rs_hgmul128_ssse3(_gf, w, (logx << 2) % 255), _mm_srli_si128(w, 4));
+        w = _mm_xor_si128(rs_hgmul128_ssse3(_gf, w, (logx << 1) % 255), _mm_srli_si128(w, 2));
+        w = _mm_xor_si128(rs_hgmul128_ssse3(_gf, w, logx % 255), _mm_srli_si128(w, 1));
+        _y[k] = (unsigned char)_mm_cvtsi128_si32(w);
+    }
+    _mm256_zeroupper();
+}
+#endif
+
+static void rs_poly_eval(const rs_gf256* _gf, unsigned char* _y,
+    const unsigned char* _logx, int _nx, const unsigned char* _p, int _np1) {
+#if defined(ZBAR_AVX2)
+    if (_zbar_cpu_avx2()) {
+        rs_poly_eval_avx2(_gf, _y, _logx, _nx, _p, _np1);
+        return;
+    }
+#endif
+#if defined(ZBAR_SSSE3)
+    if (_zbar_cpu_ssse3()) {
+        rs_poly_eval_ssse3(_gf, _y, _logx, _nx, _p, _np1);
+        return;
+    }
+#endif
+    rs_poly_eval_c(_gf, _y, _logx, _nx, _p, _np1);
+}
+
 /*Decoding.*/
 
-/*Computes the syndrome of a codeword.*/
+/*Computes the syndrome of a codeword: the codeword evaluated at
+   alpha**(_m0+j) for each j<_npar, all in one pass over the data.*/
 static void rs_calc_syndrome(const rs_gf256* _gf, int _m0,
     unsigned char* _s, int _npar, const unsigned char* _data, int _ndata) {
-    int i;
-    int j;
-    for (j = 0; j < _npar; j++) {
-        unsigned alphaj;
-        unsigned sj;
-        sj = 0;
-        alphaj = _gf->log[_gf->exp[j + _m0]];
-        for (i = 0; i < _ndata; i++)sj = _data[i] ^ rs_hgmul(_gf, sj, alphaj);
-        _s[j] = sj;
-    }
+    unsigned char logx[256];
+    int           j;
+    if (_npar <= 0)return;
+    for (j = 0; j < _npar; j++)logx[j] = _gf->log[_gf->exp[j + _m0]];
+    rs_poly_eval(_gf, _s, logx, _npar, _data, _ndata);
 }
 
 /*Berlekamp-Peterson and Berlekamp-Massey Algorithms for error-location,
@@ -514,6 +679,10 @@ int rs_correct(const rs_gf256* _gf, int _m0, unsigned char* _data, int _ndata,
     unsigned char omega[256];
     unsigned char epos[256];
     unsigned char s[256];
+    unsigned char p[256];
+    unsigned char logx[256];
+    unsigned char a[256];
+    unsigned char b[256];
     int           i;
     /*If we already have too many erasures, we can't possibly succeed.*/
     if (_nerasures > _npar)return -1;
@@ -522,6 +691,7 @@ int rs_correct(const rs_gf256* _gf, int _m0, unsigned char* _data, int _ndata,
     /*Check for a non-zero value.*/
     for (i = 0; i < _npar; i++)if (s[i]) {
         int nerrors;
+        int nodd;
         int j;
         /*Construct the error locator polynomial.*/
         nerrors = rs_modified_berlekamp_massey(_gf, lambda, s, omega, _npar,
@@ -535,34 +705,26 @@ int rs_correct(const rs_gf256* _gf, int _m0, unsigned char* _data, int _ndata,
           If they are not all distinct, or some of them were outside the valid
            range for our block size, we have a decoding error.*/
         if (rs_find_roots(_gf, epos, lambda, nerrors, _ndata) < nerrors)return -1;
-        /*Now compute the error magnitudes.*/
+        /*Now compute the error magnitudes.
+          The numerator is omega evaluated at each alpha**-epos[i], and the
+           denominator is the derivative of lambda there; all the odd powers of
+           the derivative vanish, so it is x times the polynomial in x**2 formed
+           by the odd coefficients of lambda, times alpha**(_m0*epos[i]).*/
+        for (j = 0; j < _npar; j++)p[_npar - 1 - j] = omega[j];
+        for (i = 0; i < nerrors; i++)logx[i] = (255 - epos[i]) % 255;
+        rs_poly_eval(_gf, a, logx, nerrors, p, _npar);
+        nodd = (_npar + 1) >> 1;
+        for (j = 0; j < nodd; j++)p[nodd - 1 - j] = lambda[2 * j + 1];
+        for (i = 0; i < nerrors; i++)logx[i] = (logx[i] << 1) % 255;
+        rs_poly_eval(_gf, b, logx, nerrors, p, nodd);
         for (i = 0; i < nerrors; i++) {
-            unsigned a;
-            unsigned b;
             unsigned alpha;
             unsigned alphan1;
-            unsigned alphan2;
-            unsigned alphanj;
             alpha = epos[i];
-            /*Evaluate omega at alpha**-1.*/
-            a = 0;
             alphan1 = 255 - alpha;
-            alphanj = 0;
-            for (j = 0; j < _npar; j++) {
-                a ^= rs_hgmul(_gf, omega[j], alphanj);
-                alphanj = _gf->log[_gf->exp[alphanj + alphan1]];
-            }
-            /*Evaluate the derivative of lambda at alpha**-1
-              All the odd powers vanish.*/
-            b = 0;
-            alphan2 = _gf->log[_gf->exp[alphan1 << 1]];
-            alphanj = alphan1 + _m0 * alpha % 255;
-            for (j = 1; j <= _npar; j += 2) {
-                b ^= rs_hgmul(_gf, lambda[j], alphanj);
-                alphanj = _gf->log[_gf->exp[alphanj + alphan2]];
-            }
             /*Apply the correction.*/
-            _data[_ndata - 1 - alpha] ^= rs_gdiv(_gf, a, b);
+            _data[_ndata - 1 - alpha] ^= rs_gdiv(_gf, a[i],
+                rs_hgmul(_gf, b[i], alphan1 + _m0 * alpha % 255));
         }
         return nerrors;
     }
@@ -37,6 +37,12 @@ struct rs_gf256 {
       The extra 256 entries are used to do arithmetic mod 255, since some extra
        table lookups are generally faster than doing the modulus.*/
     unsigned char exp[511];
+    /*Split-nibble multiplication tables: nib[c][n] contains c*n and
+       nib[c][16+n] contains c*(n<<4), for n<16, so that c*x is
+       nib[c][x&15]^nib[c][16+(x>>4)].
+      These let vector code multiply 16 bytes at a time by c with a pair of
+       byte shuffles.*/
+    unsigned char nib[256][32];
 };
 
 /*Initialize discrete logarithm tables for GF(2**8) using a given primitive
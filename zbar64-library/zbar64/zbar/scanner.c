@@ -6,6 +6,7 @@
 #include <zbar.h>
 #include "debug.h"
 #include "decoder.h"
+#include "simd.h"
 
 
 #ifndef ZBAR_FIXED
@@ -90,7 +91,30 @@ unsigned zbar_scanner_get_edge(const zbar_scanner_t* scn,
         return(edge << -prec);
 }
 
-zbar_symbol_type_t zbar_decode_width(zbar_decoder_t* dcode,
+#ifdef ZBAR_QR_ONLY
+/* specialized width decoder for QR only builds: just the finder
+ * pattern check, inlined into the edge loop, and no shared 1D
+ * character width to maintain
+ */
+static __inline zbar_symbol_type_t decode_width(zbar_decoder_t* dcode,
+    unsigned w)
+{
+    zbar_symbol_type_t sym = ZBAR_NONE;
+
+    dcode->w[dcode->idx & (DECODE_WINDOW - 1)] = w;
+    dbprintf(1, "    decode[%x]: w=%d (%g)\n", dcode->idx, w, (w / 32.));
+
+    if (TEST_CFG(dcode->qrf.config, ZBAR_CFG_ENABLE))
+        sym = qr_finder_decode(dcode);
+
+    dcode->idx++;
+    dcode->type = sym;
+    if (sym && dcode->handler)
+        dcode->handler(dcode);
+    return(sym);
+}
+#else
+static __inline zbar_symbol_type_t decode_width(zbar_decoder_t* dcode,
     unsigned w)
 {
     zbar_symbol_type_t tmp, sym = ZBAR_NONE;
@@ -160,7 +184,13 @@ zbar_symbol_type_t zbar_decode_width(zbar_decoder_t* dcode,
     }
     return(sym);
 }
+#endif
 
+zbar_symbol_type_t zbar_decode_width(zbar_decoder_t* dcode,
+    unsigned w)
+{
+    return(decode_width(dcode, w));
+}
 
 unsigned zbar_scanner_get_width(const zbar_scanner_t* scn)
 {
@@ -205,7 +235,7 @@ static __inline zbar_symbol_type_t process_edge(zbar_scanner_t* scn,
 
     /* pass to decoder */
     if (scn->decoder)
-       return(zbar_decode_width(scn->decoder, scn->width));
+       return(decode_width(scn->decoder, scn->width));
     return(ZBAR_PARTIAL);
 }
 
@@ -228,7 +258,7 @@ __inline zbar_symbol_type_t zbar_scanner_flush(zbar_scanner_t* scn)
 
     scn->y1_sign = scn->width = 0;
     if (scn->decoder)
-        return(zbar_decode_width(scn->decoder, 0));
+        return(decode_width(scn->decoder, 0));
 
     return(ZBAR_PARTIAL);
 }
@@ -259,25 +289,18 @@ static __inline unsigned calc_thresh(zbar_scanner_t* scn)
     return(scn->y1_min_thresh);
 }
 
-zbar_symbol_type_t zbar_scan_y(zbar_scanner_t* scn,
-    int y)
+/* edge test for the sample at x, given the smoothed intensity there
+ * (y0_0) and at the three previous positions
+ */
+static __inline zbar_symbol_type_t scan_edge(zbar_scanner_t* scn,
+    int x,
+    int y0_0,
+    int y0_1,
+    int y0_2,
+    int y0_3)
 {
-    /* FIXME calc and clip to max y range... */
-    /* retrieve short value history */
-    register int x = scn->x;
-    register int y0_1 = scn->y0[(x - 1) & 3];
-    register int y0_0 = y0_1;
-    register int y0_2, y0_3, y1_1, y2_1, y2_2;
+    register int y1_1, y2_1, y2_2;
     zbar_symbol_type_t edge;
-    if (x) {
-        /* update weighted moving average */
-        y0_0 += ((int)((y - y0_1) * EWMA_WEIGHT)) >> ZBAR_FIXED;
-        scn->y0[x & 3] = y0_0;
-    }
-    else
-        y0_0 = y0_1 = scn->y0[0] = scn->y0[1] = scn->y0[2] = scn->y0[3] = y;
-    y0_2 = scn->y0[(x - 2) & 3];
-    y0_3 = scn->y0[(x - 3) & 3];
     /* 1st differential @ x-1 */
     y1_1 = y0_1 - y0_2;
     {
@@ -291,8 +314,8 @@ zbar_symbol_type_t zbar_scan_y(zbar_scanner_t* scn,
     y2_1 = y0_0 - (y0_1 * 2) + y0_2;
     y2_2 = y0_1 - (y0_2 * 2) + y0_3;
 
-    dbprintf(1, "scan: x=%d y=%d y0=%d y1=%d y2=%d",
-        x, y, y0_1, y1_1, y2_1);
+    dbprintf(1, "scan: x=%d y0=%d y1=%d y2=%d",
+        x, y0_1, y1_1, y2_1);
 
     edge = ZBAR_NONE;
     /* 2nd zero-crossing is 1st local min/max - could be edge */
@@ -331,8 +354,232 @@ zbar_symbol_type_t zbar_scan_y(zbar_scanner_t* scn,
     }
     else
         dbprintf(1, "\n");
+    return(edge);
+}
+
+zbar_symbol_type_t zbar_scan_y(zbar_scanner_t* scn,
+    int y)
+{
+    /* FIXME calc and clip to max y range... */
+    /* retrieve short value history */
+    register int x = scn->x;
+    register int y0_1 = scn->y0[(x - 1) & 3];
+    register int y0_0 = y0_1;
+    zbar_symbol_type_t edge;
+    if (x) {
+        /* update weighted moving average */
+        y0_0 += ((int)((y - y0_1) * EWMA_WEIGHT)) >> ZBAR_FIXED;
+        scn->y0[x & 3] = y0_0;
+    }
+    else
+        y0_0 = y0_1 = scn->y0[0] = scn->y0[1] = scn->y0[2] = scn->y0[3] = y;
+
+    edge = scan_edge(scn, x, y0_0, y0_1,
+        scn->y0[(x - 2) & 3], scn->y0[(x - 3) & 3]);
+
     /* FIXME add fall-thru pass to decoder after heuristic "idle" period
        (eg, 6-8 * last width) */
     scn->x = x + 1;
     return(edge);
 }
+
+/* whole run scanner.
+ *
+ * the EWMA is a serial recurrence, so it is evaluated for a chunk of
+ * samples in one tight loop.  the 2nd differential zero crossings are
+ * then located for the whole chunk at once (vectorized where available),
+ * which yields a short list of candidate positions; only those are run
+ * through the same edge test as zbar_scan_y().
+ *
+ * candidates with both 1st differentials below y1_min_thresh are
+ * dropped early: calc_thresh() never returns less than that, and the
+ * threshold decay it applies is re-derived at the next evaluation
+ * (dx only grows between edges), so skipping it changes nothing.
+ */
+
+#define SCAN_CHUNK 256
+
+/* locate candidate edges among n smoothed samples y0[0..n-1]
+ * (y0[-3..-1] hold the preceding history)
+ */
+static int scan_candidates_c(const short* y0,
+    int n,
+    int thresh,
+    unsigned short* cand)
+{
+    int i, ncand = 0;
+    for (i = 0; i < n; i++) {
+        int y1_1 = y0[i - 1] - y0[i - 2];
+        int y1_2 = y0[i - 2] - y0[i - 3];
+        int y2_1 = y0[i] - y0[i - 1] * 2 + y0[i - 2];
+        int y2_2 = y0[i - 1] - y0[i - 2] * 2 + y0[i - 3];
+        cand[ncand] = i;
+        ncand += ((!y2_1 || ((y2_1 > 0) ? y2_2 < 0 : y2_2 > 0)) &&
+            (abs(y1_1) >= thresh || abs(y1_2) >= thresh));
+    }
+    return(ncand);
+}
+
+#ifdef ZBAR_SSE2
+static int scan_candidates_sse2(const short* y0,
+    int n,
+    int thresh,
+    unsigned short* cand)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i thr = _mm_set1_epi16(thresh - 1);
+    int i, k, ncand = 0;
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i s0 = _mm_loadu_si128((const __m128i*)(y0 + i));
+        __m128i s1 = _mm_loadu_si128((const __m128i*)(y0 + i - 1));
+        __m128i s2 = _mm_loadu_si128((const __m128i*)(y0 + i - 2));
+        __m128i s3 = _mm_loadu_si128((const __m128i*)(y0 + i - 3));
+        __m128i y2_1 = _mm_add_epi16(_mm_sub_epi16(s0, _mm_add_epi16(s1, s1)),
+            s2);
+        __m128i y2_2 = _mm_add_epi16(_mm_sub_epi16(s1, _mm_add_epi16(s2, s2)),
+            s3);
+        __m128i y1_1 = _mm_sub_epi16(s1, s2);
+        __m128i y1_2 = _mm_sub_epi16(s2, s3);
+        __m128i zc, big;
+        unsigned bits;
+        zc = _mm_or_si128(_mm_cmpeq_epi16(y2_1, zero),
+            _mm_or_si128(
+                _mm_and_si128(_mm_cmpgt_epi16(y2_1, zero),
+                    _mm_cmpgt_epi16(zero, y2_2)),
+                _mm_and_si128(_mm_cmpgt_epi16(zero, y2_1),
+                    _mm_cmpgt_epi16(y2_2, zero))));
+        y1_1 = _mm_max_epi16(y1_1, _mm_sub_epi16(zero, y1_1));
+        y1_2 = _mm_max_epi16(y1_2, _mm_sub_epi16(zero, y1_2));
+        big = _mm_cmpgt_epi16(_mm_max_epi16(y1_1, y1_2), thr);
+        bits = _mm_movemask_epi8(_mm_packs_epi16(_mm_and_si128(zc, big), zero));
+        if (!bits)
+            continue;
+        for (k = 0; k < 8; k++) {
+            cand[ncand] = i + k;
+            ncand += (bits >> k) & 1;
+        }
+    }
+    if (i < n) {
+        int j, m = scan_candidates_c(y0 + i, n - i, thresh, cand + ncand);
+        for (j = 0; j < m; j++)
+            cand[ncand + j] += i;
+        ncand += m;
+    }
+    return(ncand);
+}
+#endif
+
+#ifdef ZBAR_AVX2
+static ZBAR_TARGET_AVX2 int scan_candidates_avx2(const short* y0,
+    int n,
+    int thresh,
+    unsigned short* cand)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i thr = _mm256_set1_epi16(thresh - 1);
+    int i, k, ncand = 0;
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m256i s0 = _mm256_loadu_si256((const __m256i*)(y0 + i));
+        __m256i s1 = _mm256_loadu_si256((const __m256i*)(y0 + i - 1));
+        __m256i s2 = _mm256_loadu_si256((const __m256i*)(y0 + i - 2));
+        __m256i s3 = _mm256_loadu_si256((const __m256i*)(y0 + i - 3));
+        __m256i y2_1 = _mm256_add_epi16(
+            _mm256_sub_epi16(s0, _mm256_add_epi16(s1, s1)), s2);
+        __m256i y2_2 = _mm256_add_epi16(
+            _mm256_sub_epi16(s1, _mm256_add_epi16(s2, s2)), s3);
+        __m256i y1_1 = _mm256_abs_epi16(_mm256_sub_epi16(s1, s2));
+        __m256i y1_2 = _mm256_abs_epi16(_mm256_sub_epi16(s2, s3));
+        __m256i zc, big;
+        unsigned bits;
+        zc = _mm256_or_si256(_mm256_cmpeq_epi16(y2_1, zero),
+            _mm256_or_si256(
+                _mm256_and_si256(_mm256_cmpgt_epi16(y2_1, zero),
+                    _mm256_cmpgt_epi16(zero, y2_2)),
+                _mm256_and_si256(_mm256_cmpgt_epi16(zero, y2_1),
+                    _mm256_cmpgt_epi16(y2_2, zero))));
+        big = _mm256_cmpgt_epi16(_mm256_max_epi16(y1_1, y1_2), thr);
+        /* two mask bits per 16-bit lane */
+        bits = _mm256_movemask_epi8(_mm256_and_si256(zc, big));
+        if (!bits)
+            continue;
+        for (k = 0; k < 16; k++) {
+            cand[ncand] = i + k;
+            ncand += (bits >> (k * 2)) & 1;
+        }
+    }
+    if (i < n) {
+        int j, m = scan_candidates_c(y0 + i, n - i, thresh, cand + ncand);
+        for (j = 0; j < m; j++)
+            cand[ncand + j] += i;
+        ncand += m;
+    }
+    return(ncand);
+}
+#endif
+
+static __inline int scan_candidates(const short* y0,
+    int n,
+    int thresh,
+    unsigned short* cand)
+{
+#ifdef ZBAR_AVX2
+    if (_zbar_cpu_avx2())
+        return(scan_candidates_avx2(y0, n, thresh, cand));
+#endif
+#ifdef ZBAR_SSE2
+    return(scan_candidates_sse2(y0, n, thresh, cand));
+#else
+    return(scan_candidates_c(y0, n, thresh, cand));
+#endif
+}
+
+zbar_symbol_type_t zbar_scan_row(zbar_scanner_t* scn,
+    const unsigned char* data,
+    int n,
+    int stride)
+{
+    short buf[3 + SCAN_CHUNK];
+    unsigned short cand[SCAN_CHUNK];
+    short* y0 = buf + 3;
+    zbar_symbol_type_t edge = ZBAR_NONE;
+
+    /* first sample of a scan seeds the history */
+    if (n > 0 && !scn->x) {
+        edge = zbar_scan_y(scn, *data);
+        data += stride;
+        n--;
+    }
+
+    while (n > 0) {
+        int x = scn->x;
+        int m = (n < SCAN_CHUNK) ? n : SCAN_CHUNK;
+        register int y = scn->y0[(x - 1) & 3];
+        int i, j, ncand;
+
+        y0[-3] = scn->y0[(x - 3) & 3];
+        y0[-2] = scn->y0[(x - 2) & 3];
+        y0[-1] = y;
+        /* update weighted moving average */
+        for (i = 0; i < m; i++, data += stride) {
+            y += ((int)((*data - y) * EWMA_WEIGHT)) >> ZBAR_FIXED;
+            y0[i] = y;
+        }
+
+        ncand = scan_candidates(y0, m, scn->y1_min_thresh, cand);
+        for (j = 0; j < ncand; j++) {
+            zbar_symbol_type_t tmp;
+            i = cand[j];
+            scn->x = x + i;
+            tmp = scan_edge(scn, x + i, y0[i], y0[i - 1], y0[i - 2], y0[i - 3]);
+            if (tmp < 0 || tmp > edge)
+                edge = tmp;
+        }
+
+        /* save history for the next chunk/sample */
+        for (i = m - 4; i < m; i++)
+            scn->y0[(x + i) & 3] = y0[i];
+        scn->x = x + m;
+        n -= m;
+    }
+    return(edge);
+}
@@ -0,0 +1,107 @@
+/*------------------------------------------------------------------------
+ *  Copyright 2007-2010 (c) Jeff Brown <spadix@users.sourceforge.net>
+ *
+ *  This file is part of the ZBar Bar Code Reader.
+ *
+ *  The ZBar Bar Code Reader is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser Public License as
+ *  published by the Free Software Foundation; either version 2.1 of
+ *  the License, or (at your option) any later version.
+ *
+ *  The ZBar Bar Code Reader is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser Public License
+ *  along with the ZBar Bar Code Reader; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *  Boston, MA  02110-1301  USA
+ *
+ *  http://sourceforge.net/projects/zbar
+ *------------------------------------------------------------------------*/
+
+#include <config.h>
+
+#include "simd.h"
+
+#ifdef ZBAR_AVX2
+
+static int cpu_features;
+
+static void cpu_probe(void)
+{
+# ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 1);
+    if ((r[2] >> 9) & 1)
+        cpu_features |= ZBAR_CPU_SSSE3;
+    /* OSXSAVE and AVX, with YMM state enabled by the OS */
+    if ((r[2] & 0x18000000) == 0x18000000 &&
+        (_xgetbv(0) & 6) == 6) {
+        __cpuid(r, 0);
+        if (r[0] >= 7) {
+            __cpuidex(r, 7, 0);
+            if ((r[1] >> 5) & 1)
+                cpu_features |= ZBAR_CPU_AVX2;
+        }
+    }
+# else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        cpu_features |= ZBAR_CPU_SSSE3;
+    if (__builtin_cpu_supports("avx2"))
+        cpu_features |= ZBAR_CPU_AVX2;
+# endif
+}
+
+/* the pool's workers query the features concurrently, so the probe runs
+ * exactly once and its result is published before any of them sees it
+ */
+# if defined(_WIN32)
+#  include <windows.h>
+
+static INIT_ONCE probed = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK cpu_probe_once(PINIT_ONCE once,
+    PVOID arg,
+    PVOID* ctx)
+{
+    (void)once;
+    (void)arg;
+    (void)ctx;
+    cpu_probe();
+    return(TRUE);
+}
+
+int _zbar_cpu_features(void)
+{
+    InitOnceExecuteOnce(&probed, cpu_probe_once, NULL, NULL);
+    return(cpu_features);
+}
+
+# elif defined(HAVE_LIBPTHREAD)
+#  include <pthread.h>
+
+static pthread_once_t probed = PTHREAD_ONCE_INIT;
+
+int _zbar_cpu_features(void)
+{
+    pthread_once(&probed, cpu_probe);
+    return(cpu_features);
+}
+
+# else
+
+int _zbar_cpu_features(void)
+{
+    static int probed;
+    if (!probed) {
+        cpu_probe();
+        probed = 1;
+    }
+    return(cpu_features);
+}
+
+# endif
+#endif
@@ -0,0 +1,78 @@
+/*------------------------------------------------------------------------
+ *  Copyright 2007-2010 (c) Jeff Brown <spadix@users.sourceforge.net>
+ *
+ *  This file is part of the ZBar Bar Code Reader.
+ *
+ *  The ZBar Bar Code Reader is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser Public License as
+ *  published by the Free Software Foundation; either version 2.1 of
+ *  the License, or (at your option) any later version.
+ *
+ *  The ZBar Bar Code Reader is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser Public License
+ *  along with the ZBar Bar Code Reader; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *  Boston, MA  02110-1301  USA
+ *
+ *  http://sourceforge.net/projects/zbar
+ *------------------------------------------------------------------------*/
+#ifndef _ZBAR_SIMD_H_
+#define _ZBAR_SIMD_H_
+
+/* x86 vector kernel support
+ *
+ * ZBAR_SSE2 is defined when the compiler targets SSE2 (always on x64),
+ * ZBAR_AVX2 (ZBAR_SSSE3) when it can also emit AVX2 (SSSE3) code for
+ * functions marked ZBAR_TARGET_AVX2 (ZBAR_TARGET_SSSE3).  these kernels
+ * must only be called after _zbar_cpu_avx2() (_zbar_cpu_ssse3()) has
+ * confirmed support at runtime.
+ *
+ * define NO_SIMD to build only the scalar reference paths
+ */
+
+#ifndef NO_SIMD
+# if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define ZBAR_SSE2 1
+#  include <emmintrin.h>
+# endif
+# if defined(ZBAR_SSE2) && \
+     ((defined(_MSC_VER) && _MSC_VER >= 1700) || defined(__GNUC__))
+#  define ZBAR_AVX2 1
+#  define ZBAR_SSSE3 1
+#  include <immintrin.h>
+#  ifdef _MSC_VER
+#   include <intrin.h>
+#   define ZBAR_TARGET_AVX2
+#   define ZBAR_TARGET_SSSE3
+#  else
+#   define ZBAR_TARGET_AVX2 __attribute__((target("avx2")))
+#   define ZBAR_TARGET_SSSE3 __attribute__((target("ssse3")))
+#  endif
+# endif
+#endif
+
+#ifdef ZBAR_AVX2
+# define ZBAR_CPU_AVX2 1
+# define ZBAR_CPU_SSSE3 2
+
+/* the vector extensions supported by the cpu (and OS), as ZBAR_CPU_*
+ * flags.  probed once per process; safe to call from any thread
+ */
+extern int _zbar_cpu_features(void);
+
+/* runtime check for AVX2 */
+# define _zbar_cpu_avx2() (_zbar_cpu_features() & ZBAR_CPU_AVX2)
+
+/* runtime check for SSSE3 (PSHUFB) */
+# define _zbar_cpu_ssse3() (_zbar_cpu_features() & ZBAR_CPU_SSSE3)
+#else
+# define _zbar_cpu_avx2() 0
+# define _zbar_cpu_ssse3() 0
+#endif
+
+#endif
@@ -103,6 +103,16 @@ zbar_symbol_set_first_symbol(const zbar_symbol_set_t* syms)
     return(syms->head);
 }
 
+int zbar_symbol_get_roi(const zbar_symbol_t* sym)
+{
+    return(sym->roi);
+}
+
+int zbar_symbol_get_reported(const zbar_symbol_t* sym)
+{
+    return(sym->reported);
+}
+
 unsigned zbar_symbol_get_loc_size(const zbar_symbol_t* sym)
 {
     return(sym->npts);
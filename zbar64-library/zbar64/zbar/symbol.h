@@ -60,6 +60,8 @@ struct zbar_symbol_s {
     unsigned long time;         /* relative symbol capture time */
     int cache_count;            /* cache state */
     int quality;                /* relative symbol reliability metric */
+    int roi;                    /* image region of interest, or -1 */
+    int reported;               /* already passed to the data handler */
 };
 
 extern void _zbar_symbol_set_free(zbar_symbol_set_t*);